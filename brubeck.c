@@ -14,7 +14,7 @@ int main(int argc, char *argv[]) {
   server.set_proctitle = true;
   const char *config_file = "config.default.json";
   const char *log_file = NULL;
-  int opt;
+  int opt, i;
 
   while ((opt = getopt_long(argc, argv, ":l:c:vn", longopts, NULL)) != -1) {
     switch (opt) {
@@ -38,6 +38,12 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  /* copied before the process title reuses their memory, to exec the new
+   * binary with on upgrade */
+  server.upgrade.argv = xcalloc(argc + 1, sizeof(char *));
+  for (i = 0; i < argc; ++i)
+    server.upgrade.argv[i] = strdup(argv[i]);
+
   if (server.set_proctitle)
     initproctitle(argc, argv);
   gh_log_open(log_file);
@@ -0,0 +1,64 @@
+#include "brubeck.h"
+
+struct brubeck_admission *brubeck_admission_new(int entries, double error) {
+  struct brubeck_admission *admission =
+      xcalloc(1, sizeof(struct brubeck_admission));
+
+  admission->bloom = multibloom_new(2, entries, error);
+  admission->entries = entries;
+  return admission;
+}
+
+struct brubeck_admission *brubeck_admission_load(json_t *config) {
+  int entries = 0;
+  double error = 0.01;
+
+  json_unpack_or_die(config, "{s:i, s?:F}", "entries", &entries, "error",
+                     &error);
+
+  if (entries < 2 || error <= 0.0 || error >= 1.0)
+    die("`admission` needs at least 2 `entries` and an `error` between 0 "
+        "and 1");
+
+  log_splunk("event=admission_loaded entries=%d error=%f", entries, error);
+  return brubeck_admission_new(entries, error);
+}
+
+/*
+ * Record a sighting of a key missing from the metrics table, and return
+ * whether it should get a metric. Any number of threads can check keys
+ * at once; a sighting lost to a concurrent rotation only delays the key
+ * by one more sighting.
+ */
+bool brubeck_admission_check(struct brubeck_admission *admission,
+                             const char *key, size_t key_len) {
+  const int generation = admission->generation;
+  const uint32_t a = CityHash32(key, key_len);
+  /* the second hash for double hashing must be odd */
+  const uint32_t b = (uint32_t)((a * 0x9E3779B97F4A7C15ULL) >> 32) | 1;
+
+  if (multibloom_check(admission->bloom, generation, a, b) ||
+      multibloom_test(admission->bloom, !generation, a, b)) {
+    brubeck_atomic_inc(&admission->admitted_late);
+    return true;
+  }
+
+  brubeck_atomic_inc(&admission->rejected);
+  return false;
+}
+
+/* Start a new window: the older generation is cleared and takes over */
+void brubeck_admission_rotate(struct brubeck_admission *admission) {
+  const int next = !admission->generation;
+
+  multibloom_reset(admission->bloom, next);
+  admission->generation = next;
+}
+
+json_t *brubeck_admission_stats(struct brubeck_admission *admission) {
+  return json_pack("{s:i, s:I, s:I}", "entries", admission->entries,
+                   "rejected",
+                   (json_int_t)brubeck_atomic_fetch(&admission->rejected),
+                   "admitted_late",
+                   (json_int_t)brubeck_atomic_fetch(&admission->admitted_late));
+}
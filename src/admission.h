@@ -0,0 +1,33 @@
+#ifndef __BRUBECK_ADMISSION_H__
+#define __BRUBECK_ADMISSION_H__
+
+#include "bloom.h"
+#include "jansson.h"
+
+/*
+ * Two-hit admission for new keys: a key that is not in the metrics table
+ * yet is only given a metric the second time it is seen within a window of
+ * one to two flush intervals. Sightings go into one of two bloom filter
+ * generations, and a key is admitted when either generation already has
+ * it. Each flush the older generation is cleared and starts taking the new
+ * sightings, so one-off keys are forgotten without ever being allocated.
+ */
+struct brubeck_admission {
+  struct multibloom *bloom;
+  int generation; /* the filter that new sightings go into */
+  int entries;
+
+  uint64_t rejected;      /* first sightings that got no metric */
+  uint64_t admitted_late; /* keys that got a metric on their second sighting */
+  uint64_t reported_rejected;
+  uint64_t reported_admitted;
+};
+
+struct brubeck_admission *brubeck_admission_new(int entries, double error);
+struct brubeck_admission *brubeck_admission_load(json_t *config);
+bool brubeck_admission_check(struct brubeck_admission *admission,
+                             const char *key, size_t key_len);
+void brubeck_admission_rotate(struct brubeck_admission *admission);
+json_t *brubeck_admission_stats(struct brubeck_admission *admission);
+
+#endif
@@ -41,9 +41,15 @@ static void *backend__thread(void *_ptr) {
 
       if (self->flush)
         self->flush(self);
+
+      if (self->server->memory.max)
+        brubeck_eviction_sweep(self);
     }
 
-    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &then, NULL);
+    if (self->wait)
+      self->wait(self, &then);
+    else
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &then, NULL);
   }
   return NULL;
 }
@@ -3,6 +3,9 @@
 
 enum brubeck_backend_t { BRUBECK_BACKEND_CARBON, BRUBECK_BACKEND_KAFKA };
 
+/* Upper bound on the bytes `encode_name` may add around a metric name */
+#define BRUBECK_NAME_FRAMING 8
+
 struct brubeck_backend {
   enum brubeck_backend_t type;
   struct brubeck_server *server;
@@ -11,13 +14,29 @@ struct brubeck_backend {
 
   int (*connect)(void *);
   bool (*is_connected)(void *);
-  void (*sample)(const struct brubeck_metric *, const char *, value_t, void *);
+  void (*sample)(const struct brubeck_metric *, const char *, size_t, value_t,
+                 void *);
+  size_t (*encode_name)(char *, const char *, size_t);
   void (*flush)(void *);
 
+  /* optional: wait for the next tick (an absolute CLOCK_MONOTONIC time)
+   * doing background work, instead of sleeping */
+  void (*wait)(void *, const struct timespec *);
+
   uint32_t tick_time;
   pthread_t thread;
 
   struct brubeck_metric *queue;
+
+  /* CLOCK eviction: the metric before the next one to look at (NULL for
+   * the head of the queue), and the metrics evicted but not freed yet.
+   * They keep their `next` pointer, so that a walk of the queue that is
+   * on one of them carries on to the live metrics. */
+  struct brubeck_metric *hand;
+  struct brubeck_metric **evicted;
+  size_t evicted_count, evicted_alloc;
+  size_t evicted_bytes;
+  uint64_t evicted_epoch; /* reclaim epoch at which they were unlinked */
 };
 
 void brubeck_backend_run_threaded(struct brubeck_backend *);
@@ -1,6 +1,7 @@
 #include "brubeck.h"
 #include <stddef.h>
 #include <string.h>
+#include <time.h>
 
 static bool carbon_is_connected(void *backend) {
   struct brubeck_carbon *self = (struct brubeck_carbon *)backend;
@@ -40,25 +41,29 @@ static void carbon_disconnect(struct brubeck_carbon *self) {
   self->out_sock = -1;
 }
 
-static void plaintext_each(const struct brubeck_metric *metric, const char *key,
-                           value_t value, void *backend) {
+static size_t plaintext_encode(char *dst, const char *name, size_t len) {
+  /* Invalid metric, can't have a space; leave room for value and time */
+  if (memchr(name, ' ', len) != NULL || len + 64 > PLAINTEXT_BUFFER_SIZE)
+    return 0;
+
+  memcpy(dst, name, len);
+  dst[len] = ' ';
+  return len + 1;
+}
+
+static void plaintext_each(const struct brubeck_metric *metric,
+                           const char *name, size_t name_len, value_t value,
+                           void *backend) {
   struct brubeck_carbon *carbon = (struct brubeck_carbon *)backend;
-  char buffer[1024];
+  char buffer[PLAINTEXT_BUFFER_SIZE];
   char *ptr = buffer;
-  size_t key_len = strlen(key);
   ssize_t wr;
 
   if (!carbon_is_connected(carbon))
     return;
 
-  if (strchr(key, ' ') != NULL) {
-    /* Invalid metric, can't have a space */
-    return;
-  }
-
-  memcpy(ptr, key, key_len);
-  ptr += key_len;
-  *ptr++ = ' ';
+  memcpy(ptr, name, name_len);
+  ptr += name_len;
 
   ptr += brubeck_ftoa(ptr, value);
   *ptr++ = ' ';
@@ -98,16 +103,24 @@ static inline size_t pickle1_double(char *ptr, void *_src) {
   return 9;
 }
 
-static void pickle1_push(struct pickler *buf, const char *key, uint8_t key_len,
-                         uint32_t timestamp, value_t value) {
-  char *ptr = buf->ptr + buf->pos;
+static size_t pickle1_encode(char *dst, const char *name, size_t len) {
+  /* Invalid metric, can't have a space; must fit a SHORT_BINSTRING */
+  if (memchr(name, ' ', len) != NULL || len > MAX_PICKLE_SIZE - 1)
+    return 0;
 
-  *ptr++ = '(';
+  *dst++ = '(';
+  *dst++ = 'U';
+  *dst++ = (uint8_t)len;
+  memcpy(dst, name, len);
+  return len + 3;
+}
+
+static void pickle1_push(struct pickler *buf, const char *name,
+                         size_t name_len, uint32_t timestamp, value_t value) {
+  char *ptr = buf->ptr + buf->pos;
 
-  *ptr++ = 'U';
-  *ptr++ = key_len;
-  memcpy(ptr, key, key_len);
-  ptr += key_len;
+  memcpy(ptr, name, name_len);
+  ptr += name_len;
 
   *ptr++ = 'q';
   *ptr++ = buf->pt++;
@@ -165,26 +178,188 @@ static void pickle1_flush(void *backend) {
   carbon->bytes_sent += wr;
 }
 
-static void pickle1_each(const struct brubeck_metric *metric, const char *key,
-                         value_t value, void *backend) {
+static void pickle1_each(const struct brubeck_metric *metric,
+                         const char *name, size_t name_len, value_t value,
+                         void *backend) {
   struct brubeck_carbon *carbon = (struct brubeck_carbon *)backend;
 
-  if (strchr(key, ' ') != NULL) {
-    /* Invalid metric, can't have a space */
+  if (carbon->pickler.pos + PICKLE1_SIZE(name_len) >= PICKLE_BUFFER_SIZE) {
+    pickle1_flush(carbon);
+  }
+
+  if (!carbon_is_connected(carbon))
+    return;
+
+  pickle1_push(&carbon->pickler, name, name_len, carbon->backend.tick_time,
+               value);
+}
+
+/*********************************************
+ * Passthrough
+ *
+ * Points received by the ingestion samplers can skip aggregation and be
+ * forwarded with their original timestamp. Each carbon backend owns an
+ * MPSC ring of (value, timestamp, name) records that its thread drains
+ * while waiting for the next tick.
+ *********************************************/
+#define PASSTHROUGH_HEADER (sizeof(value_t) + sizeof(uint32_t))
+#define PASSTHROUGH_NAME_MAX (BRUBECK_SHM_RECORD_MAX - PASSTHROUGH_HEADER)
+#define PASSTHROUGH_WAIT_MS 100
+#define PASSTHROUGH_WRITE_SIZE 16384
+
+static void passthrough_write(struct brubeck_carbon *carbon, const char *buf,
+                              size_t len) {
+  ssize_t wr = write_in_full(carbon->out_sock, buf, len);
+
+  if (wr < 0) {
+    carbon_disconnect(carbon);
     return;
   }
 
-  uint8_t key_len = (uint8_t)strlen(key);
+  carbon->bytes_sent += wr;
+}
+
+static void passthrough_drain(struct brubeck_carbon *carbon) {
+  struct brubeck_shm_consumer *ring = &carbon->passthrough_reader;
+  struct brubeck_shm_slot *slot;
+  char out[PASSTHROUGH_WRITE_SIZE];
+  size_t out_len = 0;
+
+  while (carbon_is_connected(carbon) && (slot = brubeck_shm_peek(ring))) {
+    const char *name = slot->data + PASSTHROUGH_HEADER;
+    const size_t name_len = slot->len - PASSTHROUGH_HEADER;
+    uint32_t timestamp;
+    value_t value;
+
+    memcpy(&value, slot->data, sizeof(value));
+    memcpy(&timestamp, slot->data + sizeof(value), sizeof(timestamp));
+
+    if (carbon->pickler.ptr) {
+      char encoded[MAX_PICKLE_SIZE + BRUBECK_NAME_FRAMING];
+      size_t len = pickle1_encode(encoded, name, name_len);
+
+      if (len) {
+        if (carbon->pickler.pos + PICKLE1_SIZE(len) >= PICKLE_BUFFER_SIZE)
+          pickle1_flush(carbon);
+        pickle1_push(&carbon->pickler, encoded, len, timestamp, value);
+      }
+    } else if (memchr(name, ' ', name_len) == NULL) {
+      if (out_len + name_len + 64 > sizeof(out)) {
+        passthrough_write(carbon, out, out_len);
+        out_len = 0;
+      }
+
+      memcpy(out + out_len, name, name_len);
+      out_len += name_len;
+      out[out_len++] = ' ';
+      out_len += brubeck_ftoa(out + out_len, value);
+      out[out_len++] = ' ';
+      out_len += brubeck_itoa(out + out_len, timestamp);
+      out[out_len++] = '\n';
+    }
 
-  if (carbon->pickler.pos + PICKLE1_SIZE(key_len) >= PICKLE_BUFFER_SIZE) {
+    brubeck_shm_release(ring, slot);
+    carbon->forwarded++;
+  }
+
+  if (carbon->pickler.ptr)
     pickle1_flush(carbon);
+  else if (out_len && carbon_is_connected(carbon))
+    passthrough_write(carbon, out, out_len);
+}
+
+static void passthrough_wait(void *backend, const struct timespec *until) {
+  struct brubeck_carbon *carbon = (struct brubeck_carbon *)backend;
+
+  for (;;) {
+    struct timespec now;
+    long remaining;
+
+    /* while disconnected, points wait in the ring for the next tick to
+     * reconnect */
+    if (!carbon_is_connected(carbon)) {
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, until, NULL);
+      return;
+    }
+
+    passthrough_drain(carbon);
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    remaining = (until->tv_sec - now.tv_sec) * 1000 +
+                (until->tv_nsec - now.tv_nsec) / 1000000;
+    if (remaining <= 0)
+      return;
+
+    brubeck_shm_wait(&carbon->passthrough_reader,
+                     remaining < PASSTHROUGH_WAIT_MS ? (int)remaining
+                                                     : PASSTHROUGH_WAIT_MS);
   }
+}
 
-  if (!carbon_is_connected(carbon))
-    return;
+/*
+ * Give every carbon backend a passthrough ring of `slots` records.
+ * Returns the number of backends that can take passthrough points.
+ */
+int brubeck_carbon_passthrough_enable(struct brubeck_server *server,
+                                      uint32_t slots) {
+  int i, enabled = 0;
+
+  for (i = 0; i < server->active_backends; ++i) {
+    struct brubeck_carbon *carbon =
+        (struct brubeck_carbon *)server->backends[i];
+    struct brubeck_shm_ring *ring;
+
+    if (server->backends[i]->type != BRUBECK_BACKEND_CARBON)
+      continue;
+
+    enabled++;
+    if (carbon->passthrough)
+      continue;
+
+    ring = xmalloc(brubeck_shm_size(slots));
+    brubeck_shm_init(ring, slots);
+    brubeck_shm_consumer_init(&carbon->passthrough_reader, ring, slots);
+
+    __atomic_store_n(&carbon->passthrough, ring, __ATOMIC_RELEASE);
+    __atomic_store_n(&carbon->backend.wait, &passthrough_wait,
+                     __ATOMIC_RELEASE);
+  }
 
-  pickle1_push(&carbon->pickler, key, key_len, carbon->backend.tick_time,
-               value);
+  return enabled;
+}
+
+/*
+ * Queue a point for forwarding, on the carbon backend its name shards to.
+ * Returns false if the point was dropped because the queue is full.
+ */
+bool brubeck_carbon_passthrough(struct brubeck_server *server,
+                                const char *name, size_t name_len,
+                                value_t value, uint32_t timestamp) {
+  char record[BRUBECK_SHM_RECORD_MAX];
+  int i, shard = 0;
+
+  if (name_len > PASSTHROUGH_NAME_MAX)
+    return false;
+
+  if (server->active_backends > 1)
+    shard = CityHash32(name, name_len) % server->active_backends;
+
+  for (i = 0; i < server->active_backends; ++i) {
+    struct brubeck_backend *backend =
+        server->backends[(shard + i) % server->active_backends];
+
+    if (backend->type == BRUBECK_BACKEND_CARBON &&
+        ((struct brubeck_carbon *)backend)->passthrough) {
+      memcpy(record, &value, sizeof(value));
+      memcpy(record + sizeof(value), &timestamp, sizeof(timestamp));
+      memcpy(record + PASSTHROUGH_HEADER, name, name_len);
+
+      return brubeck_shm_push(((struct brubeck_carbon *)backend)->passthrough,
+                              record, PASSTHROUGH_HEADER + name_len) == 0;
+    }
+  }
+
+  return false;
 }
 
 struct brubeck_backend *brubeck_carbon_new(struct brubeck_server *server,
@@ -203,11 +378,13 @@ struct brubeck_backend *brubeck_carbon_new(struct brubeck_server *server,
 
   if (pickle) {
     carbon->backend.sample = &pickle1_each;
+    carbon->backend.encode_name = &pickle1_encode;
     carbon->backend.flush = &pickle1_flush;
     carbon->pickler.ptr = malloc(PICKLE_BUFFER_SIZE);
     pickle1_init(&carbon->pickler);
   } else {
     carbon->backend.sample = &plaintext_each;
+    carbon->backend.encode_name = &plaintext_encode;
     carbon->backend.flush = NULL;
   }
 
@@ -4,8 +4,11 @@
 #define MAX_PICKLE_SIZE 256
 #define PICKLE_BUFFER_SIZE 4096
 #define PICKLE1_SIZE(key_len) (32 + key_len)
+#define PLAINTEXT_BUFFER_SIZE 1024
 
 #include "jansson.h"
+#include "samplers/shm_ring.h"
+
 
 struct brubeck_carbon {
   struct brubeck_backend backend;
@@ -18,9 +21,20 @@ struct brubeck_carbon {
     uint16_t pt;
   } pickler;
   size_t bytes_sent;
+
+  /* points forwarded as-is by ingestion samplers, drained continuously
+   * between ticks */
+  struct brubeck_shm_ring *passthrough;
+  struct brubeck_shm_consumer passthrough_reader;
+  size_t forwarded;
 };
 
 struct brubeck_backend *brubeck_carbon_new(struct brubeck_server *server,
                                            json_t *settings, int shard_n);
+int brubeck_carbon_passthrough_enable(struct brubeck_server *server,
+                                      uint32_t slots);
+bool brubeck_carbon_passthrough(struct brubeck_server *server,
+                                const char *name, size_t name_len,
+                                value_t value, uint32_t timestamp);
 
 #endif
@@ -116,7 +116,7 @@ static int kafka_connect(void *backend) {
 }
 
 static void each_metric(const struct brubeck_metric *metric, const char *key,
-                        value_t value, void *backend) {
+                        size_t key_len, value_t value, void *backend) {
   struct brubeck_kafka *self = (struct brubeck_kafka *)backend;
 
   uint32_t tag_index = 0;
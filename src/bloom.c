@@ -25,13 +25,28 @@ int multibloom_check(struct multibloom *bloom, int f, uint32_t a, uint32_t b) {
     if (c & mask) {
       hits++;
     } else {
-      filter[byte] = c | mask;
+      /* the filter can be shared between threads */
+      brubeck_atomic_or(&filter[byte], (unsigned char)mask);
     }
   }
 
   return (hits == bloom->hashes);
 }
 
+/* Like multibloom_check, without adding the item to the filter */
+int multibloom_test(struct multibloom *bloom, int f, uint32_t a, uint32_t b) {
+  const unsigned char *filter = bloom->filters[f];
+  uint32_t x, i;
+
+  for (i = 0; i < bloom->hashes; i++) {
+    x = (a + i * b) % bloom->bits;
+    if (!(filter[x >> 3] & (1 << (x % 8))))
+      return 0;
+  }
+
+  return 1;
+}
+
 void multibloom_reset(struct multibloom *bloom, int f) {
   memset(bloom->filters[f], 0x0, bloom->bytes);
 }
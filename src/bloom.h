@@ -11,6 +11,7 @@ struct multibloom {
 };
 
 int multibloom_check(struct multibloom *bloom, int f, uint32_t a, uint32_t b);
+int multibloom_test(struct multibloom *bloom, int f, uint32_t a, uint32_t b);
 void multibloom_reset(struct multibloom *bloom, int f);
 struct multibloom *multibloom_new(int filters, int entries, double error);
 
@@ -5,6 +5,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
 #include <pthread.h>
 #include <stdbool.h>
 #include <stddef.h>
@@ -24,22 +25,44 @@
 #define BRUBECK_STATS 1
 #define MAX_ADDR 256
 
+/* UDP receive offload, Linux 5.0+; older libcs lack the definition */
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+/* socket busy polling, Linux 3.11+ and 5.11+ respectively */
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+
 typedef double value_t;
 typedef uint64_t hash_t;
 
 struct brubeck_server;
 struct brubeck_metric;
 
+#include "admission.h"
 #include "backend.h"
+#include "cardinality.h"
+#include "denylist.h"
+#include "eviction.h"
 #include "histogram.h"
+#include "hll.h"
+#include "hotkeys.h"
 #include "ht.h"
 #include "jansson.h"
 #include "log.h"
 #include "metric.h"
+#include "ratelimit.h"
 #include "sampler.h"
 #include "server.h"
 #include "slab.h"
 #include "tags.h"
+#include "talkers.h"
+#include "upgrade.h"
 #include "utils.h"
 
 #define LOGARITHMIC_GROWTH
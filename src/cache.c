@@ -0,0 +1,295 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "brubeck.h"
+
+/*
+ * Snapshot of the metric store, so that a restart keeps its keys, tag sets,
+ * gauge values and counter baselines. The file is a fixed header followed
+ * by one record per metric:
+ *
+ *   [header][record][key][record][key]...
+ *
+ * Records are packed back to back, so they are copied out before use. It
+ * is written to `<path>.tmp` and renamed over the previous snapshot, so a
+ * crash never leaves a torn file behind, and it is read with mmap.
+ */
+#define CACHE_MAGIC "BRBKSNAP"
+#define CACHE_VERSION 1
+
+/* Written on shutdown, after the backends stopped: the values recorded
+ * since the last flush are in it and can be carried over */
+#define CACHE_CLEAN 0x1
+
+struct cache_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t flags;
+  uint64_t count;
+  uint64_t created; /* unix time */
+  uint64_t checksum; /* FNV-1a of everything after the header */
+};
+
+struct cache_record {
+  value_t value;
+  value_t previous;
+  uint16_t key_len;
+  uint8_t type;
+  uint8_t reserved[5];
+};
+
+struct cache_writer {
+  FILE *file;
+  uint64_t count;
+  uint64_t checksum;
+  bool failed;
+};
+
+static uint64_t fnv1a(uint64_t h, const void *data, size_t len) {
+  const unsigned char *p = data;
+
+  while (len--) {
+    h ^= *p++;
+    h *= 0x100000001b3ULL;
+  }
+
+  return h;
+}
+
+static void cache_write(struct cache_writer *w, const void *data, size_t len) {
+  w->checksum = fnv1a(w->checksum, data, len);
+  if (fwrite(data, 1, len, w->file) != len)
+    w->failed = true;
+}
+
+static void save_metric(struct brubeck_metric *mt, void *payload) {
+  struct cache_writer *w = payload;
+  struct cache_record record;
+  const char *key;
+  size_t key_len;
+
+  if (mt->type == BRUBECK_MT_INTERNAL_STATS ||
+      brubeck_metric_get_state(mt) == BRUBECK_STATE_DISABLED)
+    return;
+
+  memset(&record, 0x0, sizeof(record));
+  key = brubeck_metric_ht_key(mt, &key_len);
+  record.key_len = (uint16_t)key_len;
+  record.type = mt->type;
+
+  pthread_spin_lock(&mt->lock);
+  switch (mt->type) {
+  case BRUBECK_MT_GAUGE:
+    record.value = mt->as.gauge.value;
+    break;
+  case BRUBECK_MT_METER:
+    record.value = mt->as.meter.value;
+    break;
+  case BRUBECK_MT_COUNTER:
+    record.value = mt->as.counter.value;
+    record.previous = mt->as.counter.previous;
+    break;
+  default:
+    /* histograms, timers and sets only carry over their key */
+    break;
+  }
+  pthread_spin_unlock(&mt->lock);
+
+  if (mt->type == BRUBECK_MT_METER && mt->as.meter.shards) {
+    int i;
+
+    for (i = 0; i < BRUBECK_METER_SHARDS; ++i) {
+      pthread_spin_lock(&mt->as.meter.shards[i].lock);
+      { record.value += mt->as.meter.shards[i].value; }
+      pthread_spin_unlock(&mt->as.meter.shards[i].lock);
+    }
+  }
+
+  cache_write(w, &record, sizeof(record));
+  cache_write(w, key, key_len);
+  w->count++;
+}
+
+static void cache_write_file(struct brubeck_server *server, bool clean) {
+  struct cache_writer w = {.count = 0, .checksum = 0xcbf29ce484222325ULL};
+  struct cache_header header;
+  char tmp_path[PATH_MAX];
+
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", server->cache.path);
+
+  if ((w.file = fopen(tmp_path, "w")) == NULL) {
+    log_splunk_errno("event=cache_save_failed path=%s", tmp_path);
+    return;
+  }
+
+  memset(&header, 0x0, sizeof(header));
+  if (fwrite(&header, sizeof(header), 1, w.file) != 1)
+    w.failed = true;
+
+  brubeck_metric_foreach(server, &save_metric, &w);
+
+  memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+  header.version = CACHE_VERSION;
+  header.flags = clean ? CACHE_CLEAN : 0;
+  header.count = w.count;
+  header.created = (uint64_t)time(NULL);
+  header.checksum = w.checksum;
+
+  if (fseek(w.file, 0, SEEK_SET) < 0 ||
+      fwrite(&header, sizeof(header), 1, w.file) != 1 ||
+      fflush(w.file) != 0 || fsync(fileno(w.file)) < 0)
+    w.failed = true;
+
+  if (fclose(w.file) != 0)
+    w.failed = true;
+
+  if (w.failed || rename(tmp_path, server->cache.path) < 0) {
+    log_splunk_errno("event=cache_save_failed path=%s", server->cache.path);
+    unlink(tmp_path);
+    return;
+  }
+
+  log_splunk("event=cache_saved path=%s keys=%llu clean=%d",
+             server->cache.path, (unsigned long long)w.count, clean);
+}
+
+/*
+ * Write a snapshot of the metric store. The metrics are walked without
+ * locking the metrics table, so this never holds up ingestion; it runs in
+ * the main thread, every `cache.interval` seconds and once more on
+ * shutdown, when the server is no longer running.
+ */
+void brubeck_cache_save(struct brubeck_server *server) {
+  if (server->cache.path)
+    cache_write_file(server, !server->running);
+}
+
+static void restore_metric(struct brubeck_server *server,
+                           const struct cache_record *record, const char *key,
+                           bool clean) {
+  static char name[UINT16_MAX + 1];
+  struct brubeck_metric *mt;
+
+  memcpy(name, key, record->key_len);
+  name[record->key_len] = '\0';
+
+  mt = brubeck_hashtable_find(server->metrics, name, record->key_len);
+  if (mt == NULL) {
+    /* restored keys take their cardinality budget like new ones; those
+     * over it are dropped rather than folded, since their values do not
+     * add up with the others of the overflow metric */
+    if (server->cardinality &&
+        !brubeck_cardinality_account(server->cardinality, name,
+                                     record->key_len))
+      return;
+
+    mt = brubeck_metric_new(server, name, record->key_len, record->type);
+  }
+
+  if (mt == NULL || mt->type != record->type)
+    return;
+
+  pthread_spin_lock(&mt->lock);
+  switch (mt->type) {
+  case BRUBECK_MT_GAUGE:
+    mt->as.gauge.value = record->value;
+    break;
+  case BRUBECK_MT_METER:
+    if (clean)
+      mt->as.meter.value = record->value;
+    break;
+  case BRUBECK_MT_COUNTER:
+    mt->as.counter.previous = record->previous;
+    if (clean)
+      mt->as.counter.value = record->value;
+    break;
+  }
+  pthread_spin_unlock(&mt->lock);
+}
+
+/*
+ * Rebuild the metric store from the last snapshot, if there is one. Runs
+ * before the samplers start, so the table is sized for all the keys at
+ * once and filled without any contention. A snapshot that cannot be used
+ * is logged and ignored.
+ */
+void brubeck_cache_load(struct brubeck_server *server) {
+  struct cache_header header;
+  struct stat st;
+  const char *data, *p, *end;
+  uint64_t i;
+  bool clean;
+  int fd;
+
+  if (server->cache.path == NULL)
+    return;
+
+  if ((fd = open(server->cache.path, O_RDWR)) < 0) {
+    if (errno != ENOENT)
+      log_splunk_errno("event=cache_load_failed path=%s", server->cache.path);
+    return;
+  }
+
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(header)) {
+    log_splunk("event=cache_load_failed path=%s error=truncated",
+               server->cache.path);
+    close(fd);
+    return;
+  }
+
+  data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    log_splunk_errno("event=cache_load_failed path=%s", server->cache.path);
+    close(fd);
+    return;
+  }
+
+  memcpy(&header, data, sizeof(header));
+  p = data + sizeof(header);
+  end = data + st.st_size;
+
+  if (memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) ||
+      header.version != CACHE_VERSION ||
+      fnv1a(0xcbf29ce484222325ULL, p, end - p) != header.checksum) {
+    log_splunk("event=cache_load_failed path=%s error=corrupt",
+               server->cache.path);
+    goto done;
+  }
+
+  clean = (header.flags & CACHE_CLEAN) != 0;
+  brubeck_hashtable_reserve(server->metrics, header.count);
+
+  for (i = 0; i < header.count; ++i) {
+    struct cache_record record;
+
+    if ((size_t)(end - p) < sizeof(record))
+      break;
+
+    memcpy(&record, p, sizeof(record));
+    p += sizeof(record);
+
+    if ((size_t)(end - p) < record.key_len)
+      break;
+
+    restore_metric(server, &record, p, clean);
+    p += record.key_len;
+  }
+
+  log_splunk("event=cache_loaded path=%s keys=%llu clean=%d age=%lld",
+             server->cache.path, (unsigned long long)i, clean,
+             (long long)(time(NULL) - (time_t)header.created));
+
+  /* the carried over values must not be applied twice, should the daemon
+   * restart again before the next snapshot */
+  if (clean) {
+    header.flags &= ~CACHE_CLEAN;
+    if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header))
+      log_splunk_errno("event=cache_load_failed path=%s", server->cache.path);
+  }
+
+done:
+  munmap((void *)data, st.st_size);
+  close(fd);
+}
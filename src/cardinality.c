@@ -0,0 +1,323 @@
+#include "brubeck.h"
+
+/* The length of the first `segments` segments of a key, before its tags */
+static size_t key_prefix_len(const char *key, size_t len, int segments) {
+  size_t i;
+
+  for (i = 0; i < len; ++i) {
+    if (key[i] == '#' || key[i] == ',')
+      break;
+    if (key[i] == '.' && --segments == 0)
+      break;
+  }
+
+  return i;
+}
+
+static uint32_t limit_for(const struct brubeck_cardinality *cardinality,
+                          const char *prefix, size_t len) {
+  size_t i;
+
+  for (i = 0; i < cardinality->limit_count; ++i) {
+    const struct brubeck_cardinality_limit *limit = &cardinality->limits[i];
+    if (limit->len == len && !memcmp(limit->prefix, prefix, len))
+      return limit->limit;
+  }
+
+  return cardinality->default_limit;
+}
+
+static void prefix_init(struct brubeck_cardinality *cardinality,
+                        struct brubeck_cardinality_prefix *p,
+                        const char *prefix, size_t len, uint32_t hash) {
+  p->len = len;
+  p->hash = hash;
+  p->limit = limit_for(cardinality, prefix, len);
+  p->attempted =
+      brubeck_hll_new(cardinality->slab, BRUBECK_CARDINALITY_PRECISION);
+  pthread_spin_init(&p->lock, PTHREAD_PROCESS_PRIVATE);
+
+  /* publishes the slot to lock-free lookups */
+  __atomic_store_n(&p->prefix, strndup(prefix, len), __ATOMIC_RELEASE);
+}
+
+static bool prefix_is(const struct brubeck_cardinality_prefix *p,
+                      const char *name, const char *prefix, size_t len,
+                      uint32_t hash) {
+  return p->hash == hash && p->len == len && !memcmp(name, prefix, len);
+}
+
+static struct brubeck_cardinality_prefix *
+claim_prefix(struct brubeck_cardinality *cardinality, const char *prefix,
+             size_t len, uint32_t hash) {
+  struct brubeck_cardinality_prefix *p = &cardinality->other;
+  size_t slot = hash & cardinality->mask;
+
+  pthread_mutex_lock(&cardinality->lock);
+
+  for (;; slot = (slot + 1) & cardinality->mask) {
+    struct brubeck_cardinality_prefix *s = &cardinality->slots[slot];
+
+    if (s->prefix == NULL) {
+      if (cardinality->count < cardinality->max_prefixes) {
+        prefix_init(cardinality, s, prefix, len, hash);
+        cardinality->count++;
+        p = s;
+      }
+      break;
+    }
+
+    /* claimed by another thread since we looked */
+    if (prefix_is(s, s->prefix, prefix, len, hash)) {
+      p = s;
+      break;
+    }
+  }
+
+  pthread_mutex_unlock(&cardinality->lock);
+  return p;
+}
+
+static struct brubeck_cardinality_prefix *
+find_prefix(struct brubeck_cardinality *cardinality, const char *prefix,
+            size_t len) {
+  const uint32_t hash = CityHash32(prefix, len);
+  size_t slot = hash & cardinality->mask;
+
+  /* the table is twice `max_prefixes`, so there is always a free slot */
+  for (;; slot = (slot + 1) & cardinality->mask) {
+    struct brubeck_cardinality_prefix *p = &cardinality->slots[slot];
+    const char *name = __atomic_load_n(&p->prefix, __ATOMIC_ACQUIRE);
+
+    if (name == NULL)
+      return claim_prefix(cardinality, prefix, len, hash);
+
+    if (prefix_is(p, name, prefix, len, hash))
+      return p;
+  }
+}
+
+/*
+ * Check a key that is about to be given a metric against the budget of its
+ * prefix, whose length is stored in `prefix_len`. An admitted key is
+ * counted against the budget right away.
+ */
+enum brubeck_cardinality_t
+brubeck_cardinality_check(struct brubeck_cardinality *cardinality,
+                          const char *key, size_t key_len, size_t *prefix_len) {
+  const size_t len =
+      key_prefix_len(key, key_len, cardinality->prefix_segments);
+  struct brubeck_cardinality_prefix *p = find_prefix(cardinality, key, len);
+  const value_t member = brubeck_hll_member(key, key_len);
+
+  if (!brubeck_hll_add_dense(p->attempted, member)) {
+    pthread_spin_lock(&p->lock);
+    brubeck_hll_add_sparse(p->attempted, member);
+    pthread_spin_unlock(&p->lock);
+  }
+
+  *prefix_len = len;
+
+  if (p->limit == 0) {
+    brubeck_atomic_inc(&p->admitted);
+    return BRUBECK_CARDINALITY_ADMIT;
+  }
+
+  if (brubeck_atomic_inc(&p->admitted) <= p->limit)
+    return BRUBECK_CARDINALITY_ADMIT;
+
+  brubeck_atomic_dec(&p->admitted);
+  brubeck_atomic_inc(&p->rejected);
+  return cardinality->fold ? BRUBECK_CARDINALITY_FOLD
+                           : BRUBECK_CARDINALITY_REJECT;
+}
+
+/* Whether `key` names one of the metrics that keys over the budget of
+ * their prefix are folded into, which take no budget themselves */
+static bool is_overflow(const char *key, size_t key_len, size_t len) {
+  const size_t overflow_len = strlen(BRUBECK_CARDINALITY_OVERFLOW);
+
+  return key_len > len + overflow_len &&
+         !memcmp(key + len, BRUBECK_CARDINALITY_OVERFLOW, overflow_len) &&
+         key[len + overflow_len] == '.';
+}
+
+/*
+ * Charge the budget of its prefix for a key that is given a metric without
+ * going through brubeck_metric_find, like one restored from the cache.
+ * Returns false if the key is over the budget and must not get a metric.
+ */
+bool brubeck_cardinality_account(struct brubeck_cardinality *cardinality,
+                                 const char *key, size_t key_len) {
+  size_t len = key_prefix_len(key, key_len, cardinality->prefix_segments);
+
+  if (is_overflow(key, key_len, len))
+    return true;
+
+  return brubeck_cardinality_check(cardinality, key, key_len, &len) ==
+         BRUBECK_CARDINALITY_ADMIT;
+}
+
+/* Give back the budget taken by a key whose metric was evicted, or that
+ * did not get a metric after all */
+void brubeck_cardinality_release(struct brubeck_cardinality *cardinality,
+                                 const char *key, size_t key_len) {
+  const size_t len =
+      key_prefix_len(key, key_len, cardinality->prefix_segments);
+  struct brubeck_cardinality_prefix *p;
+  uint32_t admitted;
+
+  /* overflow metrics never took any budget */
+  if (is_overflow(key, key_len, len))
+    return;
+
+  p = find_prefix(cardinality, key, len);
+  admitted = brubeck_atomic_fetch(&p->admitted);
+
+  while (admitted &&
+         !__sync_bool_compare_and_swap(&p->admitted, admitted, admitted - 1))
+    admitted = brubeck_atomic_fetch(&p->admitted);
+}
+
+struct brubeck_cardinality *brubeck_cardinality_new(struct brubeck_slab *slab,
+                                                    int prefix_segments,
+                                                    uint32_t default_limit,
+                                                    size_t max_prefixes) {
+  struct brubeck_cardinality *cardinality =
+      xcalloc(1, sizeof(struct brubeck_cardinality));
+  size_t size = 2;
+
+  while (size < 2 * max_prefixes)
+    size <<= 1;
+
+  pthread_mutex_init(&cardinality->lock, NULL);
+  cardinality->slots = xcalloc(size, sizeof(struct brubeck_cardinality_prefix));
+  cardinality->mask = size - 1;
+  cardinality->max_prefixes = max_prefixes;
+  cardinality->prefix_segments = prefix_segments;
+  cardinality->default_limit = default_limit;
+  cardinality->slab = slab;
+
+  prefix_init(cardinality, &cardinality->other, "__other__", 9, 0);
+  cardinality->other.limit = default_limit;
+  return cardinality;
+}
+
+/* Override the default budget of a prefix; only before any key is checked */
+void brubeck_cardinality_set_limit(struct brubeck_cardinality *cardinality,
+                                   const char *prefix, uint32_t limit) {
+  struct brubeck_cardinality_limit *l;
+
+  cardinality->limits =
+      xrealloc(cardinality->limits,
+               (cardinality->limit_count + 1) * sizeof(*cardinality->limits));
+
+  l = &cardinality->limits[cardinality->limit_count++];
+  l->prefix = strdup(prefix);
+  l->len = strlen(prefix);
+  l->limit = limit;
+}
+
+struct brubeck_cardinality *brubeck_cardinality_load(struct brubeck_slab *slab,
+                                                     json_t *config) {
+  struct brubeck_cardinality *cardinality;
+  int prefix_segments = 1, limit = 0, max_prefixes = 4096;
+  const char *overflow = "reject", *prefix;
+  json_t *limits = NULL, *value;
+
+  json_unpack_or_die(config, "{s?:i, s?:i, s?:o, s?:s, s?:i}",
+                     "prefix_segments", &prefix_segments, "limit", &limit,
+                     "limits", &limits, "overflow", &overflow, "max_prefixes",
+                     &max_prefixes);
+
+  if (prefix_segments < 1 || limit < 0 || max_prefixes < 1)
+    die("invalid `cardinality` prefix, limit or table size");
+
+  cardinality = brubeck_cardinality_new(slab, prefix_segments,
+                                        (uint32_t)limit, max_prefixes);
+
+  if (!strcmp(overflow, "fold"))
+    cardinality->fold = true;
+  else if (strcmp(overflow, "reject"))
+    die("`cardinality` overflow must be \"reject\" or \"fold\"");
+
+  if (limits) {
+    if (!json_is_object(limits))
+      die("`cardinality` limits must map prefixes to key counts");
+
+    json_object_foreach(limits, prefix, value) {
+      if (!json_is_integer(value) || json_integer_value(value) < 0)
+        die("invalid `cardinality` limit for %s", prefix);
+
+      brubeck_cardinality_set_limit(cardinality, prefix,
+                                    (uint32_t)json_integer_value(value));
+    }
+  }
+
+  log_splunk("event=cardinality_loaded prefix_segments=%d limit=%d "
+             "overflow=%s",
+             prefix_segments, limit, overflow);
+  return cardinality;
+}
+
+struct prefix_estimate {
+  const struct brubeck_cardinality_prefix *prefix;
+  value_t estimate;
+};
+
+static int estimate_cmp(const void *a, const void *b) {
+  const struct prefix_estimate *ea = a, *eb = b;
+  return (ea->estimate < eb->estimate) - (ea->estimate > eb->estimate);
+}
+
+static value_t prefix_estimate(struct brubeck_cardinality_prefix *p) {
+  value_t estimate;
+
+  pthread_spin_lock(&p->lock);
+  { estimate = brubeck_hll_estimate(p->attempted, false); }
+  pthread_spin_unlock(&p->lock);
+
+  return estimate;
+}
+
+/* The prefixes by estimated number of keys, the largest first */
+json_t *brubeck_cardinality_stats(struct brubeck_cardinality *cardinality) {
+  struct prefix_estimate *estimates;
+  json_t *prefixes = json_array();
+  size_t i, count = 0;
+
+  estimates = xmalloc((cardinality->mask + 2) * sizeof(*estimates));
+
+  for (i = 0; i <= cardinality->mask; ++i) {
+    struct brubeck_cardinality_prefix *p = &cardinality->slots[i];
+
+    if (__atomic_load_n(&p->prefix, __ATOMIC_ACQUIRE) == NULL)
+      continue;
+
+    estimates[count].prefix = p;
+    estimates[count++].estimate = prefix_estimate(p);
+  }
+
+  if (cardinality->other.admitted || cardinality->other.rejected) {
+    estimates[count].prefix = &cardinality->other;
+    estimates[count++].estimate = prefix_estimate(&cardinality->other);
+  }
+
+  qsort(estimates, count, sizeof(*estimates), &estimate_cmp);
+
+  for (i = 0; i < count; ++i) {
+    const struct brubeck_cardinality_prefix *p = estimates[i].prefix;
+
+    json_array_append_new(
+        prefixes,
+        json_pack("{s:s, s:I, s:I, s:I, s:I}", "prefix", p->prefix, "limit",
+                  (json_int_t)p->limit, "admitted", (json_int_t)p->admitted,
+                  "estimate", (json_int_t)estimates[i].estimate, "rejected",
+                  (json_int_t)p->rejected));
+  }
+
+  free(estimates);
+
+  return json_pack("{s:b, s:o}", "fold", cardinality->fold, "prefixes",
+                   prefixes);
+}
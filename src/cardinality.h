@@ -0,0 +1,74 @@
+#ifndef __BRUBECK_CARDINALITY_H__
+#define __BRUBECK_CARDINALITY_H__
+
+#include "jansson.h"
+
+/* HyperLogLog precision of the per-prefix estimates: 1KB, ~3% error */
+#define BRUBECK_CARDINALITY_PRECISION 10
+#define BRUBECK_CARDINALITY_OVERFLOW ".__overflow__"
+
+enum brubeck_cardinality_t {
+  BRUBECK_CARDINALITY_ADMIT,
+  BRUBECK_CARDINALITY_REJECT,
+  BRUBECK_CARDINALITY_FOLD,
+};
+
+struct brubeck_cardinality_limit {
+  const char *prefix;
+  size_t len;
+  uint32_t limit;
+};
+
+struct brubeck_cardinality_prefix {
+  const char *prefix; /* NULL while the slot is free */
+  size_t len;
+  uint32_t hash;
+  uint32_t limit;    /* new keys allowed for the prefix, 0 for no limit */
+  uint32_t admitted; /* keys that were given a metric */
+  uint64_t rejected; /* lookups of keys over the limit */
+  pthread_spinlock_t lock; /* guards the sparse estimator */
+  struct brubeck_hll *attempted; /* unique new keys seen, admitted or not */
+};
+
+/*
+ * Cardinality budgets for key prefixes (the first `prefix_segments`
+ * dot-separated segments of a key). Prefixes live in a fixed open
+ * addressing table: slots are claimed under `lock` and published with a
+ * release store, so lookups never lock. Once the table is full, new
+ * prefixes share the `other` budget.
+ */
+struct brubeck_cardinality {
+  pthread_mutex_t lock;
+  struct brubeck_cardinality_prefix *slots;
+  size_t mask;
+  size_t count;
+  size_t max_prefixes;
+  struct brubeck_cardinality_prefix other;
+
+  int prefix_segments;
+  uint32_t default_limit;
+  struct brubeck_cardinality_limit *limits;
+  size_t limit_count;
+  bool fold;
+
+  struct brubeck_slab *slab;
+};
+
+struct brubeck_cardinality *brubeck_cardinality_new(struct brubeck_slab *slab,
+                                                    int prefix_segments,
+                                                    uint32_t default_limit,
+                                                    size_t max_prefixes);
+void brubeck_cardinality_set_limit(struct brubeck_cardinality *cardinality,
+                                   const char *prefix, uint32_t limit);
+struct brubeck_cardinality *brubeck_cardinality_load(struct brubeck_slab *slab,
+                                                     json_t *config);
+enum brubeck_cardinality_t
+brubeck_cardinality_check(struct brubeck_cardinality *cardinality,
+                          const char *key, size_t key_len, size_t *prefix_len);
+bool brubeck_cardinality_account(struct brubeck_cardinality *cardinality,
+                                 const char *key, size_t key_len);
+void brubeck_cardinality_release(struct brubeck_cardinality *cardinality,
+                                 const char *key, size_t key_len);
+json_t *brubeck_cardinality_stats(struct brubeck_cardinality *cardinality);
+
+#endif
@@ -0,0 +1,264 @@
+#include <ctype.h>
+#include <linux/filter.h>
+
+#include "brubeck.h"
+
+static int32_t new_node(struct brubeck_denylist *denylist, uint8_t byte) {
+  struct brubeck_denylist_node *node;
+
+  denylist->nodes =
+      xrealloc(denylist->nodes, (denylist->node_count + 1) * sizeof(*node));
+
+  node = &denylist->nodes[denylist->node_count];
+  node->child = node->sibling = node->rule = -1;
+  node->byte = byte;
+  return (int32_t)denylist->node_count++;
+}
+
+static void insert_rule(struct brubeck_denylist *denylist, int32_t rule) {
+  const struct brubeck_denylist_rule *r = &denylist->rules[rule];
+  int32_t n = 0;
+  size_t i;
+
+  for (i = 0; i < r->len; ++i) {
+    const uint8_t byte = (uint8_t)r->prefix[i];
+    int32_t next = denylist->nodes[n].child;
+
+    while (next >= 0 && denylist->nodes[next].byte != byte)
+      next = denylist->nodes[next].sibling;
+
+    if (next < 0) {
+      next = new_node(denylist, byte);
+      denylist->nodes[next].sibling = denylist->nodes[n].child;
+      denylist->nodes[n].child = next;
+    }
+
+    n = next;
+  }
+
+  /* a duplicate prefix keeps counting against the first rule */
+  if (denylist->nodes[n].rule < 0)
+    denylist->nodes[n].rule = rule;
+}
+
+/* `.denied.<prefix>`, with dots and anything unusual in the prefix turned
+ * into underscores, and trailing separators dropped */
+static const char *rule_suffix(const char *prefix, size_t len) {
+  static const char HEAD[] = ".denied.";
+  char *suffix = xmalloc(sizeof(HEAD) + len);
+  size_t i, n = sizeof(HEAD) - 1;
+
+  memcpy(suffix, HEAD, n);
+  for (i = 0; i < len; ++i) {
+    const char c = prefix[i];
+    suffix[n++] = (isalnum((unsigned char)c) || c == '-') ? c : '_';
+  }
+
+  while (n > sizeof(HEAD) - 1 && suffix[n - 1] == '_')
+    n--;
+
+  suffix[n] = '\0';
+  return suffix;
+}
+
+struct brubeck_denylist *brubeck_denylist_new(const char **prefixes,
+                                              size_t count) {
+  struct brubeck_denylist *denylist = xcalloc(1, sizeof(*denylist));
+  size_t i;
+
+  denylist->rule_count = count;
+  denylist->rules = xcalloc(count, sizeof(struct brubeck_denylist_rule));
+
+  new_node(denylist, 0);
+
+  for (i = 0; i < count; ++i) {
+    struct brubeck_denylist_rule *rule = &denylist->rules[i];
+
+    rule->prefix = prefixes[i];
+    rule->len = strlen(prefixes[i]);
+
+    if (rule->len == 0 || rule->len > BRUBECK_DENYLIST_PREFIX_MAX)
+      die("`denylist` prefixes must be 1 to %d bytes long",
+          BRUBECK_DENYLIST_PREFIX_MAX);
+
+    rule->suffix = rule_suffix(rule->prefix, rule->len);
+    insert_rule(denylist, (int32_t)i);
+  }
+
+  return denylist;
+}
+
+/* Load the `denylist` array of the config file */
+struct brubeck_denylist *brubeck_denylist_load(json_t *config) {
+  struct brubeck_denylist *denylist;
+  const char **prefixes;
+  size_t i, count;
+
+  if (!json_is_array(config) || json_array_size(config) == 0)
+    die("`denylist` must be a list of key prefixes");
+
+  count = json_array_size(config);
+  prefixes = xcalloc(count, sizeof(const char *));
+
+  for (i = 0; i < count; ++i) {
+    json_t *prefix = json_array_get(config, i);
+
+    if (!json_is_string(prefix))
+      die("`denylist` prefixes must be strings");
+
+    prefixes[i] = json_string_value(prefix);
+  }
+
+  denylist = brubeck_denylist_new(prefixes, count);
+  free(prefixes);
+
+  log_splunk("event=denylist_loaded rules=%zu", count);
+  return denylist;
+}
+
+/* Returns the index of the first rule whose prefix `key` starts with, or -1 */
+int brubeck_denylist_match(const struct brubeck_denylist *denylist,
+                           const char *key, size_t len) {
+  const struct brubeck_denylist_node *nodes = denylist->nodes;
+  int32_t n = 0;
+  size_t i;
+
+  for (i = 0; i < len; ++i) {
+    n = nodes[n].child;
+    while (n >= 0 && nodes[n].byte != (uint8_t)key[i])
+      n = nodes[n].sibling;
+
+    if (n < 0)
+      return -1;
+    if (nodes[n].rule >= 0)
+      return nodes[n].rule;
+  }
+
+  return -1;
+}
+
+/* Returns true, and counts the drop, if `key` has a denied prefix */
+bool brubeck_denylist_drop(struct brubeck_denylist *denylist, const char *key,
+                           size_t len) {
+  int rule;
+
+  if (denylist == NULL)
+    return false;
+
+  rule = brubeck_denylist_match(denylist, key, len);
+  if (rule < 0)
+    return false;
+
+  brubeck_atomic_inc(&denylist->rules[rule].drops);
+  return true;
+}
+
+static inline size_t chunk_size(size_t left) {
+  return (left >= 4) ? 4 : (left >= 2) ? 2 : 1;
+}
+
+/* 2 instructions per chunk, plus the length check and the ret */
+static size_t rule_insns(const struct brubeck_denylist_rule *rule) {
+  size_t p, insns = 3;
+
+  for (p = 0; p < rule->len; p += chunk_size(rule->len - p))
+    insns += 2;
+
+  return insns;
+}
+
+/*
+ * Attach a classic BPF filter to `sock` that drops every datagram whose
+ * payload, found at `offset` (past the UDP header, for UDP sockets),
+ * starts with one of the prefixes. Only the first line of a datagram is
+ * matched: the kernel drops the datagram as a whole. Per rule:
+ *
+ *      ld len
+ *      jge #offset + len(prefix), 0, next
+ *      ld [offset + i]         ; for each 4, 2 or 1 byte chunk
+ *      jeq #chunk, 0, next
+ *      ret #0
+ *  next:
+ *      ...
+ *      ret #-1
+ *
+ * Loads past the end of the packet would make the filter drop it, hence
+ * the length check.
+ */
+int brubeck_denylist_attach(const struct brubeck_denylist *denylist, int sock,
+                            unsigned int offset) {
+  struct sock_filter *code;
+  struct sock_fprog prog;
+  size_t i, len = 0, total = 1;
+  int res;
+
+  for (i = 0; i < denylist->rule_count; ++i)
+    total += rule_insns(&denylist->rules[i]);
+
+  if (total > BPF_MAXINSNS) {
+    errno = E2BIG;
+    return -1;
+  }
+
+  code = xcalloc(total, sizeof(struct sock_filter));
+
+  for (i = 0; i < denylist->rule_count; ++i) {
+    const struct brubeck_denylist_rule *rule = &denylist->rules[i];
+    const uint8_t *prefix = (const uint8_t *)rule->prefix;
+    /* the index of the first instruction of the next rule */
+    const size_t next = len + rule_insns(rule);
+    size_t p;
+
+    code[len] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0);
+    len++;
+    code[len] = (struct sock_filter)BPF_JUMP(
+        BPF_JMP | BPF_JGE | BPF_K, offset + rule->len, 0, next - len - 1);
+    len++;
+
+    for (p = 0; p < rule->len;) {
+      const size_t n = chunk_size(rule->len - p);
+      const uint16_t size = (n == 4) ? BPF_W : (n == 2) ? BPF_H : BPF_B;
+      uint32_t chunk = 0;
+      size_t j;
+
+      /* absolute loads are in network byte order */
+      for (j = 0; j < n; ++j)
+        chunk = (chunk << 8) | prefix[p + j];
+
+      code[len] = (struct sock_filter)BPF_STMT(BPF_LD | size | BPF_ABS,
+                                               offset + (uint32_t)p);
+      len++;
+      code[len] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+                                               chunk, 0, next - len - 1);
+      len++;
+      p += n;
+    }
+
+    code[len++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0);
+    assert(len == next);
+  }
+
+  code[len++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0xFFFFFFFF);
+
+  prog.len = (unsigned short)len;
+  prog.filter = code;
+
+  res = setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog));
+  free(code);
+  return res;
+}
+
+json_t *brubeck_denylist_stats(struct brubeck_denylist *denylist) {
+  json_t *rules = json_array();
+  size_t i;
+
+  for (i = 0; i < denylist->rule_count; ++i) {
+    const struct brubeck_denylist_rule *rule = &denylist->rules[i];
+
+    json_array_append_new(rules,
+                          json_pack("{s:s, s:I}", "prefix", rule->prefix,
+                                    "drops", (json_int_t)rule->drops));
+  }
+
+  return rules;
+}
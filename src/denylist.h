@@ -0,0 +1,46 @@
+#ifndef __BRUBECK_DENYLIST_H__
+#define __BRUBECK_DENYLIST_H__
+
+#define BRUBECK_DENYLIST_PREFIX_MAX 128
+
+struct brubeck_denylist_rule {
+  const char *prefix;
+  size_t len;
+  const char *suffix; /* internal metric suffix, `.denied.<prefix>` */
+  uint64_t drops;
+  uint64_t reported;
+};
+
+struct brubeck_denylist_node {
+  int32_t child;
+  int32_t sibling;
+  int32_t rule;
+  uint8_t byte;
+};
+
+/*
+ * Key prefixes that are dropped before they are parsed. Lines are matched
+ * against a byte trie of the prefixes (the goto function of an
+ * Aho-Corasick automaton: matches are anchored at the start of the line,
+ * so it never needs failure links). The same prefixes can be compiled into
+ * a classic BPF socket filter that drops whole datagrams in the kernel.
+ */
+struct brubeck_denylist {
+  struct brubeck_denylist_rule *rules;
+  size_t rule_count;
+  struct brubeck_denylist_node *nodes;
+  size_t node_count;
+};
+
+struct brubeck_denylist *brubeck_denylist_new(const char **prefixes,
+                                              size_t count);
+struct brubeck_denylist *brubeck_denylist_load(json_t *config);
+int brubeck_denylist_match(const struct brubeck_denylist *denylist,
+                           const char *key, size_t len);
+int brubeck_denylist_attach(const struct brubeck_denylist *denylist, int sock,
+                            unsigned int offset);
+bool brubeck_denylist_drop(struct brubeck_denylist *denylist, const char *key,
+                           size_t len);
+json_t *brubeck_denylist_stats(struct brubeck_denylist *denylist);
+
+#endif
@@ -0,0 +1,355 @@
+#include "brubeck.h"
+
+/*
+ * Shortest round-trip formatting of doubles, using Florian Loitsch's Grisu2
+ * algorithm ("Printing Floating-Point Numbers Quickly and Accurately with
+ * Integers", PLDI 2010). The output always parses back to the exact same
+ * double, and is the shortest such representation in all but a tiny
+ * fraction of cases (where it is one digit longer).
+ */
+
+#define DP_SIGNIFICAND_MASK 0x000FFFFFFFFFFFFFULL
+#define DP_EXPONENT_MASK 0x7FF0000000000000ULL
+#define DP_HIDDEN_BIT 0x0010000000000000ULL
+#define DP_SIGNIFICAND_SIZE 52
+#define DP_EXPONENT_BIAS (0x3FF + DP_SIGNIFICAND_SIZE)
+#define DP_MIN_EXPONENT (-DP_EXPONENT_BIAS)
+
+struct diy_fp {
+  uint64_t f;
+  int e;
+};
+
+static const uint64_t CACHED_POWERS_F[] = {
+    0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL,
+    0xcf42894a5dce35eaULL, 0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL,
+    0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL, 0xbe5691ef416bd60cULL,
+    0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+    0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL,
+    0xc21094364dfb5637ULL, 0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL,
+    0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL, 0xb23867fb2a35b28eULL,
+    0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+    0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL,
+    0xb5b5ada8aaff80b8ULL, 0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL,
+    0x964e858c91ba2655ULL, 0xdff9772470297ebdULL, 0xa6dfbd9fb8e5b88fULL,
+    0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+    0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL,
+    0xaa242499697392d3ULL, 0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL,
+    0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL, 0x9c40000000000000ULL,
+    0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+    0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL,
+    0x9f4f2726179a2245ULL, 0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL,
+    0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL, 0x924d692ca61be758ULL,
+    0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+    0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL,
+    0x952ab45cfa97a0b3ULL, 0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL,
+    0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL, 0x88fcf317f22241e2ULL,
+    0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+    0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL,
+    0x8bab8eefb6409c1aULL, 0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL,
+    0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL, 0x80444b5e7aa7cf85ULL,
+    0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+    0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL,
+};
+
+static const int16_t CACHED_POWERS_E[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+    -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+    -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+    -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+    -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+    109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+    641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+    907, 933, 960, 986, 1013, 1039, 1066,
+};
+
+static const uint64_t POW10[] = {1ULL,
+                                 10ULL,
+                                 100ULL,
+                                 1000ULL,
+                                 10000ULL,
+                                 100000ULL,
+                                 1000000ULL,
+                                 10000000ULL,
+                                 100000000ULL,
+                                 1000000000ULL,
+                                 10000000000ULL,
+                                 100000000000ULL,
+                                 1000000000000ULL,
+                                 10000000000000ULL,
+                                 100000000000000ULL,
+                                 1000000000000000ULL,
+                                 10000000000000000ULL,
+                                 100000000000000000ULL,
+                                 1000000000000000000ULL,
+                                 10000000000000000000ULL};
+
+static inline struct diy_fp diy_fp_make(uint64_t f, int e) {
+  struct diy_fp r = {f, e};
+  return r;
+}
+
+static inline struct diy_fp diy_fp_mul(struct diy_fp a, struct diy_fp b) {
+  unsigned __int128 p = (unsigned __int128)a.f * b.f;
+  uint64_t h = (uint64_t)(p >> 64);
+  uint64_t l = (uint64_t)p;
+
+  /* round */
+  if (l & (1ULL << 63))
+    h++;
+
+  return diy_fp_make(h, a.e + b.e + 64);
+}
+
+static inline struct diy_fp diy_fp_normalize(struct diy_fp a) {
+  int s = __builtin_clzll(a.f);
+  return diy_fp_make(a.f << s, a.e - s);
+}
+
+static inline struct diy_fp diy_fp_normalize_boundary(struct diy_fp a) {
+  while (!(a.f & (DP_HIDDEN_BIT << 1))) {
+    a.f <<= 1;
+    a.e--;
+  }
+
+  a.f <<= (64 - DP_SIGNIFICAND_SIZE - 2);
+  a.e -= (64 - DP_SIGNIFICAND_SIZE - 2);
+  return a;
+}
+
+static inline struct diy_fp diy_fp_from_double(uint64_t bits) {
+  int biased_e = (int)((bits & DP_EXPONENT_MASK) >> DP_SIGNIFICAND_SIZE);
+  uint64_t significand = bits & DP_SIGNIFICAND_MASK;
+
+  if (biased_e != 0)
+    return diy_fp_make(significand + DP_HIDDEN_BIT,
+                       biased_e - DP_EXPONENT_BIAS);
+
+  /* subnormal */
+  return diy_fp_make(significand, DP_MIN_EXPONENT + 1);
+}
+
+static inline void diy_fp_boundaries(struct diy_fp v, struct diy_fp *minus,
+                                     struct diy_fp *plus) {
+  struct diy_fp pl = diy_fp_normalize_boundary(
+      diy_fp_make((v.f << 1) + 1, v.e - 1));
+  struct diy_fp mi = (v.f == DP_HIDDEN_BIT)
+                         ? diy_fp_make((v.f << 2) - 1, v.e - 2)
+                         : diy_fp_make((v.f << 1) - 1, v.e - 1);
+
+  mi.f <<= mi.e - pl.e;
+  mi.e = pl.e;
+
+  *plus = pl;
+  *minus = mi;
+}
+
+static inline struct diy_fp cached_power(int e, int *k) {
+  /* 0.30102999566398114 = 1 / log2(10) */
+  double dk = (-61 - e) * 0.30102999566398114 + 347;
+  int ik = (int)dk;
+  unsigned int index;
+
+  if (dk - ik > 0.0)
+    ik++;
+
+  index = (unsigned int)((ik >> 3) + 1);
+  *k = -(-348 + (int)(index << 3));
+
+  return diy_fp_make(CACHED_POWERS_F[index], CACHED_POWERS_E[index]);
+}
+
+static inline int count_digits32(uint32_t n) {
+  if (n < 10)
+    return 1;
+  if (n < 100)
+    return 2;
+  if (n < 1000)
+    return 3;
+  if (n < 10000)
+    return 4;
+  if (n < 100000)
+    return 5;
+  if (n < 1000000)
+    return 6;
+  if (n < 10000000)
+    return 7;
+  if (n < 100000000)
+    return 8;
+  if (n < 1000000000)
+    return 9;
+  return 10;
+}
+
+static inline void grisu_round(char *buffer, int len, uint64_t delta,
+                               uint64_t rest, uint64_t ten_kappa,
+                               uint64_t wp_w) {
+  while (rest < wp_w && delta - rest >= ten_kappa &&
+         (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+    buffer[len - 1]--;
+    rest += ten_kappa;
+  }
+}
+
+static int digit_gen(struct diy_fp w, struct diy_fp mp, uint64_t delta,
+                     char *buffer, int *k) {
+  const struct diy_fp one = diy_fp_make(1ULL << -mp.e, mp.e);
+  const uint64_t wp_w = mp.f - w.f;
+  uint32_t p1 = (uint32_t)(mp.f >> -one.e);
+  uint64_t p2 = mp.f & (one.f - 1);
+  int kappa = count_digits32(p1);
+  int len = 0;
+
+  while (kappa > 0) {
+    uint32_t d = p1 / (uint32_t)POW10[kappa - 1];
+    uint64_t rest;
+
+    p1 %= (uint32_t)POW10[kappa - 1];
+
+    if (d || len)
+      buffer[len++] = (char)('0' + d);
+
+    kappa--;
+    rest = ((uint64_t)p1 << -one.e) + p2;
+
+    if (rest <= delta) {
+      *k += kappa;
+      grisu_round(buffer, len, delta, rest, POW10[kappa] << -one.e, wp_w);
+      return len;
+    }
+  }
+
+  for (;;) {
+    char d;
+
+    p2 *= 10;
+    delta *= 10;
+    d = (char)(p2 >> -one.e);
+
+    if (d || len)
+      buffer[len++] = (char)('0' + d);
+
+    p2 &= one.f - 1;
+    kappa--;
+
+    if (p2 < delta) {
+      *k += kappa;
+      grisu_round(buffer, len, delta, p2, one.f,
+                  wp_w * (-kappa < 20 ? POW10[-kappa] : 0));
+      return len;
+    }
+  }
+}
+
+static int grisu2(uint64_t bits, char *buffer, int *k) {
+  struct diy_fp v = diy_fp_from_double(bits);
+  struct diy_fp w_m, w_p, c_mk, w, wp, wm;
+
+  diy_fp_boundaries(v, &w_m, &w_p);
+
+  c_mk = cached_power(w_p.e, k);
+  w = diy_fp_mul(diy_fp_normalize(v), c_mk);
+  wp = diy_fp_mul(w_p, c_mk);
+  wm = diy_fp_mul(w_m, c_mk);
+  wm.f++;
+  wp.f--;
+
+  return digit_gen(w, wp, wp.f - wm.f, buffer, k);
+}
+
+static int write_exponent(char *ptr, int k) {
+  char *origin = ptr;
+
+  if (k < 0) {
+    *ptr++ = '-';
+    k = -k;
+  }
+
+  return (ptr - origin) + brubeck_itoa(ptr, (uint64_t)k);
+}
+
+/*
+ * Lay out the `len` significant digits in `buffer` (worth digits * 10^k)
+ * as plain decimal notation whenever the magnitude allows it, which is
+ * what Graphite and friends expect for almost all values, and switch to
+ * exponential notation for the very large and very small ones.
+ */
+static int prettify(char *buffer, int len, int k) {
+  const int kk = len + k; /* 10^(kk-1) <= v < 10^kk */
+  int i;
+
+  if (k >= 0 && kk <= 21) {
+    /* 1234e7 -> 12340000000 */
+    for (i = len; i < kk; i++)
+      buffer[i] = '0';
+    return kk;
+  }
+
+  if (kk > 0 && kk <= 21) {
+    /* 1234e-2 -> 12.34 */
+    memmove(&buffer[kk + 1], &buffer[kk], (size_t)(len - kk));
+    buffer[kk] = '.';
+    return len + 1;
+  }
+
+  if (kk > -6 && kk <= 0) {
+    /* 1234e-6 -> 0.001234 */
+    const int offset = 2 - kk;
+    memmove(&buffer[offset], &buffer[0], (size_t)len);
+    buffer[0] = '0';
+    buffer[1] = '.';
+    for (i = 2; i < offset; i++)
+      buffer[i] = '0';
+    return len + offset;
+  }
+
+  if (len == 1) {
+    /* 1e30 */
+    buffer[1] = 'e';
+    return 2 + write_exponent(&buffer[2], kk - 1);
+  }
+
+  /* 1234e30 -> 1.234e33 */
+  memmove(&buffer[2], &buffer[1], (size_t)(len - 1));
+  buffer[1] = '.';
+  buffer[len + 1] = 'e';
+  return len + 2 + write_exponent(&buffer[len + 2], kk - 1);
+}
+
+int brubeck_ftoa(char *outbuf, value_t f) {
+  char *p = outbuf;
+  uint64_t bits;
+  int len, k;
+
+  ct_assert(sizeof(bits) == sizeof(f));
+  memcpy(&bits, &f, sizeof(bits));
+
+  if (unlikely((bits & DP_EXPONENT_MASK) == DP_EXPONENT_MASK)) {
+    if (bits & DP_SIGNIFICAND_MASK) {
+      memcpy(p, "nan", 4);
+      return 3;
+    }
+    if (f < 0)
+      *p++ = '-';
+    memcpy(p, "inf", 4);
+    return (p - outbuf) + 3;
+  }
+
+  /* zero, and also negative zero */
+  if ((bits & ~(1ULL << 63)) == 0) {
+    memcpy(p, "0", 2);
+    return 1;
+  }
+
+  if (bits >> 63) {
+    *p++ = '-';
+    bits &= ~(1ULL << 63);
+  }
+
+  len = grisu2(bits, p, &k);
+  p += prettify(p, len, k);
+
+  *p = 0;
+  return p - outbuf;
+}
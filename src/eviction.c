@@ -0,0 +1,285 @@
+#include "brubeck.h"
+
+size_t brubeck_memory_used(struct brubeck_server *server) {
+  size_t used, pending;
+
+  pthread_mutex_lock(&server->slab.lock);
+  used = server->slab.total_alloc;
+  pthread_mutex_unlock(&server->slab.lock);
+
+  used += brubeck_histo_memory();
+  if (server->hotkeys)
+    used += brubeck_hotkeys_memory(server->hotkeys);
+  pending = brubeck_atomic_fetch(&server->memory.pending);
+
+  return (used > pending) ? used - pending : 0;
+}
+
+static bool over_budget(struct brubeck_server *server) {
+  return brubeck_memory_used(server) > server->memory.max;
+}
+
+/*
+ * Checked before a new metric is allocated: sweeps only run after each
+ * flush, and a storm of new keys in between must not take the store past
+ * its budget. Once it is full, new keys are dropped until a sweep makes
+ * room again.
+ */
+bool brubeck_memory_admit(struct brubeck_server *server) {
+  if (server->memory.max == 0)
+    return true;
+
+  if (server->memory.full)
+    return false;
+
+  if (!over_budget(server))
+    return true;
+
+  server->memory.full = 1;
+  log_splunk("event=memory_full used=%zu max=%zu",
+             brubeck_memory_used(server), server->memory.max);
+  return false;
+}
+
+/*
+ * Register the calling thread as a reader, starting out as waiting for
+ * input. Without a memory budget nothing is ever freed, and there is no
+ * reader to keep track of.
+ */
+struct brubeck_reader *brubeck_reader_register(struct brubeck_server *server) {
+  struct brubeck_reader *reader;
+  uint32_t n;
+
+  if (server->memory.max == 0)
+    return NULL;
+
+  n = brubeck_atomic_inc(&server->memory.reader_count);
+  if (n > BRUBECK_MAX_READERS)
+    die("more than %d sampler threads with `max_memory`",
+        BRUBECK_MAX_READERS);
+
+  reader = &server->memory.readers[n - 1];
+  reader->current = &server->memory.epoch;
+  return reader;
+}
+
+/* Whether no reader can still hold a metric unlinked at `epoch` */
+static bool readers_quiescent(struct brubeck_server *server, uint64_t epoch) {
+  uint32_t i, count = brubeck_atomic_fetch(&server->memory.reader_count);
+
+  if (count > BRUBECK_MAX_READERS)
+    count = BRUBECK_MAX_READERS;
+
+  for (i = 0; i < count; ++i) {
+    uint64_t seen =
+        __atomic_load_n(&server->memory.readers[i].epoch, __ATOMIC_SEQ_CST);
+
+    if (seen != 0 && seen <= epoch)
+      return false;
+  }
+
+  return true;
+}
+
+/*
+ * Free the metrics evicted on an earlier sweep, once every reader went
+ * through a quiescent state since they were unlinked. Walks of the queue
+ * that started before they were unlinked may still be on them, so they
+ * are kept for another sweep while there are any; walks that start later
+ * cannot reach them.
+ */
+static void release_evicted(struct brubeck_backend *backend) {
+  struct brubeck_server *server = backend->server;
+  size_t i;
+
+  if (backend->evicted_count == 0 ||
+      brubeck_atomic_fetch(&server->memory.walkers) ||
+      !readers_quiescent(server, backend->evicted_epoch))
+    return;
+
+  /* the hot key tables of the samplers may still point to them */
+  if (server->hotkeys)
+    brubeck_hotkeys_forget(server->hotkeys, backend->evicted,
+                           backend->evicted_count);
+
+  for (i = 0; i < backend->evicted_count; ++i)
+    brubeck_metric_free(server, backend->evicted[i]);
+
+  brubeck_atomic_add(&server->memory.pending, -backend->evicted_bytes);
+  backend->evicted_count = 0;
+  backend->evicted_bytes = 0;
+}
+
+/* Take a metric out of the metrics table, unless a binary sampler handed
+ * out an id for it */
+static bool unpublish(struct brubeck_server *server,
+                      struct brubeck_metric *mt) {
+  bool pinned = false;
+  const char *key;
+  size_t key_len;
+  int i;
+
+  for (i = 0; i < server->active_samplers; ++i) {
+    struct brubeck_sampler *sampler = server->samplers[i];
+
+    if (sampler->type == BRUBECK_SAMPLER_BINARY ||
+        sampler->type == BRUBECK_SAMPLER_BINARY_UNIX)
+      pthread_mutex_lock(&((struct brubeck_binary *)sampler)->lock);
+  }
+
+  for (i = 0; i < server->active_samplers && !pinned; ++i) {
+    struct brubeck_sampler *sampler = server->samplers[i];
+
+    if (sampler->type == BRUBECK_SAMPLER_BINARY ||
+        sampler->type == BRUBECK_SAMPLER_BINARY_UNIX)
+      pinned = brubeck_binary_holds((struct brubeck_binary *)sampler, mt);
+  }
+
+  key = brubeck_metric_ht_key(mt, &key_len);
+  if (!pinned)
+    brubeck_hashtable_remove(server->metrics, key, (uint16_t)key_len);
+
+  for (i = 0; i < server->active_samplers; ++i) {
+    struct brubeck_sampler *sampler = server->samplers[i];
+
+    if (sampler->type == BRUBECK_SAMPLER_BINARY ||
+        sampler->type == BRUBECK_SAMPLER_BINARY_UNIX)
+      pthread_mutex_unlock(&((struct brubeck_binary *)sampler)->lock);
+  }
+
+  if (!pinned && server->cardinality)
+    brubeck_cardinality_release(server->cardinality, key, key_len);
+
+  return !pinned;
+}
+
+/* Unlink `mt` from the queue, given the metric before it (NULL if it was
+ * the head). Returns the metric that ends up before its successor. */
+static struct brubeck_metric *unlink_metric(struct brubeck_backend *backend,
+                                            struct brubeck_metric *prev,
+                                            struct brubeck_metric *mt) {
+  if (prev == NULL) {
+    /* samplers push new metrics on the head concurrently */
+    if (__sync_bool_compare_and_swap(&backend->queue, mt, mt->next))
+      return NULL;
+
+    for (prev = backend->queue; prev->next != mt; prev = prev->next)
+      ;
+  }
+
+  prev->next = mt->next;
+  return prev;
+}
+
+/*
+ * Move the hand around the queue once, evicting the metrics in `state`
+ * until the store is back under budget. The flush already works as the
+ * clock's reference bits: it turns ACTIVE metrics INACTIVE and INACTIVE
+ * ones DISABLED after sampling them, and any update sets them ACTIVE
+ * again, so both states hold no unflushed values.
+ */
+static void evict_circle(struct brubeck_backend *backend, uint8_t state,
+                         size_t length) {
+  struct brubeck_server *server = backend->server;
+  struct brubeck_metric *prev = backend->hand;
+  uint32_t keys;
+  size_t i;
+
+  for (i = 0; i < length && over_budget(server); ++i) {
+    struct brubeck_metric *mt = prev ? prev->next : backend->queue;
+
+    size_t bytes;
+
+    if (mt == NULL) {
+      prev = NULL;
+      mt = backend->queue;
+      if (mt == NULL)
+        break;
+    }
+
+    if (mt->type == BRUBECK_MT_INTERNAL_STATS ||
+        !brubeck_metric_set_state_if_equal(mt, state,
+                                           BRUBECK_STATE_DISABLED)) {
+      prev = mt;
+      continue;
+    }
+
+    if (!unpublish(server, mt)) {
+      brubeck_metric_set_state_if_equal(mt, BRUBECK_STATE_DISABLED, state);
+      prev = mt;
+      continue;
+    }
+
+    prev = unlink_metric(backend, prev, mt);
+
+    /* counted as freed already, so that the sweep stops once enough is
+     * evicted; a value recorded into the metric by a reader that looked
+     * it up before it was unlinked is lost */
+    bytes = brubeck_metric_memory(mt);
+    brubeck_atomic_add(&server->memory.pending, bytes);
+    backend->evicted_bytes += bytes;
+    keys = brubeck_atomic_dec(&server->internal_stats.live.unique_keys);
+    server->memory.evicted++;
+
+    if (server->at_capacity && keys < server->max_keys) {
+      server->at_capacity = 0;
+      log_splunk("event=below_capacity unique_keys=%u", keys);
+    }
+
+    if (backend->evicted_count == backend->evicted_alloc) {
+      backend->evicted_alloc = backend->evicted_alloc * 2 + 16;
+      backend->evicted = xrealloc(
+          backend->evicted, backend->evicted_alloc * sizeof(*backend->evicted));
+    }
+    backend->evicted[backend->evicted_count++] = mt;
+  }
+
+  backend->hand = prev;
+}
+
+/* Run by each backend after it flushed its metrics */
+void brubeck_eviction_sweep(struct brubeck_backend *backend) {
+  struct brubeck_server *server = backend->server;
+  struct brubeck_metric *mt;
+  size_t length = 0, evicted;
+  bool full;
+
+  release_evicted(backend);
+
+  if (!over_budget(server)) {
+    server->memory.full = 0;
+    return;
+  }
+
+  for (mt = backend->queue; mt; mt = mt->next)
+    length++;
+
+  /* idle for two intervals first, then for one */
+  evicted = backend->evicted_count;
+  evict_circle(backend, BRUBECK_STATE_DISABLED, length);
+  evict_circle(backend, BRUBECK_STATE_INACTIVE, length);
+
+  /* readers that see this epoch or a later one looked the metrics up
+   * after they were unlinked; metrics left over from a sweep that could
+   * not free them wait along with the new ones */
+  if (backend->evicted_count != evicted)
+    backend->evicted_epoch = brubeck_atomic_inc(&server->memory.epoch);
+
+  full = over_budget(server);
+  if (full != server->memory.full)
+    log_splunk("backend=%s event=%s used=%zu max=%zu evicted=%llu",
+               brubeck_backend_name(backend),
+               full ? "memory_full" : "memory_available",
+               brubeck_memory_used(server), server->memory.max,
+               (unsigned long long)server->memory.evicted);
+
+  server->memory.full = full;
+}
+
+json_t *brubeck_memory_stats(struct brubeck_server *server) {
+  return json_pack("{s:I, s:I, s:I, s:b}", "used",
+                   (json_int_t)brubeck_memory_used(server), "max",
+                   (json_int_t)server->memory.max, "evicted",
+                   (json_int_t)server->memory.evicted, "full",
+                   server->memory.full);
+}
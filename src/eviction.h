@@ -0,0 +1,60 @@
+#ifndef __BRUBECK_EVICTION_H__
+#define __BRUBECK_EVICTION_H__
+
+#include "jansson.h"
+
+#define BRUBECK_MAX_READERS 256
+
+/*
+ * A sampler thread that looks metrics up and records into them. Evicted
+ * metrics are only freed once every reader has gone through a quiescent
+ * state since they were unlinked: waiting for input, or starting on the
+ * next packet. Freed memory is handed out again right away, so a thread
+ * still holding a metric would otherwise write into another one.
+ */
+struct brubeck_reader {
+  uint64_t epoch; /* 0 while waiting, else 1 + the reclaim epoch it saw */
+  const uint64_t *current;
+} __attribute__((aligned(64)));
+
+/*
+ * Memory budget of the metric store: the metrics' slab memory, histogram
+ * buffers and sharded meters. The metrics table and the interned tag sets
+ * are shared and never shrink, so they are not counted. Once it is
+ * exceeded, each backend evicts cold metrics from its queue after flushing
+ * them, and new keys are dropped while nothing more can be evicted.
+ */
+struct brubeck_memory {
+  size_t max;      /* bytes, 0 for no limit */
+  size_t pending;  /* bytes held by evicted metrics that are not freed yet */
+  uint64_t evicted;
+  int full;
+  uint32_t walkers; /* queue walks in progress, which hold off freeing */
+
+  uint64_t epoch; /* bumped by every sweep that evicts metrics */
+  struct brubeck_reader readers[BRUBECK_MAX_READERS];
+  uint32_t reader_count;
+};
+
+/* Called by a reader before it looks up metrics; metrics it looked up
+ * before are not used anymore */
+static inline void brubeck_reader_online(struct brubeck_reader *reader) {
+  if (reader)
+    __atomic_store_n(&reader->epoch,
+                     __atomic_load_n(reader->current, __ATOMIC_ACQUIRE) + 1,
+                     __ATOMIC_SEQ_CST);
+}
+
+/* Called by a reader before it blocks waiting for input */
+static inline void brubeck_reader_offline(struct brubeck_reader *reader) {
+  if (reader)
+    __atomic_store_n(&reader->epoch, 0, __ATOMIC_RELEASE);
+}
+
+struct brubeck_reader *brubeck_reader_register(struct brubeck_server *server);
+size_t brubeck_memory_used(struct brubeck_server *server);
+bool brubeck_memory_admit(struct brubeck_server *server);
+void brubeck_eviction_sweep(struct brubeck_backend *backend);
+json_t *brubeck_memory_stats(struct brubeck_server *server);
+
+#endif
@@ -3,6 +3,22 @@
 
 #define HISTO_INIT_SIZE 16
 
+/* bytes held by the value buffers of all the histograms */
+static size_t histo_memory;
+
+size_t brubeck_histo_memory(void) {
+  return brubeck_atomic_fetch(&histo_memory);
+}
+
+/* Release the value buffer; the histogram can still be pushed to */
+void brubeck_histo_free(struct brubeck_histo *histo) {
+  const size_t bytes = histo->alloc * sizeof(value_t);
+
+  brubeck_atomic_add(&histo_memory, -bytes);
+  free(histo->values);
+  memset(histo, 0x0, sizeof(struct brubeck_histo));
+}
+
 void brubeck_histo_push(struct brubeck_histo *histo, value_t value,
                         value_t sample_freq) {
   histo->count += sample_freq;
@@ -20,6 +36,8 @@ void brubeck_histo_push(struct brubeck_histo *histo, value_t value,
     if (new_size < HISTO_INIT_SIZE)
       new_size = HISTO_INIT_SIZE;
     if (new_size != histo->alloc) {
+      brubeck_atomic_add(&histo_memory,
+                         (new_size - histo->alloc) * sizeof(value_t));
       histo->alloc = (uint16_t)new_size;
       histo->values = xrealloc(histo->values, histo->alloc * sizeof(value_t));
     }
@@ -24,5 +24,7 @@ void brubeck_histo_push(struct brubeck_histo *histo, value_t value,
                         value_t sample_rate);
 void brubeck_histo_sample(struct brubeck_histo_sample *sample,
                           struct brubeck_histo *histo);
+void brubeck_histo_free(struct brubeck_histo *histo);
+size_t brubeck_histo_memory(void);
 
 #endif
@@ -0,0 +1,183 @@
+#include "brubeck.h"
+
+/* members are hashed down to the 53 bits a double holds exactly */
+#define HLL_HASH_BITS 53
+
+static inline uint64_t hll_fmix64(uint64_t k) {
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdULL;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ULL;
+  k ^= k >> 33;
+  return k;
+}
+
+value_t brubeck_hll_member(const char *member, size_t len) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  size_t i;
+
+  for (i = 0; i < len; ++i) {
+    h ^= (uint8_t)member[i];
+    h *= 0x100000001b3ULL;
+  }
+
+  return (value_t)(hll_fmix64(h) >> (64 - HLL_HASH_BITS));
+}
+
+static inline void hll_split(const struct brubeck_hll *hll, value_t member,
+                             uint32_t *index, uint8_t *rank) {
+  const uint64_t hash = (uint64_t)member;
+  const uint64_t w = hash >> hll->precision;
+
+  *index = (uint32_t)(hash & ((1u << hll->precision) - 1));
+  *rank = w ? (uint8_t)(__builtin_ctzll(w) + 1)
+            : (uint8_t)(HLL_HASH_BITS - hll->precision + 1);
+}
+
+static inline void hll_register_max(uint8_t *reg, uint8_t rank) {
+  uint8_t current = __atomic_load_n(reg, __ATOMIC_RELAXED);
+
+  while (rank > current &&
+         !__atomic_compare_exchange_n(reg, &current, rank, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+struct brubeck_hll *brubeck_hll_new(struct brubeck_slab *slab,
+                                    uint8_t precision) {
+  struct brubeck_hll *hll =
+      brubeck_slab_alloc(slab, sizeof(struct brubeck_hll));
+
+  memset(hll, 0x0, sizeof(struct brubeck_hll));
+  hll->slab = slab;
+  hll->precision = precision;
+  return hll;
+}
+
+/* Bytes of slab memory held by the estimator */
+size_t brubeck_hll_memory(const struct brubeck_hll *hll) {
+  size_t bytes = brubeck_slab_size(sizeof(struct brubeck_hll));
+
+  if (hll->registers)
+    bytes += brubeck_slab_size((size_t)1 << hll->precision);
+
+  return bytes;
+}
+
+/* Give the estimator back to its slab; nothing may be using it anymore */
+void brubeck_hll_free(struct brubeck_hll *hll) {
+  if (hll->registers)
+    brubeck_slab_free(hll->slab, hll->registers, (size_t)1 << hll->precision);
+
+  brubeck_slab_free(hll->slab, hll, sizeof(struct brubeck_hll));
+}
+
+bool brubeck_hll_add_dense(struct brubeck_hll *hll, value_t member) {
+  uint8_t *registers = __atomic_load_n(&hll->registers, __ATOMIC_ACQUIRE);
+  uint32_t index;
+  uint8_t rank;
+
+  if (registers == NULL)
+    return false;
+
+  hll_split(hll, member, &index, &rank);
+  hll_register_max(&registers[index], rank);
+  return true;
+}
+
+static void hll_promote(struct brubeck_hll *hll) {
+  const size_t m = (size_t)1 << hll->precision;
+  uint8_t *registers = brubeck_slab_alloc(hll->slab, m);
+  uint16_t i;
+
+  memset(registers, 0x0, m);
+
+  for (i = 0; i < hll->sparse_count; ++i)
+    registers[hll->sparse[i] >> 8] = (uint8_t)hll->sparse[i];
+
+  hll->sparse_count = 0;
+  __atomic_store_n(&hll->registers, registers, __ATOMIC_RELEASE);
+}
+
+/* must be called with the owner's lock held */
+void brubeck_hll_add_sparse(struct brubeck_hll *hll, value_t member) {
+  uint32_t index;
+  uint8_t rank;
+  uint16_t i;
+
+  /* promoted by another writer while we waited for the lock */
+  if (brubeck_hll_add_dense(hll, member))
+    return;
+
+  hll_split(hll, member, &index, &rank);
+
+  for (i = 0; i < hll->sparse_count; ++i) {
+    if ((hll->sparse[i] >> 8) == index) {
+      if ((uint8_t)hll->sparse[i] < rank)
+        hll->sparse[i] = (index << 8) | rank;
+      return;
+    }
+  }
+
+  if (hll->sparse_count == HLL_SPARSE_MAX) {
+    hll_promote(hll);
+    hll_register_max(&hll->registers[index], rank);
+    return;
+  }
+
+  hll->sparse[hll->sparse_count++] = (index << 8) | rank;
+}
+
+static inline double hll_alpha(size_t m) {
+  switch (m) {
+  case 16:
+    return 0.673;
+  case 32:
+    return 0.697;
+  case 64:
+    return 0.709;
+  default:
+    return 0.7213 / (1.0 + 1.079 / (double)m);
+  }
+}
+
+/*
+ * Estimate the cardinality, optionally clearing the estimator for the next
+ * interval. Must be called with the owner's lock held; dense registers are
+ * swapped out one by one, so concurrent lock-free updates land either in
+ * this estimate or in the next one.
+ */
+value_t brubeck_hll_estimate(struct brubeck_hll *hll, bool reset) {
+  const size_t m = (size_t)1 << hll->precision;
+  uint8_t *registers = __atomic_load_n(&hll->registers, __ATOMIC_ACQUIRE);
+  double sum = 0.0, estimate;
+  size_t zeros = 0, i;
+
+  if (registers) {
+    for (i = 0; i < m; ++i) {
+      uint8_t rank = reset ? __atomic_exchange_n(&registers[i], 0,
+                                                 __ATOMIC_RELAXED)
+                           : __atomic_load_n(&registers[i], __ATOMIC_RELAXED);
+      if (!rank)
+        zeros++;
+      sum += ldexp(1.0, -rank);
+    }
+  } else {
+    zeros = m - hll->sparse_count;
+    sum = (double)zeros;
+
+    for (i = 0; i < hll->sparse_count; ++i)
+      sum += ldexp(1.0, -(int)(uint8_t)hll->sparse[i]);
+
+    if (reset)
+      hll->sparse_count = 0;
+  }
+
+  estimate = hll_alpha(m) * (double)m * (double)m / sum;
+
+  /* small range correction: linear counting */
+  if (estimate <= 2.5 * (double)m && zeros > 0)
+    estimate = (double)m * log((double)m / (double)zeros);
+
+  return floor(estimate + 0.5);
+}
@@ -0,0 +1,36 @@
+#ifndef __BRUBECK_HLL_H__
+#define __BRUBECK_HLL_H__
+
+#define HLL_MIN_PRECISION 4
+#define HLL_MAX_PRECISION 16
+#define HLL_SPARSE_MAX 64
+
+struct brubeck_slab;
+
+/*
+ * HyperLogLog cardinality estimator. Starts as a short sparse list of
+ * (register, rank) pairs, guarded by the owner's lock, and is promoted to
+ * a dense array of 2^precision registers once that list fills up. Dense
+ * registers are updated lock-free with an atomic max.
+ */
+struct brubeck_hll {
+  struct brubeck_slab *slab;
+  uint8_t *registers;
+  uint8_t precision;
+  uint16_t sparse_count;
+  uint32_t sparse[HLL_SPARSE_MAX]; /* (register << 8) | rank */
+};
+
+/* Hash a set member into a value that round-trips exactly through a
+ * value_t, so it can travel down the regular metric record path */
+value_t brubeck_hll_member(const char *member, size_t len);
+
+struct brubeck_hll *brubeck_hll_new(struct brubeck_slab *slab,
+                                    uint8_t precision);
+bool brubeck_hll_add_dense(struct brubeck_hll *hll, value_t member);
+void brubeck_hll_add_sparse(struct brubeck_hll *hll, value_t member);
+value_t brubeck_hll_estimate(struct brubeck_hll *hll, bool reset);
+size_t brubeck_hll_memory(const struct brubeck_hll *hll);
+void brubeck_hll_free(struct brubeck_hll *hll);
+
+#endif
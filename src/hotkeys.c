@@ -0,0 +1,352 @@
+#include "brubeck.h"
+
+__thread uint32_t brubeck_hotkeys_countdown;
+
+static __thread struct brubeck_hotkey_table *local_table;
+static __thread struct brubeck_hotkeys *local_owner;
+static __thread uint64_t local_rng;
+
+static uint64_t mix(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+/* Uniform in [1, 2 * every - 1]: lookups are picked once every `every` on
+ * average, without locking onto a periodic pattern in the traffic */
+static uint32_t next_countdown(uint32_t every) {
+  uint64_t x = local_rng;
+
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  local_rng = x;
+
+  x *= 0x2545F4914F6CDD1DULL;
+  return 1 + (uint32_t)(x % (2 * (uint64_t)every - 1));
+}
+
+static struct brubeck_hotkey_table *table_new(struct brubeck_hotkeys *hotkeys) {
+  struct brubeck_hotkey_table *table =
+      xcalloc(1, sizeof(struct brubeck_hotkey_table) +
+                     hotkeys->top * sizeof(struct brubeck_hotkey_entry));
+
+  pthread_spin_init(&table->lock, PTHREAD_PROCESS_PRIVATE);
+
+  pthread_mutex_lock(&hotkeys->lock);
+  {
+    hotkeys->tables =
+        xrealloc(hotkeys->tables,
+                 (hotkeys->table_count + 1) * sizeof(*hotkeys->tables));
+    hotkeys->tables[hotkeys->table_count++] = table;
+  }
+  pthread_mutex_unlock(&hotkeys->lock);
+
+  local_rng = mix((uintptr_t)table) | 1;
+  return table;
+}
+
+struct brubeck_hotkeys *brubeck_hotkeys_new(uint32_t sample_every, size_t top,
+                                            double shard_share) {
+  struct brubeck_hotkeys *hotkeys = xcalloc(1, sizeof(struct brubeck_hotkeys));
+
+  pthread_mutex_init(&hotkeys->lock, NULL);
+  hotkeys->sample_every = sample_every;
+  hotkeys->top = top;
+  hotkeys->shard_share = shard_share;
+  hotkeys->max_sharded = 256;
+  return hotkeys;
+}
+
+/* Load the `hot_keys` object of the config. Tracking is on by default,
+ * and only turned off with `"hot_keys" : false` */
+struct brubeck_hotkeys *brubeck_hotkeys_load(json_t *config) {
+  int sample_every = 64, top = 32, max_sharded = 256;
+  double shard_share = 0.01;
+  struct brubeck_hotkeys *hotkeys;
+
+  if (config && json_is_false(config))
+    return NULL;
+
+  if (config)
+    json_unpack_or_die(config, "{s?:i, s?:i, s?:F, s?:i}", "sample_every",
+                       &sample_every, "top", &top, "shard_share",
+                       &shard_share, "max_sharded", &max_sharded);
+
+  if (sample_every < 1 || top < 1 || max_sharded < 0)
+    die("hot_keys: `sample_every` and `top` must be positive");
+
+  if (shard_share < 0.0 || shard_share > 1.0)
+    die("hot_keys: `shard_share` must be between 0 and 1");
+
+  hotkeys = brubeck_hotkeys_new((uint32_t)sample_every, (size_t)top,
+                                shard_share);
+  hotkeys->max_sharded = (uint32_t)max_sharded;
+  return hotkeys;
+}
+
+static void top_update(struct brubeck_hotkey_table *table, size_t top,
+                       struct brubeck_metric *metric, uint64_t estimate) {
+  struct brubeck_hotkey_entry *entry = NULL;
+  size_t i;
+
+  for (i = 0; i < table->count; ++i) {
+    if (table->entries[i].metric == metric) {
+      table->entries[i].count = estimate;
+      return;
+    }
+  }
+
+  if (table->count < top) {
+    entry = &table->entries[table->count++];
+  } else {
+    entry = &table->entries[0];
+    for (i = 1; i < table->count; ++i) {
+      if (table->entries[i].count < entry->count)
+        entry = &table->entries[i];
+    }
+
+    if (entry->count >= estimate)
+      return;
+  }
+
+  entry->metric = metric;
+  entry->count = estimate;
+}
+
+/* Count a picked lookup in the thread's table */
+void brubeck_hotkeys_record(struct brubeck_hotkeys *hotkeys,
+                            struct brubeck_metric *metric) {
+  struct brubeck_hotkey_table *table = local_table;
+  const uint64_t h = mix((uintptr_t)metric);
+  uint32_t estimate = UINT32_MAX;
+  size_t idx[BRUBECK_HOTKEYS_DEPTH];
+  int i;
+
+  if (unlikely(local_owner != hotkeys)) {
+    table = local_table = table_new(hotkeys);
+    local_owner = hotkeys;
+  }
+
+  brubeck_hotkeys_countdown = next_countdown(hotkeys->sample_every);
+
+  pthread_spin_lock(&table->lock);
+
+  table->samples++;
+
+  for (i = 0; i < BRUBECK_HOTKEYS_DEPTH; ++i) {
+    idx[i] = (h >> (16 * i)) & (BRUBECK_HOTKEYS_WIDTH - 1);
+    if (table->sketch[i][idx[i]] < estimate)
+      estimate = table->sketch[i][idx[i]];
+  }
+
+  /* conservative update: only the counters at the minimum are raised */
+  estimate++;
+  for (i = 0; i < BRUBECK_HOTKEYS_DEPTH; ++i) {
+    if (table->sketch[i][idx[i]] < estimate)
+      table->sketch[i][idx[i]] = estimate;
+  }
+
+  top_update(table, hotkeys->top, metric, estimate);
+
+  pthread_spin_unlock(&table->lock);
+}
+
+/* The meter slot a thread adds into, handed out round-robin */
+int brubeck_hotkeys_thread_slot(void) {
+  static uint32_t next_slot;
+  static __thread int slot = -1;
+
+  if (unlikely(slot < 0))
+    slot = brubeck_atomic_inc(&next_slot) % BRUBECK_METER_SHARDS;
+
+  return slot;
+}
+
+static void shard_meter(struct brubeck_hotkeys *hotkeys,
+                        struct brubeck_metric *metric) {
+  struct brubeck_meter_shard *shards;
+  void *ptr;
+  int i;
+
+  if (metric->as.meter.shards ||
+      brubeck_atomic_fetch(&hotkeys->sharded) >= hotkeys->max_sharded)
+    return;
+
+  if (posix_memalign(&ptr, 64,
+                     BRUBECK_METER_SHARDS * sizeof(struct brubeck_meter_shard)))
+    die("oom");
+
+  shards = ptr;
+  for (i = 0; i < BRUBECK_METER_SHARDS; ++i) {
+    pthread_spin_init(&shards[i].lock, PTHREAD_PROCESS_PRIVATE);
+    shards[i].value = 0.0;
+  }
+
+  brubeck_atomic_inc(&hotkeys->sharded);
+  __atomic_store_n(&metric->as.meter.shards, shards, __ATOMIC_RELEASE);
+  log_splunk("event=meter_sharded key=%s", metric->key);
+}
+
+/* Bytes held by the shards of sharded meters, which live outside the slab */
+size_t brubeck_hotkeys_memory(struct brubeck_hotkeys *hotkeys) {
+  return (size_t)brubeck_atomic_fetch(&hotkeys->sharded) *
+         BRUBECK_METER_SHARDS * sizeof(struct brubeck_meter_shard);
+}
+
+static int metric_cmp(const void *a, const void *b) {
+  const struct brubeck_metric *ma = *(struct brubeck_metric *const *)a;
+  const struct brubeck_metric *mb = *(struct brubeck_metric *const *)b;
+  return (ma > mb) - (ma < mb);
+}
+
+/*
+ * Drop the entries of metrics that are about to be freed; `metrics` is
+ * sorted in place. It takes the tracker's lock, so it waits for a rotation
+ * that may be reading them, and once it returns no entry points to them.
+ */
+void brubeck_hotkeys_forget(struct brubeck_hotkeys *hotkeys,
+                            struct brubeck_metric **metrics, size_t count) {
+  size_t i, j, kept;
+
+  if (count == 0)
+    return;
+
+  qsort(metrics, count, sizeof(*metrics), &metric_cmp);
+
+  pthread_mutex_lock(&hotkeys->lock);
+
+  for (i = 0; i < hotkeys->table_count; ++i) {
+    struct brubeck_hotkey_table *table = hotkeys->tables[i];
+
+    pthread_spin_lock(&table->lock);
+
+    for (j = 0, kept = 0; j < table->count; ++j) {
+      if (!bsearch(&table->entries[j].metric, metrics, count,
+                   sizeof(*metrics), &metric_cmp))
+        table->entries[kept++] = table->entries[j];
+    }
+    table->count = kept;
+
+    pthread_spin_unlock(&table->lock);
+  }
+
+  pthread_mutex_unlock(&hotkeys->lock);
+}
+
+static int entry_metric_cmp(const void *a, const void *b) {
+  const struct brubeck_hotkey_entry *ea = a, *eb = b;
+  return (ea->metric > eb->metric) - (ea->metric < eb->metric);
+}
+
+static int entry_count_cmp(const void *a, const void *b) {
+  const struct brubeck_hotkey_entry *ea = a, *eb = b;
+  return (ea->count < eb->count) - (ea->count > eb->count);
+}
+
+/*
+ * Merge the tables of all the threads into the hottest keys of the
+ * interval, reset them, and shard the meters that are hot enough. A
+ * metric seen by several threads has its counts summed.
+ */
+void brubeck_hotkeys_rotate(struct brubeck_server *server) {
+  struct brubeck_hotkeys *hotkeys = server->hotkeys;
+  struct brubeck_hotkey_entry *merged;
+  struct brubeck_hotkey *hot, *old;
+  size_t i, count = 0, unique = 0, capacity, old_count;
+  uint64_t samples = 0;
+
+  pthread_mutex_lock(&hotkeys->lock);
+
+  capacity = hotkeys->table_count * hotkeys->top;
+  merged = xmalloc((capacity ? capacity : 1) * sizeof(*merged));
+
+  for (i = 0; i < hotkeys->table_count; ++i) {
+    struct brubeck_hotkey_table *table = hotkeys->tables[i];
+
+    pthread_spin_lock(&table->lock);
+    {
+      memcpy(merged + count, table->entries,
+             table->count * sizeof(struct brubeck_hotkey_entry));
+      count += table->count;
+      samples += table->samples;
+      memset(table->sketch, 0x0, sizeof(table->sketch));
+      table->count = 0;
+      table->samples = 0;
+    }
+    pthread_spin_unlock(&table->lock);
+  }
+
+  qsort(merged, count, sizeof(*merged), &entry_metric_cmp);
+
+  for (i = 0; i < count; ++i) {
+    if (unique && merged[unique - 1].metric == merged[i].metric)
+      merged[unique - 1].count += merged[i].count;
+    else
+      merged[unique++] = merged[i];
+  }
+
+  qsort(merged, unique, sizeof(*merged), &entry_count_cmp);
+  if (unique > hotkeys->top)
+    unique = hotkeys->top;
+
+  hot = xcalloc(unique ? unique : 1, sizeof(*hot));
+
+  /* evicted metrics are forgotten under the lock we hold before they are
+   * freed, so every entry still points to a live metric */
+  for (i = 0; i < unique; ++i) {
+    struct brubeck_metric *metric = merged[i].metric;
+
+    if (metric->type == BRUBECK_MT_METER && hotkeys->shard_share > 0.0 &&
+        merged[i].count >= hotkeys->shard_share * samples)
+      shard_meter(hotkeys, metric);
+
+    hot[i].key = strdup(metric->key);
+    hot[i].lookups = merged[i].count * hotkeys->sample_every;
+    hot[i].sharded =
+        (metric->type == BRUBECK_MT_METER && metric->as.meter.shards);
+  }
+
+  old = hotkeys->hot;
+  old_count = hotkeys->hot_count;
+  hotkeys->hot = hot;
+  hotkeys->hot_count = unique;
+  hotkeys->lookups = samples * hotkeys->sample_every;
+
+  pthread_mutex_unlock(&hotkeys->lock);
+
+  for (i = 0; i < old_count; ++i)
+    free(old[i].key);
+  free(old);
+  free(merged);
+}
+
+json_t *brubeck_hotkeys_stats(struct brubeck_hotkeys *hotkeys) {
+  json_t *keys = json_array();
+  uint64_t lookups;
+  size_t i;
+
+  pthread_mutex_lock(&hotkeys->lock);
+
+  lookups = hotkeys->lookups;
+
+  for (i = 0; i < hotkeys->hot_count; ++i) {
+    const struct brubeck_hotkey *hot = &hotkeys->hot[i];
+
+    json_array_append_new(
+        keys, json_pack("{s:s, s:I, s:f, s:b}", "key", hot->key, "lookups",
+                        (json_int_t)hot->lookups, "share",
+                        lookups ? (double)hot->lookups / lookups : 0.0,
+                        "sharded", hot->sharded));
+  }
+
+  pthread_mutex_unlock(&hotkeys->lock);
+
+  return json_pack("{s:i, s:I, s:i, s:o}", "sample_every",
+                   (int)hotkeys->sample_every, "lookups", (json_int_t)lookups,
+                   "sharded", (int)brubeck_atomic_fetch(&hotkeys->sharded),
+                   "keys", keys);
+}
@@ -0,0 +1,92 @@
+#ifndef __BRUBECK_HOTKEYS_H__
+#define __BRUBECK_HOTKEYS_H__
+
+#include "jansson.h"
+
+#define BRUBECK_HOTKEYS_DEPTH 4
+#define BRUBECK_HOTKEYS_WIDTH 1024
+
+/* Sharded meters spread their updates over this many slots */
+#define BRUBECK_METER_SHARDS 16
+
+/* One slot of a sharded meter, on a cache line of its own */
+struct brubeck_meter_shard {
+  pthread_spinlock_t lock;
+  value_t value;
+} __attribute__((aligned(64)));
+
+struct brubeck_hotkey_entry {
+  struct brubeck_metric *metric;
+  uint64_t count;
+};
+
+/*
+ * Sampled lookups of a single thread: a count-min sketch of how often
+ * each metric was seen, and the `top` metrics with the highest estimates.
+ * Only its thread writes to it; the lock is taken by the flush thread
+ * once an interval.
+ */
+struct brubeck_hotkey_table {
+  pthread_spinlock_t lock;
+  uint64_t samples;
+  uint32_t sketch[BRUBECK_HOTKEYS_DEPTH][BRUBECK_HOTKEYS_WIDTH];
+  size_t count;
+  struct brubeck_hotkey_entry entries[];
+};
+
+struct brubeck_hotkey {
+  char *key;
+  uint64_t lookups; /* estimated, scaled up by the sampling rate */
+  bool sharded;
+};
+
+/*
+ * Hot key tracker: 1 in `sample_every` metric lookups, on average, is
+ * counted in the table of the thread that did it. Each interval the
+ * tables are merged into the hottest `top` keys of the server, and meters
+ * that took more than `shard_share` of the lookups are switched to
+ * per-thread sharded accumulation.
+ */
+struct brubeck_hotkeys {
+  pthread_mutex_t lock;
+  uint32_t sample_every;
+  size_t top;
+  double shard_share;
+  uint32_t max_sharded;
+  uint32_t sharded;
+
+  struct brubeck_hotkey_table **tables;
+  size_t table_count;
+
+  struct brubeck_hotkey *hot;
+  size_t hot_count;
+  uint64_t lookups;
+};
+
+extern __thread uint32_t brubeck_hotkeys_countdown;
+
+struct brubeck_hotkeys *brubeck_hotkeys_new(uint32_t sample_every, size_t top,
+                                            double shard_share);
+struct brubeck_hotkeys *brubeck_hotkeys_load(json_t *config);
+void brubeck_hotkeys_record(struct brubeck_hotkeys *hotkeys,
+                            struct brubeck_metric *metric);
+void brubeck_hotkeys_forget(struct brubeck_hotkeys *hotkeys,
+                            struct brubeck_metric **metrics, size_t count);
+void brubeck_hotkeys_rotate(struct brubeck_server *server);
+json_t *brubeck_hotkeys_stats(struct brubeck_hotkeys *hotkeys);
+size_t brubeck_hotkeys_memory(struct brubeck_hotkeys *hotkeys);
+int brubeck_hotkeys_thread_slot(void);
+
+/* Called on every lookup: costs a thread-local decrement unless the lookup
+ * is picked */
+static inline void brubeck_hotkeys_sample(struct brubeck_hotkeys *hotkeys,
+                                          struct brubeck_metric *metric) {
+  if (brubeck_hotkeys_countdown > 1) {
+    brubeck_hotkeys_countdown--;
+    return;
+  }
+
+  brubeck_hotkeys_record(hotkeys, metric);
+}
+
+#endif
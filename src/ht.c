@@ -4,8 +4,38 @@
 #include "ck_ht.h"
 #include "ck_malloc.h"
 
+#define HT_SEED 0xDEADBEEF
+
+/* Start growing once the live table is 3/8 full: ck_ht would otherwise
+ * double it synchronously at 1/2 */
+#define HT_GROW_LOAD(capacity) ((capacity) / 8 * 3)
+
+/* Entries moved into the new table on every insert while growing */
+#define HT_MIGRATE_STEP 32
+
+/*
+ * The metrics table is made of up to two ck_ht tables. When the live
+ * table fills up, a table twice its size is allocated without holding the
+ * write lock and becomes the live one; every insert then also moves
+ * HT_MIGRATE_STEP entries over from the old table, so the writer never
+ * holds `write_mutex` for more than a few entries' worth of work.
+ *
+ * Entries stay in the old table until all of them have been moved, and
+ * `old` is published before `current`, so a reader that loads `current`
+ * and then `old` always finds an entry that was there before it started.
+ * A reader can still miss a key that is being inserted concurrently,
+ * which `brubeck_metric_new` already deals with.
+ */
 struct brubeck_hashtable_t {
-  ck_ht_t table;
+  ck_ht_t *current;
+  ck_ht_t *old;     /* being moved into `current`, or NULL */
+  ck_ht_t *retired; /* the previous `old`, destroyed on the next grow */
+
+  ck_ht_iterator_t migration;
+  uint64_t migrated;
+  uint64_t capacity; /* of `current` */
+  bool growing;
+
   pthread_mutex_t write_mutex;
 };
 
@@ -15,16 +45,46 @@ static void ht_free(void *p, size_t b, bool r) { free(p); }
 
 static struct ck_malloc ALLOCATOR = {.malloc = ht_malloc, .free = ht_free};
 
+static ck_ht_t *table_new(uint64_t size) {
+  ck_ht_t *table = xmalloc(sizeof(ck_ht_t));
+
+  if (!ck_ht_init(table, CK_HT_MODE_BYTESTRING, NULL, &ALLOCATOR, size,
+                  HT_SEED)) {
+    free(table);
+    return NULL;
+  }
+
+  return table;
+}
+
+static void table_free(ck_ht_t *table) {
+  if (table) {
+    ck_ht_destroy(table);
+    free(table);
+  }
+}
+
+static bool table_get(ck_ht_t *table, ck_ht_hash_t h, const char *key,
+                      uint16_t key_len, ck_ht_entry_t *entry) {
+  ck_ht_entry_key_set(entry, key, key_len);
+  return ck_ht_get_spmc(table, h, entry);
+}
+
 brubeck_hashtable_t *brubeck_hashtable_new(const uint64_t size) {
-  brubeck_hashtable_t *ht = xmalloc(sizeof(brubeck_hashtable_t));
+  brubeck_hashtable_t *ht = xcalloc(1, sizeof(brubeck_hashtable_t));
+  uint64_t capacity = 1;
+
   pthread_mutex_init(&ht->write_mutex, NULL);
 
-  if (!ck_ht_init(&ht->table, CK_HT_MODE_BYTESTRING, NULL, &ALLOCATOR,
-                  (uint64_t)size, 0xDEADBEEF)) {
+  if ((ht->current = table_new(size)) == NULL) {
     free(ht);
     return NULL;
   }
 
+  while (capacity < size)
+    capacity <<= 1;
+
+  ht->capacity = capacity;
   return ht;
 }
 
@@ -34,75 +94,200 @@ void brubeck_hashtable_free(brubeck_hashtable_t *ht) { /* no-op */
 struct brubeck_metric *brubeck_hashtable_find(brubeck_hashtable_t *ht,
                                               const char *key,
                                               uint16_t key_len) {
+  ck_ht_t *current = __atomic_load_n(&ht->current, __ATOMIC_ACQUIRE);
+  ck_ht_t *old = __atomic_load_n(&ht->old, __ATOMIC_ACQUIRE);
   ck_ht_hash_t h;
   ck_ht_entry_t entry;
 
-  ck_ht_hash(&h, &ht->table, key, key_len);
-  ck_ht_entry_key_set(&entry, key, key_len);
+  ck_ht_hash(&h, current, key, key_len);
+
+  if (table_get(current, h, key, key_len, &entry))
+    return ck_ht_entry_value(&entry);
 
-  if (ck_ht_get_spmc(&ht->table, h, &entry))
+  if (old && table_get(old, h, key, key_len, &entry))
     return ck_ht_entry_value(&entry);
 
   return NULL;
 }
 
+/* Move the next few entries of the old table; called with the lock held */
+static void migrate_step(brubeck_hashtable_t *ht) {
+  ck_ht_entry_t *entry, copy;
+  ck_ht_hash_t h;
+  int i;
+
+  for (i = 0; i < HT_MIGRATE_STEP; ++i) {
+    const char *key;
+    uint16_t key_len;
+
+    if (!ck_ht_next(ht->old, &ht->migration, &entry)) {
+      ht->retired = ht->old;
+      __atomic_store_n(&ht->old, NULL, __ATOMIC_RELEASE);
+      log_splunk("event=hashtable_grown capacity=%llu",
+                 (unsigned long long)ht->capacity);
+      return;
+    }
+
+    key = ck_ht_entry_key(entry);
+    key_len = ck_ht_entry_key_length(entry);
+
+    ck_ht_hash(&h, ht->current, key, key_len);
+    ck_ht_entry_set(&copy, h, key, key_len, ck_ht_entry_value(entry));
+
+    if (ck_ht_put_spmc(ht->current, h, &copy))
+      ht->migrated++;
+  }
+}
+
+/*
+ * Allocate the bigger table outside of the lock, then make it the live
+ * one. Only the thread that set `growing` gets here.
+ */
+static void grow(brubeck_hashtable_t *ht, uint64_t capacity) {
+  ck_ht_t *next = table_new(capacity), *retired;
+
+  pthread_mutex_lock(&ht->write_mutex);
+  ht->growing = false;
+
+  if (next == NULL) {
+    pthread_mutex_unlock(&ht->write_mutex);
+    log_splunk("event=hashtable_grow_failed capacity=%llu",
+               (unsigned long long)capacity);
+    return;
+  }
+
+  retired = ht->retired;
+  ht->retired = NULL;
+
+  ht->migration = (ck_ht_iterator_t)CK_HT_ITERATOR_INITIALIZER;
+  ht->migrated = 0;
+  ht->capacity = capacity;
+
+  __atomic_store_n(&ht->old, ht->current, __ATOMIC_RELEASE);
+  __atomic_store_n(&ht->current, next, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&ht->write_mutex);
+
+  table_free(retired);
+}
+
+/*
+ * Size an empty table for `entries` keys up front, so that a bulk load
+ * does not go through incremental growth. Only safe before there are any
+ * readers.
+ */
+void brubeck_hashtable_reserve(brubeck_hashtable_t *ht, uint64_t entries) {
+  uint64_t capacity = ht->capacity;
+  ck_ht_t *next, *empty;
+
+  while (HT_GROW_LOAD(capacity) <= entries)
+    capacity <<= 1;
+
+  if (capacity == ht->capacity || ht->old || ck_ht_count(ht->current))
+    return;
+
+  if ((next = table_new(capacity)) == NULL)
+    return;
+
+  pthread_mutex_lock(&ht->write_mutex);
+  empty = ht->current;
+  ht->current = next;
+  ht->capacity = capacity;
+  pthread_mutex_unlock(&ht->write_mutex);
+
+  table_free(empty);
+}
+
 bool brubeck_hashtable_insert(brubeck_hashtable_t *ht, const char *key,
                               uint16_t key_len, struct brubeck_metric *val) {
   ck_ht_hash_t h;
   ck_ht_entry_t entry;
+  uint64_t grow_to = 0;
   bool result;
 
-  ck_ht_hash(&h, &ht->table, key, key_len);
-  ck_ht_entry_set(&entry, h, key, key_len, val);
-
   pthread_mutex_lock(&ht->write_mutex);
-  result = ck_ht_put_spmc(&ht->table, h, &entry);
+
+  ck_ht_hash(&h, ht->current, key, key_len);
+
+  if (ht->old && table_get(ht->old, h, key, key_len, &entry)) {
+    result = false;
+  } else {
+    ck_ht_entry_set(&entry, h, key, key_len, val);
+    result = ck_ht_put_spmc(ht->current, h, &entry);
+  }
+
+  if (ht->old) {
+    migrate_step(ht);
+  } else if (!ht->growing &&
+             ck_ht_count(ht->current) >= HT_GROW_LOAD(ht->capacity)) {
+    ht->growing = true;
+    grow_to = ht->capacity << 1;
+  }
+
   pthread_mutex_unlock(&ht->write_mutex);
 
+  if (grow_to)
+    grow(ht, grow_to);
+
   return result;
 }
 
-size_t brubeck_hashtable_size(brubeck_hashtable_t *ht) {
-  size_t len;
+bool brubeck_hashtable_remove(brubeck_hashtable_t *ht, const char *key,
+                              uint16_t key_len) {
+  ck_ht_hash_t h;
+  ck_ht_entry_t entry;
+  bool current, old = false;
 
   pthread_mutex_lock(&ht->write_mutex);
-  len = ck_ht_count(&ht->table);
+
+  ck_ht_hash(&h, ht->current, key, key_len);
+  ck_ht_entry_key_set(&entry, key, key_len);
+  current = ck_ht_remove_spmc(ht->current, h, &entry);
+
+  if (ht->old) {
+    ck_ht_entry_key_set(&entry, key, key_len);
+    old = ck_ht_remove_spmc(ht->old, h, &entry);
+
+    /* it had already been moved */
+    if (current && old)
+      ht->migrated--;
+  }
+
   pthread_mutex_unlock(&ht->write_mutex);
 
-  return len;
+  return current || old;
 }
 
-void brubeck_hashtable_foreach(brubeck_hashtable_t *ht,
-                               void (*callback)(struct brubeck_metric *,
-                                                void *),
-                               void *payload) {
-  ck_ht_iterator_t iterator = CK_HT_ITERATOR_INITIALIZER;
-  ck_ht_entry_t *entry;
+static size_t hashtable_count(brubeck_hashtable_t *ht) {
+  size_t len = ck_ht_count(ht->current);
 
-  pthread_mutex_lock(&ht->write_mutex);
+  if (ht->old)
+    len += ck_ht_count(ht->old) - ht->migrated;
 
-  while (ck_ht_next(&ht->table, &iterator, &entry))
-    callback(ck_ht_entry_value(entry), payload);
+  return len;
+}
+
+size_t brubeck_hashtable_size(brubeck_hashtable_t *ht) {
+  size_t len;
 
+  pthread_mutex_lock(&ht->write_mutex);
+  len = hashtable_count(ht);
   pthread_mutex_unlock(&ht->write_mutex);
+
+  return len;
 }
 
-struct brubeck_metric **brubeck_hashtable_to_a(brubeck_hashtable_t *ht,
-                                               size_t *length) {
-  ck_ht_iterator_t iterator = CK_HT_ITERATOR_INITIALIZER;
-  ck_ht_entry_t *entry;
-  struct brubeck_metric **array;
-  size_t i = 0;
+void brubeck_hashtable_stats(brubeck_hashtable_t *ht,
+                             struct brubeck_hashtable_stats *stats) {
+  struct ck_ht_stat st;
 
   pthread_mutex_lock(&ht->write_mutex);
-  *length = ck_ht_count(&ht->table);
-  array = xmalloc(*length * sizeof(void *));
 
-  while (ck_ht_next(&ht->table, &iterator, &entry))
-    array[i++] = ck_ht_entry_value(entry);
+  ck_ht_stat(ht->current, &st);
+  stats->size = hashtable_count(ht);
+  stats->capacity = ht->capacity;
+  stats->load_factor = (double)ck_ht_count(ht->current) / ht->capacity;
+  stats->probe_maximum = st.probe_maximum;
+  stats->growing = (ht->old != NULL);
 
   pthread_mutex_unlock(&ht->write_mutex);
-
-  assert(*length == i);
-  return array;
 }
@@ -6,19 +6,26 @@
 struct brubeck_metric;
 typedef struct brubeck_hashtable_t brubeck_hashtable_t;
 
+struct brubeck_hashtable_stats {
+  size_t size;
+  uint64_t capacity;
+  double load_factor;
+  uint64_t probe_maximum; /* longest probe sequence in the live table */
+  bool growing;
+};
+
 brubeck_hashtable_t *brubeck_hashtable_new(const uint64_t size);
 void brubeck_hashtable_free(brubeck_hashtable_t *ht);
 struct brubeck_metric *brubeck_hashtable_find(brubeck_hashtable_t *ht,
                                               const char *key,
                                               uint16_t key_len);
+void brubeck_hashtable_reserve(brubeck_hashtable_t *ht, uint64_t entries);
 bool brubeck_hashtable_insert(brubeck_hashtable_t *ht, const char *key,
                               uint16_t key_len, struct brubeck_metric *val);
+bool brubeck_hashtable_remove(brubeck_hashtable_t *ht, const char *key,
+                              uint16_t key_len);
 size_t brubeck_hashtable_size(brubeck_hashtable_t *ht);
-void brubeck_hashtable_foreach(brubeck_hashtable_t *ht,
-                               void (*callback)(struct brubeck_metric *,
-                                                void *),
-                               void *payload);
-struct brubeck_metric **brubeck_hashtable_to_a(brubeck_hashtable_t *ht,
-                                               size_t *length);
+void brubeck_hashtable_stats(brubeck_hashtable_t *ht,
+                             struct brubeck_hashtable_stats *stats);
 
 #endif
@@ -6,34 +6,72 @@
 
 #ifdef BRUBECK_METRICS_FLOW
 
+#define FLOW_TOP_N 32
+
+struct flow_entry {
+  struct brubeck_metric *metric;
+  uint64_t flow;
+};
+
+struct flow_top {
+  struct flow_entry heap[FLOW_TOP_N];
+  size_t count;
+};
+
 static int flow_cmp(const void *a, const void *b) {
-  const struct brubeck_metric *ma = *(const struct brubeck_metric **)a;
-  const struct brubeck_metric *mb = *(const struct brubeck_metric **)b;
-  if (ma->flow < mb->flow)
+  const struct flow_entry *ea = a, *eb = b;
+  if (ea->flow < eb->flow)
     return 1;
-  if (ma->flow > mb->flow)
+  if (ea->flow > eb->flow)
     return -1;
   return 0;
 }
 
-static struct MHD_Response *flow_stats(struct brubeck_server *server) {
-  size_t metric_count, i, topn;
-  struct brubeck_metric **metrics;
+/* Keep the FLOW_TOP_N busiest metrics in a min-heap on their flow */
+static void flow_push(struct brubeck_metric *metric, void *payload) {
+  struct flow_top *top = payload;
+  struct flow_entry *heap = top->heap;
+  const uint64_t flow = metric->flow;
+  size_t i, child;
+
+  if (top->count < FLOW_TOP_N) {
+    for (i = top->count++; i > 0 && heap[(i - 1) / 2].flow > flow;
+         i = (i - 1) / 2)
+      heap[i] = heap[(i - 1) / 2];
+  } else {
+    if (flow <= heap[0].flow)
+      return;
+
+    /* replace the least busy one and sift it down */
+    for (i = 0; (child = 2 * i + 1) < FLOW_TOP_N; i = child) {
+      if (child + 1 < FLOW_TOP_N && heap[child + 1].flow < heap[child].flow)
+        child++;
+      if (heap[child].flow >= flow)
+        break;
+      heap[i] = heap[child];
+    }
+  }
+
+  heap[i].metric = metric;
+  heap[i].flow = flow;
+}
+
+static struct MHD_Response *metric_flows(struct brubeck_server *server) {
+  struct flow_top top = {.count = 0};
   json_t *top_metrics_j;
   char *jsonr;
+  size_t i;
 
-  metrics = brubeck_hashtable_to_a(server->metrics, &metric_count);
-  qsort(metrics, metric_count, sizeof(struct brubeck_metric *), &flow_cmp);
+  brubeck_metric_foreach(server, &flow_push, &top);
+  qsort(top.heap, top.count, sizeof(struct flow_entry), &flow_cmp);
 
-  topn = (metric_count < 32) ? metric_count : 32;
   top_metrics_j = json_object();
 
-  for (i = 0; i < topn; ++i) {
-    struct brubeck_metric *m = metrics[i];
-    json_object_set_new(top_metrics_j, m->key, json_integer(m->flow));
+  for (i = 0; i < top.count; ++i) {
+    json_object_set_new(top_metrics_j, top.heap[i].metric->key,
+                        json_integer(top.heap[i].flow));
   }
 
-  free(metrics);
   jsonr = json_dumps(top_metrics_j, JSON_INDENT(4) | JSON_PRESERVE_ORDER);
   json_decref(top_metrics_j);
 
@@ -43,12 +81,57 @@ static struct MHD_Response *flow_stats(struct brubeck_server *server) {
 
 #else
 
-static struct MHD_Response *flow_stats(struct brubeck_server *server) {
+static struct MHD_Response *metric_flows(struct brubeck_server *server) {
   return NULL;
 }
 
 #endif
 
+static struct MHD_Response *flow_stats(struct brubeck_server *server) {
+  json_t *hot;
+  char *jsonr;
+
+  if (server->hotkeys == NULL)
+    return metric_flows(server);
+
+  hot = brubeck_hotkeys_stats(server->hotkeys);
+  jsonr = json_dumps(hot, JSON_INDENT(4) | JSON_PRESERVE_ORDER);
+  json_decref(hot);
+
+  return MHD_create_response_from_buffer(strlen(jsonr), jsonr,
+                                         MHD_RESPMEM_MUST_FREE);
+}
+
+static struct MHD_Response *top_talkers(struct brubeck_server *server) {
+  json_t *talkers;
+  char *jsonr;
+
+  if (server->talkers == NULL)
+    return NULL;
+
+  talkers = brubeck_talkers_stats(server->talkers);
+  jsonr = json_dumps(talkers, JSON_INDENT(4) | JSON_PRESERVE_ORDER);
+  json_decref(talkers);
+
+  return MHD_create_response_from_buffer(strlen(jsonr), jsonr,
+                                         MHD_RESPMEM_MUST_FREE);
+}
+
+static struct MHD_Response *cardinality(struct brubeck_server *server) {
+  json_t *prefixes;
+  char *jsonr;
+
+  if (server->cardinality == NULL)
+    return NULL;
+
+  prefixes = brubeck_cardinality_stats(server->cardinality);
+  jsonr = json_dumps(prefixes, JSON_INDENT(4) | JSON_PRESERVE_ORDER);
+  json_decref(prefixes);
+
+  return MHD_create_response_from_buffer(strlen(jsonr), jsonr,
+                                         MHD_RESPMEM_MUST_FREE);
+}
+
 static struct brubeck_metric *safe_lookup_metric(struct brubeck_server *server,
                                                  const char *key) {
   return brubeck_hashtable_find(server->metrics, key, (uint16_t)strlen(key));
@@ -56,25 +139,35 @@ static struct brubeck_metric *safe_lookup_metric(struct brubeck_server *server,
 
 static struct MHD_Response *expire_metric(struct brubeck_server *server,
                                           const char *url) {
-  struct brubeck_metric *metric =
-      safe_lookup_metric(server, url + strlen("/expire/"));
+  struct MHD_Response *response = NULL;
+  struct brubeck_metric *metric;
+
+  /* like a walk of the queues, holds off freeing evicted metrics */
+  brubeck_atomic_inc(&server->memory.walkers);
 
+  metric = safe_lookup_metric(server, url + strlen("/expire/"));
   if (metric) {
     brubeck_metric_set_state(metric, BRUBECK_STATE_DISABLED);
-    return MHD_create_response_from_buffer(0, "", MHD_RESPMEM_PERSISTENT);
+    response = MHD_create_response_from_buffer(0, "", MHD_RESPMEM_PERSISTENT);
   }
-  return NULL;
+
+  brubeck_atomic_dec(&server->memory.walkers);
+  return response;
 }
 
 static struct MHD_Response *send_metric(struct brubeck_server *server,
                                         const char *url) {
   static const char *metric_types[] = {"gauge",     "meter", "counter",
-                                       "histogram", "timer", "internal"};
+                                       "histogram", "timer", "set",
+                                       "internal"};
   static const char *expire_status[] = {"disabled", "inactive", "active"};
 
-  struct brubeck_metric *metric =
-      safe_lookup_metric(server, url + strlen("/metric/"));
+  struct MHD_Response *response = NULL;
+  struct brubeck_metric *metric;
 
+  brubeck_atomic_inc(&server->memory.walkers);
+
+  metric = safe_lookup_metric(server, url + strlen("/metric/"));
   if (metric) {
     json_t *mj =
         json_pack("{s:s, s:s, s:i, s:s}", "key", metric->key, "type",
@@ -88,15 +181,17 @@ static struct MHD_Response *send_metric(struct brubeck_server *server,
 
     char *jsonr = json_dumps(mj, JSON_INDENT(4) | JSON_PRESERVE_ORDER);
     json_decref(mj);
-    return MHD_create_response_from_buffer(strlen(jsonr), jsonr,
-                                           MHD_RESPMEM_MUST_FREE);
+    response = MHD_create_response_from_buffer(strlen(jsonr), jsonr,
+                                               MHD_RESPMEM_MUST_FREE);
   }
 
-  return NULL;
+  brubeck_atomic_dec(&server->memory.walkers);
+  return response;
 }
 
 static struct MHD_Response *send_stats(struct brubeck_server *brubeck) {
   char *jsonr;
+  struct brubeck_hashtable_stats table;
   json_t *stats, *backends, *samplers;
   int i;
 
@@ -112,13 +207,14 @@ static struct MHD_Response *send_stats(struct brubeck_server *brubeck) {
 
       json_array_append_new(
           backends,
-          json_pack("{s:s, s:i, s:b, s:s, s:i, s:I}", "type", "carbon",
+          json_pack("{s:s, s:i, s:b, s:s, s:i, s:I, s:I}", "type", "carbon",
                     "sample_freq", (int)carbon->backend.sample_freq,
                     "connected", (carbon->out_sock >= 0), "address",
                     inet_ntop(AF_INET, &address->sin_addr.s_addr, addr,
                               INET_ADDRSTRLEN),
                     "port", (int)ntohs(address->sin_port), "bytes_sent",
-                    (json_int_t)carbon->bytes_sent));
+                    (json_int_t)carbon->bytes_sent, "forwarded",
+                    (json_int_t)carbon->forwarded));
     }
     if (backend->type == BRUBECK_BACKEND_KAFKA) {
       struct brubeck_kafka *kafka = (struct brubeck_kafka *)backend;
@@ -137,22 +233,122 @@ static struct MHD_Response *send_stats(struct brubeck_server *brubeck) {
     struct sockaddr_in *address = &sampler->addr;
     char addr[INET_ADDRSTRLEN];
     const char *sampler_name = NULL;
+    json_t *sampler_j;
 
     switch (sampler->type) {
     case BRUBECK_SAMPLER_STATSD:
       sampler_name = "statsd";
       break;
+    case BRUBECK_SAMPLER_STATSD_UNIX:
+      sampler_name = "statsd-unix";
+      break;
+    case BRUBECK_SAMPLER_STATSD_SHM:
+      sampler_name = "statsd-shm";
+      break;
+    case BRUBECK_SAMPLER_STATSD_TCP:
+      sampler_name = "statsd-tcp";
+      break;
+    case BRUBECK_SAMPLER_BINARY:
+      sampler_name = "binary";
+      break;
+    case BRUBECK_SAMPLER_BINARY_UNIX:
+      sampler_name = "binary-unix";
+      break;
+    case BRUBECK_SAMPLER_GRAPHITE:
+      sampler_name = "graphite";
+      break;
+    case BRUBECK_SAMPLER_GRAPHITE_PICKLE:
+      sampler_name = "graphite-pickle";
+      break;
+    case BRUBECK_SAMPLER_INFLUX:
+      sampler_name = "influx";
+      break;
+    case BRUBECK_SAMPLER_INFLUX_TCP:
+      sampler_name = "influx-tcp";
+      break;
     default:
       assert(0);
     }
 
-    json_array_append_new(
-        samplers,
-        json_pack("{s:s, s:f, s:s, s:i}", "type", sampler_name, "sample_freq",
-                  (double)sampler->current_flow, "address",
-                  inet_ntop(AF_INET, &address->sin_addr.s_addr, addr,
-                            INET_ADDRSTRLEN),
-                  "port", (int)ntohs(address->sin_port)));
+    if (sampler->type == BRUBECK_SAMPLER_STATSD_SHM) {
+      struct brubeck_shm_sampler *shm = (struct brubeck_shm_sampler *)sampler;
+      json_array_append_new(
+          samplers,
+          json_pack("{s:s, s:f, s:s, s:I}", "type", sampler_name,
+                    "sample_freq", (double)sampler->current_flow, "path",
+                    sampler->path, "dropped",
+                    (json_int_t)__atomic_load_n(&shm->ring->dropped,
+                                                __ATOMIC_RELAXED)));
+      continue;
+    }
+
+    if (sampler->path) {
+      sampler_j = json_pack("{s:s, s:f, s:s}", "type", sampler_name,
+                            "sample_freq", (double)sampler->current_flow,
+                            "path", sampler->path);
+    } else {
+      sampler_j =
+          json_pack("{s:s, s:f, s:s, s:i}", "type", sampler_name,
+                    "sample_freq", (double)sampler->current_flow, "address",
+                    inet_ntop(AF_INET, &address->sin_addr.s_addr, addr,
+                              INET_ADDRSTRLEN),
+                    "port", (int)ntohs(address->sin_port));
+    }
+
+    if (sampler->type == BRUBECK_SAMPLER_GRAPHITE ||
+        sampler->type == BRUBECK_SAMPLER_GRAPHITE_PICKLE) {
+      struct brubeck_graphite *graphite = (struct brubeck_graphite *)sampler;
+      json_object_set_new(sampler_j, "tcp",
+                          brubeck_statsd_tcp_stats(&graphite->tcp));
+      json_object_set_new(sampler_j, "graphite",
+                          brubeck_graphite_stats(graphite));
+    }
+
+    if (sampler->type == BRUBECK_SAMPLER_STATSD ||
+        sampler->type == BRUBECK_SAMPLER_STATSD_UNIX ||
+        sampler->type == BRUBECK_SAMPLER_INFLUX) {
+      struct brubeck_statsd *statsd = (struct brubeck_statsd *)sampler;
+      json_object_set_new(sampler_j, "truncated",
+                          json_integer((json_int_t)statsd->truncated));
+
+      if (statsd->spin_budget_ns)
+        json_object_set_new(sampler_j, "busy_poll",
+                            brubeck_statsd_busy_poll_stats(statsd));
+
+      if (statsd->ratelimit)
+        json_object_set_new(sampler_j, "rate_limit",
+                            brubeck_statsd_ratelimit_stats(statsd));
+
+      if (statsd->shed_load)
+        json_object_set_new(sampler_j, "shedding",
+                            brubeck_statsd_shedding_stats(statsd));
+    }
+
+    if (sampler->type == BRUBECK_SAMPLER_INFLUX)
+      json_object_set_new(
+          sampler_j, "influx",
+          brubeck_influx_stats(&((struct brubeck_influx *)sampler)->schema));
+
+    if (sampler->type == BRUBECK_SAMPLER_INFLUX_TCP) {
+      struct brubeck_influx_tcp *influx = (struct brubeck_influx_tcp *)sampler;
+      json_object_set_new(sampler_j, "tcp",
+                          brubeck_statsd_tcp_stats(&influx->tcp));
+      json_object_set_new(sampler_j, "influx",
+                          brubeck_influx_stats(&influx->schema));
+    }
+
+    if (sampler->type == BRUBECK_SAMPLER_STATSD_TCP)
+      json_object_set_new(
+          sampler_j, "tcp",
+          brubeck_statsd_tcp_stats((struct brubeck_statsd_tcp *)sampler));
+
+    if (sampler->type == BRUBECK_SAMPLER_BINARY ||
+        sampler->type == BRUBECK_SAMPLER_BINARY_UNIX)
+      json_object_set_new(
+          sampler_j, "dictionary",
+          brubeck_binary_stats((struct brubeck_binary *)sampler));
+
+    json_array_append_new(samplers, sampler_j);
   }
 
   stats =
@@ -162,6 +358,29 @@ static struct MHD_Response *send_stats(struct brubeck_server *brubeck) {
                 brubeck_stats_sample(brubeck, unique_keys), "backends",
                 backends, "samplers", samplers);
 
+  brubeck_hashtable_stats(brubeck->metrics, &table);
+  json_object_set_new(
+      stats, "table",
+      json_pack("{s:I, s:I, s:f, s:I, s:b}", "size", (json_int_t)table.size,
+                "capacity", (json_int_t)table.capacity, "load_factor",
+                table.load_factor, "probe_max",
+                (json_int_t)table.probe_maximum, "growing", table.growing));
+
+  if (brubeck->memory.max)
+    json_object_set_new(stats, "memory", brubeck_memory_stats(brubeck));
+
+  if (brubeck->max_keys)
+    json_object_set_new(stats, "at_capacity",
+                        json_integer(brubeck->at_capacity));
+
+  if (brubeck->denylist)
+    json_object_set_new(stats, "denylist",
+                        brubeck_denylist_stats(brubeck->denylist));
+
+  if (brubeck->admission)
+    json_object_set_new(stats, "admission",
+                        brubeck_admission_stats(brubeck->admission));
+
   jsonr = json_dumps(stats, JSON_INDENT(4) | JSON_PRESERVE_ORDER);
   json_decref(stats);
   return MHD_create_response_from_buffer(strlen(jsonr), jsonr,
@@ -216,6 +435,12 @@ static int handle_request(void *cls, struct MHD_Connection *connection,
     else if (!strcmp(url, "/flow_stats"))
       response = flow_stats(brubeck);
 
+    else if (!strcmp(url, "/top_talkers"))
+      response = top_talkers(brubeck);
+
+    else if (!strcmp(url, "/cardinality"))
+      response = cardinality(brubeck);
+
     else if (starts_with(url, "/metric/"))
       response = send_metric(brubeck, url);
   } else if (!strcmp(method, "POST")) {
@@ -239,22 +464,55 @@ static int handle_request(void *cls, struct MHD_Connection *connection,
   return ret;
 }
 
+static struct MHD_Daemon *http_daemon;
+
 void brubeck_http_endpoint_init(struct brubeck_server *server,
                                 const char *listen) {
-  struct MHD_Daemon *daemon;
+  const unsigned int flags =
+      MHD_USE_SELECT_INTERNALLY | MHD_USE_PIPE_FOR_SHUTDOWN;
+  const union MHD_DaemonInfo *info;
+  struct sockaddr_in addr;
+  int sock;
 
   const char *port = strrchr(listen, ':');
   port = port ? port + 1 : listen;
 
-  daemon = MHD_start_daemon(
-      MHD_USE_SELECT_INTERNALLY, atoi(port), NULL, NULL, &handle_request,
-      server, MHD_OPTION_CONNECTION_TIMEOUT, (unsigned int)10, MHD_OPTION_END);
-
-  if (!daemon)
+  memset(&addr, 0x0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons((uint16_t)atoi(port));
+  addr.sin_addr.s_addr = INADDR_ANY;
+
+  sock = brubeck_upgrade_inherit(&server->upgrade, SOCK_STREAM,
+                                 (struct sockaddr *)&addr);
+
+  if (sock >= 0)
+    http_daemon = MHD_start_daemon(
+        flags, atoi(port), NULL, NULL, &handle_request, server,
+        MHD_OPTION_CONNECTION_TIMEOUT, (unsigned int)10,
+        MHD_OPTION_LISTEN_SOCKET, sock, MHD_OPTION_END);
+  else
+    http_daemon = MHD_start_daemon(
+        flags, atoi(port), NULL, NULL, &handle_request, server,
+        MHD_OPTION_CONNECTION_TIMEOUT, (unsigned int)10, MHD_OPTION_END);
+
+  if (!http_daemon)
     die("failed to start HTTP endpoint");
+
+  info = MHD_get_daemon_info(http_daemon, MHD_DAEMON_INFO_LISTEN_FD);
+  if (info)
+    brubeck_upgrade_register(&server->upgrade, info->listen_fd);
+
   log_splunk("event=http_server listen=%s", port);
 }
 
+/* Stop accepting connections, once the listener was handed over */
+void brubeck_http_endpoint_quiesce(struct brubeck_server *server) {
+  int sock;
+
+  if (http_daemon && (sock = MHD_quiesce_daemon(http_daemon)) >= 0)
+    close(sock);
+}
+
 #else
 
 void brubeck_http_endpoint_init(struct brubeck_server *server,
@@ -262,4 +520,6 @@ void brubeck_http_endpoint_init(struct brubeck_server *server,
   die("http support has not been compiled in Brubeck");
 }
 
+void brubeck_http_endpoint_quiesce(struct brubeck_server *server) {}
+
 #endif
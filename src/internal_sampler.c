@@ -1,31 +1,98 @@
 #include "brubeck.h"
 
-#define INTERNAL_LONGEST_KEY ".unique_keys"
+static const char *INTERNAL_SUFFIXES[] = {".metrics", ".errors",
+                                          ".unique_keys", ".spin_us",
+                                          ".blocked_us",
+                                          ".top_talker.packets",
+                                          ".top_talker.share",
+                                          ".admission.rejected",
+                                          ".admission.admitted_late",
+                                          ".table.load_factor",
+                                          ".table.probe_max"};
+
+#define INTERNAL_SUFFIX_COUNT                                                  \
+  (sizeof(INTERNAL_SUFFIXES) / sizeof(INTERNAL_SUFFIXES[0]))
 
 void brubeck_internal__sample(struct brubeck_metric *metric,
                               brubeck_sample_cb sample, void *opaque) {
-  struct brubeck_internal_stats *stats = metric->as.other;
+  struct brubeck_server *server = metric->as.other;
+  struct brubeck_internal_stats *stats = &server->internal_stats;
+  const struct brubeck_metric_names *names =
+      brubeck_metric_names(metric, opaque, stats->suffixes, stats->suffix_count);
+  struct brubeck_hashtable_stats table;
   uint32_t value;
+  size_t i;
+
+  value = brubeck_atomic_swap(&stats->live.metrics, 0);
+  stats->sample.metrics = value;
+  brubeck_metric_emit(metric, names, 0, (value_t)value, sample, opaque);
+
+  value = brubeck_atomic_swap(&stats->live.errors, 0);
+  stats->sample.errors = value;
+  brubeck_metric_emit(metric, names, 1, (value_t)value, sample, opaque);
 
-  char *key = alloca(metric->key_len + strlen(INTERNAL_LONGEST_KEY) + 1);
-  memcpy(key, metric->key, metric->key_len);
+  value = brubeck_atomic_fetch(&stats->live.unique_keys);
+  stats->sample.unique_keys = value;
+  brubeck_metric_emit(metric, names, 2, (value_t)value, sample, opaque);
 
-  WITH_SUFFIX(".metrics") {
-    value = brubeck_atomic_swap(&stats->live.metrics, 0);
-    stats->sample.metrics = value;
-    sample(metric, key, (value_t)value, opaque);
+  if (stats->busy_poll) {
+    value = brubeck_atomic_swap(&stats->live.spin_us, 0);
+    stats->sample.spin_us = value;
+    brubeck_metric_emit(metric, names, 3, (value_t)value, sample, opaque);
+
+    value = brubeck_atomic_swap(&stats->live.blocked_us, 0);
+    stats->sample.blocked_us = value;
+    brubeck_metric_emit(metric, names, 4, (value_t)value, sample, opaque);
   }
 
-  WITH_SUFFIX(".errors") {
-    value = brubeck_atomic_swap(&stats->live.errors, 0);
-    stats->sample.errors = value;
-    sample(metric, key, (value_t)value, opaque);
+  brubeck_hashtable_stats(server->metrics, &table);
+  brubeck_metric_emit(metric, names, 9, table.load_factor, sample, opaque);
+  brubeck_metric_emit(metric, names, 10, (value_t)table.probe_maximum, sample,
+                      opaque);
+
+  if (server->hotkeys)
+    brubeck_hotkeys_rotate(server);
+
+  if (server->talkers) {
+    struct brubeck_talkers *talkers = server->talkers;
+    uint64_t top;
+
+    brubeck_talkers_rotate(talkers);
+    top = talkers->top_count ? talkers->top[0].packets : 0;
+
+    brubeck_metric_emit(metric, names, 5, (value_t)top, sample, opaque);
+    brubeck_metric_emit(
+        metric, names, 6,
+        talkers->packets ? 100.0 * top / talkers->packets : 0.0, sample,
+        opaque);
   }
 
-  WITH_SUFFIX(".unique_keys") {
-    value = brubeck_atomic_fetch(&stats->live.unique_keys);
-    stats->sample.unique_keys = value;
-    sample(metric, key, (value_t)value, opaque);
+  if (server->admission) {
+    struct brubeck_admission *admission = server->admission;
+    uint64_t rejected = brubeck_atomic_fetch(&admission->rejected);
+    uint64_t admitted = brubeck_atomic_fetch(&admission->admitted_late);
+
+    brubeck_admission_rotate(admission);
+
+    brubeck_metric_emit(metric, names, 7,
+                        (value_t)(rejected - admission->reported_rejected),
+                        sample, opaque);
+    brubeck_metric_emit(metric, names, 8,
+                        (value_t)(admitted - admission->reported_admitted),
+                        sample, opaque);
+    admission->reported_rejected = rejected;
+    admission->reported_admitted = admitted;
+  }
+
+  if (server->denylist) {
+    for (i = 0; i < server->denylist->rule_count; ++i) {
+      struct brubeck_denylist_rule *rule = &server->denylist->rules[i];
+      uint64_t drops = brubeck_atomic_fetch(&rule->drops);
+
+      brubeck_metric_emit(metric, names, INTERNAL_SUFFIX_COUNT + i,
+                          (value_t)(drops - rule->reported), sample, opaque);
+      rule->reported = drops;
+    }
   }
 
   /*
@@ -36,8 +103,24 @@ void brubeck_internal__sample(struct brubeck_metric *metric,
 }
 
 void brubeck_internal__init(struct brubeck_server *server) {
+  struct brubeck_internal_stats *stats = &server->internal_stats;
   struct brubeck_metric *internal;
   struct brubeck_backend *backend;
+  size_t i;
+
+  stats->suffixes = INTERNAL_SUFFIXES;
+  stats->suffix_count = INTERNAL_SUFFIX_COUNT;
+
+  if (server->denylist) {
+    stats->suffix_count += server->denylist->rule_count;
+    stats->suffixes = xcalloc(stats->suffix_count, sizeof(const char *));
+
+    for (i = 0; i < INTERNAL_SUFFIX_COUNT; ++i)
+      stats->suffixes[i] = INTERNAL_SUFFIXES[i];
+    for (i = 0; i < server->denylist->rule_count; ++i)
+      stats->suffixes[INTERNAL_SUFFIX_COUNT + i] =
+          server->denylist->rules[i].suffix;
+  }
 
   internal = brubeck_metric_new(server, server->name, strlen(server->name),
                                 BRUBECK_MT_INTERNAL_STATS);
@@ -45,8 +128,8 @@ void brubeck_internal__init(struct brubeck_server *server) {
   if (internal == NULL)
     die("Failed to initialize internal stats sampler");
 
-  internal->as.other = &server->internal_stats;
+  internal->as.other = server;
 
   backend = brubeck_metric_shard(server, internal);
-  server->internal_stats.sample_freq = backend->sample_freq;
+  stats->sample_freq = backend->sample_freq;
 }
@@ -1,10 +1,18 @@
 #include "brubeck.h"
 
+/* The slab allocation of a metric: the metric and its key, followed by the
+ * full key it is indexed by when tags were stripped from it */
+static inline size_t metric_size(size_t key_len, size_t tag_len) {
+  return sizeof(struct brubeck_metric) + key_len + 1 +
+         (tag_len ? key_len + tag_len + 1 : 0);
+}
+
 static inline struct brubeck_metric *new_metric(struct brubeck_server *server,
                                                 const char *key, size_t key_len,
                                                 uint8_t type) {
   struct brubeck_metric *metric;
   const struct brubeck_tag_set *tags = NULL;
+  const size_t full_len = key_len;
 
   if (server->tags) {
     tags = brubeck_get_tag_set(server->tags, key, key_len);
@@ -15,7 +23,7 @@ static inline struct brubeck_metric *new_metric(struct brubeck_server *server,
 
   /* slab allocation cannot fail */
   metric = brubeck_slab_alloc(&server->slab,
-                              sizeof(struct brubeck_metric) + key_len + 1);
+                              metric_size(key_len, full_len - key_len));
 
   memset(metric, 0x0, sizeof(struct brubeck_metric));
 
@@ -24,8 +32,17 @@ static inline struct brubeck_metric *new_metric(struct brubeck_server *server,
   metric->key[key_len] = '\0';
   metric->key_len = (uint16_t)key_len;
 
+  if (full_len != key_len) {
+    memcpy(metric->key + key_len + 1, key, full_len);
+    metric->key[key_len + 1 + full_len] = '\0';
+  }
+
   brubeck_metric_set_state(metric, BRUBECK_STATE_ACTIVE);
   metric->type = type;
+
+  if (type == BRUBECK_MT_SET)
+    metric->as.set = brubeck_hll_new(&server->slab, server->set_precision);
+
   pthread_spin_init(&metric->lock, PTHREAD_PROCESS_PRIVATE);
 
 #ifdef BRUBECK_METRICS_FLOW
@@ -60,13 +77,15 @@ static void gauge__record(struct brubeck_metric *metric, value_t value,
 
 static void gauge__sample(struct brubeck_metric *metric,
                           brubeck_sample_cb sample, void *opaque) {
+  const struct brubeck_metric_names *names =
+      brubeck_metric_names(metric, opaque, NULL, 0);
   value_t value;
 
   pthread_spin_lock(&metric->lock);
   { value = metric->as.gauge.value; }
   pthread_spin_unlock(&metric->lock);
 
-  sample(metric, metric->key, value, opaque);
+  brubeck_metric_emit(metric, names, 0, value, sample, opaque);
 }
 
 /*********************************************
@@ -76,9 +95,23 @@ static void gauge__sample(struct brubeck_metric *metric,
  *********************************************/
 static void meter__record(struct brubeck_metric *metric, value_t value,
                           value_t sample_freq, uint8_t modifiers) {
+  struct brubeck_meter_shard *shards =
+      __atomic_load_n(&metric->as.meter.shards, __ATOMIC_ACQUIRE);
+
   /* upsample */
   value *= sample_freq;
 
+  /* hot meters spread their updates over per-thread slots */
+  if (shards) {
+    struct brubeck_meter_shard *shard =
+        &shards[brubeck_hotkeys_thread_slot()];
+
+    pthread_spin_lock(&shard->lock);
+    { shard->value += value; }
+    pthread_spin_unlock(&shard->lock);
+    return;
+  }
+
   pthread_spin_lock(&metric->lock);
   { metric->as.meter.value += value; }
   pthread_spin_unlock(&metric->lock);
@@ -86,6 +119,8 @@ static void meter__record(struct brubeck_metric *metric, value_t value,
 
 static void meter__sample(struct brubeck_metric *metric,
                           brubeck_sample_cb sample, void *opaque) {
+  const struct brubeck_metric_names *names =
+      brubeck_metric_names(metric, opaque, NULL, 0);
   value_t value;
 
   pthread_spin_lock(&metric->lock);
@@ -95,7 +130,21 @@ static void meter__sample(struct brubeck_metric *metric,
   }
   pthread_spin_unlock(&metric->lock);
 
-  sample(metric, metric->key, value, opaque);
+  if (metric->as.meter.shards) {
+    struct brubeck_meter_shard *shards = metric->as.meter.shards;
+    int i;
+
+    for (i = 0; i < BRUBECK_METER_SHARDS; ++i) {
+      pthread_spin_lock(&shards[i].lock);
+      {
+        value += shards[i].value;
+        shards[i].value = 0.0;
+      }
+      pthread_spin_unlock(&shards[i].lock);
+    }
+  }
+
+  brubeck_metric_emit(metric, names, 0, value, sample, opaque);
 }
 
 /*********************************************
@@ -125,6 +174,8 @@ static void counter__record(struct brubeck_metric *metric, value_t value,
 
 static void counter__sample(struct brubeck_metric *metric,
                             brubeck_sample_cb sample, void *opaque) {
+  const struct brubeck_metric_names *names =
+      brubeck_metric_names(metric, opaque, NULL, 0);
   value_t value;
 
   pthread_spin_lock(&metric->lock);
@@ -134,7 +185,7 @@ static void counter__sample(struct brubeck_metric *metric,
   }
   pthread_spin_unlock(&metric->lock);
 
-  sample(metric, metric->key, value, opaque);
+  brubeck_metric_emit(metric, names, 0, value, sample, opaque);
 }
 
 /*********************************************
@@ -149,62 +200,93 @@ static void histogram__record(struct brubeck_metric *metric, value_t value,
   pthread_spin_unlock(&metric->lock);
 }
 
+enum {
+  HS_COUNT,
+  HS_COUNT_PS,
+  HS_MIN,
+  HS_MAX,
+  HS_SUM,
+  HS_MEAN,
+  HS_MEDIAN,
+  HS_PC_75,
+  HS_PC_95,
+  HS_PC_98,
+  HS_PC_99,
+  HS_PC_999,
+  HS_MAX_SUFFIX
+};
+
+static const char *HISTO_SUFFIXES[] = {
+    ".count",         ".count_ps",      ".min",           ".max",
+    ".sum",           ".mean",          ".median",        ".percentile.75",
+    ".percentile.95", ".percentile.98", ".percentile.99", ".percentile.999"};
+
 static void histogram__sample(struct brubeck_metric *metric,
                               brubeck_sample_cb sample, void *opaque) {
+  struct brubeck_backend *backend = opaque;
+  const struct brubeck_metric_names *names;
   struct brubeck_histo_sample hsample;
-  char *key;
+
+  ct_assert(sizeof(HISTO_SUFFIXES) / sizeof(HISTO_SUFFIXES[0]) ==
+            HS_MAX_SUFFIX);
 
   pthread_spin_lock(&metric->lock);
   { brubeck_histo_sample(&hsample, &metric->as.histogram); }
   pthread_spin_unlock(&metric->lock);
 
-  /* alloc space for this on the stack. we need enough for:
-   * key_length + longest_suffix + null terminator
-   */
-  key = alloca(metric->key_len + strlen(".percentile.999") + 1);
-  memcpy(key, metric->key, metric->key_len);
+  names = brubeck_metric_names(metric, backend, HISTO_SUFFIXES, HS_MAX_SUFFIX);
 
-  WITH_SUFFIX(".count") { sample(metric, key, hsample.count, opaque); }
+#define EMIT(n, v) brubeck_metric_emit(metric, names, n, v, sample, opaque)
 
-  WITH_SUFFIX(".count_ps") {
-    struct brubeck_backend *backend = opaque;
-    sample(metric, key, hsample.count / (double)backend->sample_freq, opaque);
-  }
+  EMIT(HS_COUNT, hsample.count);
+  EMIT(HS_COUNT_PS, hsample.count / (double)backend->sample_freq);
 
   /* if there have been no metrics during this sampling period,
    * we don't need to report any of the histogram samples */
   if (hsample.count == 0.0)
     return;
 
-  WITH_SUFFIX(".min") { sample(metric, key, hsample.min, opaque); }
-
-  WITH_SUFFIX(".max") { sample(metric, key, hsample.max, opaque); }
-
-  WITH_SUFFIX(".sum") { sample(metric, key, hsample.sum, opaque); }
-
-  WITH_SUFFIX(".mean") { sample(metric, key, hsample.mean, opaque); }
-
-  WITH_SUFFIX(".median") { sample(metric, key, hsample.median, opaque); }
+  EMIT(HS_MIN, hsample.min);
+  EMIT(HS_MAX, hsample.max);
+  EMIT(HS_SUM, hsample.sum);
+  EMIT(HS_MEAN, hsample.mean);
+  EMIT(HS_MEDIAN, hsample.median);
+  EMIT(HS_PC_75, hsample.percentile[PC_75]);
+  EMIT(HS_PC_95, hsample.percentile[PC_95]);
+  EMIT(HS_PC_98, hsample.percentile[PC_98]);
+  EMIT(HS_PC_99, hsample.percentile[PC_99]);
+  EMIT(HS_PC_999, hsample.percentile[PC_999]);
+
+#undef EMIT
+}
 
-  WITH_SUFFIX(".percentile.75") {
-    sample(metric, key, hsample.percentile[PC_75], opaque);
-  }
+/*********************************************
+ * Set
+ *
+ * ALLOC: mt + HLL (sparse, then 2^precision bytes)
+ *********************************************/
+static void set__record(struct brubeck_metric *metric, value_t value,
+                        value_t sample_freq, uint8_t modifiers) {
+  /* dense registers are updated lock-free */
+  if (brubeck_hll_add_dense(metric->as.set, value))
+    return;
 
-  WITH_SUFFIX(".percentile.95") {
-    sample(metric, key, hsample.percentile[PC_95], opaque);
-  }
+  pthread_spin_lock(&metric->lock);
+  { brubeck_hll_add_sparse(metric->as.set, value); }
+  pthread_spin_unlock(&metric->lock);
+}
 
-  WITH_SUFFIX(".percentile.98") {
-    sample(metric, key, hsample.percentile[PC_98], opaque);
-  }
+static void set__sample(struct brubeck_metric *metric, brubeck_sample_cb sample,
+                        void *opaque) {
+  const struct brubeck_metric_names *names =
+      brubeck_metric_names(metric, opaque, NULL, 0);
+  value_t value;
 
-  WITH_SUFFIX(".percentile.99") {
-    sample(metric, key, hsample.percentile[PC_99], opaque);
-  }
+  pthread_spin_lock(&metric->lock);
+  { value = brubeck_hll_estimate(metric->as.set, true); }
+  pthread_spin_unlock(&metric->lock);
 
-  WITH_SUFFIX(".percentile.999") {
-    sample(metric, key, hsample.percentile[PC_999], opaque);
-  }
+  brubeck_metric_emit(metric, names, 0, value, sample, opaque);
 }
 
 /********************************************************/
@@ -228,6 +310,9 @@ static struct brubeck_metric__proto {
     /* Timer -- uses same implementation as histogram */
     {&histogram__record, &histogram__sample},
 
+    /* Set -- HyperLogLog cardinality estimate */
+    {&set__record, &set__sample},
+
     /* Internal -- used for sampling brubeck itself */
     {NULL, /* recorded manually */
      brubeck_internal__sample}};
@@ -251,25 +336,236 @@ struct brubeck_backend *brubeck_metric_shard(struct brubeck_server *server,
   return server->backends[shard];
 }
 
-struct brubeck_metric *brubeck_metric_new(struct brubeck_server *server,
-                                          const char *key, size_t key_len,
-                                          uint8_t type) {
+/*
+ * Call `callback` on every metric of the server without taking any lock
+ * that ingestion needs: the metrics are walked through the backend queues,
+ * which samplers only ever push onto at the head, and evicted metrics are
+ * not freed while a walk is going on. Metrics created during the walk may
+ * or may not be seen.
+ */
+void brubeck_metric_foreach(struct brubeck_server *server,
+                            void (*callback)(struct brubeck_metric *, void *),
+                            void *payload) {
+  const int shards =
+      (server->active_backends > 1) ? server->active_backends : 1;
+  int i;
+
+  brubeck_atomic_inc(&server->memory.walkers);
+
+  for (i = 0; i < shards; ++i) {
+    struct brubeck_metric *mt;
+
+    if (server->backends[i] == NULL)
+      continue;
+
+    mt = __atomic_load_n(&server->backends[i]->queue, __ATOMIC_ACQUIRE);
+    for (; mt; mt = __atomic_load_n(&mt->next, __ATOMIC_ACQUIRE))
+      callback(mt, payload);
+  }
+
+  brubeck_atomic_dec(&server->memory.walkers);
+}
+
+static size_t encode_plain_name(char *dst, const char *name, size_t len) {
+  memcpy(dst, name, len);
+  return len;
+}
+
+const struct brubeck_metric_names *
+brubeck_metric_names(struct brubeck_metric *metric,
+                     struct brubeck_backend *backend, const char **suffixes,
+                     size_t count) {
+  static const char *NO_SUFFIX[] = {""};
+
+  size_t (*encode)(char *, const char *, size_t);
+  struct brubeck_metric_names *names;
+  size_t i, longest = 0, total = 0;
+  char *scratch, *blob, *ptr;
+
+  if (likely(metric->names != NULL))
+    return metric->names;
+
+  /* a metric is only ever sampled by the backend it is sharded to, so
+   * there's no race building the table lazily from the flush thread */
+  if (count == 0) {
+    suffixes = NO_SUFFIX;
+    count = 1;
+  }
+
+  for (i = 0; i < count; ++i) {
+    size_t len = strlen(suffixes[i]);
+    if (len > longest)
+      longest = len;
+    total += metric->key_len + len + BRUBECK_NAME_FRAMING + 1;
+  }
+
+  names = brubeck_slab_alloc(&backend->server->slab,
+                             sizeof(struct brubeck_metric_names) +
+                                 count * sizeof(names->name[0]) + total);
+  names->count = (uint16_t)count;
+  blob = ptr = (char *)&names->name[count];
+
+  encode = backend->encode_name ? backend->encode_name : &encode_plain_name;
+  scratch = xmalloc(metric->key_len + longest);
+  memcpy(scratch, metric->key, metric->key_len);
+
+  for (i = 0; i < count; ++i) {
+    size_t len = strlen(suffixes[i]);
+
+    memcpy(scratch + metric->key_len, suffixes[i], len);
+    len = encode(ptr, scratch, metric->key_len + len);
+    ptr[len] = '\0';
+
+    names->name[i].offset = (uint32_t)(ptr - blob);
+    names->name[i].len = (uint32_t)len;
+    ptr += len + 1;
+
+    if (!len)
+      log_splunk("backend=%s event=invalid_name key='%s%s'",
+                 brubeck_backend_name(backend), metric->key, suffixes[i]);
+  }
+
+  free(scratch);
+  metric->names = names;
+  return names;
+}
+
+/* The key a metric is indexed by in the metrics table, tags included */
+const char *brubeck_metric_ht_key(const struct brubeck_metric *metric,
+                                  size_t *len) {
+  if (metric->tags && metric->tags->tag_len) {
+    *len = metric->key_len + metric->tags->tag_len;
+    return metric->key + metric->key_len + 1;
+  }
+
+  *len = metric->key_len;
+  return metric->key;
+}
+
+static size_t names_size(const struct brubeck_metric_names *names) {
+  const size_t last = names->count - 1;
+
+  return sizeof(struct brubeck_metric_names) +
+         names->count * sizeof(names->name[0]) + names->name[last].offset +
+         names->name[last].len + 1;
+}
+
+/* Bytes held by a metric: its slab allocations and histogram buffer */
+size_t brubeck_metric_memory(const struct brubeck_metric *metric) {
+  size_t bytes = brubeck_slab_size(metric_size(
+      metric->key_len, metric->tags ? metric->tags->tag_len : 0));
+
+  if (metric->names)
+    bytes += brubeck_slab_size(names_size(metric->names));
+
+  if (metric->type == BRUBECK_MT_SET)
+    bytes += brubeck_hll_memory(metric->as.set);
+  else if (metric->type == BRUBECK_MT_METER && metric->as.meter.shards)
+    bytes += BRUBECK_METER_SHARDS * sizeof(struct brubeck_meter_shard);
+  else if (metric->type == BRUBECK_MT_HISTO || metric->type == BRUBECK_MT_TIMER)
+    bytes += metric->as.histogram.alloc * sizeof(value_t);
+
+  return bytes;
+}
+
+/*
+ * Give the memory of a metric back. It must not be reachable anymore: out
+ * of the metrics table and its backend's queue, for long enough that no
+ * thread that found it before is still recording into it.
+ */
+void brubeck_metric_free(struct brubeck_server *server,
+                         struct brubeck_metric *metric) {
+  if (metric->type == BRUBECK_MT_SET) {
+    brubeck_hll_free(metric->as.set);
+  } else if (metric->type == BRUBECK_MT_METER && metric->as.meter.shards) {
+    free(metric->as.meter.shards);
+    brubeck_atomic_dec(&server->hotkeys->sharded);
+  } else if (metric->type == BRUBECK_MT_HISTO ||
+             metric->type == BRUBECK_MT_TIMER) {
+    pthread_spin_lock(&metric->lock);
+    { brubeck_histo_free(&metric->as.histogram); }
+    pthread_spin_unlock(&metric->lock);
+  }
+
+  if (metric->names)
+    brubeck_slab_free(&server->slab, (void *)metric->names,
+                      names_size(metric->names));
+
+  pthread_spin_destroy(&metric->lock);
+  brubeck_slab_free(
+      &server->slab, metric,
+      metric_size(metric->key_len, metric->tags ? metric->tags->tag_len : 0));
+}
+
+/* Create and publish the metric for `key`. If another thread published
+ * one first, that one is returned and `created` is left false. */
+static struct brubeck_metric *create_metric(struct brubeck_server *server,
+                                            const char *key, size_t key_len,
+                                            uint8_t type, bool *created) {
   struct brubeck_metric *metric;
-  // key is part of a shared buffer that will change, so a copy is required
-  char *key_for_ht = strndup(key, key_len);
+  const char *ht_key;
+  size_t ht_len;
+  uint32_t keys;
+
+  *created = false;
 
   metric = new_metric(server, key, key_len, type);
   if (!metric)
     return NULL;
 
-  if (!brubeck_hashtable_insert(server->metrics, key_for_ht, key_len, metric)) {
-    free(key_for_ht);
+  /* key is part of a shared buffer that will change, so the table indexes
+   * the copy kept with the metric */
+  ht_key = brubeck_metric_ht_key(metric, &ht_len);
+
+  if (!brubeck_hashtable_insert(server->metrics, ht_key, ht_len, metric)) {
+    brubeck_metric_free(server, metric);
     return brubeck_hashtable_find(server->metrics, key, key_len);
   }
   brubeck_backend_register_metric(brubeck_metric_shard(server, metric), metric);
 
   /* Record internal stats */
-  brubeck_stats_inc(server, unique_keys);
+  keys = brubeck_stats_inc(server, unique_keys);
+  if (server->max_keys && keys >= server->max_keys && !server->at_capacity) {
+    server->at_capacity = 1;
+    log_splunk("event=at_capacity unique_keys=%u", keys);
+  }
+
+  *created = true;
+  return metric;
+}
+
+struct brubeck_metric *brubeck_metric_new(struct brubeck_server *server,
+                                          const char *key, size_t key_len,
+                                          uint8_t type) {
+  bool created;
+  return create_metric(server, key, key_len, type, &created);
+}
+
+/* The `<prefix>.__overflow__.<type>` metric that keys over the budget of
+ * their prefix are folded into: one per type, since samples of different
+ * types cannot be recorded into the same metric */
+static struct brubeck_metric *overflow_metric(struct brubeck_server *server,
+                                              const char *key,
+                                              size_t prefix_len,
+                                              uint8_t type) {
+  static const char *TYPE_NAMES[] = {"gauge", "meter",  "counter",
+                                     "histogram", "timer", "set"};
+  struct brubeck_metric *metric;
+  char name[256];
+  int len;
+
+  if (type >= sizeof(TYPE_NAMES) / sizeof(TYPE_NAMES[0]))
+    return NULL;
+
+  len = snprintf(name, sizeof(name), "%.*s%s.%s", (int)prefix_len, key,
+                 BRUBECK_CARDINALITY_OVERFLOW, TYPE_NAMES[type]);
+  if (len < 0 || (size_t)len >= sizeof(name))
+    return NULL;
+
+  metric = brubeck_hashtable_find(server->metrics, name, (uint16_t)len);
+  if (metric == NULL)
+    metric = brubeck_metric_new(server, name, len, type);
+
   return metric;
 }
 
@@ -282,9 +578,34 @@ struct brubeck_metric *brubeck_metric_find(struct brubeck_server *server,
   metric = brubeck_hashtable_find(server->metrics, key, (uint16_t)key_len);
 
   if (unlikely(metric == NULL)) {
-    if (server->at_capacity)
+    if (server->at_capacity || !brubeck_memory_admit(server))
+      return NULL;
+
+    if (server->admission &&
+        !brubeck_admission_check(server->admission, key, key_len))
       return NULL;
 
+    if (server->cardinality) {
+      size_t prefix_len;
+      bool created;
+
+      switch (brubeck_cardinality_check(server->cardinality, key, key_len,
+                                        &prefix_len)) {
+      case BRUBECK_CARDINALITY_REJECT:
+        return NULL;
+      case BRUBECK_CARDINALITY_FOLD:
+        return overflow_metric(server, key, prefix_len, type);
+      default:
+        break;
+      }
+
+      /* the budget was taken for a key that did not get a new metric */
+      metric = create_metric(server, key, key_len, type, &created);
+      if (!created)
+        brubeck_cardinality_release(server->cardinality, key, key_len);
+      return metric;
+    }
+
     return brubeck_metric_new(server, key, key_len, type);
   }
 
@@ -292,5 +613,8 @@ struct brubeck_metric *brubeck_metric_find(struct brubeck_server *server,
   brubeck_atomic_inc(&metric->flow);
 #endif
 
+  if (server->hotkeys)
+    brubeck_hotkeys_sample(server->hotkeys, metric);
+
   return metric;
 }
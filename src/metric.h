@@ -7,6 +7,7 @@ enum brubeck_metric_t {
   BRUBECK_MT_COUNTER, /** C */
   BRUBECK_MT_HISTO,   /** h */
   BRUBECK_MT_TIMER,   /** ms */
+  BRUBECK_MT_SET,     /** s */
   BRUBECK_MT_INTERNAL_STATS
 };
 
@@ -26,9 +27,25 @@ enum {
   BRUBECK_STATE_ACTIVE = 2
 };
 
+/*
+ * Output names of a metric (its key plus each of the suffixes it is
+ * sampled with), already encoded in the wire format of the backend the
+ * metric is sharded to. Built lazily on the first flush and kept in
+ * slab memory for the life of the metric; a zero length marks a name the
+ * backend cannot emit.
+ */
+struct brubeck_metric_names {
+  uint16_t count;
+  struct {
+    uint32_t offset;
+    uint32_t len;
+  } name[];
+};
+
 struct brubeck_metric {
   struct brubeck_metric *next;
   const struct brubeck_tag_set *tags;
+  const struct brubeck_metric_names *names;
 
 #ifdef BRUBECK_METRICS_FLOW
   uint64_t flow;
@@ -42,11 +59,16 @@ struct brubeck_metric {
   union {
     struct {
       value_t value;
-    } gauge, meter;
+    } gauge;
+    struct {
+      value_t value;
+      struct brubeck_meter_shard *shards; /* set once the meter is hot */
+    } meter;
     struct {
       value_t value, previous;
     } counter;
     struct brubeck_histo histogram;
+    struct brubeck_hll *set;
     void *other;
   } as;
 
@@ -54,8 +76,8 @@ struct brubeck_metric {
 };
 
 typedef void (*brubeck_sample_cb)(const struct brubeck_metric *metric,
-                                  const char *key, value_t value,
-                                  void *backend);
+                                  const char *name, size_t name_len,
+                                  value_t value, void *backend);
 
 void brubeck_metric_sample(struct brubeck_metric *metric, brubeck_sample_cb cb,
                            void *backend);
@@ -66,8 +88,20 @@ struct brubeck_metric *brubeck_metric_new(struct brubeck_server *server,
                                           const char *, size_t, uint8_t);
 struct brubeck_metric *brubeck_metric_find(struct brubeck_server *server,
                                            const char *, size_t, uint8_t);
+const char *brubeck_metric_ht_key(const struct brubeck_metric *metric,
+                                  size_t *len);
+size_t brubeck_metric_memory(const struct brubeck_metric *metric);
+void brubeck_metric_free(struct brubeck_server *server,
+                         struct brubeck_metric *metric);
+void brubeck_metric_foreach(struct brubeck_server *server,
+                            void (*callback)(struct brubeck_metric *, void *),
+                            void *payload);
 struct brubeck_backend *brubeck_metric_shard(struct brubeck_server *server,
                                              struct brubeck_metric *);
+const struct brubeck_metric_names *
+brubeck_metric_names(struct brubeck_metric *metric,
+                     struct brubeck_backend *backend, const char **suffixes,
+                     size_t count);
 static inline const uint8_t
 brubeck_metric_get_state(const struct brubeck_metric *metric) {
   return __atomic_load_n(&metric->private_state, __ATOMIC_SEQ_CST);
@@ -84,7 +118,16 @@ brubeck_metric_set_state_if_equal(struct brubeck_metric *metric,
   return __atomic_compare_exchange_n(&metric->private_state, &expected, state,
                                      false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
 }
-#define WITH_SUFFIX(suffix)                                                    \
-  memcpy(key + metric->key_len, suffix, strlen(suffix) + 1);
+
+static inline void brubeck_metric_emit(const struct brubeck_metric *metric,
+                                       const struct brubeck_metric_names *names,
+                                       size_t i, value_t value,
+                                       brubeck_sample_cb sample, void *opaque) {
+  const char *blob = (const char *)&names->name[names->count];
+
+  if (names->name[i].len)
+    sample(metric, blob + names->name[i].offset, names->name[i].len, value,
+           opaque);
+}
 
 #endif
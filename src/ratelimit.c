@@ -0,0 +1,218 @@
+#include "brubeck.h"
+
+#define RATELIMIT_PROBE_MAX 8
+
+static void table_init(struct brubeck_ratelimit_table *table, double rate,
+                       double burst, int max_entries) {
+  size_t size = 1;
+
+  table->rate = rate;
+  table->burst = (burst > 0.0) ? burst : rate;
+
+  if (rate <= 0.0)
+    return;
+
+  while (size < (size_t)max_entries)
+    size <<= 1;
+
+  table->buckets = xcalloc(size, sizeof(struct brubeck_token_bucket));
+  table->mask = size - 1;
+}
+
+static struct brubeck_token_bucket *
+bucket_for(struct brubeck_ratelimit_table *table, uint64_t key, uint64_t now) {
+  const size_t start = (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 32);
+  struct brubeck_token_bucket *bucket, *idlest = NULL;
+  size_t i;
+
+  for (i = 0; i < RATELIMIT_PROBE_MAX; ++i) {
+    bucket = &table->buckets[(start + i) & table->mask];
+
+    if (bucket->last == 0)
+      goto init;
+
+    if (bucket->key == key) {
+      bucket->tokens += (double)(now - bucket->last) * table->rate / 1e9;
+      if (bucket->tokens > table->burst)
+        bucket->tokens = table->burst;
+      bucket->last = now;
+      return bucket;
+    }
+
+    if (idlest == NULL || bucket->last < idlest->last)
+      idlest = bucket;
+  }
+
+  bucket = idlest;
+
+init:
+  bucket->key = key;
+  bucket->last = now;
+  bucket->tokens = table->burst;
+  return bucket;
+}
+
+/* Take up to `want` tokens from the bucket, returns how many were taken */
+static size_t bucket_take(struct brubeck_token_bucket *bucket, size_t want) {
+  size_t have = (size_t)bucket->tokens;
+
+  if (want > have)
+    want = have;
+
+  bucket->tokens -= (double)want;
+  return want;
+}
+
+static size_t count_lines(const char *buffer, const char *end) {
+  size_t lines = 0;
+
+  while (buffer < end) {
+    const char *eol = memchr(buffer, '\n', end - buffer);
+    if (!eol)
+      eol = end;
+
+    lines += (eol > buffer);
+    buffer = eol + 1;
+  }
+
+  return lines;
+}
+
+/* The length of the first `segments` segments of the key on a line */
+static size_t prefix_len(const char *line, const char *eol, int segments) {
+  const char *p;
+
+  for (p = line; p < eol; ++p) {
+    if (*p == ':' || *p == '|' || *p == ',' || *p == ' ')
+      break;
+    if (*p == '.' && --segments == 0)
+      break;
+  }
+
+  return p - line;
+}
+
+static size_t limit_source(struct brubeck_ratelimit *ratelimit,
+                           const struct sockaddr_in *source, char *buffer,
+                           char *end, uint64_t now) {
+  struct brubeck_token_bucket *bucket;
+  size_t lines = count_lines(buffer, end), allowed;
+  char *p = buffer;
+
+  bucket = bucket_for(&ratelimit->source, source->sin_addr.s_addr, now);
+  allowed = bucket_take(bucket, lines);
+
+  if (allowed == lines)
+    return end - buffer;
+
+  ratelimit->source_dropped += lines - allowed;
+
+  /* keep the first `allowed` lines */
+  while (allowed) {
+    char *eol = memchr(p, '\n', end - p);
+    if (!eol)
+      eol = end;
+
+    allowed -= (eol > p);
+    p = eol + 1;
+  }
+
+  return (p > buffer) ? (size_t)(p - buffer) - 1 : 0;
+}
+
+/* Drop the lines over their prefix's limit, moving the remaining ones
+ * down over the gaps */
+static size_t limit_prefix(struct brubeck_ratelimit *ratelimit, char *buffer,
+                           char *end, uint64_t now) {
+  char *read = buffer, *write = buffer;
+
+  while (read < end) {
+    char *eol = memchr(read, '\n', end - read);
+    size_t line_len;
+
+    if (!eol)
+      eol = end;
+    line_len = eol - read;
+
+    if (line_len) {
+      const size_t len = prefix_len(read, eol, ratelimit->prefix_segments);
+      struct brubeck_token_bucket *bucket =
+          bucket_for(&ratelimit->prefix, CityHash32(read, len), now);
+
+      if (bucket_take(bucket, 1)) {
+        if (write != buffer)
+          *write++ = '\n';
+        if (write != read)
+          memmove(write, read, line_len);
+        write += line_len;
+      } else {
+        ratelimit->prefix_dropped++;
+      }
+    }
+
+    read = eol + 1;
+  }
+
+  return write - buffer;
+}
+
+/*
+ * Apply the limits to a datagram received from `source` (or NULL for
+ * sockets without addresses) at time `now`, in nanoseconds. Lines over the
+ * limits are dropped in place; returns the length of what is left.
+ */
+size_t brubeck_ratelimit_apply(struct brubeck_ratelimit *ratelimit,
+                               const struct sockaddr_in *source, char *buffer,
+                               size_t len, uint64_t now) {
+  if (source && ratelimit->source.rate > 0.0)
+    len = limit_source(ratelimit, source, buffer, buffer + len, now);
+
+  if (len && ratelimit->prefix.rate > 0.0)
+    len = limit_prefix(ratelimit, buffer, buffer + len, now);
+
+  return len;
+}
+
+struct brubeck_ratelimit *
+brubeck_ratelimit_new(const struct brubeck_ratelimit_config *config) {
+  struct brubeck_ratelimit *ratelimit =
+      xcalloc(1, sizeof(struct brubeck_ratelimit));
+
+  table_init(&ratelimit->source, config->source_rate, config->source_burst,
+             config->max_entries);
+  table_init(&ratelimit->prefix, config->prefix_rate, config->prefix_burst,
+             config->max_entries);
+  ratelimit->prefix_segments = config->prefix_segments;
+  return ratelimit;
+}
+
+/* Load the `rate_limit` object of a sampler, or return NULL if it has none */
+struct brubeck_ratelimit_config *
+brubeck_ratelimit_config_load(json_t *settings, const char *name) {
+  struct brubeck_ratelimit_config *config;
+
+  if (settings == NULL)
+    return NULL;
+
+  config = xcalloc(1, sizeof(struct brubeck_ratelimit_config));
+  config->prefix_segments = 1;
+  config->max_entries = 4096;
+
+  json_unpack_or_die(settings, "{s?:F, s?:F, s?:F, s?:F, s?:i, s?:i}",
+                     "source_rate", &config->source_rate, "source_burst",
+                     &config->source_burst, "prefix_rate",
+                     &config->prefix_rate, "prefix_burst",
+                     &config->prefix_burst, "prefix_segments",
+                     &config->prefix_segments, "max_entries",
+                     &config->max_entries);
+
+  if (config->source_rate < 0.0 || config->prefix_rate < 0.0 ||
+      (config->source_rate == 0.0 && config->prefix_rate == 0.0))
+    die("%s: `rate_limit` needs a positive `source_rate` or `prefix_rate`",
+        name);
+
+  if (config->prefix_segments < 1 || config->max_entries < 1)
+    die("%s: invalid `rate_limit` table size or prefix", name);
+
+  return config;
+}
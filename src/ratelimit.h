@@ -0,0 +1,49 @@
+#ifndef __BRUBECK_RATELIMIT_H__
+#define __BRUBECK_RATELIMIT_H__
+
+struct brubeck_token_bucket {
+  uint64_t key;
+  uint64_t last; /* when it was last refilled, in ns; 0 if unused */
+  double tokens;
+};
+
+/* Fixed-size table of token buckets. When a probe window is full, the
+ * bucket that was idle for the longest is recycled. */
+struct brubeck_ratelimit_table {
+  struct brubeck_token_bucket *buckets;
+  size_t mask;
+  double rate;  /* lines per second, 0 to not limit */
+  double burst; /* bucket size, in lines */
+};
+
+struct brubeck_ratelimit_config {
+  double source_rate, source_burst;
+  double prefix_rate, prefix_burst;
+  int prefix_segments;
+  int max_entries;
+};
+
+/*
+ * Per-worker rate limiter: lines are counted against a bucket for the
+ * address that sent them and, optionally, one for their key prefix (the
+ * first `prefix_segments` dot-separated segments). It is only ever used by
+ * its worker, so it needs no locking.
+ */
+struct brubeck_ratelimit {
+  struct brubeck_ratelimit_table source;
+  struct brubeck_ratelimit_table prefix;
+  int prefix_segments;
+
+  uint64_t source_dropped;
+  uint64_t prefix_dropped;
+};
+
+struct brubeck_ratelimit_config *
+brubeck_ratelimit_config_load(json_t *settings, const char *name);
+struct brubeck_ratelimit *
+brubeck_ratelimit_new(const struct brubeck_ratelimit_config *config);
+size_t brubeck_ratelimit_apply(struct brubeck_ratelimit *ratelimit,
+                               const struct sockaddr_in *source, char *buffer,
+                               size_t len, uint64_t now);
+
+#endif
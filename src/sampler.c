@@ -1,5 +1,11 @@
+#include <linux/filter.h>
+
 #include "brubeck.h"
 
+#ifndef SO_ATTACH_REUSEPORT_CBPF
+#define SO_ATTACH_REUSEPORT_CBPF 51
+#endif
+
 void brubeck_sampler_init_inet(struct brubeck_sampler *sampler,
                                struct brubeck_server *server, const char *url,
                                int port) {
@@ -11,8 +17,14 @@ void brubeck_sampler_init_inet(struct brubeck_sampler *sampler,
 }
 
 int brubeck_sampler_socket(struct brubeck_sampler *sampler, int multisock) {
-  int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  struct brubeck_upgrade *upgrade = &sampler->server->upgrade;
+  int sock = brubeck_upgrade_inherit(upgrade, SOCK_DGRAM,
+                                     (struct sockaddr *)&sampler->addr);
 
+  if (sock >= 0)
+    goto done;
+
+  sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
   assert(sock >= 0);
 
   sock_enlarge_in(sock);
@@ -24,5 +36,110 @@ int brubeck_sampler_socket(struct brubeck_sampler *sampler, int multisock) {
   if (bind(sock, (struct sockaddr *)&sampler->addr, sizeof(sampler->addr)) < 0)
     die("failed to bind socket");
 
+done:
+  brubeck_upgrade_register(upgrade, sock);
+  return sock;
+}
+
+/*
+ * Attach a classic BPF program to the SO_REUSEPORT group of `sock` that
+ * hands each packet to the socket at the index of the core that received
+ * it in `cpus` (the group keeps sockets in the order they were bound).
+ * Packets received on other cores are spread by core number.
+ *
+ *      ld cpu
+ *      jeq #cpus[i], ret_i     ; for each core
+ *      mod #count
+ *      ret a
+ *  ret_i:
+ *      ret #i                  ; for each core
+ */
+int brubeck_sampler_steer_cpus(int sock, const int *cpus, unsigned int count) {
+  struct sock_filter code[2 * BRUBECK_STEER_CPUS_MAX + 3];
+  struct sock_fprog prog;
+  unsigned int i, len = 0;
+
+  assert(count > 0 && count <= BRUBECK_STEER_CPUS_MAX);
+
+  code[len++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+                                             SKF_AD_OFF + SKF_AD_CPU);
+
+  /* every jeq is `count + 1` instructions away from its ret */
+  for (i = 0; i < count; ++i)
+    code[len++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+                                               (uint32_t)cpus[i], count + 1, 0);
+
+  code[len++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, count);
+  code[len++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_A, 0);
+
+  for (i = 0; i < count; ++i)
+    code[len++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, i);
+
+  prog.len = (unsigned short)len;
+  prog.filter = code;
+
+  return setsockopt(sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog,
+                    sizeof(prog));
+}
+
+void brubeck_sampler_init_unix(struct brubeck_sampler *sampler,
+                               struct brubeck_server *server,
+                               const char *path) {
+  struct sockaddr_un un;
+
+  if (strlen(path) >= sizeof(un.sun_path))
+    die("socket path too long: %s", path);
+
+  sampler->server = server;
+  sampler->path = path;
+
+  log_splunk("sampler=%s event=load_unix path=%s",
+             brubeck_sampler_name(sampler), path);
+}
+
+int brubeck_sampler_socket_unix(struct brubeck_sampler *sampler, mode_t mode,
+                                int rcvbuf) {
+  struct brubeck_upgrade *upgrade = &sampler->server->upgrade;
+  struct sockaddr_un un;
+  struct stat st;
+  int sock;
+
+  memset(&un, 0x0, sizeof(un));
+  un.sun_family = AF_UNIX;
+  strncpy(un.sun_path, sampler->path, sizeof(un.sun_path) - 1);
+
+  /* an inherited socket is still bound to the file, which must stay */
+  sock = brubeck_upgrade_inherit(upgrade, SOCK_DGRAM, (struct sockaddr *)&un);
+  if (sock >= 0)
+    goto done;
+
+  sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+  assert(sock >= 0);
+
+  if (rcvbuf > 0)
+    sock_setrcvbuf(sock, rcvbuf);
+  else
+    sock_enlarge_in(sock);
+
+  /* a stale socket left behind by a previous run would fail the bind;
+   * anything else at the path is not ours to remove */
+  if (lstat(sampler->path, &st) == 0) {
+    if (!S_ISSOCK(st.st_mode))
+      die("%s exists and is not a socket", sampler->path);
+
+    if (unlink(sampler->path) < 0 && errno != ENOENT)
+      die("failed to remove stale socket %s", sampler->path);
+  } else if (errno != ENOENT) {
+    die("failed to stat socket %s", sampler->path);
+  }
+
+  if (bind(sock, (struct sockaddr *)&un, sizeof(un)) < 0)
+    die("failed to bind socket %s", sampler->path);
+
+  if (chmod(sampler->path, mode) < 0)
+    die("failed to set permissions on socket %s", sampler->path);
+
+done:
+  brubeck_upgrade_register(upgrade, sock);
   return sock;
 }
@@ -3,6 +3,15 @@
 
 enum brubeck_sampler_t {
   BRUBECK_SAMPLER_STATSD,
+  BRUBECK_SAMPLER_STATSD_UNIX,
+  BRUBECK_SAMPLER_STATSD_SHM,
+  BRUBECK_SAMPLER_STATSD_TCP,
+  BRUBECK_SAMPLER_BINARY,
+  BRUBECK_SAMPLER_BINARY_UNIX,
+  BRUBECK_SAMPLER_GRAPHITE,
+  BRUBECK_SAMPLER_GRAPHITE_PICKLE,
+  BRUBECK_SAMPLER_INFLUX,
+  BRUBECK_SAMPLER_INFLUX_TCP,
 };
 
 struct brubeck_sampler {
@@ -11,6 +20,7 @@ struct brubeck_sampler {
 
   int in_sock;
   struct sockaddr_in addr;
+  const char *path; /* AF_UNIX and shared memory samplers only */
 
   size_t inflow;
   size_t current_flow;
@@ -18,21 +28,52 @@ struct brubeck_sampler {
   void (*shutdown)(struct brubeck_sampler *);
 };
 
+#define BRUBECK_STEER_CPUS_MAX 128
+
 int brubeck_sampler_socket(struct brubeck_sampler *sampler, int multisock);
+int brubeck_sampler_steer_cpus(int sock, const int *cpus, unsigned int count);
+int brubeck_sampler_socket_unix(struct brubeck_sampler *sampler, mode_t mode,
+                                int rcvbuf);
 void brubeck_sampler_init_inet(struct brubeck_sampler *sampler,
                                struct brubeck_server *server, const char *url,
                                int port);
+void brubeck_sampler_init_unix(struct brubeck_sampler *sampler,
+                               struct brubeck_server *server,
+                               const char *path);
 
 static inline const char *
 brubeck_sampler_name(struct brubeck_sampler *sampler) {
   switch (sampler->type) {
   case BRUBECK_SAMPLER_STATSD:
     return "statsd";
+  case BRUBECK_SAMPLER_STATSD_UNIX:
+    return "statsd-unix";
+  case BRUBECK_SAMPLER_STATSD_SHM:
+    return "statsd-shm";
+  case BRUBECK_SAMPLER_STATSD_TCP:
+    return "statsd-tcp";
+  case BRUBECK_SAMPLER_BINARY:
+    return "binary";
+  case BRUBECK_SAMPLER_BINARY_UNIX:
+    return "binary-unix";
+  case BRUBECK_SAMPLER_GRAPHITE:
+    return "graphite";
+  case BRUBECK_SAMPLER_GRAPHITE_PICKLE:
+    return "graphite-pickle";
+  case BRUBECK_SAMPLER_INFLUX:
+    return "influx";
+  case BRUBECK_SAMPLER_INFLUX_TCP:
+    return "influx-tcp";
   default:
     return NULL;
   }
 }
 
+#include "samplers/binary.h"
+#include "samplers/shm.h"
 #include "samplers/statsd.h"
+#include "samplers/statsd_tcp.h"
+#include "samplers/graphite.h"
+#include "samplers/influx.h"
 
 #endif
@@ -0,0 +1,429 @@
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+
+#include "brubeck.h"
+
+#define MAX_PACKET_SIZE 8192
+#define REPLY_SIZE 16
+
+static int binary_metric_type(uint8_t type) {
+  switch (type) {
+  case BRUBECK_BIN_GAUGE:
+    return BRUBECK_MT_GAUGE;
+  case BRUBECK_BIN_METER:
+    return BRUBECK_MT_METER;
+  case BRUBECK_BIN_COUNTER:
+    return BRUBECK_MT_COUNTER;
+  case BRUBECK_BIN_HISTO:
+  case BRUBECK_BIN_DISTRIBUTION:
+    return BRUBECK_MT_HISTO;
+  case BRUBECK_BIN_TIMER:
+    return BRUBECK_MT_TIMER;
+  default:
+    return -1;
+  }
+}
+
+static inline uint32_t index_slot(struct brubeck_binary *bin,
+                                  const struct brubeck_metric *metric) {
+  uint64_t h = (uint64_t)(uintptr_t)metric * 0x9E3779B97F4A7C15ULL;
+  return (uint32_t)(h >> 32) & (2 * bin->capacity - 1);
+}
+
+void brubeck_binary_dict_init(struct brubeck_binary *bin, uint32_t capacity) {
+  struct timespec now;
+
+  if (capacity == 0 || capacity > (1u << 30) || (capacity & (capacity - 1)))
+    die("binary sampler: max_keys must be a power of two");
+
+  bin->capacity = capacity;
+  bin->count = 0;
+  bin->keys = xcalloc(capacity, sizeof(struct brubeck_metric *));
+  bin->index = xcalloc(2 * (size_t)capacity, sizeof(uint32_t));
+  pthread_mutex_init(&bin->lock, NULL);
+
+  /* ids handed out by a previous run must not resolve against ours */
+  clock_gettime(CLOCK_REALTIME, &now);
+  bin->epoch = (uint32_t)(now.tv_sec ^ (now.tv_nsec << 2) ^ (getpid() << 16));
+}
+
+/* Whether the dictionary hands out an id for `metric`; with `bin->lock`
+ * held. Such metrics must never be evicted. */
+bool brubeck_binary_holds(struct brubeck_binary *bin,
+                          const struct brubeck_metric *metric) {
+  uint32_t slot;
+
+  for (slot = index_slot(bin, metric); bin->index[slot];
+       slot = (slot + 1) & (2 * bin->capacity - 1)) {
+    if (bin->keys[bin->index[slot] - 1] == metric)
+      return true;
+  }
+
+  return false;
+}
+
+/* Returns the id of a key, registering it if needed */
+static uint32_t binary_register(struct brubeck_binary *bin, const char *key,
+                                size_t key_len, uint8_t type) {
+  char key_buf[BRUBECK_BIN_KEY_MAX + 1];
+  struct brubeck_metric *metric;
+  int mt = binary_metric_type(type);
+  uint32_t id = BRUBECK_BIN_INVALID_ID;
+  uint32_t slot;
+  const char *found_key;
+  size_t found_len;
+  bool retried = false;
+
+  if (mt < 0 || key_len == 0 || key_len > BRUBECK_BIN_KEY_MAX ||
+      memchr(key, '\0', key_len))
+    return BRUBECK_BIN_INVALID_ID;
+
+  memcpy(key_buf, key, key_len);
+  key_buf[key_len] = '\0';
+
+retry:
+  metric = brubeck_metric_find(bin->sampler.server, key_buf, key_len, mt);
+  if (metric == NULL || metric->type != mt)
+    return BRUBECK_BIN_INVALID_ID;
+
+  /* a key over its cardinality budget can be folded into the overflow
+   * metric of its prefix, which must not be given the id of the key */
+  found_key = brubeck_metric_ht_key(metric, &found_len);
+  if (found_len != key_len || memcmp(found_key, key_buf, key_len))
+    return BRUBECK_BIN_INVALID_ID;
+
+  pthread_mutex_lock(&bin->lock);
+  {
+    /* evictions happen under this lock: once it is held, a metric that is
+     * still in the table stays there for as long as it holds an id. One
+     * that was evicted in between is looked up once more. */
+    if (brubeck_hashtable_find(bin->sampler.server->metrics, key_buf,
+                               key_len) != metric) {
+      pthread_mutex_unlock(&bin->lock);
+      if (retried)
+        return BRUBECK_BIN_INVALID_ID;
+      retried = true;
+      goto retry;
+    }
+
+    for (slot = index_slot(bin, metric); bin->index[slot];
+         slot = (slot + 1) & (2 * bin->capacity - 1)) {
+      if (bin->keys[bin->index[slot] - 1] == metric) {
+        id = bin->index[slot] - 1;
+        break;
+      }
+    }
+
+    if (id == BRUBECK_BIN_INVALID_ID && bin->count < bin->capacity) {
+      id = bin->count;
+      bin->keys[id] = metric;
+      bin->index[slot] = id + 1;
+
+      /* publish the slot before readers can see the new id */
+      __atomic_store_n(&bin->count, id + 1, __ATOMIC_RELEASE);
+    }
+  }
+  pthread_mutex_unlock(&bin->lock);
+
+  return id;
+}
+
+static size_t binary_parse_register(struct brubeck_binary *bin,
+                                    const char *buffer, size_t len,
+                                    char *reply) {
+  const struct brubeck_bin_register *reg =
+      (const struct brubeck_bin_register *)buffer;
+  struct brubeck_bin_registered *registered =
+      (struct brubeck_bin_registered *)reply;
+  uint32_t id = BRUBECK_BIN_INVALID_ID;
+
+  if (len >= sizeof(struct brubeck_bin_register) &&
+      len == sizeof(struct brubeck_bin_register) + le16toh(reg->key_len))
+    id = binary_register(bin, reg->key, le16toh(reg->key_len), reg->type);
+
+  if (id == BRUBECK_BIN_INVALID_ID) {
+    brubeck_atomic_inc(&bin->rejected);
+    brubeck_stats_inc(bin->sampler.server, errors);
+  } else {
+    brubeck_atomic_inc(&bin->registered);
+  }
+
+  if (len < sizeof(struct brubeck_bin_register))
+    return 0;
+
+  brubeck_bin_header_init(&registered->header, BRUBECK_BIN_REGISTERED);
+  registered->cookie = reg->cookie;
+  registered->id = htole32(id);
+  registered->epoch = htole32(bin->epoch);
+  return sizeof(struct brubeck_bin_registered);
+}
+
+static size_t binary_parse_records(struct brubeck_binary *bin,
+                                   const char *buffer, size_t len,
+                                   char *reply) {
+  struct brubeck_server *server = bin->sampler.server;
+  const struct brubeck_bin_records *records =
+      (const struct brubeck_bin_records *)buffer;
+  const struct brubeck_bin_record *record, *end;
+  uint32_t count;
+
+  if (len < sizeof(struct brubeck_bin_records) ||
+      (len - sizeof(struct brubeck_bin_records)) %
+          sizeof(struct brubeck_bin_record)) {
+    brubeck_stats_inc(server, errors);
+    return 0;
+  }
+
+  if (le32toh(records->epoch) != bin->epoch) {
+    struct brubeck_bin_stale *stale = (struct brubeck_bin_stale *)reply;
+
+    brubeck_atomic_inc(&bin->stale);
+    brubeck_stats_inc(server, errors);
+
+    brubeck_bin_header_init(&stale->header, BRUBECK_BIN_STALE);
+    stale->epoch = htole32(bin->epoch);
+    return sizeof(struct brubeck_bin_stale);
+  }
+
+  count = __atomic_load_n(&bin->count, __ATOMIC_ACQUIRE);
+  record = (const struct brubeck_bin_record *)(records + 1);
+  end = (const struct brubeck_bin_record *)(buffer + len);
+
+  for (; record < end; ++record) {
+    const uint32_t id = le32toh(record->id);
+    struct brubeck_metric *metric;
+    value_t value, sample_rate;
+
+    if (unlikely(id >= count)) {
+      brubeck_stats_inc(server, errors);
+      continue;
+    }
+
+    metric = bin->keys[id];
+    if (unlikely(metric->type != binary_metric_type(record->type))) {
+      brubeck_stats_inc(server, errors);
+      continue;
+    }
+
+    sample_rate = brubeck_bin_bits_float(record->sample_rate);
+    if (sample_rate <= 0.0 || sample_rate > 1.0) {
+      brubeck_stats_inc(server, errors);
+      continue;
+    }
+
+    value = brubeck_bin_bits_double(record->value);
+    if (metric->type == BRUBECK_MT_TIMER)
+      value *= bin->scale_timers_by;
+
+    brubeck_stats_inc(server, metrics);
+    brubeck_metric_record(metric, value, 1.0 / sample_rate,
+                          (record->flags & BRUBECK_BIN_RELATIVE)
+                              ? BRUBECK_MOD_RELATIVE_VALUE
+                              : 0);
+  }
+
+  return 0;
+}
+
+/*
+ * Handle a single packet. Returns the length of the reply written into
+ * `reply` (at least REPLY_SIZE bytes), or 0 if there is nothing to send.
+ */
+size_t brubeck_binary_packet_parse(struct brubeck_binary *bin,
+                                   const char *buffer, size_t len,
+                                   char *reply) {
+  switch (brubeck_bin_kind(buffer, len)) {
+  case BRUBECK_BIN_RECORDS:
+    return binary_parse_records(bin, buffer, len, reply);
+  case BRUBECK_BIN_REGISTER:
+    return binary_parse_register(bin, buffer, len, reply);
+  default:
+    brubeck_stats_inc(bin->sampler.server, errors);
+    log_splunk("sampler=%s event=packet_drop",
+               brubeck_sampler_name(&bin->sampler));
+    return 0;
+  }
+}
+
+static void binary_run(struct brubeck_binary *bin, int sock) {
+  const unsigned int SIM_PACKETS = bin->mmsg_count;
+  struct brubeck_server *server = bin->sampler.server;
+  struct brubeck_reader *reader = brubeck_reader_register(server);
+
+  unsigned int i;
+  struct iovec iovecs[SIM_PACKETS];
+  struct mmsghdr msgs[SIM_PACKETS];
+  struct sockaddr_storage names[SIM_PACKETS];
+  char reply[REPLY_SIZE];
+
+  ct_assert(sizeof(struct brubeck_bin_registered) <= REPLY_SIZE);
+  ct_assert(sizeof(struct brubeck_bin_stale) <= REPLY_SIZE);
+
+  memset(msgs, 0x0, sizeof(msgs));
+
+  for (i = 0; i < SIM_PACKETS; ++i) {
+    iovecs[i].iov_base = xmalloc(MAX_PACKET_SIZE);
+    iovecs[i].iov_len = MAX_PACKET_SIZE;
+    msgs[i].msg_hdr.msg_iov = &iovecs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+    msgs[i].msg_hdr.msg_name = &names[i];
+  }
+
+  log_splunk("sampler=%s event=worker_online syscall=recvmmsg socket=%d",
+             brubeck_sampler_name(&bin->sampler), sock);
+
+  for (;;) {
+    int res;
+
+    for (i = 0; i < SIM_PACKETS; ++i)
+      msgs[i].msg_hdr.msg_namelen = sizeof(names[i]);
+
+    brubeck_reader_offline(reader);
+    res = recvmmsg(sock, msgs, SIM_PACKETS, MSG_WAITFORONE, NULL);
+    brubeck_reader_online(reader);
+
+    if (res < 0) {
+      if (errno == EAGAIN || errno == EINTR)
+        continue;
+
+      log_splunk_errno("sampler=%s event=failed_read",
+                       brubeck_sampler_name(&bin->sampler));
+      brubeck_stats_inc(server, errors);
+      continue;
+    }
+
+    brubeck_atomic_add(&bin->sampler.inflow, res);
+
+    for (i = 0; i < res; ++i) {
+      const struct msghdr *hdr = &msgs[i].msg_hdr;
+      size_t reply_len = brubeck_binary_packet_parse(
+          bin, hdr->msg_iov->iov_base, msgs[i].msg_len, reply);
+
+      /* unbound AF_UNIX clients cannot be answered */
+      if (reply_len && hdr->msg_namelen > sizeof(sa_family_t))
+        sendto(sock, reply, reply_len, MSG_DONTWAIT, hdr->msg_name,
+               hdr->msg_namelen);
+    }
+  }
+}
+
+static void *binary__thread(void *_in) {
+  struct brubeck_binary *bin = _in;
+  int sock = bin->sampler.in_sock;
+
+#ifdef SO_REUSEPORT
+  if (sock < 0) {
+    sock = brubeck_sampler_socket(&bin->sampler, 1);
+  }
+#endif
+
+  assert(sock >= 0);
+  binary_run(bin, sock);
+  return NULL;
+}
+
+static void run_worker_threads(struct brubeck_binary *bin) {
+  unsigned int i;
+  bin->workers = xmalloc(bin->worker_count * sizeof(pthread_t));
+
+  for (i = 0; i < bin->worker_count; ++i) {
+    if (pthread_create(&bin->workers[i], NULL, &binary__thread, bin) != 0)
+      die("failed to start sampler thread");
+  }
+}
+
+static void shutdown_sampler(struct brubeck_sampler *sampler) {
+  struct brubeck_binary *bin = (struct brubeck_binary *)sampler;
+  size_t i;
+
+  for (i = 0; i < bin->worker_count; ++i) {
+    pthread_cancel(bin->workers[i]);
+  }
+
+  /* after an upgrade, the new process is bound to the same file */
+  if (sampler->path && !sampler->server->upgrade.handed_off)
+    unlink(sampler->path);
+}
+
+static struct brubeck_binary *binary_alloc(enum brubeck_sampler_t type) {
+  struct brubeck_binary *bin = xcalloc(1, sizeof(struct brubeck_binary));
+
+  bin->sampler.type = type;
+  bin->sampler.shutdown = &shutdown_sampler;
+  bin->sampler.in_sock = -1;
+  bin->worker_count = 4;
+  bin->mmsg_count = 8;
+  bin->scale_timers_by = 1.;
+
+  return bin;
+}
+
+struct brubeck_sampler *brubeck_binary_new(struct brubeck_server *server,
+                                           json_t *settings) {
+  struct brubeck_binary *bin = binary_alloc(BRUBECK_SAMPLER_BINARY);
+
+  char *address;
+  int port;
+  int multisock = 0;
+  int max_keys = 65536;
+
+  json_unpack_or_die(settings, "{s:s, s:i, s?:i, s?:i, s?:b, s?:i, s?:F}",
+                     "address", &address, "port", &port, "workers",
+                     &bin->worker_count, "multimsg", &bin->mmsg_count,
+                     "multisock", &multisock, "max_keys", &max_keys,
+                     "scale_timers_by", &bin->scale_timers_by);
+
+  brubeck_sampler_init_inet(&bin->sampler, server, address, port);
+  brubeck_binary_dict_init(bin, (uint32_t)max_keys);
+
+#ifndef SO_REUSEPORT
+  multisock = 0;
+#endif
+
+  if (!multisock)
+    bin->sampler.in_sock = brubeck_sampler_socket(&bin->sampler, 0);
+
+  run_worker_threads(bin);
+  return &bin->sampler;
+}
+
+struct brubeck_sampler *brubeck_binary_unix_new(struct brubeck_server *server,
+                                                json_t *settings) {
+  struct brubeck_binary *bin = binary_alloc(BRUBECK_SAMPLER_BINARY_UNIX);
+
+  char *path;
+  char *mode = "0666";
+  int rcvbuf = 0;
+  int max_keys = 65536;
+  long perms;
+
+  json_unpack_or_die(settings, "{s:s, s?:s, s?:i, s?:i, s?:i, s?:i, s?:F}",
+                     "path", &path, "mode", &mode, "rcvbuf", &rcvbuf,
+                     "workers", &bin->worker_count, "multimsg",
+                     &bin->mmsg_count, "max_keys", &max_keys,
+                     "scale_timers_by", &bin->scale_timers_by);
+
+  perms = strtol(mode, NULL, 8);
+  if (perms <= 0 || perms > 0777)
+    die("invalid socket mode '%s'", mode);
+
+  brubeck_sampler_init_unix(&bin->sampler, server, path);
+  brubeck_binary_dict_init(bin, (uint32_t)max_keys);
+
+  bin->sampler.in_sock =
+      brubeck_sampler_socket_unix(&bin->sampler, (mode_t)perms, rcvbuf);
+
+  run_worker_threads(bin);
+  return &bin->sampler;
+}
+
+json_t *brubeck_binary_stats(struct brubeck_binary *bin) {
+  return json_pack("{s:i, s:i, s:I, s:I, s:I}", "keys",
+                   (int)__atomic_load_n(&bin->count, __ATOMIC_ACQUIRE),
+                   "max_keys", (int)bin->capacity, "registered",
+                   (json_int_t)bin->registered, "rejected",
+                   (json_int_t)bin->rejected, "stale",
+                   (json_int_t)bin->stale);
+}
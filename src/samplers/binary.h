@@ -0,0 +1,40 @@
+#ifndef __BRUBECK_BINARY_H__
+#define __BRUBECK_BINARY_H__
+
+#include "binary_proto.h"
+
+struct brubeck_binary {
+  struct brubeck_sampler sampler;
+  pthread_t *workers;
+  unsigned int worker_count;
+  unsigned int mmsg_count;
+  double scale_timers_by;
+  uint32_t epoch;
+
+  /* key dictionary: ids index `keys` directly; `index` maps a metric back
+   * to its id so that registering a key twice hands out the same id */
+  struct brubeck_metric **keys;
+  uint32_t *index;
+  uint32_t capacity;
+  uint32_t count;
+  pthread_mutex_t lock;
+
+  size_t registered;
+  size_t rejected;
+  size_t stale;
+};
+
+void brubeck_binary_dict_init(struct brubeck_binary *bin, uint32_t capacity);
+bool brubeck_binary_holds(struct brubeck_binary *bin,
+                          const struct brubeck_metric *metric);
+size_t brubeck_binary_packet_parse(struct brubeck_binary *bin,
+                                   const char *buffer, size_t len,
+                                   char *reply);
+
+struct brubeck_sampler *brubeck_binary_new(struct brubeck_server *server,
+                                           json_t *settings);
+struct brubeck_sampler *brubeck_binary_unix_new(struct brubeck_server *server,
+                                                json_t *settings);
+json_t *brubeck_binary_stats(struct brubeck_binary *bin);
+
+#endif
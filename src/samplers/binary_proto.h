@@ -0,0 +1,237 @@
+#ifndef __BRUBECK_BINARY_PROTO_H__
+#define __BRUBECK_BINARY_PROTO_H__
+
+/*
+ * Compact binary ingestion protocol.
+ *
+ * Clients register each key once and get back a 32-bit id; from then on
+ * they send packed fixed-size records that brubeck resolves with an array
+ * index instead of parsing and hashing the key. All integers and floats
+ * are little-endian on the wire.
+ *
+ *   REGISTER   client -> brubeck   header, cookie, type, key_len, key
+ *   REGISTERED brubeck -> client   header, cookie, id, epoch
+ *   RECORDS    client -> brubeck   header, epoch, record[]
+ *   STALE      brubeck -> client   header, epoch
+ *
+ * The epoch identifies the dictionary that handed out the ids. It changes
+ * every time brubeck starts: a RECORDS packet carrying an old epoch is
+ * dropped and answered with STALE, telling the client to register its
+ * keys again. A rejected registration (the dictionary is full, or the key
+ * is invalid) is answered with BRUBECK_BIN_INVALID_ID.
+ *
+ * This header is self-contained so that clients can copy it into their
+ * own tree; it doubles as the reference encoder.
+ */
+
+#include <endian.h>
+#include <stdint.h>
+#include <string.h>
+
+#define BRUBECK_BIN_MAGIC 0xB7
+#define BRUBECK_BIN_VERSION 1
+#define BRUBECK_BIN_KEY_MAX 1024
+#define BRUBECK_BIN_INVALID_ID 0xFFFFFFFF
+
+enum brubeck_bin_kind {
+  BRUBECK_BIN_REGISTER = 1,
+  BRUBECK_BIN_REGISTERED = 2,
+  BRUBECK_BIN_RECORDS = 3,
+  BRUBECK_BIN_STALE = 4,
+};
+
+/* metric types, using their statsd letters */
+enum brubeck_bin_type {
+  BRUBECK_BIN_GAUGE = 'g',
+  BRUBECK_BIN_METER = 'c',
+  BRUBECK_BIN_COUNTER = 'C',
+  BRUBECK_BIN_HISTO = 'h',
+  BRUBECK_BIN_TIMER = 'm',
+  BRUBECK_BIN_DISTRIBUTION = 'd',
+};
+
+/* record flags */
+#define BRUBECK_BIN_RELATIVE 0x1 /* gauge delta, like `+1|g` */
+
+struct brubeck_bin_header {
+  uint8_t magic;
+  uint8_t version;
+  uint8_t kind;
+  uint8_t _reserved;
+} __attribute__((packed));
+
+struct brubeck_bin_register {
+  struct brubeck_bin_header header;
+  uint32_t cookie; /* echoed back in the reply */
+  uint8_t type;
+  uint8_t _reserved;
+  uint16_t key_len;
+  char key[];
+} __attribute__((packed));
+
+struct brubeck_bin_registered {
+  struct brubeck_bin_header header;
+  uint32_t cookie;
+  uint32_t id;
+  uint32_t epoch;
+} __attribute__((packed));
+
+struct brubeck_bin_records {
+  struct brubeck_bin_header header;
+  uint32_t epoch;
+} __attribute__((packed));
+
+struct brubeck_bin_record {
+  uint32_t id;
+  uint8_t type;
+  uint8_t flags;
+  uint16_t _reserved;
+  uint32_t sample_rate; /* float in (0.0, 1.0] */
+  uint64_t value;       /* double */
+} __attribute__((packed));
+
+struct brubeck_bin_stale {
+  struct brubeck_bin_header header;
+  uint32_t epoch;
+} __attribute__((packed));
+
+static inline void brubeck_bin_header_init(struct brubeck_bin_header *header,
+                                           enum brubeck_bin_kind kind) {
+  header->magic = BRUBECK_BIN_MAGIC;
+  header->version = BRUBECK_BIN_VERSION;
+  header->kind = (uint8_t)kind;
+  header->_reserved = 0;
+}
+
+/* Returns the kind of a packet, or 0 if it is not a valid packet */
+static inline int brubeck_bin_kind(const void *packet, size_t len) {
+  const struct brubeck_bin_header *header =
+      (const struct brubeck_bin_header *)packet;
+
+  if (len < sizeof(struct brubeck_bin_header) ||
+      header->magic != BRUBECK_BIN_MAGIC ||
+      header->version != BRUBECK_BIN_VERSION)
+    return 0;
+
+  return header->kind;
+}
+
+static inline uint64_t brubeck_bin_double_bits(double d) {
+  uint64_t bits;
+  memcpy(&bits, &d, sizeof(bits));
+  return htole64(bits);
+}
+
+static inline double brubeck_bin_bits_double(uint64_t bits) {
+  double d;
+  bits = le64toh(bits);
+  memcpy(&d, &bits, sizeof(d));
+  return d;
+}
+
+static inline uint32_t brubeck_bin_float_bits(float f) {
+  uint32_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+  return htole32(bits);
+}
+
+static inline float brubeck_bin_bits_float(uint32_t bits) {
+  float f;
+  bits = le32toh(bits);
+  memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+/*
+ * Encode a registration request into `buf`. Returns the packet length, or
+ * 0 if the key is empty, too long, or does not fit in `size` bytes.
+ */
+static inline size_t brubeck_bin_register_encode(void *buf, size_t size,
+                                                 uint32_t cookie,
+                                                 enum brubeck_bin_type type,
+                                                 const char *key,
+                                                 size_t key_len) {
+  struct brubeck_bin_register *reg = (struct brubeck_bin_register *)buf;
+  const size_t len = sizeof(struct brubeck_bin_register) + key_len;
+
+  if (key_len == 0 || key_len > BRUBECK_BIN_KEY_MAX || len > size)
+    return 0;
+
+  brubeck_bin_header_init(&reg->header, BRUBECK_BIN_REGISTER);
+  reg->cookie = htole32(cookie);
+  reg->type = (uint8_t)type;
+  reg->_reserved = 0;
+  reg->key_len = htole16((uint16_t)key_len);
+  memcpy(reg->key, key, key_len);
+  return len;
+}
+
+/* Decode a registration reply. Returns 0 on success, -1 if malformed */
+static inline int brubeck_bin_registered_decode(const void *packet, size_t len,
+                                                uint32_t *cookie, uint32_t *id,
+                                                uint32_t *epoch) {
+  const struct brubeck_bin_registered *reply =
+      (const struct brubeck_bin_registered *)packet;
+
+  if (brubeck_bin_kind(packet, len) != BRUBECK_BIN_REGISTERED ||
+      len < sizeof(struct brubeck_bin_registered))
+    return -1;
+
+  *cookie = le32toh(reply->cookie);
+  *id = le32toh(reply->id);
+  *epoch = le32toh(reply->epoch);
+  return 0;
+}
+
+/*
+ * Incremental encoder for RECORDS packets:
+ *
+ *     struct brubeck_bin_writer w;
+ *     brubeck_bin_records_begin(&w, buf, sizeof(buf), epoch);
+ *     while (brubeck_bin_records_push(&w, id, BRUBECK_BIN_METER, 1.0, 1.0, 0))
+ *       ...
+ *     send(sock, buf, w.len, 0);
+ */
+struct brubeck_bin_writer {
+  char *buf;
+  size_t size;
+  size_t len;
+};
+
+static inline void brubeck_bin_records_begin(struct brubeck_bin_writer *w,
+                                             void *buf, size_t size,
+                                             uint32_t epoch) {
+  struct brubeck_bin_records *records = (struct brubeck_bin_records *)buf;
+
+  brubeck_bin_header_init(&records->header, BRUBECK_BIN_RECORDS);
+  records->epoch = htole32(epoch);
+
+  w->buf = (char *)buf;
+  w->size = size;
+  w->len = sizeof(struct brubeck_bin_records);
+}
+
+/* Returns 1 if the record was appended, 0 if the packet is full */
+static inline int brubeck_bin_records_push(struct brubeck_bin_writer *w,
+                                           uint32_t id,
+                                           enum brubeck_bin_type type,
+                                           double value, float sample_rate,
+                                           uint8_t flags) {
+  struct brubeck_bin_record *record;
+
+  if (w->len + sizeof(struct brubeck_bin_record) > w->size)
+    return 0;
+
+  record = (struct brubeck_bin_record *)(w->buf + w->len);
+  record->id = htole32(id);
+  record->type = (uint8_t)type;
+  record->flags = flags;
+  record->_reserved = 0;
+  record->sample_rate = brubeck_bin_float_bits(sample_rate);
+  record->value = brubeck_bin_double_bits(value);
+
+  w->len += sizeof(struct brubeck_bin_record);
+  return 1;
+}
+
+#endif
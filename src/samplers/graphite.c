@@ -0,0 +1,714 @@
+#define _GNU_SOURCE
+#include <time.h>
+
+#include "brubeck.h"
+
+#define GRAPHITE_KEY_MAX 1024
+#define PICKLE_STACK_MAX 64
+#define PICKLE_MEMO_MAX (1 << 20)
+
+static void graphite_invalid(struct brubeck_graphite *graphite) {
+  brubeck_atomic_inc(&graphite->invalid);
+  brubeck_stats_inc(graphite->tcp.sampler.server, errors);
+}
+
+/*
+ * Handle a single point. `name` must be NUL-terminated. Points are either
+ * recorded as gauges, or queued untouched for the carbon backends.
+ */
+static void graphite_point(struct brubeck_graphite *graphite, char *name,
+                           size_t name_len, double timestamp, value_t value) {
+  struct brubeck_server *server = graphite->tcp.sampler.server;
+
+  if (name_len == 0 || name_len > GRAPHITE_KEY_MAX || !isfinite(value)) {
+    graphite_invalid(graphite);
+    return;
+  }
+
+  if (brubeck_denylist_drop(server->denylist, name, name_len))
+    return;
+
+  brubeck_atomic_inc(&graphite->points);
+  brubeck_stats_inc(server, metrics);
+
+  if (graphite->passthrough) {
+    if (timestamp <= 0.0 || timestamp > (double)UINT32_MAX)
+      timestamp = (double)time(NULL);
+
+    if (!brubeck_carbon_passthrough(server, name, name_len, value,
+                                    (uint32_t)timestamp))
+      brubeck_atomic_inc(&graphite->dropped);
+  } else {
+    struct brubeck_metric *metric =
+        brubeck_metric_find(server, name, name_len, BRUBECK_MT_GAUGE);
+
+    if (metric != NULL)
+      brubeck_metric_record(metric, value, 1.0, 0);
+  }
+}
+
+/*********************************************
+ * Plaintext protocol
+ *
+ *      path.to.metric 42.5 1500000000\n
+ *********************************************/
+void brubeck_graphite_line(struct brubeck_graphite *graphite, char *line,
+                           char *end) {
+  char *name, *sep, *ptr;
+  double value, timestamp = -1.0;
+
+  if (end > line && end[-1] == '\r')
+    end--;
+  *end = '\0';
+
+  while (*line == ' ' || *line == '\t')
+    line++;
+
+  if (*line == '\0')
+    return;
+
+  name = line;
+  sep = strpbrk(line, " \t");
+  if (sep == NULL) {
+    graphite_invalid(graphite);
+    return;
+  }
+  *sep = '\0';
+
+  value = strtod(sep + 1, &ptr);
+  if (ptr == sep + 1) {
+    graphite_invalid(graphite);
+    return;
+  }
+
+  while (*ptr == ' ' || *ptr == '\t')
+    ptr++;
+
+  if (*ptr) {
+    char *ts = ptr;
+    timestamp = strtod(ts, &ptr);
+    if (ptr == ts) {
+      graphite_invalid(graphite);
+      return;
+    }
+    while (*ptr == ' ' || *ptr == '\t')
+      ptr++;
+  }
+
+  if (*ptr) {
+    graphite_invalid(graphite);
+    return;
+  }
+
+  graphite_point(graphite, name, sep - name, timestamp, value);
+}
+
+static char *plaintext_parse(struct brubeck_statsd_tcp_loop *loop,
+                             struct brubeck_statsd_tcp_conn *conn, char *start,
+                             char *end) {
+  struct brubeck_graphite *graphite = (struct brubeck_graphite *)loop->tcp;
+  char *last = memrchr(start, '\n', end - start);
+
+  if (!last)
+    return start;
+
+  while (start <= last) {
+    char *nl = memchr(start, '\n', last + 1 - start);
+    brubeck_graphite_line(graphite, start, nl);
+    start = nl + 1;
+  }
+
+  return start;
+}
+
+/*********************************************
+ * Pickle protocol
+ *
+ * Frames are a 4-byte big-endian length followed by a pickled list of
+ * (path, (timestamp, value)) tuples. This is not a general unpickler: it
+ * only keeps track of the values that can make up such a list, and points
+ * are handled as soon as they are appended, straight out of the frame.
+ * The stack and memo live in per-thread scratch space, so decoding does
+ * not allocate.
+ *********************************************/
+enum {
+  PV_MARK,
+  PV_LIST,
+  PV_STR,
+  PV_NUM,
+  PV_POINT,  /* (timestamp, value) */
+  PV_METRIC, /* (path, (timestamp, value)) */
+  PV_OTHER
+};
+
+struct pickle_value {
+  uint8_t kind;
+  uint32_t len;
+  const char *str;
+  double timestamp;
+  double value;
+};
+
+struct pickle_scratch {
+  struct pickle_value stack[PICKLE_STACK_MAX];
+  struct pickle_value *memo;
+  uint64_t *memo_frame; /* the frame each memo slot was last PUT in */
+  size_t memo_size;
+  uint64_t frame; /* current frame, from 1 */
+};
+
+struct unpickler {
+  struct brubeck_graphite *graphite;
+  struct pickle_scratch *scratch;
+  const uint8_t *ptr, *end;
+  size_t sp;
+  size_t memo_len;
+};
+
+static inline bool up_need(struct unpickler *up, size_t n) {
+  return (size_t)(up->end - up->ptr) >= n;
+}
+
+static inline struct pickle_value *up_push(struct unpickler *up,
+                                           uint8_t kind) {
+  struct pickle_value *v;
+
+  if (up->sp == PICKLE_STACK_MAX)
+    return NULL;
+
+  v = &up->scratch->stack[up->sp++];
+  memset(v, 0x0, sizeof(*v));
+  v->kind = kind;
+  return v;
+}
+
+static inline struct pickle_value *up_top(struct unpickler *up) {
+  return up->sp ? &up->scratch->stack[up->sp - 1] : NULL;
+}
+
+/* index of the topmost mark, or -1 */
+static inline ssize_t up_mark(struct unpickler *up) {
+  ssize_t i;
+
+  for (i = (ssize_t)up->sp - 1; i >= 0; --i) {
+    if (up->scratch->stack[i].kind == PV_MARK)
+      return i;
+  }
+
+  return -1;
+}
+
+static uint64_t up_le(const uint8_t *p, size_t n) {
+  uint64_t v = 0;
+
+  while (n--)
+    v = (v << 8) | p[n];
+
+  return v;
+}
+
+/* a line-terminated argument of the text opcodes */
+static const char *up_line(struct unpickler *up, size_t *len) {
+  const uint8_t *nl = memchr(up->ptr, '\n', up->end - up->ptr);
+  const char *line = (const char *)up->ptr;
+
+  if (!nl)
+    return NULL;
+
+  *len = nl - up->ptr;
+  up->ptr = nl + 1;
+  return line;
+}
+
+static bool up_line_number(struct unpickler *up, double *out) {
+  char buf[64], *end;
+  size_t len;
+  const char *line = up_line(up, &len);
+
+  if (!line || len == 0 || len >= sizeof(buf))
+    return false;
+
+  memcpy(buf, line, len);
+  buf[len] = '\0';
+
+  /* INT and LONG: "I01\n" is True, "L12L\n" is a long */
+  if (buf[len - 1] == 'L')
+    buf[len - 1] = '\0';
+
+  *out = strtod(buf, &end);
+  return end != buf && *end == '\0';
+}
+
+static bool up_memo_put(struct unpickler *up, uint64_t idx) {
+  struct pickle_scratch *scratch = up->scratch;
+  struct pickle_value *top = up_top(up);
+
+  if (!top || idx >= PICKLE_MEMO_MAX)
+    return false;
+
+  if (idx >= scratch->memo_size) {
+    size_t size = scratch->memo_size ? scratch->memo_size : 256;
+
+    while (size <= idx)
+      size *= 2;
+
+    scratch->memo =
+        realloc(scratch->memo, size * sizeof(struct pickle_value));
+    scratch->memo_frame =
+        realloc(scratch->memo_frame, size * sizeof(uint64_t));
+    if (!scratch->memo || !scratch->memo_frame)
+      die("failed to grow pickle memo");
+
+    memset(scratch->memo_frame + scratch->memo_size, 0x0,
+           (size - scratch->memo_size) * sizeof(uint64_t));
+    scratch->memo_size = size;
+  }
+
+  scratch->memo[idx] = *top;
+  scratch->memo_frame[idx] = scratch->frame;
+  if (idx >= up->memo_len)
+    up->memo_len = idx + 1;
+  return true;
+}
+
+static bool up_memo_get(struct unpickler *up, uint64_t idx) {
+  struct pickle_value *v;
+
+  /* slots that were not PUT in this frame hold stale or uninitialized
+   * values, pointing into some other frame */
+  if (idx >= up->memo_len || up->scratch->memo_frame[idx] != up->scratch->frame)
+    return false;
+
+  v = up_push(up, PV_OTHER);
+  if (!v)
+    return false;
+
+  *v = up->scratch->memo[idx];
+  return true;
+}
+
+static bool up_string(struct unpickler *up, size_t len) {
+  struct pickle_value *v;
+
+  if (!up_need(up, len))
+    return false;
+
+  v = up_push(up, PV_STR);
+  if (!v)
+    return false;
+
+  v->str = (const char *)up->ptr;
+  v->len = (uint32_t)len;
+  up->ptr += len;
+  return true;
+}
+
+static bool up_number(struct unpickler *up, double number) {
+  struct pickle_value *v = up_push(up, PV_NUM);
+
+  if (!v)
+    return false;
+
+  v->value = number;
+  return true;
+}
+
+/* replace the `n` topmost values with the tuple they make up */
+static bool up_tuple(struct unpickler *up, size_t n, bool marked) {
+  struct pickle_value *items, tuple;
+
+  if (up->sp < n + marked)
+    return false;
+
+  items = &up->scratch->stack[up->sp - n];
+  memset(&tuple, 0x0, sizeof(tuple));
+  tuple.kind = PV_OTHER;
+
+  if (n == 2 && items[0].kind == PV_NUM && items[1].kind == PV_NUM) {
+    tuple.kind = PV_POINT;
+    tuple.timestamp = items[0].value;
+    tuple.value = items[1].value;
+  } else if (n == 2 && items[0].kind == PV_STR && items[1].kind == PV_POINT) {
+    tuple = items[1];
+    tuple.kind = PV_METRIC;
+    tuple.str = items[0].str;
+    tuple.len = items[0].len;
+  }
+
+  up->sp -= n + marked;
+  up->scratch->stack[up->sp++] = tuple;
+  return true;
+}
+
+static void up_emit(struct unpickler *up, const struct pickle_value *item) {
+  char key[GRAPHITE_KEY_MAX + 1];
+
+  if (item->kind != PV_METRIC || item->len > GRAPHITE_KEY_MAX ||
+      memchr(item->str, '\0', item->len)) {
+    graphite_invalid(up->graphite);
+    return;
+  }
+
+  memcpy(key, item->str, item->len);
+  key[item->len] = '\0';
+
+  graphite_point(up->graphite, key, item->len, item->timestamp, item->value);
+}
+
+/* append the `n` topmost values to the list right below them */
+static bool up_append(struct unpickler *up, size_t n, bool marked) {
+  struct pickle_value *items;
+  size_t i;
+
+  if (up->sp < n + marked + 1)
+    return false;
+
+  items = &up->scratch->stack[up->sp - n];
+  if (items[-1 - (int)marked].kind != PV_LIST)
+    return false;
+
+  for (i = 0; i < n; ++i)
+    up_emit(up, &items[i]);
+
+  up->sp -= n + marked;
+  return true;
+}
+
+static bool up_step(struct unpickler *up, bool *stop) {
+  const uint8_t op = *up->ptr++;
+  ssize_t mark;
+  size_t len;
+  double number;
+
+  switch (op) {
+  case 0x80: /* PROTO */
+    if (!up_need(up, 1))
+      return false;
+    up->ptr += 1;
+    return true;
+
+  case 0x95: /* FRAME */
+    if (!up_need(up, 8))
+      return false;
+    up->ptr += 8;
+    return true;
+
+  case '.': /* STOP */
+    *stop = true;
+    return true;
+
+  case '(': /* MARK */
+    return up_push(up, PV_MARK) != NULL;
+
+  case ']': /* EMPTY_LIST */
+    return up_push(up, PV_LIST) != NULL;
+
+  case 'l': /* LIST */
+    if ((mark = up_mark(up)) < 0)
+      return false;
+    up->scratch->stack[mark].kind = PV_LIST;
+    return up_append(up, up->sp - mark - 1, false);
+
+  case ')': /* EMPTY_TUPLE */
+    return up_push(up, PV_OTHER) != NULL;
+
+  case 't': /* TUPLE */
+    if ((mark = up_mark(up)) < 0)
+      return false;
+    return up_tuple(up, up->sp - mark - 1, true);
+
+  case 0x85: /* TUPLE1 */
+    return up_tuple(up, 1, false);
+  case 0x86: /* TUPLE2 */
+    return up_tuple(up, 2, false);
+  case 0x87: /* TUPLE3 */
+    return up_tuple(up, 3, false);
+
+  case 'a': /* APPEND */
+    return up_append(up, 1, false);
+
+  case 'e': /* APPENDS */
+    if ((mark = up_mark(up)) < 0)
+      return false;
+    return up_append(up, up->sp - mark - 1, true);
+
+  case 'N': /* NONE */
+    return up_push(up, PV_OTHER) != NULL;
+  case 0x88: /* NEWTRUE */
+    return up_number(up, 1.0);
+  case 0x89: /* NEWFALSE */
+    return up_number(up, 0.0);
+
+  case 'K': /* BININT1 */
+    if (!up_need(up, 1))
+      return false;
+    number = up->ptr[0];
+    up->ptr += 1;
+    return up_number(up, number);
+
+  case 'M': /* BININT2 */
+    if (!up_need(up, 2))
+      return false;
+    number = (double)up_le(up->ptr, 2);
+    up->ptr += 2;
+    return up_number(up, number);
+
+  case 'J': /* BININT */
+    if (!up_need(up, 4))
+      return false;
+    number = (double)(int32_t)up_le(up->ptr, 4);
+    up->ptr += 4;
+    return up_number(up, number);
+
+  case 0x8a: /* LONG1 */
+    if (!up_need(up, 1) || up->ptr[0] > 8 || !up_need(up, 1 + up->ptr[0]))
+      return false;
+    len = up->ptr[0];
+    if (len == 0) {
+      number = 0.0;
+    } else {
+      uint64_t v = up_le(up->ptr + 1, len);
+      /* sign-extend */
+      if (len < 8 && (v & (1ULL << (len * 8 - 1))))
+        v |= ~0ULL << (len * 8);
+      number = (double)(int64_t)v;
+    }
+    up->ptr += 1 + len;
+    return up_number(up, number);
+
+  case 'G': { /* BINFLOAT, big-endian */
+    uint64_t bits = 0;
+    size_t i;
+
+    if (!up_need(up, 8))
+      return false;
+    for (i = 0; i < 8; ++i)
+      bits = (bits << 8) | up->ptr[i];
+    memcpy(&number, &bits, sizeof(number));
+    up->ptr += 8;
+    return up_number(up, number);
+  }
+
+  case 'I': /* INT */
+  case 'L': /* LONG */
+  case 'F': /* FLOAT */
+    return up_line_number(up, &number) && up_number(up, number);
+
+  case 'U': /* SHORT_BINSTRING */
+  case 'C': /* SHORT_BINBYTES */
+  case 0x8c: /* SHORT_BINUNICODE */
+    if (!up_need(up, 1))
+      return false;
+    len = up->ptr[0];
+    up->ptr += 1;
+    return up_string(up, len);
+
+  case 'T': /* BINSTRING */
+  case 'B': /* BINBYTES */
+  case 'X': /* BINUNICODE */
+    if (!up_need(up, 4))
+      return false;
+    len = (size_t)up_le(up->ptr, 4);
+    up->ptr += 4;
+    return up_string(up, len);
+
+  case 0x8d: /* BINUNICODE8 */
+    if (!up_need(up, 8))
+      return false;
+    len = (size_t)up_le(up->ptr, 8);
+    up->ptr += 8;
+    return up_string(up, len);
+
+  case 'S': { /* STRING, a quoted repr */
+    const char *line = up_line(up, &len);
+    struct pickle_value *v;
+
+    if (!line || len < 2 || line[0] != line[len - 1] ||
+        (line[0] != '\'' && line[0] != '"'))
+      return false;
+
+    if (!(v = up_push(up, PV_STR)))
+      return false;
+    v->str = line + 1;
+    v->len = (uint32_t)(len - 2);
+    return true;
+  }
+
+  case 'V': { /* UNICODE, raw-unicode-escape */
+    const char *line = up_line(up, &len);
+    struct pickle_value *v;
+
+    if (!line || !(v = up_push(up, PV_STR)))
+      return false;
+    v->str = line;
+    v->len = (uint32_t)len;
+    return true;
+  }
+
+  case 'q': /* BINPUT */
+    if (!up_need(up, 1))
+      return false;
+    up->ptr += 1;
+    return up_memo_put(up, up->ptr[-1]);
+
+  case 'r': /* LONG_BINPUT */
+    if (!up_need(up, 4))
+      return false;
+    up->ptr += 4;
+    return up_memo_put(up, up_le(up->ptr - 4, 4));
+
+  case 0x94: /* MEMOIZE */
+    return up_memo_put(up, up->memo_len);
+
+  case 'h': /* BINGET */
+    if (!up_need(up, 1))
+      return false;
+    up->ptr += 1;
+    return up_memo_get(up, up->ptr[-1]);
+
+  case 'j': /* LONG_BINGET */
+    if (!up_need(up, 4))
+      return false;
+    up->ptr += 4;
+    return up_memo_get(up, up_le(up->ptr - 4, 4));
+
+  case 'p': /* PUT */
+  case 'g': /* GET */
+    if (!up_line_number(up, &number) || number < 0)
+      return false;
+    return (op == 'p') ? up_memo_put(up, (uint64_t)number)
+                       : up_memo_get(up, (uint64_t)number);
+
+  default:
+    return false;
+  }
+}
+
+/*
+ * Decode one pickle frame, handling its points as they are appended.
+ * Returns 0 on success, or -1 if the frame is malformed or uses opcodes
+ * that cannot appear in a list of points; points decoded before the
+ * error are kept.
+ */
+int brubeck_graphite_unpickle(struct brubeck_graphite *graphite,
+                              struct brubeck_statsd_tcp_loop *loop,
+                              const char *frame, size_t len) {
+  struct unpickler up;
+  bool stop = false;
+
+  if (loop->scratch == NULL)
+    loop->scratch = xcalloc(1, sizeof(struct pickle_scratch));
+
+  up.graphite = graphite;
+  up.scratch = loop->scratch;
+  up.ptr = (const uint8_t *)frame;
+  up.end = up.ptr + len;
+  up.sp = 0;
+  up.memo_len = 0;
+  up.scratch->frame++;
+
+  while (!stop && up.ptr < up.end) {
+    if (!up_step(&up, &stop))
+      break;
+  }
+
+  if (!stop) {
+    graphite_invalid(graphite);
+    return -1;
+  }
+
+  return 0;
+}
+
+static char *pickle_parse(struct brubeck_statsd_tcp_loop *loop,
+                          struct brubeck_statsd_tcp_conn *conn, char *start,
+                          char *end) {
+  struct brubeck_graphite *graphite = (struct brubeck_graphite *)loop->tcp;
+  const size_t max_frame = graphite->tcp.buffer_size - 1 - sizeof(uint32_t);
+
+  while (end - start >= (ssize_t)sizeof(uint32_t)) {
+    const size_t available = end - start - sizeof(uint32_t);
+    uint32_t len;
+
+    memcpy(&len, start, sizeof(len));
+    len = ntohl(len);
+
+    if (len > max_frame) {
+      /* can never fit in the buffer: skip it as it arrives */
+      log_splunk("sampler=%s event=frame_too_long from=%s length=%u",
+                 brubeck_sampler_name(&graphite->tcp.sampler),
+                 inet_ntoa(conn->peer.sin_addr), len);
+      brubeck_atomic_inc(&graphite->tcp.overflows);
+      graphite_invalid(graphite);
+      conn->skip = len - available;
+      return end;
+    }
+
+    if (available < len)
+      break;
+
+    start += sizeof(uint32_t);
+    brubeck_graphite_unpickle(graphite, loop, start, len);
+    start += len;
+  }
+
+  return start;
+}
+
+/********************************************************/
+
+static struct brubeck_graphite *graphite_new(struct brubeck_server *server,
+                                             json_t *settings,
+                                             enum brubeck_sampler_t type,
+                                             brubeck_tcp_parse_cb parse,
+                                             int buffer_size) {
+  struct brubeck_graphite *graphite =
+      xcalloc(1, sizeof(struct brubeck_graphite));
+  char *address;
+  int port, passthrough = 0, queue_size = 16384;
+
+  brubeck_statsd_tcp_init(&graphite->tcp, server, type, parse);
+
+  json_unpack_or_die(settings, "{s:s, s:i, s?:i, s?:i, s?:i, s?:b, s?:i}",
+                     "address", &address, "port", &port, "workers",
+                     &graphite->tcp.loop_count, "buffer_size", &buffer_size,
+                     "idle_timeout", &graphite->tcp.idle_timeout,
+                     "passthrough", &passthrough, "queue_size", &queue_size);
+
+  if (passthrough) {
+    const char *name = brubeck_sampler_name(&graphite->tcp.sampler);
+
+    if (queue_size <= 0 || (queue_size & (queue_size - 1)))
+      die("%s queue_size must be a power of two", name);
+
+    if (!brubeck_carbon_passthrough_enable(server, (uint32_t)queue_size))
+      die("%s passthrough needs a carbon backend", name);
+
+    graphite->passthrough = true;
+  }
+
+  brubeck_statsd_tcp_start(&graphite->tcp, address, port, buffer_size);
+  return graphite;
+}
+
+struct brubeck_sampler *brubeck_graphite_new(struct brubeck_server *server,
+                                             json_t *settings) {
+  return &graphite_new(server, settings, BRUBECK_SAMPLER_GRAPHITE,
+                       &plaintext_parse, 8192)
+              ->tcp.sampler;
+}
+
+struct brubeck_sampler *
+brubeck_graphite_pickle_new(struct brubeck_server *server, json_t *settings) {
+  return &graphite_new(server, settings, BRUBECK_SAMPLER_GRAPHITE_PICKLE,
+                       &pickle_parse, 1 << 20)
+              ->tcp.sampler;
+}
+
+json_t *brubeck_graphite_stats(struct brubeck_graphite *graphite) {
+  return json_pack("{s:b, s:I, s:I, s:I}", "passthrough",
+                   graphite->passthrough, "points",
+                   (json_int_t)graphite->points, "invalid",
+                   (json_int_t)graphite->invalid, "dropped",
+                   (json_int_t)graphite->dropped);
+}
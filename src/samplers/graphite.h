@@ -0,0 +1,28 @@
+#ifndef __BRUBECK_GRAPHITE_H__
+#define __BRUBECK_GRAPHITE_H__
+
+struct brubeck_graphite {
+  struct brubeck_statsd_tcp tcp;
+
+  /* forward points to the carbon backends instead of aggregating them */
+  bool passthrough;
+
+  uint64_t points;
+  uint64_t invalid;
+  uint64_t dropped;
+};
+
+struct brubeck_sampler *brubeck_graphite_new(struct brubeck_server *server,
+                                             json_t *settings);
+struct brubeck_sampler *
+brubeck_graphite_pickle_new(struct brubeck_server *server, json_t *settings);
+json_t *brubeck_graphite_stats(struct brubeck_graphite *graphite);
+
+/* exposed for testing */
+void brubeck_graphite_line(struct brubeck_graphite *graphite, char *line,
+                           char *end);
+int brubeck_graphite_unpickle(struct brubeck_graphite *graphite,
+                              struct brubeck_statsd_tcp_loop *loop,
+                              const char *frame, size_t len);
+
+#endif
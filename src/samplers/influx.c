@@ -0,0 +1,381 @@
+#define _GNU_SOURCE
+#include "brubeck.h"
+
+#define INFLUX_KEY_MAX 1024
+
+/*
+ * Skip to the first unescaped `stop` character or space, or to `end`.
+ * Escaped characters are skipped over but kept as they are, so a metric
+ * name keeps its backslashes.
+ */
+static inline char *scan_until(char *p, char *end, char stop) {
+  while (p < end && *p != stop && *p != ' ') {
+    if (*p == '\\' && p + 1 < end)
+      p++;
+    p++;
+  }
+  return p;
+}
+
+static const char *BOOLEANS[] = {"t", "T", "true", "True", "TRUE",
+                                 "f", "F", "false", "False", "FALSE"};
+
+/* Returns 1 or 0 for a boolean token, or -1 */
+static int parse_boolean(const char *token, size_t len) {
+  size_t i;
+
+  for (i = 0; i < sizeof(BOOLEANS) / sizeof(BOOLEANS[0]); ++i) {
+    if (strlen(BOOLEANS[i]) == len && !memcmp(BOOLEANS[i], token, len))
+      return i < 5;
+  }
+
+  return -1;
+}
+
+/*
+ * Parse a field value: a float, an integer (`42i`, `42u`), a boolean or
+ * a string. Returns a pointer past the value, or NULL if it is malformed;
+ * `numeric` is false for strings, which cannot be recorded.
+ */
+static char *parse_value(char *p, char *end, value_t *value, bool *numeric) {
+  char *token = p, *num_end;
+  size_t len;
+  int boolean;
+
+  if (*p == '"') {
+    for (++p; p < end && *p != '"'; ++p) {
+      if (*p == '\\' && p + 1 < end)
+        p++;
+    }
+
+    *numeric = false;
+    return (p < end) ? p + 1 : NULL;
+  }
+
+  while (p < end && *p != ',' && *p != ' ')
+    p++;
+
+  len = p - token;
+  if (len == 0)
+    return NULL;
+
+  *numeric = true;
+
+  if (len <= 5 && (boolean = parse_boolean(token, len)) >= 0) {
+    *value = (value_t)boolean;
+    return p;
+  }
+
+  /* the value is followed by ',', ' ' or the NUL at the end of the line,
+   * so strtod cannot run past it */
+  *value = strtod(token, &num_end);
+  if (num_end == token || !isfinite(*value))
+    return NULL;
+
+  if (num_end < p && (*num_end == 'i' || *num_end == 'u'))
+    num_end++;
+
+  return (num_end == p) ? p : NULL;
+}
+
+static uint8_t field_type(struct brubeck_influx_schema *schema,
+                          const char *name, size_t len) {
+  size_t i;
+
+  for (i = 0; i < schema->field_count; ++i) {
+    const struct brubeck_influx_field *field = &schema->fields[i];
+    if (field->len == len && !memcmp(field->name, name, len))
+      return field->type;
+  }
+
+  return schema->default_type;
+}
+
+/*
+ * Record a field as the metric `measurement.field,tags`. A field named
+ * `value` is recorded as `measurement,tags`: that key is already in the
+ * buffer, NUL-terminated, so it is looked up without being copied.
+ */
+static bool influx_record(struct brubeck_influx_schema *schema,
+                          const char *measurement, size_t measurement_len,
+                          size_t tags_len, const char *name, size_t name_len,
+                          value_t value) {
+  char key[INFLUX_KEY_MAX + 1];
+  const char *tags = measurement + measurement_len;
+  const uint8_t type = field_type(schema, name, name_len);
+  struct brubeck_metric *metric;
+  size_t key_len;
+
+  if (name_len == 5 && !memcmp(name, "value", 5)) {
+    metric = brubeck_metric_find(schema->server, measurement,
+                                 measurement_len + tags_len, type);
+  } else {
+    key_len = measurement_len + 1 + name_len + tags_len;
+    if (key_len > INFLUX_KEY_MAX)
+      return false;
+
+    memcpy(key, measurement, measurement_len);
+    key[measurement_len] = '.';
+    memcpy(key + measurement_len + 1, name, name_len);
+    memcpy(key + measurement_len + 1 + name_len, tags, tags_len);
+    key[key_len] = '\0';
+
+    metric = brubeck_metric_find(schema->server, key, key_len, type);
+  }
+
+  if (metric != NULL)
+    brubeck_metric_record(metric, value, 1.0, 0);
+
+  return true;
+}
+
+/*
+ * Parse and record a single line in place:
+ *
+ *      measurement[,tag=value...] field=value[,field=value...] [timestamp]
+ *
+ * Returns the number of points recorded, or -1 if the line is malformed;
+ * fields before the error have already been recorded. Timestamps are
+ * validated but dropped, since points are aggregated like any other
+ * metric.
+ */
+int brubeck_influx_line_parse(struct brubeck_influx_schema *schema,
+                              char *line, char *end) {
+  char *p, *digits;
+  size_t measurement_len, tags_len = 0;
+  int points = 0;
+
+  if (end > line && end[-1] == '\r')
+    end--;
+  *end = '\0';
+
+  if (line == end || *line == '#')
+    return 0;
+
+  p = scan_until(line, end, ',');
+  measurement_len = p - line;
+  if (measurement_len == 0 || p == end)
+    return -1;
+
+  if (*p == ',') {
+    p = scan_until(p + 1, end, ' ');
+    tags_len = p - line - measurement_len;
+    if (tags_len < 2 || p == end)
+      return -1;
+  }
+
+  /* the separator becomes the NUL that terminates `measurement,tags` */
+  *p++ = '\0';
+
+  for (;;) {
+    char *name = p;
+    size_t name_len;
+    bool numeric;
+    value_t value;
+
+    p = scan_until(p, end, '=');
+    if (p == name || p == end || *p != '=')
+      return -1;
+    name_len = p - name;
+
+    p = parse_value(p + 1, end, &value, &numeric);
+    if (!p)
+      return -1;
+
+    if (numeric) {
+      if (!influx_record(schema, line, measurement_len, tags_len, name,
+                         name_len, value))
+        return -1;
+      points++;
+    }
+
+    if (p == end || *p == ' ')
+      break;
+
+    p++;
+  }
+
+  if (p < end) {
+    digits = ++p;
+    if (*p == '-')
+      digits = ++p;
+
+    while (p < end && *p >= '0' && *p <= '9')
+      p++;
+
+    if (p == digits || p != end)
+      return -1;
+  }
+
+  return points;
+}
+
+void brubeck_influx_packet_parse(struct brubeck_influx_schema *schema,
+                                 char *buffer, char *end) {
+  struct brubeck_server *server = schema->server;
+  int points = 0;
+
+  while (buffer < end) {
+    char *line_end = memchr(buffer, '\n', end - buffer);
+    int res;
+
+    if (!line_end)
+      line_end = end;
+
+    if (brubeck_denylist_drop(server->denylist, buffer, line_end - buffer)) {
+      buffer = line_end + 1;
+      continue;
+    }
+
+    res = brubeck_influx_line_parse(schema, buffer, line_end);
+    if (res < 0) {
+      brubeck_atomic_inc(&schema->invalid);
+      brubeck_stats_inc(server, errors);
+      log_splunk("sampler=influx event=packet_drop");
+    } else {
+      points += res;
+    }
+
+    buffer = line_end + 1;
+  }
+
+  if (points) {
+    brubeck_atomic_add(&schema->points, points);
+    brubeck_atomic_add(&server->internal_stats.live.metrics, points);
+  }
+}
+
+static void influx_udp_parse(struct brubeck_statsd *statsd, char *buffer,
+                             char *end, double sample_freq) {
+  struct brubeck_influx *influx = (struct brubeck_influx *)statsd;
+  brubeck_influx_packet_parse(&influx->schema, buffer, end);
+}
+
+static char *influx_tcp_parse(struct brubeck_statsd_tcp_loop *loop,
+                              struct brubeck_statsd_tcp_conn *conn,
+                              char *start, char *end) {
+  struct brubeck_influx_tcp *influx = (struct brubeck_influx_tcp *)loop->tcp;
+  char *last = memrchr(start, '\n', end - start);
+
+  if (!last)
+    return start;
+
+  brubeck_influx_packet_parse(&influx->schema, start, last);
+  return last + 1;
+}
+
+static uint8_t influx_type(const char *name, const char *type) {
+  if (!strcmp(type, "g"))
+    return BRUBECK_MT_GAUGE;
+  if (!strcmp(type, "c"))
+    return BRUBECK_MT_METER;
+  if (!strcmp(type, "C"))
+    return BRUBECK_MT_COUNTER;
+  if (!strcmp(type, "h"))
+    return BRUBECK_MT_HISTO;
+  if (!strcmp(type, "ms"))
+    return BRUBECK_MT_TIMER;
+
+  die("%s: invalid metric type '%s'", name, type);
+  return 0;
+}
+
+static void influx_schema_init(struct brubeck_influx_schema *schema,
+                               struct brubeck_sampler *sampler,
+                               const char *default_type, json_t *fields) {
+  const char *name = brubeck_sampler_name(sampler);
+
+  schema->server = sampler->server;
+
+  if (schema->server->tags == NULL)
+    die("%s needs tagging enabled with `tag_capacity`", name);
+
+  schema->default_type = influx_type(name, default_type);
+
+  if (fields) {
+    const char *field;
+    json_t *type;
+    size_t i = 0;
+
+    if (!json_is_object(fields))
+      die("%s: `fields` must map field names to metric types", name);
+
+    schema->field_count = json_object_size(fields);
+    schema->fields =
+        xcalloc(schema->field_count, sizeof(struct brubeck_influx_field));
+
+    json_object_foreach(fields, field, type) {
+      if (!json_is_string(type))
+        die("%s: invalid metric type for field '%s'", name, field);
+
+      schema->fields[i].name = field;
+      schema->fields[i].len = strlen(field);
+      schema->fields[i].type = influx_type(name, json_string_value(type));
+      i++;
+    }
+  }
+}
+
+struct brubeck_sampler *brubeck_influx_new(struct brubeck_server *server,
+                                           json_t *settings) {
+  struct brubeck_influx *influx = xcalloc(1, sizeof(struct brubeck_influx));
+  char *address, *default_type = "g";
+  int port, multisock = 0, gro = 0, busy_poll = 0, spin_budget = -1;
+  int denylist_filter = 0;
+  json_t *fields = NULL, *cpus = NULL, *rate_limit = NULL;
+
+  brubeck_statsd_init(&influx->udp, BRUBECK_SAMPLER_INFLUX, &influx_udp_parse);
+
+  json_unpack_or_die(
+      settings,
+      "{s:s, s:i, s?:i, s?:i, s?:b, s?:b, s?:o, s?:i, s?:i, s?:b, s?:i, s?:o, "
+      "s?:s, s?:o}",
+      "address", &address, "port", &port, "workers", &influx->udp.worker_count,
+      "multimsg", &influx->udp.mmsg_count, "multisock", &multisock, "gro", &gro,
+      "cpus", &cpus, "busy_poll", &busy_poll, "spin_budget", &spin_budget,
+      "denylist_filter", &denylist_filter, "top_talkers",
+      &influx->udp.top_talkers, "rate_limit", &rate_limit, "default_type",
+      &default_type, "fields", &fields);
+
+  influx->udp.gro = gro;
+  influx->udp.denylist_filter = denylist_filter;
+  influx->udp.ratelimit = brubeck_ratelimit_config_load(rate_limit, "influx");
+  brubeck_statsd_set_cpus(&influx->udp, cpus,
+                          json_object_get(settings, "workers") != NULL);
+
+  brubeck_sampler_init_inet(&influx->udp.sampler, server, address, port);
+  brubeck_statsd_set_busy_poll(&influx->udp, busy_poll,
+                               spin_budget < 0 ? busy_poll : spin_budget);
+  influx_schema_init(&influx->schema, &influx->udp.sampler, default_type,
+                     fields);
+  brubeck_statsd_start(&influx->udp, multisock);
+  return &influx->udp.sampler;
+}
+
+struct brubeck_sampler *brubeck_influx_tcp_new(struct brubeck_server *server,
+                                               json_t *settings) {
+  struct brubeck_influx_tcp *influx =
+      xcalloc(1, sizeof(struct brubeck_influx_tcp));
+  char *address, *default_type = "g";
+  int port, buffer_size = 65536;
+  json_t *fields = NULL;
+
+  brubeck_statsd_tcp_init(&influx->tcp, server, BRUBECK_SAMPLER_INFLUX_TCP,
+                          &influx_tcp_parse);
+
+  json_unpack_or_die(settings, "{s:s, s:i, s?:i, s?:i, s?:i, s?:s, s?:o}",
+                     "address", &address, "port", &port, "workers",
+                     &influx->tcp.loop_count, "buffer_size", &buffer_size,
+                     "idle_timeout", &influx->tcp.idle_timeout,
+                     "default_type", &default_type, "fields", &fields);
+
+  influx_schema_init(&influx->schema, &influx->tcp.sampler, default_type,
+                     fields);
+  brubeck_statsd_tcp_start(&influx->tcp, address, port, buffer_size);
+  return &influx->tcp.sampler;
+}
+
+json_t *brubeck_influx_stats(struct brubeck_influx_schema *schema) {
+  return json_pack("{s:I, s:I}", "points", (json_int_t)schema->points,
+                   "invalid", (json_int_t)schema->invalid);
+}
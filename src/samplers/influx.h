@@ -0,0 +1,42 @@
+#ifndef __BRUBECK_INFLUX_H__
+#define __BRUBECK_INFLUX_H__
+
+struct brubeck_influx_field {
+  const char *name;
+  size_t len;
+  uint8_t type;
+};
+
+/* how fields map onto metrics, shared by the UDP and TCP samplers */
+struct brubeck_influx_schema {
+  struct brubeck_server *server;
+  uint8_t default_type;
+  struct brubeck_influx_field *fields;
+  size_t field_count;
+
+  uint64_t points;
+  uint64_t invalid;
+};
+
+struct brubeck_influx {
+  struct brubeck_statsd udp;
+  struct brubeck_influx_schema schema;
+};
+
+struct brubeck_influx_tcp {
+  struct brubeck_statsd_tcp tcp;
+  struct brubeck_influx_schema schema;
+};
+
+int brubeck_influx_line_parse(struct brubeck_influx_schema *schema,
+                              char *line, char *end);
+void brubeck_influx_packet_parse(struct brubeck_influx_schema *schema,
+                                 char *buffer, char *end);
+
+struct brubeck_sampler *brubeck_influx_new(struct brubeck_server *server,
+                                           json_t *settings);
+struct brubeck_sampler *brubeck_influx_tcp_new(struct brubeck_server *server,
+                                               json_t *settings);
+json_t *brubeck_influx_stats(struct brubeck_influx_schema *schema);
+
+#endif
@@ -0,0 +1,182 @@
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "brubeck.h"
+
+/* busy-poll this many times on an empty ring before sleeping */
+#define SHM_SPIN 1024
+#define SHM_WAIT_MS 100
+/* check on the producer of a claimed-but-unpublished slot after this long */
+#define SHM_STALL_SECS 1
+
+static void *shm__thread(void *_in) {
+  struct brubeck_shm_sampler *shm = _in;
+  struct brubeck_server *server = shm->sampler.server;
+  struct brubeck_shm_consumer ring;
+  struct brubeck_reader *reader = brubeck_reader_register(server);
+  char record[BRUBECK_SHM_RECORD_MAX + 1];
+  time_t stalled_since = 0;
+  int idle = 0;
+
+  /* a ring has a single consumer: after an upgrade, the previous process
+   * holds the lock until it has stopped reading */
+  if (flock(shm->lock_fd, LOCK_EX) < 0)
+    die("failed to lock shared memory ring %s", shm->sampler.path);
+
+  brubeck_shm_consumer_init(&ring, shm->ring, shm->slots);
+
+  log_splunk("sampler=%s event=worker_online path=%s",
+             brubeck_sampler_name(&shm->sampler), shm->sampler.path);
+
+  for (;;) {
+    struct brubeck_shm_slot *slot;
+
+    pthread_testcancel();
+    brubeck_reader_online(reader);
+
+    slot = brubeck_shm_peek(&ring);
+
+    if (likely(slot != NULL)) {
+      /* the length comes from an untrusted producer, read it once */
+      const uint32_t len = __atomic_load_n(&slot->len, __ATOMIC_RELAXED);
+
+      /* the parser writes into the record, and producers can write to
+       * the slot at any time: parse a private copy */
+      if (likely(len <= BRUBECK_SHM_RECORD_MAX))
+        memcpy(record, slot->data, len);
+
+      brubeck_shm_release(&ring, slot);
+
+      if (likely(len <= BRUBECK_SHM_RECORD_MAX)) {
+        brubeck_atomic_inc(&shm->sampler.inflow);
+        brubeck_statsd_packet_parse(server, record, record + len,
+                                    shm->scale_timers_by);
+      } else {
+        brubeck_stats_inc(server, errors);
+      }
+
+      stalled_since = 0;
+      idle = 0;
+      continue;
+    }
+
+    if (++idle < SHM_SPIN) {
+      brubeck_cpu_relax();
+      continue;
+    }
+
+    if (brubeck_shm_pending(&ring)) {
+      struct timespec now;
+      clock_gettime(CLOCK_MONOTONIC, &now);
+
+      if (!stalled_since) {
+        stalled_since = now.tv_sec;
+      } else if (now.tv_sec - stalled_since >= SHM_STALL_SECS) {
+        if (brubeck_shm_skip(&ring)) {
+          log_splunk("sampler=%s event=skip_stalled_slot",
+                     brubeck_sampler_name(&shm->sampler));
+          brubeck_stats_inc(server, errors);
+        }
+        stalled_since = 0;
+      }
+    }
+
+    brubeck_reader_offline(reader);
+    brubeck_shm_wait(&ring, SHM_WAIT_MS);
+  }
+
+  return NULL;
+}
+
+static struct brubeck_shm_ring *shm_map(const char *path, uint32_t capacity,
+                                        mode_t mode, size_t *map_size) {
+  const size_t size = brubeck_shm_size(capacity);
+  struct brubeck_shm_ring *ring;
+  struct stat st;
+  int fd = open(path, O_RDWR | O_CREAT, mode);
+
+  if (fd < 0 || fstat(fd, &st) < 0)
+    die("failed to open shared memory ring %s", path);
+
+  if ((size_t)st.st_size != size) {
+    /* a new ring, or one with a different geometry: start from scratch
+     * (producers still mapping the old file have to re-attach) */
+    if (ftruncate(fd, 0) < 0 || ftruncate(fd, (off_t)size) < 0)
+      die("failed to size shared memory ring %s", path);
+  }
+
+  if (fchmod(fd, mode) < 0)
+    die("failed to set permissions on shared memory ring %s", path);
+
+  ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (ring == MAP_FAILED)
+    die("failed to map shared memory ring %s", path);
+
+  if (brubeck_shm_valid(ring, size) && ring->capacity == capacity) {
+    /* pick up where the previous process left off, so producers
+     * never have to notice a restart */
+    log_splunk("sampler=statsd-shm event=ring_resume path=%s pending=%llu",
+               path, (unsigned long long)(ring->tail - ring->head));
+  } else {
+    brubeck_shm_init(ring, capacity);
+  }
+
+  *map_size = size;
+  return ring;
+}
+
+static void shutdown_sampler(struct brubeck_sampler *sampler) {
+  struct brubeck_shm_sampler *shm = (struct brubeck_shm_sampler *)sampler;
+
+  /* the ring file is kept around so producers can keep pushing
+   * while we restart */
+  pthread_cancel(shm->thread);
+  pthread_join(shm->thread, NULL);
+  close(shm->lock_fd);
+}
+
+struct brubeck_sampler *brubeck_shm_new(struct brubeck_server *server,
+                                        json_t *settings) {
+  struct brubeck_shm_sampler *shm =
+      xcalloc(1, sizeof(struct brubeck_shm_sampler));
+
+  char *path;
+  char *mode = "0666";
+  int slots = 65536;
+  long perms;
+
+  shm->sampler.type = BRUBECK_SAMPLER_STATSD_SHM;
+  shm->sampler.shutdown = &shutdown_sampler;
+  shm->sampler.in_sock = -1;
+  shm->scale_timers_by = 1.;
+
+  json_unpack_or_die(settings, "{s:s, s?:s, s?:i, s?:F}", "path", &path,
+                     "mode", &mode, "slots", &slots, "scale_timers_by",
+                     &shm->scale_timers_by);
+
+  if (slots <= 0 || (slots & (slots - 1)))
+    die("shared memory ring slots must be a power of two");
+
+  perms = strtol(mode, NULL, 8);
+  if (perms <= 0 || perms > 0777)
+    die("invalid shared memory ring mode '%s'", mode);
+
+  shm->sampler.server = server;
+  shm->sampler.path = path;
+  shm->slots = (uint32_t)slots;
+  shm->ring = shm_map(path, shm->slots, (mode_t)perms, &shm->map_size);
+
+  if ((shm->lock_fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+    die("failed to open shared memory ring %s", path);
+
+  log_splunk("sampler=statsd-shm event=load_shm path=%s slots=%d", path,
+             slots);
+
+  if (pthread_create(&shm->thread, NULL, &shm__thread, shm) != 0)
+    die("failed to start sampler thread");
+
+  return &shm->sampler;
+}
@@ -0,0 +1,19 @@
+#ifndef __BRUBECK_SHM_H__
+#define __BRUBECK_SHM_H__
+
+#include "shm_ring.h"
+
+struct brubeck_shm_sampler {
+  struct brubeck_sampler sampler;
+  struct brubeck_shm_ring *ring;
+  size_t map_size;
+  uint32_t slots; /* as mapped; the ring header is not trusted */
+  pthread_t thread;
+  int lock_fd; /* flock'd by the consuming thread */
+  double scale_timers_by;
+};
+
+struct brubeck_sampler *brubeck_shm_new(struct brubeck_server *server,
+                                        json_t *settings);
+
+#endif
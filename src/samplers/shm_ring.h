@@ -0,0 +1,292 @@
+#ifndef __BRUBECK_SHM_RING_H__
+#define __BRUBECK_SHM_RING_H__
+
+/*
+ * Shared-memory ring for local statsd producers.
+ *
+ * Brubeck's `statsd-shm` sampler creates a file (usually under /dev/shm)
+ * holding a bounded multi-producer, single-consumer ring of fixed-size
+ * slots, following Dmitry Vyukov's sequenced-slot design. Each slot carries
+ * one record: one or more newline-separated statsd lines, exactly as they
+ * would be sent in a UDP packet.
+ *
+ * This header is self-contained so that clients can copy it into their
+ * own tree. A producer only needs:
+ *
+ *     struct brubeck_shm_ring *ring = brubeck_shm_attach("/dev/shm/brubeck");
+ *     brubeck_shm_push(ring, "some.key:1|c", 12);
+ *
+ * Pushing a record costs a CAS and a memcpy; the only syscall is a futex
+ * wake, issued when the consumer has gone idle waiting for data.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BRUBECK_SHM_MAGIC 0x48535242 /* "BRSH" */
+#define BRUBECK_SHM_VERSION 1
+#define BRUBECK_SHM_SLOT_SIZE 512
+#define BRUBECK_SHM_RECORD_MAX (BRUBECK_SHM_SLOT_SIZE - 16 - 1)
+
+struct brubeck_shm_slot {
+  uint64_t seq;
+  uint32_t len;
+  int32_t pid; /* of the producer writing it, 0 if unknown */
+  char data[BRUBECK_SHM_SLOT_SIZE - 16];
+};
+
+struct brubeck_shm_ring {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t capacity; /* number of slots, a power of two */
+  uint32_t slot_size;
+
+  /* next position to be claimed by a producer */
+  uint64_t tail __attribute__((aligned(64)));
+
+  /* next position to be read by the consumer; only written by it, and
+   * only read back when a new consumer resumes the ring */
+  uint64_t head __attribute__((aligned(64)));
+
+  /* consumer wake-ups, and records dropped because the ring was full */
+  uint32_t futex __attribute__((aligned(64)));
+  uint32_t waiting;
+  uint64_t dropped;
+
+  struct brubeck_shm_slot slots[] __attribute__((aligned(64)));
+};
+
+static inline size_t brubeck_shm_size(uint32_t capacity) {
+  return sizeof(struct brubeck_shm_ring) +
+         (size_t)capacity * sizeof(struct brubeck_shm_slot);
+}
+
+static inline void brubeck_shm_init(struct brubeck_shm_ring *ring,
+                                    uint32_t capacity) {
+  uint32_t i;
+
+  memset(ring, 0x0, sizeof(struct brubeck_shm_ring));
+  ring->capacity = capacity;
+  ring->slot_size = sizeof(struct brubeck_shm_slot);
+  ring->version = BRUBECK_SHM_VERSION;
+
+  for (i = 0; i < capacity; ++i) {
+    ring->slots[i].seq = i;
+    ring->slots[i].pid = 0;
+  }
+
+  __atomic_store_n(&ring->magic, BRUBECK_SHM_MAGIC, __ATOMIC_RELEASE);
+}
+
+static inline int brubeck_shm_valid(const struct brubeck_shm_ring *ring,
+                                    size_t map_size) {
+  return map_size >= sizeof(struct brubeck_shm_ring) &&
+         __atomic_load_n(&ring->magic, __ATOMIC_ACQUIRE) == BRUBECK_SHM_MAGIC &&
+         ring->version == BRUBECK_SHM_VERSION &&
+         ring->slot_size == sizeof(struct brubeck_shm_slot) &&
+         ring->capacity && !(ring->capacity & (ring->capacity - 1)) &&
+         brubeck_shm_size(ring->capacity) <= map_size;
+}
+
+static inline void brubeck_shm_wake(struct brubeck_shm_ring *ring) {
+  if (__atomic_load_n(&ring->waiting, __ATOMIC_SEQ_CST)) {
+    __atomic_add_fetch(&ring->futex, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, &ring->futex, FUTEX_WAKE, 1, NULL, NULL, 0);
+  }
+}
+
+/*
+ * Producer side: copy a record into the ring. Returns 0 on success, or -1
+ * with errno set to EMSGSIZE (record too large) or EAGAIN (ring full; the
+ * record is dropped and counted).
+ */
+static inline int brubeck_shm_push(struct brubeck_shm_ring *ring,
+                                   const char *record, size_t len) {
+  const uint64_t mask = ring->capacity - 1;
+  struct brubeck_shm_slot *slot;
+  uint64_t pos, expected;
+
+  if (len > BRUBECK_SHM_RECORD_MAX) {
+    errno = EMSGSIZE;
+    return -1;
+  }
+
+  pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+  for (;;) {
+    int64_t dif;
+
+    slot = &ring->slots[pos & mask];
+    dif = (int64_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+
+    if (dif == 0) {
+      if (__atomic_compare_exchange_n(&ring->tail, &pos, pos + 1, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    } else if (dif < 0) {
+      __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+      errno = EAGAIN;
+      return -1;
+    } else {
+      pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    }
+  }
+
+  /* lets the consumer tell a dead producer from a slow one */
+  __atomic_store_n(&slot->pid, (int32_t)getpid(), __ATOMIC_RELEASE);
+
+  memcpy(slot->data, record, len);
+  slot->len = (uint32_t)len;
+
+  /* a CAS instead of a plain store: if we were presumed dead and the
+   * consumer gave up on this slot, our record is lost rather than
+   * corrupting the sequence */
+  expected = pos;
+  if (!__atomic_compare_exchange_n(&slot->seq, &expected, pos + 1, 0,
+                                   __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+    errno = ETIMEDOUT;
+    return -1;
+  }
+
+  brubeck_shm_wake(ring);
+  return 0;
+}
+
+/*
+ * Consumer side state. The ring is shared with every producer, which can
+ * write anything to it, so the consumer keeps its own position and the
+ * slot mask, fixed when the ring was mapped, and only trusts the ring for
+ * the slot sequences.
+ */
+struct brubeck_shm_consumer {
+  struct brubeck_shm_ring *ring;
+  uint64_t mask;
+  uint64_t head;
+};
+
+/* `capacity` is the slot count the ring was sized and mapped for */
+static inline void brubeck_shm_consumer_init(struct brubeck_shm_consumer *c,
+                                             struct brubeck_shm_ring *ring,
+                                             uint32_t capacity) {
+  c->ring = ring;
+  c->mask = capacity - 1;
+  c->head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Consumer side: return the next published slot, or NULL if the ring is
+ * empty (or the next claimed slot is still being written).
+ */
+static inline struct brubeck_shm_slot *
+brubeck_shm_peek(struct brubeck_shm_consumer *c) {
+  struct brubeck_shm_slot *slot = &c->ring->slots[c->head & c->mask];
+
+  if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) == c->head + 1)
+    return slot;
+
+  return NULL;
+}
+
+static inline void brubeck_shm_release(struct brubeck_shm_consumer *c,
+                                       struct brubeck_shm_slot *slot) {
+  __atomic_store_n(&slot->pid, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&slot->seq, c->head + c->mask + 1, __ATOMIC_RELEASE);
+  __atomic_store_n(&c->ring->head, ++c->head, __ATOMIC_RELEASE);
+}
+
+/* Consumer side: true if a producer claimed the head slot but has not
+ * published it yet */
+static inline int brubeck_shm_pending(struct brubeck_shm_consumer *c) {
+  return __atomic_load_n(&c->ring->tail, __ATOMIC_ACQUIRE) != c->head;
+}
+
+/*
+ * Consumer side: give up on a head slot that was claimed but never
+ * published because its producer died halfway through a push. A slot is
+ * only recycled once its producer is known to be gone: one that is merely
+ * slow could still be writing into it, over the record of the next
+ * producer to claim it. A slot with no PID was claimed by a producer that
+ * died before it could store one: the store right after the claim is the
+ * only thing it had left to do, and callers only skip slots that have been
+ * stalled for a while. Returns 0 if the slot cannot be skipped (yet).
+ *
+ * Producers must share the consumer's PID namespace for this to work;
+ * otherwise stalled slots are never skipped.
+ */
+static inline int brubeck_shm_skip(struct brubeck_shm_consumer *c) {
+  struct brubeck_shm_slot *slot = &c->ring->slots[c->head & c->mask];
+  const int32_t pid = __atomic_load_n(&slot->pid, __ATOMIC_ACQUIRE);
+  uint64_t expected = c->head;
+
+  if (pid > 0 && (kill(pid, 0) == 0 || errno != ESRCH))
+    return 0;
+
+  if (!__atomic_compare_exchange_n(&slot->seq, &expected,
+                                   c->head + c->mask + 1, 0, __ATOMIC_SEQ_CST,
+                                   __ATOMIC_RELAXED))
+    return 0;
+
+  __atomic_store_n(&slot->pid, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&c->ring->head, ++c->head, __ATOMIC_RELEASE);
+  return 1;
+}
+
+/* Consumer side: sleep until a producer pushes, or `timeout_ms` passes */
+static inline void brubeck_shm_wait(struct brubeck_shm_consumer *c,
+                                    int timeout_ms) {
+  struct timespec ts = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+  struct brubeck_shm_ring *ring = c->ring;
+  uint32_t val;
+
+  __atomic_store_n(&ring->waiting, 1, __ATOMIC_SEQ_CST);
+  val = __atomic_load_n(&ring->futex, __ATOMIC_SEQ_CST);
+
+  if (!brubeck_shm_peek(c))
+    syscall(SYS_futex, &ring->futex, FUTEX_WAIT, val, &ts, NULL, 0);
+
+  __atomic_store_n(&ring->waiting, 0, __ATOMIC_SEQ_CST);
+}
+
+/* Producer side: map an existing ring created by brubeck */
+static inline struct brubeck_shm_ring *brubeck_shm_attach(const char *path) {
+  struct brubeck_shm_ring *ring;
+  struct stat st;
+  int fd = open(path, O_RDWR);
+
+  if (fd < 0)
+    return NULL;
+
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return NULL;
+  }
+
+  ring = (struct brubeck_shm_ring *)mmap(
+      NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (ring == MAP_FAILED)
+    return NULL;
+
+  if (!brubeck_shm_valid(ring, (size_t)st.st_size)) {
+    munmap(ring, (size_t)st.st_size);
+    errno = EINVAL;
+    return NULL;
+  }
+
+  return ring;
+}
+
+static inline void brubeck_shm_detach(struct brubeck_shm_ring *ring) {
+  munmap(ring, brubeck_shm_size(ring->capacity));
+}
+
+#endif
@@ -1,6 +1,7 @@
 #include <stddef.h>
 #define _GNU_SOURCE
 #include "brubeck.h"
+#include <linux/sock_diag.h>
 #include <sys/socket.h>
 #include <sys/uio.h>
 
@@ -11,85 +12,426 @@
 #endif
 
 #define MAX_PACKET_SIZE 8192
+#define MAX_GRO_PACKET_SIZE 65536
+#define STATSD_TAGGED_KEY_MAX 1024
+
+#define CONTROL_SIZE (CMSG_SPACE(sizeof(int)) + CMSG_SPACE(sizeof(uint32_t)))
+
+#ifndef SO_MEMINFO
+#define SO_MEMINFO 55
+#endif
+
+/* how often load shedding is adjusted, and its bounds */
+#define SHED_PERIOD_NS (50 * 1000000ULL)
+#define SHED_KEEP_MIN (1.0 / 1024)
+#define SHED_QUEUE_HIGH 0.5
+#define SHED_QUEUE_LOW 0.1
+
+static size_t statsd_packet_size(struct brubeck_statsd *statsd) {
+  return statsd->gro ? MAX_GRO_PACKET_SIZE : MAX_PACKET_SIZE;
+}
+
+/* Segment size of a datagram coalesced by GRO, or 0 */
+static size_t gro_segment_size(struct msghdr *msg) {
+  struct cmsghdr *cmsg;
+
+  for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+    if (cmsg->cmsg_level == IPPROTO_UDP && cmsg->cmsg_type == UDP_GRO) {
+      int segment;
+      memcpy(&segment, CMSG_DATA(cmsg), sizeof(segment));
+      return segment > 0 ? (size_t)segment : 0;
+    }
+  }
+
+  return 0;
+}
+
+/* The IPv4 address a datagram was sent from, or NULL */
+static const struct sockaddr_in *msg_source(struct msghdr *msg) {
+  const struct sockaddr_in *source = msg->msg_name;
+
+  if (source == NULL || msg->msg_namelen < sizeof(*source) ||
+      source->sin_family != AF_INET)
+    return NULL;
+
+  return source;
+}
+
+static inline uint64_t monotonic_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Note the socket drops reported by SO_RXQ_OVFL with a datagram */
+static void rxq_overflow(struct brubeck_statsd_worker *worker,
+                         struct msghdr *msg) {
+  struct cmsghdr *cmsg;
+
+  for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+      uint32_t drops;
+      memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+
+      if (drops != worker->rxq_drops) {
+        worker->overflows += (uint32_t)(drops - worker->rxq_drops);
+        worker->rxq_drops = drops;
+        worker->overflowed = true;
+      }
+      return;
+    }
+  }
+}
+
+/* How full the receive queue of a socket is, from 0 to 1 */
+static double queue_fill(int sock) {
+  uint32_t meminfo[SK_MEMINFO_VARS];
+  socklen_t len = sizeof(meminfo);
+
+  if (getsockopt(sock, SOL_SOCKET, SO_MEMINFO, meminfo, &len) < 0 ||
+      meminfo[SK_MEMINFO_RCVBUF] == 0)
+    return 0.0;
+
+  return (double)meminfo[SK_MEMINFO_RMEM_ALLOC] /
+         (double)meminfo[SK_MEMINFO_RCVBUF];
+}
+
+/*
+ * AIMD controller for load shedding: halve the share of datagrams that are
+ * kept when the kernel dropped packets or the queue is more than half
+ * full, and grow it back slowly once the queue has drained.
+ */
+double brubeck_statsd_shed_keep(double keep, bool overflowed, double fill) {
+  if (overflowed || fill > SHED_QUEUE_HIGH) {
+    keep *= 0.5;
+    if (keep < SHED_KEEP_MIN)
+      keep = SHED_KEEP_MIN;
+  } else if (fill < SHED_QUEUE_LOW && keep < 1.0) {
+    keep *= 1.25;
+    if (keep > 1.0)
+      keep = 1.0;
+  }
+
+  return keep;
+}
+
+static void shed_adjust(struct brubeck_statsd_worker *worker, uint64_t now) {
+  const double fill = queue_fill(worker->sock);
+  const double keep = worker->keep;
+
+  worker->keep = brubeck_statsd_shed_keep(keep, worker->overflowed, fill);
+
+  if ((keep == 1.0) != (worker->keep == 1.0))
+    log_splunk("sampler=%s event=%s keep=%f queue=%f",
+               brubeck_sampler_name(&worker->statsd->sampler),
+               (keep == 1.0) ? "shedding_load" : "shedding_stopped",
+               worker->keep, fill);
+
+  worker->overflowed = false;
+  worker->next_adjust = now + SHED_PERIOD_NS;
+}
+
+/* xorshift64*, uniform in [0, 1) */
+static inline double random_unit(uint64_t *state) {
+  uint64_t x = *state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  *state = x;
+  return (double)((x * 0x2545F4914F6CDD1DULL) >> 11) / 9007199254740992.0;
+}
+
+static void statsd_parse_one(struct brubeck_statsd_worker *worker,
+                             const struct sockaddr_in *source, char *buf,
+                             size_t len) {
+  struct brubeck_statsd *statsd = worker->statsd;
+  double sample_freq = 1.0;
+
+  if (statsd->shed_load) {
+    const uint64_t now = monotonic_ns();
+
+    if (now >= worker->next_adjust)
+      shed_adjust(worker, now);
+
+    /* every datagram is kept with the same probability, so upsampling the
+     * kept ones by its inverse keeps totals unbiased */
+    if (worker->keep < 1.0) {
+      if (random_unit(&worker->rng) >= worker->keep) {
+        worker->shed++;
+        return;
+      }
+      sample_freq = 1.0 / worker->keep;
+    }
+  }
+
+  if (worker->ratelimit) {
+    len = brubeck_ratelimit_apply(worker->ratelimit, source, buf, len,
+                                  monotonic_ns());
+    if (len == 0)
+      return;
+  }
+
+  statsd->parse(statsd, buf, buf + len, sample_freq);
+}
+
+/*
+ * Parse a datagram received from `source` (NULL on Unix sockets) and
+ * return the number of datagrams it held. With GRO, it is made of
+ * datagrams of `segment` bytes each (the last one can be shorter) which
+ * are parsed back to front: the parser terminates each one with a NUL,
+ * which lands on the first byte of the next.
+ */
+size_t brubeck_statsd_parse_datagram(struct brubeck_statsd_worker *worker,
+                                     const struct sockaddr_in *source,
+                                     char *buf, size_t len, size_t segment) {
+  size_t off, count;
+
+  if (segment == 0 || segment >= len) {
+    statsd_parse_one(worker, source, buf, len);
+    return 1;
+  }
+
+  count = (len + segment - 1) / segment;
+  off = (count - 1) * segment;
+
+  statsd_parse_one(worker, source, buf + off, len - off);
+  while (off) {
+    off -= segment;
+    statsd_parse_one(worker, source, buf + off, segment);
+  }
+
+  return count;
+}
+
+/*
+ * A datagram did not fit in the receive buffer and was dropped, since its
+ * last line is cut short. Returns the buffer size to use from now on.
+ */
+static size_t statsd_truncated(struct brubeck_statsd *statsd, size_t size) {
+  brubeck_atomic_inc(&statsd->truncated);
+  brubeck_stats_inc(statsd->sampler.server, errors);
+
+  if (size < MAX_GRO_PACKET_SIZE) {
+    log_splunk("sampler=%s event=packet_truncated buffer_size=%d",
+               brubeck_sampler_name(&statsd->sampler), MAX_GRO_PACKET_SIZE);
+    return MAX_GRO_PACKET_SIZE;
+  }
+
+  return size;
+}
 
 #ifdef HAVE_RECVMMSG
 
 #ifndef MSG_WAITFORONE
 #define MSG_WAITFORONE 0x0
 #endif
+#endif
+
+static inline int worker_recv(struct brubeck_statsd_worker *worker,
+                              struct mmsghdr *msgs, unsigned int vlen,
+                              struct msghdr *msg, bool block) {
+#ifdef HAVE_RECVMMSG
+  if (msgs)
+    return recvmmsg(worker->sock, msgs, vlen,
+                    block ? MSG_WAITFORONE : MSG_DONTWAIT, NULL);
+#endif
+  return recvmsg(worker->sock, msg, block ? 0 : MSG_DONTWAIT);
+}
+
+/*
+ * Receive into either `msgs` (recvmmsg) or `msg` (recvmsg). In busy-poll
+ * mode, spin on non-blocking reads for up to the spin budget before
+ * blocking; the time spent waiting either way is accounted to the worker
+ * and the internal stats.
+ */
+static int statsd_recv(struct brubeck_statsd_worker *worker,
+                       struct mmsghdr *msgs, unsigned int vlen,
+                       struct msghdr *msg) {
+  struct brubeck_statsd *statsd = worker->statsd;
+  struct brubeck_server *server = statsd->sampler.server;
+  uint64_t start, now;
+  int res;
+
+  if (!statsd->spin_budget_ns)
+    return worker_recv(worker, msgs, vlen, msg, true);
+
+  start = monotonic_ns();
+  for (;;) {
+    res = worker_recv(worker, msgs, vlen, msg, false);
+    now = monotonic_ns();
+
+    if (res >= 0 || errno != EAGAIN || now - start >= statsd->spin_budget_ns)
+      break;
+  }
+
+  worker->spin_ns += now - start;
+  brubeck_atomic_add(&server->internal_stats.live.spin_us,
+                     (uint32_t)((now - start) / 1000));
+
+  if (res >= 0 || errno != EAGAIN)
+    return res;
 
-static void statsd_run_recvmmsg(struct brubeck_statsd *statsd, int sock) {
+  res = worker_recv(worker, msgs, vlen, msg, true);
+  start = now;
+  now = monotonic_ns();
+
+  worker->blocked_ns += now - start;
+  brubeck_atomic_add(&server->internal_stats.live.blocked_us,
+                     (uint32_t)((now - start) / 1000));
+  return res;
+}
+
+#ifdef HAVE_RECVMMSG
+
+static void statsd_run_recvmmsg(struct brubeck_statsd_worker *worker) {
+  struct brubeck_statsd *statsd = worker->statsd;
   const unsigned int SIM_PACKETS = statsd->mmsg_count;
   struct brubeck_server *server = statsd->sampler.server;
+  size_t size = statsd_packet_size(statsd);
 
   unsigned int i;
   struct iovec iovecs[SIM_PACKETS];
   struct mmsghdr msgs[SIM_PACKETS];
+  struct sockaddr_in reporters[SIM_PACKETS];
+  char control[SIM_PACKETS][CONTROL_SIZE];
 
   memset(msgs, 0x0, sizeof(msgs));
 
   for (i = 0; i < SIM_PACKETS; ++i) {
-    iovecs[i].iov_base = xmalloc(MAX_PACKET_SIZE);
-    iovecs[i].iov_len = MAX_PACKET_SIZE - 1;
+    iovecs[i].iov_base = xmalloc(size);
+    iovecs[i].iov_len = size - 1;
     msgs[i].msg_hdr.msg_iov = &iovecs[i];
     msgs[i].msg_hdr.msg_iovlen = 1;
+    msgs[i].msg_hdr.msg_control = control[i];
+
+    if (worker->talkers || worker->ratelimit)
+      msgs[i].msg_hdr.msg_name = &reporters[i];
   }
 
-  log_splunk("sampler=statsd event=worker_online syscall=recvmmsg socket=%d",
-             sock);
+  log_splunk("sampler=%s event=worker_online syscall=recvmmsg socket=%d",
+             brubeck_sampler_name(&statsd->sampler), worker->sock);
 
   for (;;) {
-    int res = recvmmsg(sock, msgs, SIM_PACKETS, MSG_WAITFORONE, NULL);
+    size_t grown = size;
+    int res;
+
+    for (i = 0; i < SIM_PACKETS; ++i) {
+      msgs[i].msg_hdr.msg_controllen = CONTROL_SIZE;
+      msgs[i].msg_hdr.msg_namelen = sizeof(reporters[i]);
+    }
+
+    brubeck_reader_offline(worker->reader);
+    res = statsd_recv(worker, msgs, SIM_PACKETS, NULL);
+    brubeck_reader_online(worker->reader);
 
     if (res < 0) {
       if (errno == EAGAIN || errno == EINTR)
         continue;
 
-      log_splunk_errno("sampler=statsd event=failed_read");
+      log_splunk_errno("sampler=%s event=failed_read",
+                       brubeck_sampler_name(&statsd->sampler));
       brubeck_stats_inc(server, errors);
       continue;
     }
 
-    /* store stats */
-    brubeck_atomic_add(&statsd->sampler.inflow, res);
-
     for (i = 0; i < res; ++i) {
-      char *buf = msgs[i].msg_hdr.msg_iov->iov_base;
-      char *end = buf + msgs[i].msg_len;
-      brubeck_statsd_packet_parse(server, buf, end, statsd->scale_timers_by);
+      struct msghdr *hdr = &msgs[i].msg_hdr;
+      const struct sockaddr_in *source = msg_source(hdr);
+
+      if (statsd->shed_load)
+        rxq_overflow(worker, hdr);
+
+      if (worker->talkers && source)
+        brubeck_talkers_add(worker->talkers, source, msgs[i].msg_len);
+
+      if (hdr->msg_flags & MSG_TRUNC) {
+        grown = statsd_truncated(statsd, size);
+        continue;
+      }
+
+      /* store stats */
+      brubeck_atomic_add(&statsd->sampler.inflow,
+                         brubeck_statsd_parse_datagram(
+                             worker, source, hdr->msg_iov->iov_base,
+                             msgs[i].msg_len, gro_segment_size(hdr)));
+    }
+
+    if (grown != size) {
+      size = grown;
+      for (i = 0; i < SIM_PACKETS; ++i) {
+        iovecs[i].iov_base = xrealloc(iovecs[i].iov_base, size);
+        iovecs[i].iov_len = size - 1;
+      }
     }
   }
 }
 #endif
 
-static void statsd_run_recvmsg(struct brubeck_statsd *statsd, int sock) {
+static void statsd_run_recvmsg(struct brubeck_statsd_worker *worker) {
+  struct brubeck_statsd *statsd = worker->statsd;
   struct brubeck_server *server = statsd->sampler.server;
+  size_t size = statsd_packet_size(statsd);
 
-  char *buffer = xmalloc(MAX_PACKET_SIZE);
+  char *buffer = xmalloc(size);
+  char control[CONTROL_SIZE];
   struct sockaddr_in reporter;
-  socklen_t reporter_len = sizeof(reporter);
-  memset(&reporter, 0, reporter_len);
+  struct iovec iov;
+  struct msghdr msg;
+  memset(&reporter, 0, sizeof(reporter));
 
-  log_splunk("sampler=statsd event=worker_online syscall=recvmsg socket=%d",
-             sock);
+  log_splunk("sampler=%s event=worker_online syscall=recvmsg socket=%d",
+             brubeck_sampler_name(&statsd->sampler), worker->sock);
 
   for (;;) {
-    int res = recvfrom(sock, buffer, MAX_PACKET_SIZE - 1, 0,
-                       (struct sockaddr *)&reporter, &reporter_len);
+    const struct sockaddr_in *source;
+    int res;
+
+    memset(&msg, 0x0, sizeof(msg));
+    iov.iov_base = buffer;
+    iov.iov_len = size - 1;
+    msg.msg_name = &reporter;
+    msg.msg_namelen = sizeof(reporter);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    brubeck_reader_offline(worker->reader);
+    res = statsd_recv(worker, NULL, 0, &msg);
+    brubeck_reader_online(worker->reader);
 
     if (res < 0) {
       if (errno == EAGAIN || errno == EINTR)
         continue;
 
-      log_splunk_errno("sampler=statsd event=failed_read from=%s",
+      log_splunk_errno("sampler=%s event=failed_read from=%s",
+                       brubeck_sampler_name(&statsd->sampler),
                        inet_ntoa(reporter.sin_addr));
       brubeck_stats_inc(server, errors);
       continue;
     }
 
-    brubeck_atomic_inc(&statsd->sampler.inflow);
-    brubeck_statsd_packet_parse(server, buffer, buffer + res,
-                                statsd->scale_timers_by);
+    source = msg_source(&msg);
+    if (statsd->shed_load)
+      rxq_overflow(worker, &msg);
+
+    if (worker->talkers && source)
+      brubeck_talkers_add(worker->talkers, source, res);
+
+    if (msg.msg_flags & MSG_TRUNC) {
+      size_t grown = statsd_truncated(statsd, size);
+
+      if (grown != size) {
+        size = grown;
+        buffer = xrealloc(buffer, size);
+      }
+      continue;
+    }
+
+    brubeck_atomic_add(&statsd->sampler.inflow,
+                       brubeck_statsd_parse_datagram(worker, source, buffer,
+                                                     res,
+                                                     gro_segment_size(&msg)));
   }
 }
 
@@ -138,6 +480,9 @@ static inline char *parse_float(char *buffer, value_t *result, uint8_t *mods) {
 
 int brubeck_statsd_msg_parse(struct brubeck_statsd_msg *msg, char *buffer,
                              char *end, const double scale_timers_by) {
+  const char *member;
+  size_t member_len;
+
   *end = '\0';
 
   /**
@@ -169,20 +514,48 @@ int brubeck_statsd_msg_parse(struct brubeck_statsd_msg *msg, char *buffer,
    *
    *      gaugor:333|g
    *             ^^^
+   *
+   * DogStatsD packs several values of the same metric into a
+   * single line; they are validated here and recorded by the caller.
+   *
+   *      timor:320:117:65|ms
+   *                ^^^^^^^
+   *
+   * Set members are arbitrary strings and are hashed once the
+   * type is known.
    */
   {
+    member = buffer;
     msg->modifiers = 0;
+    msg->value_count = 1;
+    msg->values = NULL;
     buffer = parse_float(buffer, &msg->value, &msg->modifiers);
 
-    if (*buffer != '|')
-      return -1;
+    if (*buffer == ':') {
+      msg->values = buffer + 1;
+      do {
+        value_t value;
+        uint8_t mods = 0;
 
+        buffer = parse_float(buffer + 1, &value, &mods);
+        if (++msg->value_count == 0)
+          return -1;
+      } while (*buffer == ':');
+    }
+
+    if (*buffer != '|') {
+      buffer = strchr(buffer, '|');
+      if (!buffer || buffer[1] != 's')
+        return -1;
+    }
+
+    member_len = buffer - member;
     buffer++;
   }
 
   /**
    * Message type: one or two char identifier with the
-   * message type. Valid values: g, c, C, h, ms
+   * message type. Valid values: g, c, C, h, d, ms, s
    *
    *      gaugor:333|g
    *                 ^
@@ -199,8 +572,18 @@ int brubeck_statsd_msg_parse(struct brubeck_statsd_msg *msg, char *buffer,
       msg->type = BRUBECK_MT_COUNTER;
       break;
     case 'h':
+    case 'd': /* DogStatsD distributions */
       msg->type = BRUBECK_MT_HISTO;
       break;
+    case 's':
+      if (member_len == 0)
+        return -1;
+      msg->type = BRUBECK_MT_SET;
+      msg->value = brubeck_hll_member(member, member_len);
+      msg->modifiers = 0;
+      msg->value_count = 1;
+      msg->values = NULL;
+      break;
     case 'm':
       ++buffer;
       if (*buffer == 's') {
@@ -236,6 +619,31 @@ int brubeck_statsd_msg_parse(struct brubeck_statsd_msg *msg, char *buffer,
     } else {
       msg->sample_freq = 1.0;
     }
+  }
+
+  /**
+   * Tags: DogStatsD tag block, if it exists. The tags are interned
+   * together with the key when the metric is looked up.
+   *
+   *      gorets:1|c|@0.1|#env:prod,az:a
+   *                      ^^^^^^^^^^^^^^^
+   */
+  {
+    msg->tags = NULL;
+    msg->tags_len = 0;
+
+    if (buffer[0] == '|' && buffer[1] == '#') {
+      buffer += 2;
+      msg->tags = buffer;
+      while (*buffer != '\0' && *buffer != '\n' && *buffer != '|')
+        ++buffer;
+
+      if (buffer - msg->tags > UINT16_MAX)
+        return -1;
+      msg->tags_len = buffer - msg->tags;
+      if (msg->tags_len == 0)
+        msg->tags = NULL;
+    }
 
     if (buffer[0] == '\0' || (buffer[0] == '\n' && buffer[1] == '\0'))
       return 0;
@@ -244,8 +652,60 @@ int brubeck_statsd_msg_parse(struct brubeck_statsd_msg *msg, char *buffer,
   }
 }
 
-void brubeck_statsd_packet_parse(struct brubeck_server *server, char *buffer,
-                                 char *end, const double scale_timers_by) {
+/*
+ * Find the metric for a message. DogStatsD tags are folded into the key
+ * in the `key#tag:value,...` form understood by the tag interning, so
+ * each distinct tag set gets its own metric; they are ignored when
+ * tagging is not enabled.
+ */
+static struct brubeck_metric *statsd_find(struct brubeck_server *server,
+                                          struct brubeck_statsd_msg *msg) {
+  char key[STATSD_TAGGED_KEY_MAX + 1];
+  size_t key_len;
+
+  if (msg->tags == NULL || server->tags == NULL)
+    return brubeck_metric_find(server, msg->key, msg->key_len, msg->type);
+
+  key_len = (size_t)msg->key_len + 1 + msg->tags_len;
+  if (key_len > STATSD_TAGGED_KEY_MAX)
+    return NULL;
+
+  memcpy(key, msg->key, msg->key_len);
+  key[msg->key_len] = '#';
+  memcpy(key + msg->key_len + 1, msg->tags, msg->tags_len);
+  key[key_len] = '\0';
+
+  return brubeck_metric_find(server, key, key_len, msg->type);
+}
+
+static void statsd_record(struct brubeck_metric *metric,
+                          struct brubeck_statsd_msg *msg,
+                          const double scale_timers_by) {
+  char *values = msg->values;
+  uint16_t i;
+
+  brubeck_metric_record(metric, msg->value, msg->sample_freq, msg->modifiers);
+
+  for (i = 1; i < msg->value_count; ++i) {
+    value_t value;
+    uint8_t mods = 0;
+
+    values = parse_float(values, &value, &mods) + 1;
+    if (msg->type == BRUBECK_MT_TIMER)
+      value *= scale_timers_by;
+
+    brubeck_metric_record(metric, value, msg->sample_freq, mods);
+  }
+}
+
+/*
+ * Parse the lines of a datagram. `sample_freq` is the inverse of the share
+ * of datagrams that were kept while shedding load; it upsamples the values
+ * on top of their own sample rate, except for absolute counters.
+ */
+static void statsd_packet_parse(struct brubeck_server *server, char *buffer,
+                                char *end, const double scale_timers_by,
+                                const double sample_freq) {
   struct brubeck_statsd_msg msg;
   struct brubeck_metric *metric;
 
@@ -254,15 +714,20 @@ void brubeck_statsd_packet_parse(struct brubeck_server *server, char *buffer,
     if (!stat_end)
       stat_end = end;
 
-    if (brubeck_statsd_msg_parse(&msg, buffer, stat_end, scale_timers_by) < 0) {
+    if (brubeck_denylist_drop(server->denylist, buffer, stat_end - buffer)) {
+      /* counted against the matching rule */
+    } else if (brubeck_statsd_msg_parse(&msg, buffer, stat_end,
+                                        scale_timers_by) < 0) {
       brubeck_stats_inc(server, errors);
       log_splunk("sampler=statsd event=packet_drop");
     } else {
       brubeck_stats_inc(server, metrics);
-      metric = brubeck_metric_find(server, msg.key, msg.key_len, msg.type);
+      if (sample_freq != 1.0 && msg.type != BRUBECK_MT_COUNTER)
+        msg.sample_freq *= sample_freq;
+
+      metric = statsd_find(server, &msg);
       if (metric != NULL)
-        brubeck_metric_record(metric, msg.value, msg.sample_freq,
-                              msg.modifiers);
+        statsd_record(metric, &msg, scale_timers_by);
     }
 
     /* move buf past this stat */
@@ -270,35 +735,134 @@ void brubeck_statsd_packet_parse(struct brubeck_server *server, char *buffer,
   }
 }
 
+void brubeck_statsd_packet_parse(struct brubeck_server *server, char *buffer,
+                                 char *end, const double scale_timers_by) {
+  statsd_packet_parse(server, buffer, end, scale_timers_by, 1.0);
+}
+
 static void *statsd__thread(void *_in) {
-  struct brubeck_statsd *statsd = _in;
-  int sock = statsd->sampler.in_sock;
+  struct brubeck_statsd_worker *worker = _in;
+  struct brubeck_statsd *statsd = worker->statsd;
+  int sock = worker->sock;
+
+  assert(sock >= 0);
+
+  worker->reader = brubeck_reader_register(statsd->sampler.server);
 
-#ifdef SO_REUSEPORT
-  if (sock < 0) {
-    sock = brubeck_sampler_socket(&statsd->sampler, 1);
+  if (worker->cpu >= 0) {
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(worker->cpu, &set);
+
+    /* before the receive buffers are allocated, so that they are local
+     * to the core */
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+      log_splunk("sampler=%s event=failed_to_pin cpu=%d",
+                 brubeck_sampler_name(&statsd->sampler), worker->cpu);
   }
-#endif
 
-  assert(sock >= 0);
+  if (statsd->gro && sock_enable_gro(sock) < 0) {
+    log_splunk_errno("sampler=%s event=gro_unavailable",
+                     brubeck_sampler_name(&statsd->sampler));
+  }
+
+  if (statsd->busy_poll && sock_set_busy_poll(sock, statsd->busy_poll) < 0) {
+    log_splunk_errno("sampler=%s event=busy_poll_unavailable",
+                     brubeck_sampler_name(&statsd->sampler));
+  }
+
+  if (statsd->shed_load) {
+    int one = 1;
+
+    /* without multisock the workers share this socket and each of them
+     * sees its drops */
+    if (setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof(one)) < 0) {
+      log_splunk_errno("sampler=%s event=rxq_ovfl_unavailable",
+                       brubeck_sampler_name(&statsd->sampler));
+    }
+  }
 
 #ifdef HAVE_RECVMMSG
   if (statsd->mmsg_count > 1) {
-    statsd_run_recvmmsg(statsd, sock);
+    statsd_run_recvmmsg(worker);
     return NULL;
   }
 #endif
 
-  statsd_run_recvmsg(statsd, sock);
+  statsd_run_recvmsg(worker);
   return NULL;
 }
 
-static void run_worker_threads(struct brubeck_statsd *statsd) {
+static void attach_denylist(struct brubeck_statsd *statsd, int sock) {
+  struct brubeck_denylist *denylist = statsd->sampler.server->denylist;
+
+  /* the filters of UDP sockets see the UDP header before the payload */
+  const unsigned int offset = statsd->sampler.path ? 0 : sizeof(struct udphdr);
+
+  if (denylist == NULL)
+    die("%s: `denylist_filter` needs a `denylist`",
+        brubeck_sampler_name(&statsd->sampler));
+
+  /* the filter runs once per GRO super-packet, and would drop the whole
+   * burst on the first line of its first datagram */
+  if (statsd->gro)
+    die("%s: `denylist_filter` cannot be used with `gro`",
+        brubeck_sampler_name(&statsd->sampler));
+
+  if (brubeck_denylist_attach(denylist, sock, offset) < 0) {
+    log_splunk_errno("sampler=%s event=denylist_filter_unavailable",
+                     brubeck_sampler_name(&statsd->sampler));
+  }
+}
+
+static void run_worker_threads(struct brubeck_statsd *statsd, int multisock) {
   unsigned int i;
-  statsd->workers = xmalloc(statsd->worker_count * sizeof(pthread_t));
+  statsd->workers =
+      xcalloc(statsd->worker_count, sizeof(struct brubeck_statsd_worker));
 
   for (i = 0; i < statsd->worker_count; ++i) {
-    if (pthread_create(&statsd->workers[i], NULL, &statsd__thread, statsd) != 0)
+    struct brubeck_statsd_worker *worker = &statsd->workers[i];
+
+    worker->statsd = statsd;
+    worker->cpu = statsd->cpu_count ? statsd->cpus[i] : -1;
+
+    /* the sockets join the SO_REUSEPORT group in worker order, which is
+     * what the CPU steering program relies on */
+    if (multisock)
+      worker->sock = brubeck_sampler_socket(&statsd->sampler, 1);
+    else
+      worker->sock = statsd->sampler.in_sock;
+
+    if (statsd->denylist_filter && (multisock || i == 0))
+      attach_denylist(statsd, worker->sock);
+
+    if (statsd->top_talkers)
+      worker->talkers = brubeck_talkers_table_new(statsd->sampler.server,
+                                                   statsd->top_talkers);
+
+    if (statsd->ratelimit)
+      worker->ratelimit = brubeck_ratelimit_new(statsd->ratelimit);
+
+    worker->keep = 1.0;
+    worker->rng = (0x9E3779B97F4A7C15ULL * (i + 1)) ^ (uint64_t)time(NULL);
+  }
+
+  if (multisock && statsd->cpu_count) {
+    if (brubeck_sampler_steer_cpus(statsd->workers[0].sock, statsd->cpus,
+                                   statsd->cpu_count) < 0) {
+      log_splunk_errno("sampler=%s event=steering_unavailable",
+                       brubeck_sampler_name(&statsd->sampler));
+    } else {
+      log_splunk("sampler=%s event=steering_by_cpu workers=%u",
+                 brubeck_sampler_name(&statsd->sampler), statsd->cpu_count);
+    }
+  }
+
+  for (i = 0; i < statsd->worker_count; ++i) {
+    struct brubeck_statsd_worker *worker = &statsd->workers[i];
+
+    if (pthread_create(&worker->thread, NULL, &statsd__thread, worker) != 0)
       die("failed to start sampler thread");
   }
 }
@@ -308,39 +872,231 @@ static void shutdown_sampler(struct brubeck_sampler *sampler) {
   size_t i;
 
   for (i = 0; i < statsd->worker_count; ++i) {
-    pthread_cancel(statsd->workers[i]);
+    pthread_cancel(statsd->workers[i].thread);
+  }
+
+  /* after an upgrade, the new process is bound to the same file */
+  if (sampler->path && !sampler->server->upgrade.handed_off)
+    unlink(sampler->path);
+}
+
+void brubeck_statsd_parse(struct brubeck_statsd *statsd, char *buffer,
+                          char *end, double sample_freq) {
+  statsd_packet_parse(statsd->sampler.server, buffer, end,
+                      statsd->scale_timers_by, sample_freq);
+}
+
+void brubeck_statsd_init(struct brubeck_statsd *statsd,
+                         enum brubeck_sampler_t type,
+                         brubeck_statsd_parse_cb parse) {
+  statsd->sampler.type = type;
+  statsd->sampler.shutdown = &shutdown_sampler;
+  statsd->sampler.in_sock = -1;
+  statsd->worker_count = 4;
+  statsd->mmsg_count = 1;
+  statsd->scale_timers_by = 1.;
+  statsd->parse = parse;
+}
+
+/* Open the socket of an inet sampler and start its workers */
+void brubeck_statsd_start(struct brubeck_statsd *statsd, int multisock) {
+#ifndef SO_REUSEPORT
+  multisock = 0;
+#endif
+
+  if (!multisock)
+    statsd->sampler.in_sock = brubeck_sampler_socket(&statsd->sampler, 0);
+
+  run_worker_threads(statsd, multisock);
+}
+
+/*
+ * Pin one worker to each of the cores in the `cpus` array. With
+ * `multisock`, each packet is also steered to the worker pinned to the core
+ * that received it, instead of by hash.
+ */
+void brubeck_statsd_set_cpus(struct brubeck_statsd *statsd, json_t *cpus,
+                             bool workers_set) {
+  const char *name = brubeck_sampler_name(&statsd->sampler);
+  size_t i, count;
+
+  if (!cpus)
+    return;
+
+  count = json_is_array(cpus) ? json_array_size(cpus) : 0;
+  if (count == 0 || count > BRUBECK_STEER_CPUS_MAX)
+    die("%s: `cpus` must list between 1 and %d cores", name,
+        BRUBECK_STEER_CPUS_MAX);
+
+  statsd->cpus = xcalloc(count, sizeof(int));
+  statsd->cpu_count = (unsigned int)count;
+
+  for (i = 0; i < count; ++i) {
+    json_t *cpu = json_array_get(cpus, i);
+
+    if (!json_is_integer(cpu) || json_integer_value(cpu) < 0 ||
+        json_integer_value(cpu) >= CPU_SETSIZE)
+      die("%s: invalid core in `cpus`", name);
+
+    statsd->cpus[i] = (int)json_integer_value(cpu);
+  }
+
+  /* one worker per core; an explicit `workers` must agree */
+  if (workers_set && statsd->worker_count != statsd->cpu_count)
+    die("%s: `workers` is %u but `cpus` lists %u cores", name,
+        statsd->worker_count, statsd->cpu_count);
+
+  statsd->worker_count = statsd->cpu_count;
+}
+
+/*
+ * Busy poll the worker sockets for `busy_poll` usecs per receive, and spin
+ * on non-blocking reads for up to `spin_budget` usecs before blocking.
+ */
+void brubeck_statsd_set_busy_poll(struct brubeck_statsd *statsd, int busy_poll,
+                                  int spin_budget) {
+  struct brubeck_server *server = statsd->sampler.server;
+
+  if (busy_poll < 0 || spin_budget < 0)
+    die("%s: `busy_poll` and `spin_budget` must be positive",
+        brubeck_sampler_name(&statsd->sampler));
+
+  statsd->busy_poll = busy_poll;
+  statsd->spin_budget_ns = (uint64_t)spin_budget * 1000;
+
+  if (statsd->spin_budget_ns)
+    server->internal_stats.busy_poll = true;
+}
+
+json_t *brubeck_statsd_busy_poll_stats(struct brubeck_statsd *statsd) {
+  uint64_t spin_ns = 0, blocked_ns = 0;
+  unsigned int i;
+
+  for (i = 0; i < statsd->worker_count; ++i) {
+    spin_ns += statsd->workers[i].spin_ns;
+    blocked_ns += statsd->workers[i].blocked_ns;
+  }
+
+  return json_pack("{s:i, s:I, s:I}", "spin_budget_us",
+                   (int)(statsd->spin_budget_ns / 1000), "spin_us",
+                   (json_int_t)(spin_ns / 1000), "blocked_us",
+                   (json_int_t)(blocked_ns / 1000));
+}
+
+json_t *brubeck_statsd_ratelimit_stats(struct brubeck_statsd *statsd) {
+  uint64_t source_dropped = 0, prefix_dropped = 0;
+  unsigned int i;
+
+  for (i = 0; i < statsd->worker_count; ++i) {
+    struct brubeck_ratelimit *ratelimit = statsd->workers[i].ratelimit;
+
+    source_dropped += ratelimit->source_dropped;
+    prefix_dropped += ratelimit->prefix_dropped;
   }
+
+  return json_pack("{s:f, s:f, s:I, s:I}", "source_rate",
+                   statsd->ratelimit->source_rate, "prefix_rate",
+                   statsd->ratelimit->prefix_rate, "source_dropped",
+                   (json_int_t)source_dropped, "prefix_dropped",
+                   (json_int_t)prefix_dropped);
+}
+
+json_t *brubeck_statsd_shedding_stats(struct brubeck_statsd *statsd) {
+  uint64_t shed = 0, overflows = 0;
+  double keep = 1.0;
+  unsigned int i;
+
+  for (i = 0; i < statsd->worker_count; ++i) {
+    const struct brubeck_statsd_worker *worker = &statsd->workers[i];
+
+    if (worker->keep < keep)
+      keep = worker->keep;
+
+    shed += worker->shed;
+
+    /* workers sharing a socket all see the same drops */
+    if (statsd->sampler.in_sock >= 0)
+      overflows = (worker->overflows > overflows) ? worker->overflows
+                                                  : overflows;
+    else
+      overflows += worker->overflows;
+  }
+
+  return json_pack("{s:f, s:I, s:I}", "keep", keep, "shed", (json_int_t)shed,
+                   "overflows", (json_int_t)overflows);
+}
+
+static struct brubeck_statsd *statsd_alloc(enum brubeck_sampler_t type) {
+  struct brubeck_statsd *std = xcalloc(1, sizeof(struct brubeck_statsd));
+  brubeck_statsd_init(std, type, &brubeck_statsd_parse);
+  return std;
 }
 
 struct brubeck_sampler *brubeck_statsd_new(struct brubeck_server *server,
                                            json_t *settings) {
-  struct brubeck_statsd *std = xmalloc(sizeof(struct brubeck_statsd));
+  struct brubeck_statsd *std = statsd_alloc(BRUBECK_SAMPLER_STATSD);
 
   char *address;
   int port;
-  int multisock = 0;
+  int multisock = 0, gro = 0, busy_poll = 0, spin_budget = -1;
+  int denylist_filter = 0, shed_load = 0;
+  json_t *cpus = NULL, *rate_limit = NULL;
+
+  json_unpack_or_die(settings,
+                     "{s:s, s:i, s?:i, s?:i, s?:b, s?:F, s?:b, s?:o, s?:i, "
+                     "s?:i, s?:b, s?:i, s?:o, s?:b}",
+                     "address", &address, "port", &port, "workers",
+                     &std->worker_count, "multimsg", &std->mmsg_count,
+                     "multisock", &multisock, "scale_timers_by",
+                     &std->scale_timers_by, "gro", &gro, "cpus", &cpus,
+                     "busy_poll", &busy_poll, "spin_budget", &spin_budget,
+                     "denylist_filter", &denylist_filter, "top_talkers",
+                     &std->top_talkers, "rate_limit", &rate_limit,
+                     "shed_load", &shed_load);
+
+  std->gro = gro;
+  std->denylist_filter = denylist_filter;
+  std->shed_load = shed_load;
+  std->ratelimit = brubeck_ratelimit_config_load(rate_limit, "statsd");
+  brubeck_statsd_set_cpus(std, cpus,
+                          json_object_get(settings, "workers") != NULL);
 
-  std->sampler.type = BRUBECK_SAMPLER_STATSD;
-  std->sampler.shutdown = &shutdown_sampler;
-  std->sampler.in_sock = -1;
-  std->worker_count = 4;
-  std->mmsg_count = 1;
-  std->scale_timers_by = 1.;
+  brubeck_sampler_init_inet(&std->sampler, server, address, port);
+  brubeck_statsd_set_busy_poll(std, busy_poll,
+                               spin_budget < 0 ? busy_poll : spin_budget);
+  brubeck_statsd_start(std, multisock);
+  return &std->sampler;
+}
 
-  json_unpack_or_die(settings, "{s:s, s:i, s?:i, s?:i, s?:b, s?:F}", "address",
-                     &address, "port", &port, "workers", &std->worker_count,
-                     "multimsg", &std->mmsg_count, "multisock", &multisock,
-                     "scale_timers_by", &std->scale_timers_by);
+struct brubeck_sampler *brubeck_statsd_unix_new(struct brubeck_server *server,
+                                                json_t *settings) {
+  struct brubeck_statsd *std = statsd_alloc(BRUBECK_SAMPLER_STATSD_UNIX);
 
-  brubeck_sampler_init_inet(&std->sampler, server, address, port);
+  char *path;
+  char *mode = "0666";
+  int rcvbuf = 0, denylist_filter = 0;
+  json_t *rate_limit = NULL;
+  long perms;
 
-#ifndef SO_REUSEPORT
-  multisock = 0;
-#endif
+  json_unpack_or_die(
+      settings, "{s:s, s?:s, s?:i, s?:i, s?:i, s?:F, s?:b, s?:o}", "path",
+      &path, "mode", &mode, "rcvbuf", &rcvbuf, "workers", &std->worker_count,
+      "multimsg", &std->mmsg_count, "scale_timers_by", &std->scale_timers_by,
+      "denylist_filter", &denylist_filter, "rate_limit", &rate_limit);
 
-  if (!multisock)
-    std->sampler.in_sock = brubeck_sampler_socket(&std->sampler, 0);
+  std->denylist_filter = denylist_filter;
+  std->ratelimit = brubeck_ratelimit_config_load(rate_limit, "statsd-unix");
+
+  perms = strtol(mode, NULL, 8);
+  if (perms <= 0 || perms > 0777)
+    die("invalid socket mode '%s'", mode);
+
+  brubeck_sampler_init_unix(&std->sampler, server, path);
+
+  /* there's no SO_REUSEPORT for AF_UNIX: all the workers share a socket */
+  std->sampler.in_sock =
+      brubeck_sampler_socket_unix(&std->sampler, (mode_t)perms, rcvbuf);
 
-  run_worker_threads(std);
+  run_worker_threads(std, 0);
   return &std->sampler;
 }
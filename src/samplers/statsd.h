@@ -10,22 +10,107 @@ struct brubeck_statsd_msg {
   value_t value;       /* floating point value of the message */
   value_t sample_freq; /* floating poit sample freq (1.0 / sample_rate) */
   uint8_t modifiers;   /* modifiers, as a brubeck_metric_mod_t */
+  uint16_t value_count; /* number of packed values (key:1:2:3|ms) */
+  char *values;         /* packed values after the first one, or NULL */
+  char *tags;           /* DogStatsD tag block (|#a:b,c:d), or NULL */
+  uint16_t tags_len;    /* length of the tag block */
+};
+
+struct brubeck_statsd;
+
+/* Parse all the messages in a received datagram, which stands for
+ * `sample_freq` datagrams when the worker is shedding load */
+typedef void (*brubeck_statsd_parse_cb)(struct brubeck_statsd *statsd,
+                                        char *buffer, char *end,
+                                        double sample_freq);
+
+struct brubeck_statsd_worker {
+  struct brubeck_statsd *statsd;
+  pthread_t thread;
+  int sock;
+  int cpu; /* the core the worker is pinned to, or -1 */
+  struct brubeck_reader *reader;
+
+  /* the heaviest sources of the packets received by the worker */
+  struct brubeck_talker_table *talkers;
+
+  /* limits on the lines accepted per source and key prefix, or NULL */
+  struct brubeck_ratelimit *ratelimit;
+
+  /* load shedding: the probability of keeping a datagram, adjusted from
+   * the socket queue fill and the kernel drops every SHED_PERIOD_NS */
+  double keep;
+  uint64_t rng;
+  uint64_t next_adjust;
+  uint32_t rxq_drops;
+  bool overflowed;
+  uint64_t shed;
+  uint64_t overflows;
+
+  /* time spent waiting for packets, when busy polling */
+  uint64_t spin_ns;
+  uint64_t blocked_ns;
 };
 
 struct brubeck_statsd {
   struct brubeck_sampler sampler;
-  pthread_t *workers;
+  struct brubeck_statsd_worker *workers;
   unsigned int worker_count;
   unsigned int mmsg_count;
   double scale_timers_by;
+  brubeck_statsd_parse_cb parse;
+
+  /* coalesce incoming datagrams with UDP_GRO */
+  bool gro;
+  uint64_t truncated;
+
+  /* cores to pin the workers to, one worker per core */
+  int *cpus;
+  unsigned int cpu_count;
+
+  /* drop datagrams starting with a denied prefix in the kernel */
+  bool denylist_filter;
+
+  /* how many sources each worker tracks, 0 to not track them */
+  unsigned int top_talkers;
+
+  /* the limits each worker enforces, or NULL */
+  struct brubeck_ratelimit_config *ratelimit;
+
+  /* sample datagrams when the workers cannot keep up */
+  bool shed_load;
+
+  /* SO_BUSY_POLL time in usecs, and how long to spin before blocking */
+  int busy_poll;
+  uint64_t spin_budget_ns;
 };
 
 void brubeck_statsd_packet_parse(struct brubeck_server *server, char *buffer,
                                  char *end, const double);
 int brubeck_statsd_msg_parse(struct brubeck_statsd_msg *msg, char *buffer,
                              char *end, const double);
+void brubeck_statsd_parse(struct brubeck_statsd *statsd, char *buffer,
+                          char *end, double sample_freq);
+double brubeck_statsd_shed_keep(double keep, bool overflowed, double fill);
+size_t brubeck_statsd_parse_datagram(struct brubeck_statsd_worker *worker,
+                                     const struct sockaddr_in *source,
+                                     char *buf, size_t len, size_t segment);
+
+void brubeck_statsd_init(struct brubeck_statsd *statsd,
+                         enum brubeck_sampler_t type,
+                         brubeck_statsd_parse_cb parse);
+void brubeck_statsd_start(struct brubeck_statsd *statsd, int multisock);
+void brubeck_statsd_set_cpus(struct brubeck_statsd *statsd, json_t *cpus,
+                             bool workers_set);
+void brubeck_statsd_set_busy_poll(struct brubeck_statsd *statsd, int busy_poll,
+                                  int spin_budget);
+json_t *brubeck_statsd_busy_poll_stats(struct brubeck_statsd *statsd);
+json_t *brubeck_statsd_ratelimit_stats(struct brubeck_statsd *statsd);
+json_t *brubeck_statsd_shedding_stats(struct brubeck_statsd *statsd);
 
 struct brubeck_sampler *brubeck_statsd_new(struct brubeck_server *server,
                                            json_t *settings);
+struct brubeck_sampler *brubeck_statsd_unix_new(struct brubeck_server *server,
+                                                json_t *settings);
 
 #endif
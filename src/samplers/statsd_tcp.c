@@ -0,0 +1,398 @@
+#define _GNU_SOURCE
+#include <sys/epoll.h>
+#include <time.h>
+
+#include "brubeck.h"
+
+#define TCP_MAX_EVENTS 256
+#define TCP_SWEEP_MS 1000
+#define TCP_BACKLOG 1024
+
+static time_t tcp_now(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+  return now.tv_sec;
+}
+
+static void tcp_close(struct brubeck_statsd_tcp_loop *loop,
+                      struct brubeck_statsd_tcp_conn *conn) {
+  pthread_mutex_lock(&loop->lock);
+  {
+    if (conn->prev)
+      conn->prev->next = conn->next;
+    else
+      loop->conns = conn->next;
+    if (conn->next)
+      conn->next->prev = conn->prev;
+    loop->conn_count--;
+  }
+  pthread_mutex_unlock(&loop->lock);
+
+  /* closing the fd also removes it from the epoll set */
+  close(conn->fd);
+  free(conn);
+}
+
+static void tcp_accept(struct brubeck_statsd_tcp_loop *loop, int listener,
+                       time_t now) {
+  struct brubeck_statsd_tcp *tcp = loop->tcp;
+
+  for (;;) {
+    struct brubeck_statsd_tcp_conn *conn;
+    struct sockaddr_in peer;
+    socklen_t peer_len = sizeof(peer);
+    struct epoll_event ev;
+    int fd;
+
+    fd = accept4(listener, (struct sockaddr *)&peer, &peer_len,
+                 SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+    if (fd < 0) {
+      if (errno != EAGAIN && errno != EINTR && errno != ECONNABORTED) {
+        log_splunk_errno("sampler=%s event=failed_accept",
+                         brubeck_sampler_name(&tcp->sampler));
+        brubeck_stats_inc(tcp->sampler.server, errors);
+      }
+      return;
+    }
+
+    conn = xmalloc(sizeof(struct brubeck_statsd_tcp_conn) + tcp->buffer_size);
+    memset(conn, 0x0, sizeof(struct brubeck_statsd_tcp_conn));
+    conn->fd = fd;
+    conn->peer = peer;
+    conn->connected_at = conn->last_active = now;
+
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.ptr = conn;
+
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+      log_splunk_errno("sampler=%s event=failed_epoll_add",
+                       brubeck_sampler_name(&tcp->sampler));
+      close(fd);
+      free(conn);
+      continue;
+    }
+
+    pthread_mutex_lock(&loop->lock);
+    {
+      conn->next = loop->conns;
+      if (loop->conns)
+        loop->conns->prev = conn;
+      loop->conns = conn;
+      loop->conn_count++;
+    }
+    pthread_mutex_unlock(&loop->lock);
+
+    brubeck_atomic_inc(&tcp->accepted);
+  }
+}
+
+static char *statsd_tcp_parse(struct brubeck_statsd_tcp_loop *loop,
+                              struct brubeck_statsd_tcp_conn *conn,
+                              char *start, char *end) {
+  struct brubeck_statsd_tcp *tcp = loop->tcp;
+  char *last = memrchr(start, '\n', end - start);
+
+  if (!last)
+    return start;
+
+  brubeck_statsd_packet_parse(tcp->sampler.server, start, last,
+                              tcp->scale_timers_by);
+  return last + 1;
+}
+
+/*
+ * Read straight into the connection buffer, after any incomplete message
+ * left over from the previous read, and parse all the complete messages in
+ * place. Only the trailing incomplete message is ever moved.
+ */
+void brubeck_statsd_tcp_read(struct brubeck_statsd_tcp_loop *loop,
+                             struct brubeck_statsd_tcp_conn *conn,
+                             time_t now) {
+  struct brubeck_statsd_tcp *tcp = loop->tcp;
+  const size_t capacity = tcp->buffer_size - 1;
+  char *start = conn->buffer;
+  char *data = conn->buffer + conn->partial;
+  char *end;
+  ssize_t res;
+
+  res = read(conn->fd, data, capacity - conn->partial);
+
+  if (res == 0) {
+    tcp_close(loop, conn);
+    return;
+  }
+
+  if (res < 0) {
+    if (errno == EAGAIN || errno == EINTR)
+      return;
+
+    log_splunk_errno("sampler=%s event=failed_read from=%s",
+                     brubeck_sampler_name(&tcp->sampler),
+                     inet_ntoa(conn->peer.sin_addr));
+    brubeck_stats_inc(tcp->sampler.server, errors);
+    tcp_close(loop, conn);
+    return;
+  }
+
+  conn->bytes += res;
+  conn->reads++;
+  conn->last_active = now;
+  brubeck_atomic_inc(&tcp->sampler.inflow);
+
+  end = data + res;
+
+  if (conn->skip) {
+    size_t n = ((size_t)res < conn->skip) ? (size_t)res : conn->skip;
+
+    conn->skip -= n;
+    if (conn->skip)
+      return;
+
+    start = data + n;
+  } else if (conn->discard) {
+    char *nl = memchr(data, '\n', res);
+    if (!nl)
+      return;
+
+    conn->discard = false;
+    start = nl + 1;
+  }
+
+  start = tcp->parse(loop, conn, start, end);
+
+  /* the parser started skipping an oversized frame */
+  if (conn->skip) {
+    conn->partial = 0;
+    return;
+  }
+
+  conn->partial = end - start;
+
+  if (conn->partial == capacity) {
+    /* a single line larger than the whole buffer */
+    log_splunk("sampler=%s event=line_too_long from=%s",
+               brubeck_sampler_name(&tcp->sampler),
+               inet_ntoa(conn->peer.sin_addr));
+    brubeck_atomic_inc(&tcp->overflows);
+    brubeck_stats_inc(tcp->sampler.server, errors);
+    conn->discard = true;
+    conn->partial = 0;
+  } else if (conn->partial && start != conn->buffer) {
+    memmove(conn->buffer, start, conn->partial);
+  }
+}
+
+void brubeck_statsd_tcp_sweep(struct brubeck_statsd_tcp_loop *loop,
+                              time_t now) {
+  struct brubeck_statsd_tcp *tcp = loop->tcp;
+  struct brubeck_statsd_tcp_conn *conn, *next;
+
+  /* only this thread ever unlinks connections, so the list can be
+   * walked without the lock */
+  for (conn = loop->conns; conn; conn = next) {
+    next = conn->next;
+
+    if (now - conn->last_active >= tcp->idle_timeout) {
+      brubeck_atomic_inc(&tcp->idle_closed);
+      tcp_close(loop, conn);
+    }
+  }
+
+  loop->last_sweep = now;
+}
+
+static void *tcp__thread(void *_in) {
+  struct brubeck_statsd_tcp_loop *loop = _in;
+  struct brubeck_statsd_tcp *tcp = loop->tcp;
+  struct epoll_event events[TCP_MAX_EVENTS];
+
+  loop->reader = brubeck_reader_register(tcp->sampler.server);
+
+  log_splunk("sampler=%s event=worker_online syscall=epoll_wait",
+             brubeck_sampler_name(&tcp->sampler));
+
+  for (;;) {
+    time_t now;
+    int i, n;
+
+    brubeck_reader_offline(loop->reader);
+    n = epoll_wait(loop->epfd, events, TCP_MAX_EVENTS, TCP_SWEEP_MS);
+    brubeck_reader_online(loop->reader);
+    now = tcp_now();
+
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+
+      log_splunk_errno("sampler=%s event=failed_epoll_wait",
+                       brubeck_sampler_name(&tcp->sampler));
+      brubeck_stats_inc(tcp->sampler.server, errors);
+      continue;
+    }
+
+    for (i = 0; i < n; ++i) {
+      struct brubeck_statsd_tcp_conn *conn = events[i].data.ptr;
+
+      if (conn == NULL)
+        tcp_accept(loop, tcp->sampler.in_sock, now);
+      else
+        brubeck_statsd_tcp_read(loop, conn, now);
+    }
+
+    if (tcp->idle_timeout > 0 && now != loop->last_sweep)
+      brubeck_statsd_tcp_sweep(loop, now);
+  }
+
+  return NULL;
+}
+
+static void shutdown_sampler(struct brubeck_sampler *sampler) {
+  struct brubeck_statsd_tcp *tcp = (struct brubeck_statsd_tcp *)sampler;
+  unsigned int i;
+
+  for (i = 0; i < tcp->loop_count; ++i)
+    pthread_cancel(tcp->loops[i].thread);
+
+  close(sampler->in_sock);
+}
+
+static int tcp_listen(struct brubeck_sampler *sampler) {
+  struct brubeck_upgrade *upgrade = &sampler->server->upgrade;
+  int sock = brubeck_upgrade_inherit(upgrade, SOCK_STREAM,
+                                     (struct sockaddr *)&sampler->addr);
+
+  /* connections accepted by the previous process are not handed over;
+   * their clients reconnect once it exits */
+  if (sock >= 0)
+    goto done;
+
+  sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, IPPROTO_TCP);
+  assert(sock >= 0);
+
+  sock_setreuse(sock, 1);
+
+  if (bind(sock, (struct sockaddr *)&sampler->addr, sizeof(sampler->addr)) < 0)
+    die("failed to bind socket");
+
+  if (listen(sock, TCP_BACKLOG) < 0)
+    die("failed to listen on socket");
+
+done:
+  brubeck_upgrade_register(upgrade, sock);
+  return sock;
+}
+
+void brubeck_statsd_tcp_init(struct brubeck_statsd_tcp *tcp,
+                             struct brubeck_server *server,
+                             enum brubeck_sampler_t type,
+                             brubeck_tcp_parse_cb parse) {
+  tcp->sampler.type = type;
+  tcp->sampler.shutdown = &shutdown_sampler;
+  tcp->sampler.server = server;
+  tcp->parse = parse;
+  tcp->loop_count = 4;
+  tcp->idle_timeout = 300;
+  tcp->scale_timers_by = 1.;
+}
+
+void brubeck_statsd_tcp_start(struct brubeck_statsd_tcp *tcp,
+                              const char *address, int port, int buffer_size) {
+  const char *name = brubeck_sampler_name(&tcp->sampler);
+  unsigned int i;
+
+  if (tcp->loop_count == 0)
+    die("%s needs at least one worker", name);
+
+  if (buffer_size < 64)
+    die("%s buffer_size is too small", name);
+
+  tcp->buffer_size = (size_t)buffer_size;
+
+  url_to_inaddr2(&tcp->sampler.addr, address, port);
+  tcp->sampler.in_sock = tcp_listen(&tcp->sampler);
+
+  log_splunk("sampler=%s event=load_tcp addr=%s:%d workers=%u", name, address,
+             port, tcp->loop_count);
+
+  tcp->loops = xcalloc(tcp->loop_count, sizeof(struct brubeck_statsd_tcp_loop));
+
+  for (i = 0; i < tcp->loop_count; ++i) {
+    struct brubeck_statsd_tcp_loop *loop = &tcp->loops[i];
+    struct epoll_event ev;
+
+    loop->tcp = tcp;
+    pthread_mutex_init(&loop->lock, NULL);
+
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epfd < 0)
+      die("failed to create epoll instance");
+
+    /* every loop waits on the listener; EPOLLEXCLUSIVE wakes a single
+     * one of them per incoming connection */
+    ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+    ev.data.ptr = NULL;
+
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, tcp->sampler.in_sock, &ev) < 0)
+      die("failed to add listener to epoll");
+
+    if (pthread_create(&loop->thread, NULL, &tcp__thread, loop) != 0)
+      die("failed to start sampler thread");
+  }
+}
+
+struct brubeck_sampler *brubeck_statsd_tcp_new(struct brubeck_server *server,
+                                               json_t *settings) {
+  struct brubeck_statsd_tcp *tcp =
+      xcalloc(1, sizeof(struct brubeck_statsd_tcp));
+  char *address;
+  int port, buffer_size = 8192;
+
+  brubeck_statsd_tcp_init(tcp, server, BRUBECK_SAMPLER_STATSD_TCP,
+                          &statsd_tcp_parse);
+
+  json_unpack_or_die(settings, "{s:s, s:i, s?:i, s?:i, s?:i, s?:F}",
+                     "address", &address, "port", &port, "workers",
+                     &tcp->loop_count, "buffer_size", &buffer_size,
+                     "idle_timeout", &tcp->idle_timeout, "scale_timers_by",
+                     &tcp->scale_timers_by);
+
+  brubeck_statsd_tcp_start(tcp, address, port, buffer_size);
+  return &tcp->sampler;
+}
+
+json_t *brubeck_statsd_tcp_stats(struct brubeck_statsd_tcp *tcp) {
+  json_t *clients = json_array();
+  time_t now = tcp_now();
+  size_t connections = 0;
+  unsigned int i;
+
+  for (i = 0; i < tcp->loop_count; ++i) {
+    struct brubeck_statsd_tcp_loop *loop = &tcp->loops[i];
+    struct brubeck_statsd_tcp_conn *conn;
+
+    pthread_mutex_lock(&loop->lock);
+    connections += loop->conn_count;
+
+    for (conn = loop->conns; conn; conn = conn->next) {
+      char addr[INET_ADDRSTRLEN];
+
+      json_array_append_new(
+          clients,
+          json_pack("{s:s, s:i, s:I, s:I, s:i, s:i}", "address",
+                    inet_ntop(AF_INET, &conn->peer.sin_addr, addr,
+                              INET_ADDRSTRLEN),
+                    "port", (int)ntohs(conn->peer.sin_port), "bytes",
+                    (json_int_t)conn->bytes, "reads", (json_int_t)conn->reads,
+                    "connected_for", (int)(now - conn->connected_at),
+                    "idle_for", (int)(now - conn->last_active)));
+    }
+    pthread_mutex_unlock(&loop->lock);
+  }
+
+  return json_pack("{s:i, s:I, s:I, s:I, s:i, s:o}", "connections",
+                   (int)connections, "accepted", (json_int_t)tcp->accepted,
+                   "idle_closed", (json_int_t)tcp->idle_closed, "overflows",
+                   (json_int_t)tcp->overflows, "idle_timeout",
+                   tcp->idle_timeout, "clients", clients);
+}
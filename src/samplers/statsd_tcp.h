@@ -0,0 +1,70 @@
+#ifndef __BRUBECK_STATSD_TCP_H__
+#define __BRUBECK_STATSD_TCP_H__
+
+struct brubeck_statsd_tcp_conn {
+  struct brubeck_statsd_tcp_conn *prev, *next;
+  int fd;
+  bool discard; /* skipping the rest of a line that overflowed the buffer */
+  size_t skip;  /* bytes of an oversized frame still to be dropped */
+  struct sockaddr_in peer;
+  time_t connected_at;
+  time_t last_active;
+  uint64_t bytes;
+  uint64_t reads;
+  size_t partial; /* bytes of an incomplete line at the start of buffer */
+  char buffer[];
+};
+
+struct brubeck_statsd_tcp_loop {
+  struct brubeck_statsd_tcp *tcp;
+  pthread_t thread;
+  int epfd;
+  time_t last_sweep;
+  void *scratch; /* per-thread parser state */
+  struct brubeck_reader *reader;
+
+  /* guards the connection list against readers in the HTTP thread */
+  pthread_mutex_t lock;
+  struct brubeck_statsd_tcp_conn *conns;
+  size_t conn_count;
+};
+
+/*
+ * Parse the complete messages between `start` and `end` and return a
+ * pointer past the last one; the rest is kept for the next read.
+ */
+typedef char *(*brubeck_tcp_parse_cb)(struct brubeck_statsd_tcp_loop *loop,
+                                      struct brubeck_statsd_tcp_conn *conn,
+                                      char *start, char *end);
+
+struct brubeck_statsd_tcp {
+  struct brubeck_sampler sampler;
+  struct brubeck_statsd_tcp_loop *loops;
+  unsigned int loop_count;
+  brubeck_tcp_parse_cb parse;
+
+  double scale_timers_by;
+  size_t buffer_size;
+  int idle_timeout;
+
+  uint64_t accepted;
+  uint64_t idle_closed;
+  uint64_t overflows;
+};
+
+struct brubeck_sampler *brubeck_statsd_tcp_new(struct brubeck_server *server,
+                                               json_t *settings);
+void brubeck_statsd_tcp_init(struct brubeck_statsd_tcp *tcp,
+                             struct brubeck_server *server,
+                             enum brubeck_sampler_t type,
+                             brubeck_tcp_parse_cb parse);
+void brubeck_statsd_tcp_start(struct brubeck_statsd_tcp *tcp,
+                              const char *address, int port, int buffer_size);
+void brubeck_statsd_tcp_read(struct brubeck_statsd_tcp_loop *loop,
+                             struct brubeck_statsd_tcp_conn *conn,
+                             time_t now);
+void brubeck_statsd_tcp_sweep(struct brubeck_statsd_tcp_loop *loop,
+                              time_t now);
+json_t *brubeck_statsd_tcp_stats(struct brubeck_statsd_tcp *tcp);
+
+#endif
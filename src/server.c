@@ -55,8 +55,12 @@ static void update_proctitle(struct brubeck_server *server) {
 
     for (i = 0; i < server->active_samplers; ++i) {
       struct brubeck_sampler *sampler = server->samplers[i];
-      PUTS("%s :%d %d/s", (i > 0) ? "," : "",
-           (int)ntohs(sampler->addr.sin_port), (int)sampler->current_flow);
+      if (sampler->path)
+        PUTS("%s %s %d/s", (i > 0) ? "," : "", sampler->path,
+             (int)sampler->current_flow);
+      else
+        PUTS("%s :%d %d/s", (i > 0) ? "," : "",
+             (int)ntohs(sampler->addr.sin_port), (int)sampler->current_flow);
     }
 
     PUTS(" ]");
@@ -65,7 +69,8 @@ static void update_proctitle(struct brubeck_server *server) {
 }
 
 static void dump_metric(struct brubeck_metric *mt, void *out_file) {
-  static const char *METRIC_NAMES[] = {"g", "c", "C", "h", "ms", "internal"};
+  static const char *METRIC_NAMES[] = {"g", "c", "C", "h", "ms", "s",
+                                       "internal"};
   fprintf((FILE *)out_file, "%s|%s\n", mt->key, METRIC_NAMES[mt->type]);
 }
 
@@ -82,7 +87,7 @@ static void dump_all_metrics(struct brubeck_server *server) {
     return;
   }
 
-  brubeck_hashtable_foreach(server->metrics, &dump_metric, dump);
+  brubeck_metric_foreach(server, &dump_metric, dump);
   fclose(dump);
 }
 
@@ -120,6 +125,32 @@ static void load_samplers(struct brubeck_server *server, json_t *samplers) {
     if (type && !strcmp(type, "statsd")) {
       server->samplers[server->active_samplers++] =
           brubeck_statsd_new(server, s);
+    } else if (type && !strcmp(type, "statsd-unix")) {
+      server->samplers[server->active_samplers++] =
+          brubeck_statsd_unix_new(server, s);
+    } else if (type && !strcmp(type, "statsd-shm")) {
+      server->samplers[server->active_samplers++] = brubeck_shm_new(server, s);
+    } else if (type && !strcmp(type, "statsd-tcp")) {
+      server->samplers[server->active_samplers++] =
+          brubeck_statsd_tcp_new(server, s);
+    } else if (type && !strcmp(type, "binary")) {
+      server->samplers[server->active_samplers++] =
+          brubeck_binary_new(server, s);
+    } else if (type && !strcmp(type, "binary-unix")) {
+      server->samplers[server->active_samplers++] =
+          brubeck_binary_unix_new(server, s);
+    } else if (type && !strcmp(type, "graphite")) {
+      server->samplers[server->active_samplers++] =
+          brubeck_graphite_new(server, s);
+    } else if (type && !strcmp(type, "graphite-pickle")) {
+      server->samplers[server->active_samplers++] =
+          brubeck_graphite_pickle_new(server, s);
+    } else if (type && !strcmp(type, "influx")) {
+      server->samplers[server->active_samplers++] =
+          brubeck_influx_new(server, s);
+    } else if (type && !strcmp(type, "influx-tcp")) {
+      server->samplers[server->active_samplers++] =
+          brubeck_influx_tcp_new(server, s);
     } else {
       log_splunk("sampler=%s event=invalid_sampler", type);
     }
@@ -152,6 +183,7 @@ static int load_signalfd(void) {
   sigaddset(&mask, SIGINT);
   sigaddset(&mask, SIGTERM);
   sigaddset(&mask, SIGHUP);
+  sigaddset(&mask, SIGUSR1);
   sigaddset(&mask, SIGUSR2);
 
   if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1)
@@ -180,7 +212,11 @@ static void load_config(struct brubeck_server *server, const char *path) {
 
   /* optional */
   char *http = NULL;
-  int tag_capacity = 0;
+  json_t *denylist = NULL, *admission = NULL, *cardinality = NULL;
+  json_t *hot_keys = NULL, *cache = NULL;
+  int tag_capacity = 0, max_keys = 0;
+  json_int_t max_memory = 0;
+  int set_precision = 12;
 
   server->name = "brubeck";
   server->config_name = get_config_name(path);
@@ -191,14 +227,24 @@ static void load_config(struct brubeck_server *server, const char *path) {
         error.line, error.column);
   }
 
-  json_unpack_or_die(server->config, "{s?:s, s:s, s:i, s?:i, s:o, s:o, s?:s}",
-                     "server_name", &server->name, "dumpfile",
-                     &server->dump_path, "capacity", &capacity, "tag_capacity",
-                     &tag_capacity, "backends", &backends, "samplers",
-                     &samplers, "http", &http);
+  json_unpack_or_die(
+      server->config,
+      "{s?:s, s:s, s:i, s?:i, s?:i, s:o, s:o, s?:s, s?:o, s?:o, s?:o, s?:i, "
+      "s?:I, s?:o, s?:o}",
+      "server_name", &server->name, "dumpfile", &server->dump_path,
+      "capacity", &capacity, "tag_capacity", &tag_capacity, "set_precision",
+      &set_precision, "backends", &backends, "samplers", &samplers, "http",
+      &http, "denylist", &denylist, "admission", &admission, "cardinality",
+      &cardinality, "max_keys", &max_keys, "max_memory", &max_memory,
+      "hot_keys", &hot_keys, "cache", &cache);
 
   gh_log_set_instance(server->name);
 
+  if (set_precision < HLL_MIN_PRECISION || set_precision > HLL_MAX_PRECISION)
+    die("set_precision must be between %d and %d", HLL_MIN_PRECISION,
+        HLL_MAX_PRECISION);
+  server->set_precision = (uint8_t)set_precision;
+
   server->metrics = brubeck_hashtable_new(1 << capacity);
   if (!server->metrics)
     die("failed to initialize hash table (size: %lu)", 1ul << capacity);
@@ -209,7 +255,38 @@ static void load_config(struct brubeck_server *server, const char *path) {
       die("failed to initialize tags (size: %lu)", 1ul << tag_capacity);
     log_splunk("event=tagging_initialized");
   }
+
+  if (denylist)
+    server->denylist = brubeck_denylist_load(denylist);
+
+  if (admission)
+    server->admission = brubeck_admission_load(admission);
+
+  if (max_keys < 0)
+    die("max_keys must not be negative");
+  server->max_keys = (uint32_t)max_keys;
+
+  if (max_memory < 0)
+    die("max_memory must not be negative");
+  server->memory.max = (size_t)max_memory;
+
+  if (cardinality)
+    server->cardinality = brubeck_cardinality_load(&server->slab, cardinality);
+
+  server->hotkeys = brubeck_hotkeys_load(hot_keys);
+
+  if (cache) {
+    json_unpack_or_die(cache, "{s:s, s?:i}", "path", &server->cache.path,
+                       "interval", &server->cache.interval);
+    if (server->cache.interval < 0)
+      die("cache: `interval` must not be negative");
+  }
+
   load_backends(server, backends);
+
+  /* restore the metrics before any sampler can create them */
+  brubeck_cache_load(server);
+
   load_samplers(server, samplers);
 
   if (http)
@@ -221,6 +298,9 @@ void brubeck_server_init(struct brubeck_server *server, const char *config) {
    * backends get disconnected */
   signal(SIGPIPE, SIG_IGN);
 
+  /* pick up the sockets of the process we are upgrading from, if any */
+  brubeck_upgrade_receive(&server->upgrade);
+
   server->fd_signal = load_signalfd();
   server->fd_update = load_timerfd(1);
 
@@ -232,6 +312,8 @@ void brubeck_server_init(struct brubeck_server *server, const char *config) {
 
   /* Init the internal stats */
   brubeck_internal__init(server);
+
+  brubeck_upgrade_ack(&server->upgrade);
 }
 
 static int timer_elapsed(struct pollfd *fd) {
@@ -253,9 +335,33 @@ static int signal_triggered(struct pollfd *fd) {
   return -1;
 }
 
+/*
+ * The new binary took over the sockets: stop the samplers and HTTP
+ * endpoint, and give the backends time for one more flush of what this
+ * process aggregated before it exits.
+ */
+static void upgrade_handoff(struct brubeck_server *server) {
+  int i, drain = 0;
+
+  for (i = 0; i < server->active_samplers; ++i) {
+    struct brubeck_sampler *sampler = server->samplers[i];
+    if (sampler->shutdown)
+      sampler->shutdown(sampler);
+  }
+
+  brubeck_http_endpoint_quiesce(server);
+
+  for (i = 0; i < server->active_backends; ++i) {
+    if (server->backends[i]->sample_freq > drain)
+      drain = server->backends[i]->sample_freq;
+  }
+
+  brubeck_upgrade_drain(&server->upgrade, drain + 1);
+}
+
 int brubeck_server_run(struct brubeck_server *server) {
-  struct pollfd fds[2];
-  int nfd = 2;
+  struct pollfd fds[3];
+  int nfd = 3, ticks = 0;
   size_t i;
 
   memset(fds, 0x0, sizeof(fds));
@@ -266,10 +372,15 @@ int brubeck_server_run(struct brubeck_server *server) {
   fds[1].fd = server->fd_update;
   fds[1].events = POLLIN;
 
+  /* the channel to the new binary during an upgrade, or ignored */
+  fds[2].events = POLLIN;
+
   server->running = 1;
   log_splunk("event=listening");
 
   while (server->running) {
+    fds[2].fd = server->upgrade.pending;
+
     if (poll(fds, nfd, -1) < 0)
       continue;
 
@@ -278,6 +389,9 @@ int brubeck_server_run(struct brubeck_server *server) {
       gh_log_reopen();
       log_splunk("event=reload_log");
       break;
+    case SIGUSR1:
+      brubeck_upgrade_start(server);
+      break;
     case SIGUSR2:
       dump_all_metrics(server);
       break;
@@ -287,21 +401,55 @@ int brubeck_server_run(struct brubeck_server *server) {
       break;
     }
 
+    if (fds[2].fd >= 0 && fds[2].revents &&
+        brubeck_upgrade_acked(&server->upgrade))
+      upgrade_handoff(server);
+
     if (timer_elapsed(&fds[1])) {
       update_flows(server);
       update_proctitle(server);
+
+      /* once handed off, the snapshot belongs to the new process */
+      if (server->cache.interval && ++ticks == server->cache.interval) {
+        if (!server->upgrade.handed_off)
+          brubeck_cache_save(server);
+        ticks = 0;
+      }
+
+      brubeck_upgrade_expire(&server->upgrade);
+      if (brubeck_upgrade_drained(&server->upgrade))
+        server->running = 0;
     }
   }
 
+  /* a new binary that has not taken over yet must not outlive this one */
+  brubeck_upgrade_cancel(&server->upgrade, "shutdown");
+
   for (i = 0; i < server->active_backends; ++i)
     pthread_cancel(server->backends[i]->thread);
 
+  /* after an upgrade the samplers are already down, and the snapshot now
+   * belongs to the new process */
+  if (server->upgrade.handed_off) {
+    log_splunk("event=shutdown");
+    return 0;
+  }
+
+  /* the snapshot carries over what was not flushed, so the backends must
+   * be done flushing before it is taken */
+  if (server->cache.path) {
+    for (i = 0; i < server->active_backends; ++i)
+      pthread_join(server->backends[i]->thread, NULL);
+  }
+
   for (i = 0; i < server->active_samplers; ++i) {
     struct brubeck_sampler *sampler = server->samplers[i];
     if (sampler->shutdown)
       sampler->shutdown(sampler);
   }
 
+  brubeck_cache_save(server);
+
   log_splunk("event=shutdown");
   return 0;
 }
@@ -3,6 +3,7 @@
 
 #include "slab.h"
 #include "tags.h"
+#include "upgrade.h"
 
 struct brubeck_internal_stats {
   int sample_freq;
@@ -10,7 +11,14 @@ struct brubeck_internal_stats {
     uint32_t metrics;
     uint32_t errors;
     uint32_t unique_keys;
+    uint32_t spin_us;
+    uint32_t blocked_us;
   } live, sample;
+  bool busy_poll; /* whether any sampler reports spin and blocked time */
+
+  /* the internal metric suffixes, with one per denylist rule */
+  const char **suffixes;
+  size_t suffix_count;
 };
 
 // Server
@@ -36,8 +44,38 @@ struct brubeck_server {
 
   brubeck_hashtable_t *metrics;
   brubeck_tags_t *tags;
+  uint32_t max_keys; /* new keys are dropped past this many, 0 for no limit */
   int at_capacity;
 
+  struct brubeck_memory memory;
+
+  /* per-prefix key budgets, or NULL */
+  struct brubeck_cardinality *cardinality;
+
+  /* two-hit admission of new keys, or NULL */
+  struct brubeck_admission *admission;
+
+  /* key prefixes dropped before parsing, or NULL */
+  struct brubeck_denylist *denylist;
+
+  /* the heaviest sources of the UDP samplers, or NULL */
+  struct brubeck_talkers *talkers;
+
+  /* sampled hot key tracker, or NULL */
+  struct brubeck_hotkeys *hotkeys;
+
+  /* snapshot of the metric store, kept across restarts */
+  struct {
+    const char *path; /* NULL to not keep one */
+    int interval;     /* seconds between snapshots, 0 for shutdown only */
+  } cache;
+
+  /* the listening sockets, handed over to a new binary on SIGUSR1 */
+  struct brubeck_upgrade upgrade;
+
+  /* HyperLogLog precision (log2 of the register count) for sets */
+  uint8_t set_precision;
+
   struct brubeck_sampler *samplers[8];
   struct brubeck_backend *backends[8];
 
@@ -51,6 +89,7 @@ struct brubeck_server {
 
 void brubeck_http_endpoint_init(struct brubeck_server *server,
                                 const char *listen_on);
+void brubeck_http_endpoint_quiesce(struct brubeck_server *server);
 
 void brubeck_internal__init(struct brubeck_server *server);
 void brubeck_internal__sample(struct brubeck_metric *metric,
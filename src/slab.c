@@ -14,12 +14,38 @@ void *brubeck_slab_alloc(struct brubeck_slab *slab, size_t need) {
   struct brubeck_slab_node *node;
   void *ptr;
 
-  need = ((need + SLAB_SIZE - 1) & ~(SLAB_SIZE - 1));
+  need = brubeck_slab_size(need);
 
   pthread_mutex_lock(&slab->lock);
 
+  if (slab->free_lists && need / SLAB_SIZE < SLAB_FREE_CLASSES) {
+    void **chunk = slab->free_lists[need / SLAB_SIZE];
+
+    if (chunk) {
+      slab->free_lists[need / SLAB_SIZE] = *chunk;
+      slab->total_alloc += need;
+      pthread_mutex_unlock(&slab->lock);
+      return chunk;
+    }
+  }
+
   node = slab->current;
 
+  if (unlikely(need > NODE_SIZE)) {
+    /* too large for a shared node: give it a dedicated one, chained
+     * behind the current node so that keeps filling up */
+    struct brubeck_slab_node *large =
+        xmalloc(sizeof(struct brubeck_slab_node) + need);
+
+    large->alloc = need;
+    large->next = node->next;
+    node->next = large;
+
+    slab->total_alloc += need;
+    pthread_mutex_unlock(&slab->lock);
+    return large->heap;
+  }
+
   if (node->alloc + need > NODE_SIZE) {
     node = push_node(slab);
   }
@@ -34,7 +60,35 @@ void *brubeck_slab_alloc(struct brubeck_slab *slab, size_t need) {
   return ptr;
 }
 
+/*
+ * Give back a chunk of `size` bytes (as passed to brubeck_slab_alloc, or
+ * less) to be handed out again for allocations of the same size. Nodes are
+ * never returned to the system, but the bytes stop counting as allocated.
+ * Chunks too large for the free lists are never handed out again, so they
+ * keep counting.
+ */
+void brubeck_slab_free(struct brubeck_slab *slab, void *ptr, size_t size) {
+  void **chunk = ptr;
+
+  size = brubeck_slab_size(size);
+
+  pthread_mutex_lock(&slab->lock);
+
+  if (slab->free_lists == NULL)
+    slab->free_lists = xcalloc(SLAB_FREE_CLASSES, sizeof(void *));
+
+  if (size / SLAB_SIZE < SLAB_FREE_CLASSES) {
+    slab->total_alloc -= size;
+    *chunk = slab->free_lists[size / SLAB_SIZE];
+    slab->free_lists[size / SLAB_SIZE] = chunk;
+  }
+
+  pthread_mutex_unlock(&slab->lock);
+}
+
 void brubeck_slab_init(struct brubeck_slab *slab) {
+  slab->total_alloc = 0;
+  slab->free_lists = NULL;
   push_node(slab);
   pthread_mutex_init(&slab->lock, NULL);
 }
@@ -6,6 +6,11 @@
 #define SLABS_PER_NODE 128
 #define NODE_SIZE (SLAB_SIZE * (SLABS_PER_NODE - 1))
 
+#define brubeck_slab_size(need) (((need) + SLAB_SIZE - 1) & ~(SLAB_SIZE - 1))
+
+/* Freed chunks of up to 64KB are kept for reuse, one list per size */
+#define SLAB_FREE_CLASSES (65536 / SLAB_SIZE + 1)
+
 struct brubeck_slab_node {
   struct brubeck_slab_node *next;
   size_t alloc;
@@ -14,11 +19,13 @@ struct brubeck_slab_node {
 
 struct brubeck_slab {
   struct brubeck_slab_node *current;
-  size_t total_alloc;
+  size_t total_alloc; /* bytes handed out and not freed */
+  void **free_lists;  /* allocated on the first free */
   pthread_mutex_t lock;
 };
 
 void brubeck_slab_init(struct brubeck_slab *slab);
 void *brubeck_slab_alloc(struct brubeck_slab *slab, size_t need);
+void brubeck_slab_free(struct brubeck_slab *slab, void *ptr, size_t size);
 
 #endif
@@ -75,16 +75,31 @@ const uint16_t brubeck_tag_offset(const char *str) {
   return offset;
 }
 
-const uint16_t count_char_in_str(const char *str, char c) {
-  uint16_t count;
-  for (count = 0; str[count]; str[count] == c ? count++ : c++)
-    ;
+/* upper bound on the number of tags in a tag string */
+static uint16_t count_possible_tags(const char *str, uint16_t len) {
+  uint16_t i, count = 1;
+  for (i = 0; i < len; ++i) {
+    if (str[i] == *str_delim)
+      count++;
+  }
   return count;
 }
 
+/* Tags are either `key=value` or, in DogStatsD blocks, `key:value` */
 bool parse_tag(char *kv_str, struct brubeck_tag *tag) {
   char *state, *key, *value;
 
+  if (!strchr(kv_str, char_assoc)) {
+    value = strchr(kv_str, ':');
+    if (value == NULL || value == kv_str || value[1] == '\0')
+      return false;
+
+    *value++ = '\0';
+    tag->key = kv_str;
+    tag->value = value;
+    return true;
+  }
+
   key = strtok_r(kv_str, str_assoc, &state);
   if (key == NULL)
     return false;
@@ -97,29 +112,43 @@ bool parse_tag(char *kv_str, struct brubeck_tag *tag) {
   return true;
 }
 
+static void parse_tags_into(struct brubeck_tag_set *tag_set, char *tag_str,
+                            uint16_t tag_str_len) {
+  char *state;
+
+  tag_set->tag_len = tag_str_len;
+
+  /* `#` introduces Librato and DogStatsD style tag blocks */
+  if (*tag_str == '#')
+    tag_str++;
+
+  for (tag_str = strtok_r(tag_str, str_delim, &state); tag_str;
+       tag_str = strtok_r(NULL, str_delim, &state)) {
+    if (parse_tag(tag_str, &(tag_set->tags[tag_set->num_tags]))) {
+      ++(tag_set->num_tags);
+    }
+  }
+}
+
+static size_t tag_set_size(uint16_t num_possible_tags) {
+  return sizeof(struct brubeck_tag_set) +
+         num_possible_tags * sizeof(struct brubeck_tag);
+}
+
 /* tag_str may be mutated and must remain accessible for the life of
    the brubeck_tag_set */
 struct brubeck_tag_set *brubeck_parse_tags(char *tag_str,
                                            uint16_t tag_str_len) {
-  char *state;
-
   uint16_t num_possible_tags =
-      tag_str ? count_char_in_str(tag_str, char_assoc) : 0;
+      tag_str ? count_possible_tags(tag_str, tag_str_len) : 0;
 
-  size_t alloc_size = sizeof(struct brubeck_tag_set) +
-                      num_possible_tags * sizeof(struct brubeck_tag *);
-  struct brubeck_tag_set *tag_set = malloc(alloc_size);
+  size_t alloc_size = tag_set_size(num_possible_tags);
+  struct brubeck_tag_set *tag_set = xmalloc(alloc_size);
   memset(tag_set, 0x0, alloc_size);
 
-  if (tag_str) {
-    tag_set->tag_len = tag_str_len;
-    for (tag_str = strtok_r(tag_str, str_delim, &state); tag_str;
-         tag_str = strtok_r(NULL, str_delim, &state)) {
-      if (parse_tag(tag_str, &(tag_set->tags[tag_set->num_tags]))) {
-        ++(tag_set->num_tags);
-      }
-    }
-  }
+  if (tag_str)
+    parse_tags_into(tag_set, tag_str, tag_str_len);
+
   return tag_set;
 }
 
@@ -130,20 +159,26 @@ brubeck_get_tag_set_of_tag_str(struct brubeck_tags_t *tags, const char *tag_str,
   tag_set = brubeck_tags_find(tags, tag_str, tag_str_len);
 
   if (tag_set == NULL) {
-    /* two copies are necessary because
-       - tag_str is a piece of a buffer that will change when receiving future
-       messages
-       - creating a brubeck_tag_set consumes and modifies a tag string
-       - hash table storage requires an unmodified key to be accessible for the
-       life of the hash table entry
-    */
-    char *tag_str_for_parse = strdup(tag_str);
-    char *tag_str_for_key = strdup(tag_str);
-    tag_set = brubeck_parse_tags(tag_str_for_parse, tag_str_len);
+    /* tag_str is a piece of a buffer that will change when receiving future
+       messages. A single allocation holds the tag set, the hash table key
+       (which must stay unmodified for the life of the entry) and the copy
+       that the parser splits into tags */
+    uint16_t num_possible_tags = count_possible_tags(tag_str, tag_str_len);
+    size_t set_size = tag_set_size(num_possible_tags);
+    char *block = xmalloc(set_size + 2 * ((size_t)tag_str_len + 1));
+    char *tag_str_for_key = block + set_size;
+    char *tag_str_for_parse = tag_str_for_key + tag_str_len + 1;
+
+    memcpy(tag_str_for_key, tag_str, tag_str_len);
+    tag_str_for_key[tag_str_len] = '\0';
+    memcpy(tag_str_for_parse, tag_str_for_key, tag_str_len + 1);
+
+    tag_set = (struct brubeck_tag_set *)block;
+    memset(tag_set, 0x0, set_size);
+    parse_tags_into(tag_set, tag_str_for_parse, tag_str_len);
+
     if (!brubeck_tags_insert(tags, tag_str_for_key, tag_str_len, tag_set)) {
-      free(tag_set);
-      free(tag_str_for_parse);
-      free(tag_str_for_key);
+      free(block);
       tag_set = brubeck_tags_find(tags, tag_str, tag_str_len);
     }
   }
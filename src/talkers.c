@@ -0,0 +1,325 @@
+#include "brubeck.h"
+
+#define TALKER_NIL UINT32_MAX
+
+struct brubeck_talker_slot {
+  uint32_t hash_next; /* next entry in the same index chain */
+  uint32_t prev, next; /* entries in the same bucket */
+  uint32_t bucket;
+};
+
+struct brubeck_talker_bucket {
+  uint64_t packets;
+  uint32_t prev, next; /* neighbouring buckets, by packet count */
+  uint32_t first;      /* entry */
+};
+
+static void table_reset(struct brubeck_talker_table *table) {
+  uint32_t i;
+
+  table->count = 0;
+  table->packets = 0;
+  table->lightest = TALKER_NIL;
+
+  for (i = 0; i <= table->index_mask; ++i)
+    table->index[i] = TALKER_NIL;
+
+  /* there are never more buckets in use than entries */
+  for (i = 0; i < table->size; ++i)
+    table->buckets[i].next = (i + 1 < table->size) ? i + 1 : TALKER_NIL;
+  table->free_buckets = 0;
+}
+
+struct brubeck_talker_table *
+brubeck_talkers_table_new(struct brubeck_server *server, size_t size) {
+  struct brubeck_talkers *talkers = server->talkers;
+  struct brubeck_talker_table *table;
+  size_t index_size = 1;
+
+  if (talkers == NULL) {
+    talkers = xcalloc(1, sizeof(struct brubeck_talkers));
+    pthread_mutex_init(&talkers->lock, NULL);
+    server->talkers = talkers;
+  }
+
+  while (index_size < size)
+    index_size <<= 1;
+
+  table = xcalloc(1, sizeof(struct brubeck_talker_table) +
+                         size * sizeof(struct brubeck_talker));
+  pthread_spin_init(&table->lock, PTHREAD_PROCESS_PRIVATE);
+  table->size = size;
+  table->slots = xcalloc(size, sizeof(struct brubeck_talker_slot));
+  table->buckets = xcalloc(size, sizeof(struct brubeck_talker_bucket));
+  table->index = xmalloc(index_size * sizeof(uint32_t));
+  table->index_mask = (uint32_t)(index_size - 1);
+  table_reset(table);
+
+  pthread_mutex_lock(&talkers->lock);
+  {
+    talkers->tables =
+        xrealloc(talkers->tables,
+                 (talkers->table_count + 1) * sizeof(*talkers->tables));
+    talkers->tables[talkers->table_count++] = table;
+
+    if (size > talkers->size)
+      talkers->size = size;
+  }
+  pthread_mutex_unlock(&talkers->lock);
+
+  return table;
+}
+
+static uint32_t *index_head(struct brubeck_talker_table *table,
+                            uint32_t addr) {
+  const uint64_t h = ((uint64_t)addr * 0x9E3779B97F4A7C15ULL) >> 32;
+  return &table->index[h & table->index_mask];
+}
+
+static uint32_t index_find(struct brubeck_talker_table *table, uint32_t addr) {
+  uint32_t e = *index_head(table, addr);
+
+  while (e != TALKER_NIL && table->entries[e].addr != addr)
+    e = table->slots[e].hash_next;
+  return e;
+}
+
+static void index_insert(struct brubeck_talker_table *table, uint32_t e) {
+  uint32_t *head = index_head(table, table->entries[e].addr);
+
+  table->slots[e].hash_next = *head;
+  *head = e;
+}
+
+static void index_remove(struct brubeck_talker_table *table, uint32_t e) {
+  uint32_t *link = index_head(table, table->entries[e].addr);
+
+  while (*link != e)
+    link = &table->slots[*link].hash_next;
+  *link = table->slots[e].hash_next;
+}
+
+/* Take a free bucket for `packets` and link it after `after`, or first */
+static uint32_t bucket_insert(struct brubeck_talker_table *table,
+                              uint32_t after, uint64_t packets) {
+  const uint32_t b = table->free_buckets;
+  struct brubeck_talker_bucket *bucket = &table->buckets[b];
+
+  table->free_buckets = bucket->next;
+
+  bucket->packets = packets;
+  bucket->first = TALKER_NIL;
+  bucket->prev = after;
+
+  if (after == TALKER_NIL) {
+    bucket->next = table->lightest;
+    table->lightest = b;
+  } else {
+    bucket->next = table->buckets[after].next;
+    table->buckets[after].next = b;
+  }
+
+  if (bucket->next != TALKER_NIL)
+    table->buckets[bucket->next].prev = b;
+
+  return b;
+}
+
+static void slot_link(struct brubeck_talker_table *table, uint32_t b,
+                      uint32_t e) {
+  struct brubeck_talker_bucket *bucket = &table->buckets[b];
+  struct brubeck_talker_slot *slot = &table->slots[e];
+
+  slot->bucket = b;
+  slot->prev = TALKER_NIL;
+  slot->next = bucket->first;
+
+  if (bucket->first != TALKER_NIL)
+    table->slots[bucket->first].prev = e;
+  bucket->first = e;
+}
+
+/* Take an entry out of its bucket, and free the bucket once empty */
+static void slot_unlink(struct brubeck_talker_table *table, uint32_t e) {
+  struct brubeck_talker_slot *slot = &table->slots[e];
+  struct brubeck_talker_bucket *bucket = &table->buckets[slot->bucket];
+
+  if (slot->prev != TALKER_NIL)
+    table->slots[slot->prev].next = slot->next;
+  else
+    bucket->first = slot->next;
+
+  if (slot->next != TALKER_NIL)
+    table->slots[slot->next].prev = slot->prev;
+
+  if (bucket->first != TALKER_NIL)
+    return;
+
+  if (bucket->prev != TALKER_NIL)
+    table->buckets[bucket->prev].next = bucket->next;
+  else
+    table->lightest = bucket->next;
+
+  if (bucket->next != TALKER_NIL)
+    table->buckets[bucket->next].prev = bucket->prev;
+
+  bucket->next = table->free_buckets;
+  table->free_buckets = slot->bucket;
+}
+
+/* Count a packet for an entry, moving it up to the next bucket */
+static void slot_increment(struct brubeck_talker_table *table, uint32_t e) {
+  struct brubeck_talker_slot *slot = &table->slots[e];
+  const uint32_t b = slot->bucket;
+  const uint64_t packets = ++table->entries[e].packets;
+  uint32_t next = table->buckets[b].next;
+
+  if (next == TALKER_NIL || table->buckets[next].packets != packets) {
+    /* alone in its bucket, which can move up with it */
+    if (table->buckets[b].first == e && slot->next == TALKER_NIL) {
+      table->buckets[b].packets = packets;
+      return;
+    }
+
+    next = bucket_insert(table, b, packets);
+  }
+
+  slot_unlink(table, e);
+  slot_link(table, next, e);
+}
+
+void brubeck_talkers_add(struct brubeck_talker_table *table,
+                         const struct sockaddr_in *source, size_t bytes) {
+  const uint32_t addr = source->sin_addr.s_addr;
+  uint32_t e;
+
+  pthread_spin_lock(&table->lock);
+
+  table->packets++;
+
+  e = index_find(table, addr);
+
+  if (e == TALKER_NIL) {
+    struct brubeck_talker *talker;
+
+    if (table->count < table->size) {
+      uint32_t b = table->lightest;
+
+      e = (uint32_t)table->count++;
+      talker = &table->entries[e];
+      memset(talker, 0x0, sizeof(*talker));
+
+      /* it starts from nothing, below every other counter */
+      if (b == TALKER_NIL || table->buckets[b].packets != 0)
+        b = bucket_insert(table, TALKER_NIL, 0);
+      slot_link(table, b, e);
+    } else {
+      /* take over the lightest counter, inheriting its count as error */
+      e = table->buckets[table->lightest].first;
+      talker = &table->entries[e];
+      index_remove(table, e);
+
+      talker->error = talker->packets;
+      talker->bytes = 0;
+    }
+
+    talker->addr = addr;
+    index_insert(table, e);
+  }
+
+  slot_increment(table, e);
+  table->entries[e].bytes += bytes;
+
+  pthread_spin_unlock(&table->lock);
+}
+
+static int talker_addr_cmp(const void *a, const void *b) {
+  const struct brubeck_talker *ta = a, *tb = b;
+  return (ta->addr > tb->addr) - (ta->addr < tb->addr);
+}
+
+static int talker_packets_cmp(const void *a, const void *b) {
+  const struct brubeck_talker *ta = a, *tb = b;
+  return (ta->packets < tb->packets) - (ta->packets > tb->packets);
+}
+
+/*
+ * Merge the tables of all the workers into the top talkers of the
+ * interval, and reset them. A source tracked by several workers has its
+ * counts summed.
+ */
+void brubeck_talkers_rotate(struct brubeck_talkers *talkers) {
+  struct brubeck_talker *merged, *old;
+  size_t i, count = 0, unique = 0, capacity = 0;
+  uint64_t packets = 0;
+
+  pthread_mutex_lock(&talkers->lock);
+
+  for (i = 0; i < talkers->table_count; ++i)
+    capacity += talkers->tables[i]->size;
+
+  merged = xmalloc((capacity ? capacity : 1) * sizeof(*merged));
+
+  for (i = 0; i < talkers->table_count; ++i) {
+    struct brubeck_talker_table *table = talkers->tables[i];
+
+    pthread_spin_lock(&table->lock);
+    {
+      memcpy(merged + count, table->entries,
+             table->count * sizeof(struct brubeck_talker));
+      count += table->count;
+      packets += table->packets;
+      table_reset(table);
+    }
+    pthread_spin_unlock(&table->lock);
+  }
+
+  qsort(merged, count, sizeof(*merged), &talker_addr_cmp);
+
+  for (i = 0; i < count; ++i) {
+    if (unique && merged[unique - 1].addr == merged[i].addr) {
+      merged[unique - 1].packets += merged[i].packets;
+      merged[unique - 1].bytes += merged[i].bytes;
+      merged[unique - 1].error += merged[i].error;
+    } else {
+      merged[unique++] = merged[i];
+    }
+  }
+
+  qsort(merged, unique, sizeof(*merged), &talker_packets_cmp);
+
+  old = talkers->top;
+  talkers->top = merged;
+  talkers->top_count = (unique < talkers->size) ? unique : talkers->size;
+  talkers->packets = packets;
+
+  pthread_mutex_unlock(&talkers->lock);
+  free(old);
+}
+
+json_t *brubeck_talkers_stats(struct brubeck_talkers *talkers) {
+  json_t *top = json_array();
+  uint64_t packets;
+  size_t i;
+
+  pthread_mutex_lock(&talkers->lock);
+
+  packets = talkers->packets;
+
+  for (i = 0; i < talkers->top_count; ++i) {
+    const struct brubeck_talker *talker = &talkers->top[i];
+    char addr[INET_ADDRSTRLEN];
+
+    inet_ntop(AF_INET, &talker->addr, addr, sizeof(addr));
+    json_array_append_new(
+        top, json_pack("{s:s, s:I, s:I, s:I}", "address", addr, "packets",
+                       (json_int_t)talker->packets, "bytes",
+                       (json_int_t)talker->bytes, "error",
+                       (json_int_t)talker->error));
+  }
+
+  pthread_mutex_unlock(&talkers->lock);
+
+  return json_pack("{s:I, s:o}", "packets", (json_int_t)packets, "talkers",
+                   top);
+}
@@ -0,0 +1,62 @@
+#ifndef __BRUBECK_TALKERS_H__
+#define __BRUBECK_TALKERS_H__
+
+struct brubeck_talker {
+  uint32_t addr; /* IPv4 source address, in network order */
+  uint64_t packets;
+  uint64_t bytes;
+  uint64_t error; /* how much `packets` may be overestimated by */
+};
+
+struct brubeck_talker_slot;
+struct brubeck_talker_bucket;
+
+/*
+ * Space-Saving summary of the heaviest sources seen by a single worker:
+ * `size` counters, where a new source takes over the counter of the
+ * lightest one. Any source that sent more than 1/size of the packets is
+ * guaranteed to be in it. Only its worker writes to it; the lock is taken
+ * by the flush thread once an interval.
+ *
+ * Counters are found through a hash index on the address and kept in a
+ * Stream-Summary: a list of buckets of equal packet counts, lightest
+ * first, so that a packet costs constant time however large the table.
+ */
+struct brubeck_talker_table {
+  pthread_spinlock_t lock;
+  size_t size;
+  size_t count;
+  uint64_t packets;
+
+  struct brubeck_talker_slot *slots; /* one per entry */
+  struct brubeck_talker_bucket *buckets;
+  uint32_t lightest; /* first bucket in use */
+  uint32_t free_buckets;
+
+  uint32_t *index; /* address hash -> first entry of its chain */
+  uint32_t index_mask;
+
+  struct brubeck_talker entries[];
+};
+
+/* All the tables of a server, and their merged top talkers from the last
+ * interval */
+struct brubeck_talkers {
+  pthread_mutex_t lock;
+  size_t size;
+  struct brubeck_talker_table **tables;
+  size_t table_count;
+
+  struct brubeck_talker *top;
+  size_t top_count;
+  uint64_t packets;
+};
+
+struct brubeck_talker_table *
+brubeck_talkers_table_new(struct brubeck_server *server, size_t size);
+void brubeck_talkers_add(struct brubeck_talker_table *table,
+                         const struct sockaddr_in *source, size_t bytes);
+void brubeck_talkers_rotate(struct brubeck_talkers *talkers);
+json_t *brubeck_talkers_stats(struct brubeck_talkers *talkers);
+
+#endif
@@ -0,0 +1,340 @@
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#include "brubeck.h"
+
+/* Keep track of a listening socket, to be handed over on upgrade */
+void brubeck_upgrade_register(struct brubeck_upgrade *upgrade, int sock) {
+  if (upgrade->socket_count == BRUBECK_UPGRADE_MAX_FDS) {
+    log_splunk("event=upgrade_too_many_sockets fd=%d", sock);
+    return;
+  }
+
+  upgrade->sockets[upgrade->socket_count++] = sock;
+}
+
+static bool same_address(const struct sockaddr *addr,
+                         const struct sockaddr_storage *bound) {
+  if (addr->sa_family != bound->ss_family)
+    return false;
+
+  switch (addr->sa_family) {
+  case AF_INET: {
+    const struct sockaddr_in *a = (const struct sockaddr_in *)addr;
+    const struct sockaddr_in *b = (const struct sockaddr_in *)bound;
+    return a->sin_port == b->sin_port &&
+           a->sin_addr.s_addr == b->sin_addr.s_addr;
+  }
+  case AF_UNIX: {
+    const struct sockaddr_un *a = (const struct sockaddr_un *)addr;
+    const struct sockaddr_un *b = (const struct sockaddr_un *)bound;
+    return strncmp(a->sun_path, b->sun_path, sizeof(a->sun_path)) == 0;
+  }
+  }
+
+  return false;
+}
+
+/*
+ * Take over an inherited socket of the given type, bound to `addr`, or
+ * return -1 if there is none and a new one must be bound. The sockets of
+ * a SO_REUSEPORT group all share an address; they are taken in the order
+ * they were bound in the previous process.
+ */
+int brubeck_upgrade_inherit(struct brubeck_upgrade *upgrade, int type,
+                            const struct sockaddr *addr) {
+  size_t i;
+
+  for (i = 0; i < upgrade->inherited_count; ++i) {
+    struct sockaddr_storage bound;
+    socklen_t len = sizeof(bound);
+    int sock = upgrade->inherited[i], sock_type;
+    socklen_t type_len = sizeof(sock_type);
+
+    if (sock < 0)
+      continue;
+
+    memset(&bound, 0x0, sizeof(bound));
+
+    if (getsockopt(sock, SOL_SOCKET, SO_TYPE, &sock_type, &type_len) < 0 ||
+        getsockname(sock, (struct sockaddr *)&bound, &len) < 0)
+      continue;
+
+    if (sock_type == type && same_address(addr, &bound)) {
+      upgrade->inherited[i] = -1;
+      log_splunk("event=upgrade_inherit fd=%d", sock);
+      return sock;
+    }
+  }
+
+  return -1;
+}
+
+/* Pass all the registered sockets down `channel` */
+int brubeck_upgrade_send(struct brubeck_upgrade *upgrade, int channel) {
+  char control[CMSG_SPACE(sizeof(int) * BRUBECK_UPGRADE_MAX_FDS)];
+  uint32_t count = (uint32_t)upgrade->socket_count;
+  struct iovec iov = {.iov_base = &count, .iov_len = sizeof(count)};
+  struct msghdr msg;
+
+  memset(&msg, 0x0, sizeof(msg));
+  memset(control, 0x0, sizeof(control));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+
+  if (count) {
+    struct cmsghdr *cmsg;
+
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+    memcpy(CMSG_DATA(cmsg), upgrade->sockets, sizeof(int) * count);
+  }
+
+  return (sendmsg(channel, &msg, MSG_NOSIGNAL) < 0) ? -1 : 0;
+}
+
+/* Receive the sockets of the previous process from `channel` */
+int brubeck_upgrade_recv(struct brubeck_upgrade *upgrade, int channel) {
+  char control[CMSG_SPACE(sizeof(int) * BRUBECK_UPGRADE_MAX_FDS)];
+  uint32_t count = 0;
+  struct iovec iov = {.iov_base = &count, .iov_len = sizeof(count)};
+  struct cmsghdr *cmsg;
+  struct msghdr msg;
+
+  memset(&msg, 0x0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  if (recvmsg(channel, &msg, MSG_CMSG_CLOEXEC) != sizeof(count))
+    return -1;
+
+  upgrade->inherited_count = 0;
+
+  for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+      size_t n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+      memcpy(upgrade->inherited, CMSG_DATA(cmsg), n * sizeof(int));
+      upgrade->inherited_count = n;
+    }
+  }
+
+  return (upgrade->inherited_count == count) ? 0 : -1;
+}
+
+/*
+ * Called first thing on startup: if this process was exec'd by an upgrade,
+ * pick up the sockets of the one it replaces. They are taken over as the
+ * samplers start, and the rest are closed on ack.
+ */
+void brubeck_upgrade_receive(struct brubeck_upgrade *upgrade) {
+  const char *env = getenv(BRUBECK_UPGRADE_ENV);
+
+  upgrade->channel = -1;
+  upgrade->inherited_count = 0;
+  upgrade->pending = -1;
+
+  if (env == NULL)
+    return;
+
+  upgrade->channel = atoi(env);
+  unsetenv(BRUBECK_UPGRADE_ENV);
+
+  if (fcntl(upgrade->channel, F_SETFD, FD_CLOEXEC) < 0 ||
+      brubeck_upgrade_recv(upgrade, upgrade->channel) < 0)
+    die("failed to receive the sockets of the previous process");
+
+  log_splunk("event=upgrade_received sockets=%zu", upgrade->inherited_count);
+}
+
+/* Tell the previous process that this one is up and receiving */
+void brubeck_upgrade_ack(struct brubeck_upgrade *upgrade) {
+  const char ack = '1';
+  size_t i;
+
+  if (upgrade->channel < 0)
+    return;
+
+  for (i = 0; i < upgrade->inherited_count; ++i) {
+    if (upgrade->inherited[i] >= 0) {
+      log_splunk("event=upgrade_unused fd=%d", upgrade->inherited[i]);
+      close(upgrade->inherited[i]);
+      upgrade->inherited[i] = -1;
+    }
+  }
+
+  if (write(upgrade->channel, &ack, 1) != 1)
+    log_splunk_errno("event=upgrade_ack_failed");
+
+  close(upgrade->channel);
+  upgrade->channel = -1;
+  log_splunk("event=upgrade_ready");
+}
+
+static time_t upgrade_now(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec;
+}
+
+/* Close the descriptors from `from` to `to`, both included */
+static void close_fds(unsigned int from, unsigned int to) {
+  unsigned int max = (unsigned int)getdtablesize();
+
+  if (from > to)
+    return;
+
+#ifdef SYS_close_range
+  if (syscall(SYS_close_range, from, to, 0) == 0)
+    return;
+#endif
+
+  /* kernels older than 5.9 */
+  for (; from <= to && from < max; ++from)
+    close((int)from);
+}
+
+/*
+ * Start the new process and hand it the listening sockets. The metric
+ * store goes over through the cache snapshot, which is saved first and
+ * loaded by the new process before its samplers start. The ack is waited
+ * for from the main loop, see brubeck_upgrade_acked; until it comes, this
+ * process keeps serving as if nothing happened. Returns whether the new
+ * process was started.
+ */
+bool brubeck_upgrade_start(struct brubeck_server *server) {
+  struct brubeck_upgrade *upgrade = &server->upgrade;
+  char channel_fd[16];
+  int pair[2];
+  pid_t pid;
+
+  if (upgrade->argv == NULL) {
+    log_splunk("event=upgrade_failed error=no_argv");
+    return false;
+  }
+
+  if (upgrade->pending >= 0 || upgrade->handed_off) {
+    log_splunk("event=upgrade_failed error=in_progress");
+    return false;
+  }
+
+  brubeck_cache_save(server);
+
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) < 0) {
+    log_splunk_errno("event=upgrade_failed");
+    return false;
+  }
+
+  /* only the child's end goes across the exec */
+  if (fcntl(pair[1], F_SETFD, 0) < 0) {
+    log_splunk_errno("event=upgrade_failed");
+    close(pair[0]);
+    close(pair[1]);
+    return false;
+  }
+
+  snprintf(channel_fd, sizeof(channel_fd), "%d", pair[1]);
+  setenv(BRUBECK_UPGRADE_ENV, channel_fd, 1);
+
+  pid = fork();
+  if (pid == 0) {
+    sigset_t mask;
+
+    /* the sockets come through the channel, nothing else is inherited */
+    if (pair[1] > 3)
+      close_fds(3, (unsigned int)pair[1] - 1);
+    close_fds(pair[1] < 3 ? 3 : (unsigned int)pair[1] + 1, ~0U);
+
+    sigemptyset(&mask);
+    sigprocmask(SIG_SETMASK, &mask, NULL);
+
+    execvp(upgrade->argv[0], upgrade->argv);
+    _exit(127);
+  }
+
+  unsetenv(BRUBECK_UPGRADE_ENV);
+  close(pair[1]);
+
+  if (pid < 0) {
+    log_splunk_errno("event=upgrade_failed");
+    close(pair[0]);
+    return false;
+  }
+
+  log_splunk("event=upgrade_start pid=%d sockets=%zu", (int)pid,
+             upgrade->socket_count);
+
+  upgrade->pending = pair[0];
+  upgrade->child = pid;
+  upgrade->deadline = upgrade_now() + BRUBECK_UPGRADE_TIMEOUT;
+
+  if (brubeck_upgrade_send(upgrade, pair[0]) < 0) {
+    brubeck_upgrade_cancel(upgrade, "send");
+    return false;
+  }
+
+  return true;
+}
+
+/*
+ * Read the ack of the new process once the channel is readable. Returns
+ * whether it took over; if the channel was closed instead, the upgrade is
+ * given up on.
+ */
+bool brubeck_upgrade_acked(struct brubeck_upgrade *upgrade) {
+  char ack = 0;
+
+  if (upgrade->pending < 0)
+    return false;
+
+  if (read(upgrade->pending, &ack, 1) != 1 || ack != '1') {
+    brubeck_upgrade_cancel(upgrade, "no_ack");
+    return false;
+  }
+
+  close(upgrade->pending);
+  upgrade->pending = -1;
+  upgrade->handed_off = true;
+  log_splunk("event=upgrade_handoff pid=%d", (int)upgrade->child);
+  return true;
+}
+
+/* Give up on the new process and keep serving */
+void brubeck_upgrade_cancel(struct brubeck_upgrade *upgrade,
+                            const char *error) {
+  if (upgrade->pending < 0)
+    return;
+
+  log_splunk("event=upgrade_failed pid=%d error=%s", (int)upgrade->child,
+             error);
+  kill(upgrade->child, SIGKILL);
+  waitpid(upgrade->child, NULL, 0);
+  close(upgrade->pending);
+  upgrade->pending = -1;
+}
+
+/* Called on every tick of the main loop while an upgrade is pending */
+void brubeck_upgrade_expire(struct brubeck_upgrade *upgrade) {
+  if (upgrade->pending >= 0 && upgrade_now() >= upgrade->deadline)
+    brubeck_upgrade_cancel(upgrade, "timeout");
+}
+
+/* After the handoff, give the backends `seconds` to flush before exiting */
+void brubeck_upgrade_drain(struct brubeck_upgrade *upgrade, int seconds) {
+  log_splunk("event=upgrade_drain seconds=%d", seconds);
+  upgrade->deadline = upgrade_now() + seconds;
+}
+
+bool brubeck_upgrade_drained(struct brubeck_upgrade *upgrade) {
+  return upgrade->handed_off && upgrade_now() >= upgrade->deadline;
+}
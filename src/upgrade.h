@@ -0,0 +1,58 @@
+#ifndef __BRUBECK_UPGRADE_H__
+#define __BRUBECK_UPGRADE_H__
+
+/* SCM_MAX_FD: the most descriptors a single message can carry */
+#define BRUBECK_UPGRADE_MAX_FDS 253
+
+/* How long the old process waits for the new one to ack, in seconds */
+#define BRUBECK_UPGRADE_TIMEOUT 30
+
+/* Set in the environment of the new process, to its end of the channel */
+#define BRUBECK_UPGRADE_ENV "BRUBECK_UPGRADE_FD"
+
+/*
+ * Hot upgrade: on SIGUSR1 the daemon execs the binary it was started from
+ * and passes it all its listening sockets over a Unix socket pair. The new
+ * process takes them over, by address, as its samplers and HTTP endpoint
+ * start, and acks once it is ready; until then the old one keeps
+ * receiving on them, so no traffic is dropped in between.
+ */
+struct brubeck_upgrade {
+  char **argv; /* to exec the new process with, or NULL */
+
+  /* the sockets this process listens on, in the order they were bound */
+  int sockets[BRUBECK_UPGRADE_MAX_FDS];
+  size_t socket_count;
+
+  /* the sockets passed by the previous process; -1 once taken over */
+  int inherited[BRUBECK_UPGRADE_MAX_FDS];
+  size_t inherited_count;
+  int channel; /* to the previous process, -1 once acked */
+
+  /* an upgrade in progress, driven from the main loop: the channel to the
+   * new process while waiting for its ack, or -1 */
+  int pending;
+  pid_t child;
+
+  /* when the wait for the ack times out, then when the drain is over,
+   * in seconds of CLOCK_MONOTONIC */
+  time_t deadline;
+
+  bool handed_off;
+};
+
+void brubeck_upgrade_register(struct brubeck_upgrade *upgrade, int sock);
+int brubeck_upgrade_inherit(struct brubeck_upgrade *upgrade, int type,
+                            const struct sockaddr *addr);
+int brubeck_upgrade_send(struct brubeck_upgrade *upgrade, int channel);
+int brubeck_upgrade_recv(struct brubeck_upgrade *upgrade, int channel);
+void brubeck_upgrade_receive(struct brubeck_upgrade *upgrade);
+void brubeck_upgrade_ack(struct brubeck_upgrade *upgrade);
+bool brubeck_upgrade_start(struct brubeck_server *server);
+bool brubeck_upgrade_acked(struct brubeck_upgrade *upgrade);
+void brubeck_upgrade_cancel(struct brubeck_upgrade *upgrade, const char *error);
+void brubeck_upgrade_expire(struct brubeck_upgrade *upgrade);
+void brubeck_upgrade_drain(struct brubeck_upgrade *upgrade, int seconds);
+bool brubeck_upgrade_drained(struct brubeck_upgrade *upgrade);
+
+#endif
@@ -55,6 +55,30 @@ void sock_enlarge_in(int fd) {
     die("Failed to set SO_RCVBUF");
 }
 
+void sock_setrcvbuf(int fd, int size) {
+  if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) == -1)
+    die("Failed to set SO_RCVBUF");
+}
+
+/* Returns -1 if the kernel cannot coalesce UDP datagrams (before 5.0) */
+int sock_enable_gro(int fd) {
+  int on = 1;
+  return setsockopt(fd, IPPROTO_UDP, UDP_GRO, &on, sizeof(on));
+}
+
+/*
+ * Returns -1 if busy polling cannot be enabled: SO_BUSY_POLL needs
+ * CAP_NET_ADMIN, and SO_PREFER_BUSY_POLL is only available since 5.11.
+ */
+int sock_set_busy_poll(int fd, int usecs) {
+  int on = 1;
+
+  if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs)) < 0)
+    return -1;
+
+  return setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &on, sizeof(on));
+}
+
 void sock_enlarge_out(int fd) {
   int bs = LARGE_SOCK_SIZE;
 
@@ -103,8 +127,6 @@ void url_to_inaddr2(struct sockaddr_in *addr, const char *url, int port) {
   }
 }
 
-#define FLOAT_PRECISION 4
-
 int brubeck_itoa(char *ptr, uint64_t number) {
   char *origin = ptr;
   int size;
@@ -125,76 +147,3 @@ int brubeck_itoa(char *ptr, uint64_t number) {
 
   return size;
 }
-
-int brubeck_ftoa(char *outbuf, float f) {
-  uint64_t mantissa, int_part, frac_part;
-  int safe_shift;
-  uint64_t safe_mask;
-  short exp2;
-  char *p;
-
-  union {
-    int L;
-    float F;
-  } x;
-
-  x.F = f;
-  p = outbuf;
-
-  exp2 = (unsigned char)(x.L >> 23) - 127;
-  mantissa = (x.L & 0xFFFFFF) | 0x800000;
-  frac_part = 0;
-  int_part = 0;
-
-  if (x.L < 0) {
-    *p++ = '-';
-  }
-
-  if (exp2 < -36) {
-    *p++ = '0';
-    goto END;
-  }
-
-  safe_shift = -(exp2 + 1);
-  safe_mask = 0xFFFFFFFFFFFFFFFFULL >> (64 - 24 - safe_shift);
-
-  if (exp2 >= 64) {
-    int_part = ULONG_MAX;
-  } else if (exp2 >= 23) {
-    int_part = mantissa << (exp2 - 23);
-  } else if (exp2 >= 0) {
-    int_part = mantissa >> (23 - exp2);
-    frac_part = (mantissa)&safe_mask;
-  } else /* if (exp2 < 0) */ {
-    frac_part = (mantissa & 0xFFFFFF);
-  }
-
-  if (int_part == 0) {
-    *p++ = '0';
-  } else {
-    p += brubeck_itoa(p, int_part);
-  }
-
-  if (frac_part != 0) {
-    int m;
-
-    *p++ = '.';
-
-    for (m = 0; m < FLOAT_PRECISION; m++) {
-      frac_part = (frac_part << 3) + (frac_part << 1);
-      *p++ = (frac_part >> (24 + safe_shift)) + '0';
-      frac_part &= safe_mask;
-    }
-
-    for (; p[-1] == '0'; --p) {
-    }
-
-    if (p[-1] == '.') {
-      --p;
-    }
-  }
-
-END:
-  *p = 0;
-  return p - outbuf;
-}
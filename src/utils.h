@@ -12,11 +12,17 @@ void sock_setreuse(int fd, int reuse);
 void sock_setreuse_port(int fd, int reuse);
 void sock_enlarge_out(int fd);
 void sock_enlarge_in(int fd);
+void sock_setrcvbuf(int fd, int size);
+int sock_enable_gro(int fd);
+int sock_set_busy_poll(int fd, int usecs);
 
 char *find_substr(const char *s, const char *find, size_t slen);
 
 int brubeck_itoa(char *ptr, uint64_t number);
-int brubeck_ftoa(char *outbuf, float f);
+/* Shortest round-trip representation of `f`; needs at most
+ * BRUBECK_FTOA_MAX bytes of output, including the NUL terminator */
+#define BRUBECK_FTOA_MAX 32
+int brubeck_ftoa(char *outbuf, value_t f);
 
 static inline int starts_with(const char *str, const char *prefix) {
   for (;; str++, prefix++)
@@ -57,11 +63,19 @@ static inline void *xrealloc(void *ptr, size_t size) {
 #define brubeck_atomic_dec(P) __sync_add_and_fetch((P), -1)
 #define brubeck_atomic_add(P, V) __sync_add_and_fetch((P), (V))
 #define brubeck_atomic_swap(P, V) __sync_lock_test_and_set((P), (V))
+#define brubeck_atomic_or(P, V) __sync_fetch_and_or((P), (V))
 #define brubeck_atomic_fetch(P) __sync_add_and_fetch((P), 0)
 
 /* Compile read-write barrier */
 #define brubeck_barrier() __sync_synchronize()
 
+/* Spin-wait hint */
+#if defined(__x86_64__) || defined(__i386__)
+#define brubeck_cpu_relax() __builtin_ia32_pause()
+#else
+#define brubeck_cpu_relax() brubeck_barrier()
+#endif
+
 void initproctitle(int argc, char **argv);
 int getproctitle(char **procbuffer);
 void setproctitle(const char *prog, const char *txt);
@@ -7,6 +7,8 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "../src/samplers/binary_proto.h"
+
 void diep(char *s) {
   perror(s);
   exit(1);
@@ -15,8 +17,11 @@ void diep(char *s) {
 #define MAX_THREADS 4
 #define SERVER_IP "127.0.0.1"
 #define PORT 8126
+#define KEYS 128
+#define RECORDS_PER_PACKET 32
 
 static uint32_t counter;
+static int binary;
 
 static int build_packet(char *buffer) {
   static const char types[] = {'g', 'c', 'C', 'h'};
@@ -34,6 +39,79 @@ static void *report_thread(void *_) {
   }
 }
 
+static enum brubeck_bin_type key_type(int stat) {
+  static const enum brubeck_bin_type types[] = {
+      BRUBECK_BIN_GAUGE, BRUBECK_BIN_METER, BRUBECK_BIN_COUNTER,
+      BRUBECK_BIN_HISTO};
+  return types[(stat * 0x37) % 4];
+}
+
+/* register the same keys the text generator uses; returns the epoch */
+static uint32_t register_keys(int s, uint32_t *ids) {
+  struct timeval tv = {1, 0};
+  uint32_t epoch = 0;
+  int stat;
+
+  setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+  for (stat = 0; stat < KEYS;) {
+    char key[64], packet[128], reply[64];
+    uint32_t cookie, id;
+    int key_len = sprintf(key, "github.test.packet.%d", stat);
+    size_t len = brubeck_bin_register_encode(packet, sizeof(packet), stat,
+                                             key_type(stat), key, key_len);
+    ssize_t res;
+
+    if (send(s, packet, len, 0) < 0)
+      diep("send");
+
+    res = recv(s, reply, sizeof(reply), 0);
+    if (res < 0 ||
+        brubeck_bin_registered_decode(reply, res, &cookie, &id, &epoch) < 0 ||
+        cookie != (uint32_t)stat)
+      continue; /* lost or stale reply: try again */
+
+    if (id == BRUBECK_BIN_INVALID_ID) {
+      fprintf(stderr, "brubeck rejected key %s\n", key);
+      exit(1);
+    }
+
+    ids[stat++] = id;
+  }
+
+  return epoch;
+}
+
+static void spam_binary(int s) {
+  uint32_t ids[KEYS];
+  uint32_t epoch = register_keys(s, ids);
+  char packet[sizeof(struct brubeck_bin_records) +
+              RECORDS_PER_PACKET * sizeof(struct brubeck_bin_record)];
+  char reply[64];
+
+  for (;;) {
+    struct brubeck_bin_writer w;
+    int i;
+    ssize_t res = recv(s, reply, sizeof(reply), MSG_DONTWAIT);
+
+    /* brubeck restarted: our ids are no longer valid */
+    if (res > 0 && brubeck_bin_kind(reply, res) == BRUBECK_BIN_STALE)
+      epoch = register_keys(s, ids);
+
+    brubeck_bin_records_begin(&w, packet, sizeof(packet), epoch);
+    for (i = 0; i < RECORDS_PER_PACKET; ++i) {
+      int stat = rand() % KEYS;
+      brubeck_bin_records_push(&w, ids[stat], key_type(stat), rand() % 1024,
+                               1.0f, 0);
+    }
+
+    if (send(s, packet, w.len, 0) < 0)
+      printf("C ==> DROPPED\n");
+
+    __sync_add_and_fetch(&counter, RECORDS_PER_PACKET);
+  }
+}
+
 static void *spam_thread(void *_sock) {
   struct sockaddr_in *si_other = _sock;
   int s, slen = sizeof(*si_other);
@@ -42,6 +120,13 @@ static void *spam_thread(void *_sock) {
   if ((s = socket(AF_INET, SOCK_DGRAM, 0)) == -1)
     diep("socket");
 
+  if (binary) {
+    /* connected, so that replies from brubeck can be received */
+    if (connect(s, (void *)si_other, slen) < 0)
+      diep("connect");
+    spam_binary(s);
+  }
+
   for (;;) {
     int len = build_packet(packet);
     if (sendto(s, packet, len, 0, (void *)si_other, slen) < 0)
@@ -59,8 +144,10 @@ int main(int argc, char *argv[]) {
   pthread_t threads[MAX_THREADS], report;
   int i;
 
-  if (argc != 3) {
-    fprintf(stderr, "Usage: 'udp-stress IP PORT'\n");
+  if (argc == 4 && !strcmp(argv[3], "binary"))
+    binary = 1;
+  else if (argc != 3) {
+    fprintf(stderr, "Usage: 'udp-stress IP PORT [binary]'\n");
     exit(-1);
   }
 
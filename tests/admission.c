@@ -0,0 +1,44 @@
+#include "brubeck.h"
+#include "sput.h"
+
+static bool admitted(struct brubeck_admission *admission, const char *key) {
+  return brubeck_admission_check(admission, key, strlen(key));
+}
+
+void test_admission__two_hits(void) {
+  static struct brubeck_server server;
+  static struct brubeck_backend backend;
+  struct brubeck_admission *admission = brubeck_admission_new(1000, 0.001);
+  char packet[] = "once.a:1|c\ntwice:1|c\ntwice:2|c\ntwice:4|c";
+
+  sput_fail_unless(!admitted(admission, "app.req_1"), "first sighting");
+  sput_fail_unless(admitted(admission, "app.req_1"), "second sighting");
+  sput_fail_unless(!admitted(admission, "app.req_2"), "other key");
+
+  brubeck_admission_rotate(admission);
+  sput_fail_unless(admitted(admission, "app.req_2"),
+                   "sightings carry over one rotation");
+  sput_fail_unless(!admitted(admission, "app.req_3"), "new window");
+
+  brubeck_admission_rotate(admission);
+  brubeck_admission_rotate(admission);
+  sput_fail_unless(!admitted(admission, "app.req_3"),
+                   "sightings expire after two rotations");
+  sput_fail_unless(admission->rejected == 4 && admission->admitted_late == 2,
+                   "rejected and admitted counts");
+
+  brubeck_slab_init(&server.slab);
+  server.metrics = brubeck_hashtable_new(64);
+  server.backends[0] = &backend;
+  server.admission = brubeck_admission_new(1000, 0.001);
+
+  brubeck_statsd_packet_parse(&server, packet, packet + strlen(packet), 1.0);
+
+  sput_fail_unless(brubeck_hashtable_find(server.metrics, "once.a", 6) == NULL,
+                   "one-off key gets no metric");
+  sput_fail_unless(
+      brubeck_hashtable_find(server.metrics, "twice", 5) != NULL &&
+          server.admission->rejected == 2 &&
+          server.admission->admitted_late == 1,
+      "repeated key admitted on its second sighting");
+}
@@ -0,0 +1,122 @@
+#include "brubeck.h"
+#include "sput.h"
+
+static uint32_t do_register(struct brubeck_binary *bin, const char *key,
+                            enum brubeck_bin_type type, uint32_t *epoch) {
+  char packet[256], reply[16];
+  uint32_t cookie, id;
+  size_t len;
+
+  len = brubeck_bin_register_encode(packet, sizeof(packet), 0xC0FFEE, type,
+                                    key, strlen(key));
+  len = brubeck_binary_packet_parse(bin, packet, len, reply);
+
+  if (brubeck_bin_registered_decode(reply, len, &cookie, &id, epoch) < 0 ||
+      cookie != 0xC0FFEE)
+    return 0xDEADBEEF;
+
+  return id;
+}
+
+void test_binary__dictionary(void) {
+  static struct brubeck_server server;
+  static struct brubeck_backend backend;
+  struct brubeck_binary bin;
+  struct brubeck_bin_writer w;
+  struct brubeck_metric *meter, *gauge;
+  char packet[512], reply[16];
+  uint32_t epoch, id;
+  size_t len;
+
+  memset(&bin, 0x0, sizeof(bin));
+  brubeck_slab_init(&server.slab);
+  server.metrics = brubeck_hashtable_new(64);
+  server.backends[0] = &backend;
+  bin.sampler.server = &server;
+  bin.sampler.type = BRUBECK_SAMPLER_BINARY;
+  bin.scale_timers_by = 1.0;
+  brubeck_binary_dict_init(&bin, 2);
+
+  sput_fail_unless(do_register(&bin, "bin.meter", BRUBECK_BIN_METER, &epoch) ==
+                       0,
+                   "first key gets id 0");
+  sput_fail_unless(epoch == bin.epoch, "reply carries the epoch");
+  sput_fail_unless(do_register(&bin, "bin.meter", BRUBECK_BIN_METER, &epoch) ==
+                       0,
+                   "registering twice returns the same id");
+  sput_fail_unless(do_register(&bin, "bin.meter", BRUBECK_BIN_GAUGE, &epoch) ==
+                       BRUBECK_BIN_INVALID_ID,
+                   "type mismatch is rejected");
+  sput_fail_unless(do_register(&bin, "bin.gauge", BRUBECK_BIN_GAUGE, &epoch) ==
+                       1,
+                   "second key gets id 1");
+  sput_fail_unless(do_register(&bin, "bin.full", BRUBECK_BIN_GAUGE, &epoch) ==
+                       BRUBECK_BIN_INVALID_ID,
+                   "full dictionary rejects new keys");
+
+  meter = brubeck_hashtable_find(server.metrics, "bin.meter", 9);
+  gauge = brubeck_hashtable_find(server.metrics, "bin.gauge", 9);
+
+  brubeck_bin_records_begin(&w, packet, sizeof(packet), epoch);
+  brubeck_bin_records_push(&w, 0, BRUBECK_BIN_METER, 2.0, 1.0f, 0);
+  brubeck_bin_records_push(&w, 0, BRUBECK_BIN_METER, 3.0, 0.5f, 0);
+  brubeck_bin_records_push(&w, 1, BRUBECK_BIN_GAUGE, 10.0, 1.0f, 0);
+  brubeck_bin_records_push(&w, 1, BRUBECK_BIN_GAUGE, -4.0, 1.0f,
+                           BRUBECK_BIN_RELATIVE);
+  brubeck_bin_records_push(&w, 7, BRUBECK_BIN_GAUGE, 1.0, 1.0f, 0);
+  brubeck_bin_records_push(&w, 0, BRUBECK_BIN_GAUGE, 1.0, 1.0f, 0);
+
+  len = brubeck_binary_packet_parse(&bin, packet, w.len, reply);
+  sput_fail_unless(len == 0, "records are not answered");
+  sput_fail_unless(meter->as.meter.value == 8.0, "meter records applied");
+  sput_fail_unless(gauge->as.gauge.value == 6.0, "gauge records applied");
+  sput_fail_unless(server.internal_stats.live.metrics == 4 &&
+                       server.internal_stats.live.errors == 4,
+                   "unknown ids and wrong types are errors");
+
+  brubeck_bin_records_begin(&w, packet, sizeof(packet), epoch + 1);
+  brubeck_bin_records_push(&w, 0, BRUBECK_BIN_METER, 2.0, 1.0f, 0);
+  len = brubeck_binary_packet_parse(&bin, packet, w.len, reply);
+  sput_fail_unless(brubeck_bin_kind(reply, len) == BRUBECK_BIN_STALE,
+                   "old epochs are answered with STALE");
+  sput_fail_unless(meter->as.meter.value == 8.0, "stale records are dropped");
+
+  id = (uint32_t)brubeck_binary_packet_parse(&bin, packet, w.len - 1, reply);
+  sput_fail_unless(id == 0, "truncated packets are dropped");
+}
+
+void test_binary__folded_keys(void) {
+  static struct brubeck_server server;
+  static struct brubeck_backend backend;
+  struct brubeck_binary bin;
+  struct brubeck_cardinality *c;
+  uint64_t rejected = 0;
+  uint32_t epoch;
+  size_t i;
+
+  memset(&bin, 0x0, sizeof(bin));
+  brubeck_slab_init(&server.slab);
+  server.metrics = brubeck_hashtable_new(64);
+  server.backends[0] = &backend;
+  c = brubeck_cardinality_new(&server.slab, 1, 1, 4);
+  c->fold = true;
+  server.cardinality = c;
+  bin.sampler.server = &server;
+  bin.sampler.type = BRUBECK_SAMPLER_BINARY;
+  bin.scale_timers_by = 1.0;
+  brubeck_binary_dict_init(&bin, 4);
+
+  sput_fail_unless(do_register(&bin, "fold.a", BRUBECK_BIN_METER, &epoch) == 0,
+                   "key within budget registered");
+  sput_fail_unless(do_register(&bin, "fold.b", BRUBECK_BIN_METER, &epoch) ==
+                       BRUBECK_BIN_INVALID_ID,
+                   "key over budget is not given an id");
+  for (i = 0; i <= c->mask; ++i)
+    rejected += c->slots[i].rejected;
+  sput_fail_unless(rejected == 1, "checked against the budget once");
+  sput_fail_unless(brubeck_hashtable_find(server.metrics,
+                                          "fold.__overflow__.meter",
+                                          23) != NULL,
+                   "folded into the overflow metric");
+  sput_fail_unless(bin.count == 1, "overflow metric not registered");
+}
@@ -0,0 +1,91 @@
+#include "brubeck.h"
+#include "sput.h"
+
+struct test_server {
+  struct brubeck_server server;
+  struct brubeck_backend backend;
+};
+
+static struct brubeck_server *server_new(const char *path) {
+  struct test_server *t = calloc(1, sizeof(struct test_server));
+
+  brubeck_slab_init(&t->server.slab);
+  t->server.metrics = brubeck_hashtable_new(16);
+  t->server.backends[0] = &t->backend;
+  t->backend.server = &t->server;
+  t->server.cache.path = path;
+  return &t->server;
+}
+
+static struct brubeck_metric *find(struct brubeck_server *server,
+                                   const char *key, uint8_t type) {
+  return brubeck_metric_find(server, key, strlen(key), type);
+}
+
+void test_cache__roundtrip(void) {
+  struct brubeck_server *saved, *loaded, *reloaded, *limited, *corrupt;
+  struct brubeck_metric *mt;
+  char path[64];
+  FILE *file;
+
+  snprintf(path, sizeof(path), "/tmp/brubeck-cache-test.%d", (int)getpid());
+
+  saved = server_new(path);
+  brubeck_metric_record(find(saved, "gauge", BRUBECK_MT_GAUGE), 5.0, 1.0, 0);
+  brubeck_metric_record(find(saved, "meter", BRUBECK_MT_METER), 7.0, 1.0, 0);
+  mt = find(saved, "counter", BRUBECK_MT_COUNTER);
+  brubeck_metric_record(mt, 10.0, 1.0, 0);
+  brubeck_metric_record(mt, 13.0, 1.0, 0);
+  find(saved, "timer", BRUBECK_MT_TIMER);
+
+  /* a shutdown snapshot */
+  brubeck_cache_save(saved);
+
+  loaded = server_new(path);
+  brubeck_cache_load(loaded);
+
+  sput_fail_unless(brubeck_hashtable_size(loaded->metrics) == 4 &&
+                       find(loaded, "timer", BRUBECK_MT_TIMER) != NULL,
+                   "keys are restored");
+  sput_fail_unless(
+      find(loaded, "gauge", BRUBECK_MT_GAUGE)->as.gauge.value == 5.0 &&
+          find(loaded, "meter", BRUBECK_MT_METER)->as.meter.value == 7.0,
+      "values are restored from a shutdown snapshot");
+
+  mt = find(loaded, "counter", BRUBECK_MT_COUNTER);
+  sput_fail_unless(mt->as.counter.value == 3.0 &&
+                       mt->as.counter.previous == 13.0,
+                   "counters keep their baseline");
+
+  reloaded = server_new(path);
+  brubeck_cache_load(reloaded);
+
+  sput_fail_unless(
+      find(reloaded, "gauge", BRUBECK_MT_GAUGE)->as.gauge.value == 5.0 &&
+          find(reloaded, "meter", BRUBECK_MT_METER)->as.meter.value == 0.0,
+      "unflushed values are only carried over once");
+
+  /* restored keys take their cardinality budget; with no room for
+   * prefixes, they all share the `other` one */
+  limited = server_new(path);
+  limited->cardinality = brubeck_cardinality_new(&limited->slab, 1, 3, 0);
+  brubeck_cache_load(limited);
+
+  sput_fail_unless(brubeck_hashtable_size(limited->metrics) == 3 &&
+                       limited->cardinality->other.admitted == 3 &&
+                       limited->cardinality->other.rejected == 1,
+                   "restored keys over the budget are dropped");
+
+  file = fopen(path, "r+");
+  fseek(file, -1, SEEK_END);
+  fputc('X', file);
+  fclose(file);
+
+  corrupt = server_new(path);
+  brubeck_cache_load(corrupt);
+
+  sput_fail_unless(brubeck_hashtable_size(corrupt->metrics) == 0,
+                   "corrupt snapshots are ignored");
+
+  unlink(path);
+}
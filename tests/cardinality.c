@@ -0,0 +1,137 @@
+#include "brubeck.h"
+#include "sput.h"
+#include "thread_helper.h"
+
+#define RACED_KEYS 20000
+
+static pthread_barrier_t race_start;
+
+static enum brubeck_cardinality_t check(struct brubeck_cardinality *c,
+                                        const char *key, size_t *prefix_len) {
+  return brubeck_cardinality_check(c, key, strlen(key), prefix_len);
+}
+
+static uint32_t admitted_for(struct brubeck_cardinality *c,
+                             const char *prefix) {
+  size_t i;
+
+  for (i = 0; i <= c->mask; ++i) {
+    if (c->slots[i].prefix && !strcmp(c->slots[i].prefix, prefix))
+      return c->slots[i].admitted;
+  }
+
+  return 0;
+}
+
+static void *thread_create_keys(void *ptr) {
+  struct brubeck_server *server = ptr;
+  char key[32];
+  int i;
+
+  pthread_barrier_wait(&race_start);
+
+  for (i = 0; i < RACED_KEYS; ++i) {
+    int len = snprintf(key, sizeof(key), "race.key_%d", i);
+    brubeck_metric_find(server, key, len, BRUBECK_MT_METER);
+  }
+
+  return NULL;
+}
+
+void test_cardinality__prefix_budgets(void) {
+  static struct brubeck_server server;
+  static struct brubeck_backend backend;
+  static struct brubeck_slab slab;
+  struct brubeck_cardinality *c;
+  char key[64];
+  size_t prefix_len = 0;
+  int i, admitted = 0;
+
+  brubeck_slab_init(&slab);
+  c = brubeck_cardinality_new(&slab, 2, 3, 2);
+  brubeck_cardinality_set_limit(c, "app.debug", 1);
+
+  for (i = 0; i < 10; ++i) {
+    snprintf(key, sizeof(key), "app.web.req_%d", i);
+    admitted += (check(c, key, &prefix_len) == BRUBECK_CARDINALITY_ADMIT);
+  }
+
+  sput_fail_unless(admitted == 3 && prefix_len == 7,
+                   "default budget on the first two segments");
+  sput_fail_unless(check(c, "app.debug.a", &prefix_len) ==
+                           BRUBECK_CARDINALITY_ADMIT &&
+                       check(c, "app.debug.b", &prefix_len) ==
+                           BRUBECK_CARDINALITY_REJECT,
+                   "prefix override");
+  sput_fail_unless(check(c, "app#tag=x", &prefix_len) ==
+                           BRUBECK_CARDINALITY_ADMIT &&
+                       prefix_len == 3,
+                   "prefixes stop at the tags");
+  sput_fail_unless(c->count == 2 && c->other.admitted == 1,
+                   "prefixes past max_prefixes share a budget");
+
+  for (i = 0; i < 1000; ++i) {
+    snprintf(key, sizeof(key), "app.web.req_%d", i);
+    check(c, key, &prefix_len);
+  }
+
+  for (i = 0; i <= (int)c->mask; ++i) {
+    const struct brubeck_cardinality_prefix *p = &c->slots[i];
+    value_t estimate;
+
+    if (p->prefix == NULL || strcmp(p->prefix, "app.web"))
+      continue;
+
+    estimate = brubeck_hll_estimate(p->attempted, false);
+    sput_fail_unless(p->admitted == 3 && p->rejected == 1007 &&
+                         estimate > 900 && estimate < 1100,
+                     "attempted keys are estimated, admitted ones counted");
+  }
+
+  brubeck_slab_init(&server.slab);
+  server.metrics = brubeck_hashtable_new(64);
+  server.backends[0] = &backend;
+  server.cardinality = brubeck_cardinality_new(&server.slab, 1, 1, 16);
+  server.cardinality->fold = true;
+
+  sput_fail_unless(brubeck_metric_find(&server, "a.x", 3, BRUBECK_MT_METER) !=
+                       NULL,
+                   "key within budget");
+  sput_fail_unless(brubeck_metric_find(&server, "a.y", 3, BRUBECK_MT_METER) ==
+                       brubeck_hashtable_find(server.metrics,
+                                              "a.__overflow__.meter", 20),
+                   "key over budget folded into the overflow metric");
+  sput_fail_unless(brubeck_metric_find(&server, "a.z", 3, BRUBECK_MT_TIMER) ==
+                       brubeck_hashtable_find(server.metrics,
+                                              "a.__overflow__.timer", 20),
+                   "overflow metrics are kept apart by type");
+
+  /* evicting an overflow metric gives back no budget */
+  brubeck_cardinality_release(server.cardinality, "a.__overflow__.meter", 20);
+  sput_fail_unless(admitted_for(server.cardinality, "a") == 1 &&
+                       brubeck_metric_find(&server, "a.w", 3,
+                                           BRUBECK_MT_METER) ==
+                           brubeck_hashtable_find(server.metrics,
+                                                  "a.__overflow__.meter", 20),
+                   "overflow metrics take no budget");
+
+  server.max_keys = 3;
+  server.cardinality = NULL;
+  sput_fail_unless(brubeck_metric_find(&server, "b", 1, BRUBECK_MT_METER) &&
+                       server.at_capacity &&
+                       !brubeck_metric_find(&server, "c", 1, BRUBECK_MT_METER),
+                   "new keys dropped past max_keys");
+
+  /* threads racing to create the same keys take one budget slot each */
+  memset(&server, 0x0, sizeof(server));
+  brubeck_slab_init(&server.slab);
+  server.metrics = brubeck_hashtable_new(RACED_KEYS);
+  server.backends[0] = &backend;
+  server.cardinality = brubeck_cardinality_new(&server.slab, 1, 0, 16);
+
+  pthread_barrier_init(&race_start, NULL, MAX_THREADS);
+  spawn_threads(&thread_create_keys, &server);
+  pthread_barrier_destroy(&race_start);
+  sput_fail_unless(admitted_for(server.cardinality, "race") == RACED_KEYS,
+                   "budget is given back by inserts that lost a race");
+}
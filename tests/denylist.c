@@ -0,0 +1,55 @@
+#include "brubeck.h"
+#include "sput.h"
+
+static bool denied(struct brubeck_denylist *denylist, const char *key) {
+  return brubeck_denylist_drop(denylist, key, strlen(key));
+}
+
+void test_denylist__prefixes(void) {
+  static struct brubeck_server server;
+  static struct brubeck_backend backend;
+  const char *prefixes[] = {"debug.", "tmp.req_", "tmp.", "x"};
+  struct brubeck_denylist *denylist = brubeck_denylist_new(prefixes, 4);
+  char packet[] = "debug.foo:1|c\nok.a:1|c\ntmp.req_42:2|ms\nx:1|g\nok.b:3|c";
+
+  sput_fail_unless(denylist->rule_count == 4, "rules loaded");
+  sput_fail_unless(!strcmp(denylist->rules[0].suffix, ".denied.debug") &&
+                       !strcmp(denylist->rules[1].suffix, ".denied.tmp_req"),
+                   "rule metric suffixes");
+
+  sput_fail_unless(brubeck_denylist_match(denylist, "debug.a", 7) == 0,
+                   "matches a prefix");
+  sput_fail_unless(brubeck_denylist_match(denylist, "debug", 5) < 0,
+                   "a key shorter than the prefix does not match");
+  sput_fail_unless(brubeck_denylist_match(denylist, "tmp.req_1", 9) == 2,
+                   "the shortest matching prefix wins");
+  sput_fail_unless(brubeck_denylist_match(denylist, "xyz", 3) == 3,
+                   "single byte prefix");
+  sput_fail_unless(brubeck_denylist_match(denylist, "ok.debug.a", 10) < 0,
+                   "prefixes only match at the start");
+  sput_fail_unless(!denied(NULL, "debug.a"), "no denylist");
+
+  brubeck_slab_init(&server.slab);
+  server.metrics = brubeck_hashtable_new(64);
+  server.backends[0] = &backend;
+  server.denylist = denylist;
+
+  brubeck_statsd_packet_parse(&server, packet, packet + strlen(packet), 1.0);
+
+  sput_fail_unless(
+      brubeck_hashtable_find(server.metrics, "ok.a", 4) != NULL &&
+          brubeck_hashtable_find(server.metrics, "ok.b", 4) != NULL,
+      "allowed lines of a mixed packet are recorded");
+  sput_fail_unless(
+      brubeck_hashtable_find(server.metrics, "debug.foo", 9) == NULL &&
+          brubeck_hashtable_find(server.metrics, "tmp.req_42", 10) == NULL,
+      "denied lines are dropped");
+  sput_fail_unless(denylist->rules[0].drops == 1 &&
+                       denylist->rules[1].drops == 0 &&
+                       denylist->rules[2].drops == 1 &&
+                       denylist->rules[3].drops == 1,
+                   "drops are counted per rule");
+  sput_fail_unless(server.internal_stats.live.metrics == 2 &&
+                       server.internal_stats.live.errors == 0,
+                   "denied lines are neither metrics nor errors");
+}
@@ -0,0 +1,123 @@
+#include "brubeck.h"
+#include "sput.h"
+
+static bool queued(struct brubeck_backend *backend,
+                   const struct brubeck_metric *metric) {
+  struct brubeck_metric *mt;
+
+  for (mt = backend->queue; mt; mt = mt->next) {
+    if (mt == metric)
+      return true;
+  }
+
+  return false;
+}
+
+static void count_metric(struct brubeck_metric *metric, void *payload) {
+  (*(int *)payload)++;
+}
+
+static struct brubeck_metric *find(struct brubeck_server *server,
+                                   const char *key) {
+  return brubeck_metric_find(server, key, strlen(key), BRUBECK_MT_METER);
+}
+
+void test_eviction__clock(void) {
+  static struct brubeck_server server;
+  static struct brubeck_backend backend;
+  struct brubeck_reader *reader;
+  struct brubeck_metric *a, *b, *c;
+  int walked = 0;
+
+  brubeck_slab_init(&server.slab);
+  server.metrics = brubeck_hashtable_new(64);
+  server.backends[0] = &backend;
+  backend.server = &server;
+
+  a = find(&server, "cold.a");
+  b = find(&server, "warm.b");
+  c = find(&server, "live.c");
+
+  brubeck_metric_set_state(a, BRUBECK_STATE_DISABLED);
+  brubeck_metric_set_state(b, BRUBECK_STATE_INACTIVE);
+
+  server.memory.max = brubeck_memory_used(&server) - 1;
+  brubeck_eviction_sweep(&backend);
+
+  sput_fail_unless(!queued(&backend, a) && queued(&backend, b) &&
+                       queued(&backend, c) &&
+                       !brubeck_hashtable_find(server.metrics, "cold.a", 6),
+                   "the coldest metric is evicted first");
+  sput_fail_unless(server.memory.evicted == 1 && !server.memory.full &&
+                       brubeck_memory_used(&server) < server.memory.max,
+                   "evicted memory counts as freed");
+
+  /* a sampler that looked metrics up before the next eviction */
+  reader = brubeck_reader_register(&server);
+  brubeck_reader_online(reader);
+
+  server.memory.max = 1;
+  brubeck_eviction_sweep(&backend);
+
+  sput_fail_unless(!queued(&backend, b) && queued(&backend, c) &&
+                       server.memory.evicted == 2,
+                   "idle metrics are evicted, active ones are not");
+  sput_fail_unless(server.memory.full && find(&server, "new.d") == NULL,
+                   "new keys are dropped while over budget");
+
+  brubeck_metric_foreach(&server, &count_metric, &walked);
+  sput_fail_unless(walked == 1, "walks only see the metrics left");
+
+  server.memory.max = 1 << 20;
+  server.memory.walkers = 1;
+  brubeck_eviction_sweep(&backend);
+
+  sput_fail_unless(backend.evicted_count == 1,
+                   "evicted metrics are not freed during a walk");
+
+  server.memory.walkers = 0;
+  brubeck_eviction_sweep(&backend);
+
+  sput_fail_unless(backend.evicted_count == 1,
+                   "evicted metrics are not freed before readers quiesce");
+
+  brubeck_reader_offline(reader);
+  brubeck_eviction_sweep(&backend);
+
+  sput_fail_unless(!server.memory.full && find(&server, "cold.a") == b,
+                   "evicted memory is reused");
+
+  /* the budget also holds between sweeps */
+  server.memory.max = brubeck_memory_used(&server) + 1;
+  sput_fail_unless(find(&server, "storm.e") != NULL &&
+                       find(&server, "storm.f") == NULL && server.memory.full,
+                   "new keys stop at the budget before any sweep");
+
+  /* evicting below `max_keys` takes new keys again */
+  server.memory.max = 1;
+  server.max_keys = server.internal_stats.live.unique_keys;
+  server.at_capacity = 1;
+  brubeck_metric_set_state(c, BRUBECK_STATE_DISABLED);
+  brubeck_eviction_sweep(&backend);
+  sput_fail_unless(!server.at_capacity, "eviction clears the key cap");
+}
+
+void test_eviction__large_chunks(void) {
+  static struct brubeck_slab slab;
+  const size_t large = SLAB_FREE_CLASSES * SLAB_SIZE;
+  void *small, *big;
+
+  brubeck_slab_init(&slab);
+  small = brubeck_slab_alloc(&slab, 100);
+  big = brubeck_slab_alloc(&slab, large);
+
+  brubeck_slab_free(&slab, small, 100);
+  sput_fail_unless(slab.total_alloc == large,
+                   "freed chunks stop counting as allocated");
+  sput_fail_unless(brubeck_slab_alloc(&slab, 100) == small,
+                   "freed chunks are reused");
+
+  brubeck_slab_free(&slab, big, large);
+  sput_fail_unless(slab.total_alloc == large + brubeck_slab_size(100),
+                   "chunks that are never reused keep counting");
+}
@@ -1,19 +1,72 @@
 #include "brubeck.h"
 #include "sput.h"
 
-static void check_eq(float f, const char *str) {
-  char buf[16];
-  brubeck_ftoa(buf, f);
-  sput_fail_unless(strcmp(str, buf) == 0, str);
+#define ROUNDTRIP_SAMPLES 1000000
+
+static void check_eq(double f, const char *str) {
+  char buf[BRUBECK_FTOA_MAX];
+  int len = brubeck_ftoa(buf, f);
+  sput_fail_unless(strcmp(str, buf) == 0 && len == (int)strlen(str), str);
+}
+
+static uint64_t xorshift64(uint64_t *state) {
+  uint64_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return *state = x;
+}
+
+static double random_double(uint64_t *state) {
+  uint64_t bits;
+  double d;
+
+  do {
+    bits = xorshift64(state);
+    memcpy(&d, &bits, sizeof(d));
+  } while (!isfinite(d));
+
+  return d;
 }
 
 void test_ftoa(void) {
   check_eq(0.0, "0");
+  check_eq(-0.0, "0");
   check_eq(15.0, "15");
+  check_eq(-15.0, "-15");
   check_eq(15.5, "15.5");
   check_eq(15.505, "15.505");
   check_eq(0.125, "0.125");
   check_eq(1234.567, "1234.567");
-  check_eq(99999.999, "100000");
+  check_eq(99999.999, "99999.999");
   check_eq(0.999, "0.999");
+  check_eq(0.1, "0.1");
+  check_eq(0.001234, "0.001234");
+  check_eq(1e-7, "1e-7");
+  check_eq(1.5e-10, "1.5e-10");
+  check_eq(123456789012345680.0, "123456789012345680");
+  check_eq(18446744073709551616.0, "18446744073709552000");
+  check_eq(1e22, "1e22");
+  check_eq(1.7976931348623157e308, "1.7976931348623157e308");
+  check_eq(5e-324, "5e-324");
+  check_eq(INFINITY, "inf");
+  check_eq(-INFINITY, "-inf");
+  check_eq(NAN, "nan");
+}
+
+void test_ftoa__roundtrip(void) {
+  uint64_t state = 0x9E3779B97F4A7C15ULL;
+  char buf[BRUBECK_FTOA_MAX];
+  int i;
+
+  for (i = 0; i < ROUNDTRIP_SAMPLES; ++i) {
+    double d = (i & 1) ? random_double(&state)
+                       : (double)(int64_t)xorshift64(&state) / 1000.0;
+    int len = brubeck_ftoa(buf, d);
+
+    if (len >= BRUBECK_FTOA_MAX || strtod(buf, NULL) != d)
+      break;
+  }
+
+  sput_fail_unless(i == ROUNDTRIP_SAMPLES, "random doubles round-trip");
 }
@@ -0,0 +1,101 @@
+#include "brubeck.h"
+#include "sput.h"
+
+/* [("a.b", (1500000000, 1.5)), ("c.d", (1500000001, 2))], protocol 2 */
+static const char PICKLE_V2[] =
+    "\x80\x02\x5d\x71\x00\x28\x58\x03\x00\x00\x00\x61\x2e\x62\x71\x01\x4a"
+    "\x00\x2f\x68\x59\x47\x3f\xf8\x00\x00\x00\x00\x00\x00\x86\x71\x02\x86"
+    "\x71\x03\x58\x03\x00\x00\x00\x63\x2e\x64\x71\x04\x4a\x01\x2f\x68\x59"
+    "\x4b\x02\x86\x71\x05\x86\x71\x06\x65\x2e";
+
+/* [("e.f", (1500000002, 3.25))], protocol 0 */
+static const char PICKLE_V0[] =
+    "(lp0\n(Ve.f\np1\n(I1500000002\nF3.25\ntp2\ntp3\na.";
+
+/* [(b"g.h", (1500000003, -7))], protocol 4 */
+static const char PICKLE_V4[] =
+    "\x80\x04\x95\x18\x00\x00\x00\x00\x00\x00\x00\x5d\x94\x43\x03\x67\x2e"
+    "\x68\x94\x4a\x03\x2f\x68\x59\x4a\xf9\xff\xff\xff\x86\x94\x86\x94\x61"
+    "\x2e";
+
+static double gauge_value(struct brubeck_server *server, const char *key) {
+  struct brubeck_metric *metric =
+      brubeck_hashtable_find(server->metrics, key, strlen(key));
+  return metric ? metric->as.gauge.value : NAN;
+}
+
+static void feed_line(struct brubeck_graphite *graphite, const char *line) {
+  char buf[256];
+  size_t len = strlen(line);
+
+  memcpy(buf, line, len);
+  brubeck_graphite_line(graphite, buf, buf + len);
+}
+
+void test_graphite__points(void) {
+  static struct brubeck_server server;
+  static struct brubeck_backend backend;
+  struct brubeck_graphite graphite;
+  struct brubeck_statsd_tcp_loop loop;
+
+  memset(&graphite, 0x0, sizeof(graphite));
+  memset(&loop, 0x0, sizeof(loop));
+  brubeck_slab_init(&server.slab);
+  server.metrics = brubeck_hashtable_new(64);
+  server.backends[0] = &backend;
+  graphite.tcp.sampler.server = &server;
+  graphite.tcp.sampler.type = BRUBECK_SAMPLER_GRAPHITE;
+  loop.tcp = &graphite.tcp;
+
+  feed_line(&graphite, "plain.a 42 1500000000\r");
+  feed_line(&graphite, "plain.b  -1.5");
+  feed_line(&graphite, "");
+  feed_line(&graphite, "plain.c");
+  feed_line(&graphite, "plain.d x 1500000000");
+  feed_line(&graphite, "plain.e 1 1500000000 3");
+  feed_line(&graphite, "plain.f nan");
+
+  sput_fail_unless(gauge_value(&server, "plain.a") == 42.0,
+                   "line with a timestamp");
+  sput_fail_unless(gauge_value(&server, "plain.b") == -1.5,
+                   "line without a timestamp");
+  sput_fail_unless(graphite.points == 2 && graphite.invalid == 4,
+                   "malformed lines are rejected");
+
+  sput_fail_unless(brubeck_graphite_unpickle(&graphite, &loop, PICKLE_V2,
+                                             sizeof(PICKLE_V2) - 1) == 0,
+                   "protocol 2 frame");
+  sput_fail_unless(gauge_value(&server, "a.b") == 1.5 &&
+                       gauge_value(&server, "c.d") == 2.0,
+                   "protocol 2 points recorded");
+
+  sput_fail_unless(brubeck_graphite_unpickle(&graphite, &loop, PICKLE_V0,
+                                             sizeof(PICKLE_V0) - 1) == 0,
+                   "protocol 0 frame");
+  sput_fail_unless(gauge_value(&server, "e.f") == 3.25,
+                   "protocol 0 point recorded");
+
+  sput_fail_unless(brubeck_graphite_unpickle(&graphite, &loop, PICKLE_V4,
+                                             sizeof(PICKLE_V4) - 1) == 0,
+                   "protocol 4 frame");
+  sput_fail_unless(gauge_value(&server, "g.h") == -7.0,
+                   "protocol 4 point recorded");
+  sput_fail_unless(graphite.points == 6 && graphite.invalid == 4,
+                   "every pickled point counted");
+
+  sput_fail_unless(brubeck_graphite_unpickle(&graphite, &loop, PICKLE_V2,
+                                             sizeof(PICKLE_V2) - 8) < 0,
+                   "truncated frame is rejected");
+  sput_fail_unless(brubeck_graphite_unpickle(&graphite, &loop, "\x80\x02}.",
+                                             4) < 0,
+                   "unsupported opcodes are rejected");
+  sput_fail_unless(graphite.points == 6 && graphite.invalid == 6,
+                   "bad frames counted as invalid");
+
+  /* PUT slot 5, then GET slot 2: set by an earlier frame, not this one */
+  sput_fail_unless(brubeck_graphite_unpickle(&graphite, &loop,
+                                             "\x80\x02(q\x05h\x02.", 7) < 0,
+                   "memo slots from another frame are rejected");
+  sput_fail_unless(graphite.points == 6 && graphite.invalid == 7,
+                   "no point from a stale memo slot");
+}
@@ -0,0 +1,92 @@
+#include "brubeck.h"
+#include "sput.h"
+#include "thread_helper.h"
+
+#define CONCURRENT_MEMBERS 100000
+
+static value_t member(const char *prefix, int i) {
+  char buffer[64];
+  int len = snprintf(buffer, sizeof(buffer), "%s%d", prefix, i);
+  return brubeck_hll_member(buffer, len);
+}
+
+static bool within(value_t estimate, double expected, double error) {
+  return fabs(estimate - expected) <= expected * error;
+}
+
+static void hll_add(struct brubeck_hll *hll, value_t value) {
+  if (!brubeck_hll_add_dense(hll, value))
+    brubeck_hll_add_sparse(hll, value);
+}
+
+void test_hll__estimate(void) {
+  struct brubeck_slab slab;
+  struct brubeck_hll *hll;
+  value_t m = brubeck_hll_member("user.1234", 9);
+  int i;
+
+  brubeck_slab_init(&slab);
+  hll = brubeck_hll_new(&slab, 12);
+
+  sput_fail_unless(m == brubeck_hll_member("user.1234", 9) &&
+                       m != brubeck_hll_member("user.1235", 9),
+                   "members hash deterministically");
+  sput_fail_unless(m == floor(m), "hashed members are exact integers");
+
+  for (i = 0; i < 3; ++i)
+    hll_add(hll, member("dup.", 0));
+  sput_fail_unless(hll->registers == NULL, "small sets stay sparse");
+  sput_fail_unless(brubeck_hll_estimate(hll, true) == 1.0,
+                   "duplicates count once");
+  sput_fail_unless(brubeck_hll_estimate(hll, false) == 0.0,
+                   "estimate resets the set");
+
+  for (i = 0; i < 40; ++i)
+    hll_add(hll, member("small.", i));
+  sput_fail_unless(within(brubeck_hll_estimate(hll, true), 40, 0.05),
+                   "sparse estimate is close");
+
+  for (i = 0; i < 50000; ++i)
+    hll_add(hll, member("large.", i));
+  sput_fail_unless(hll->registers != NULL, "large sets are promoted");
+  sput_fail_unless(within(brubeck_hll_estimate(hll, true), 50000, 0.05),
+                   "dense estimate is within 5%");
+
+  for (i = 0; i < 1000; ++i)
+    hll_add(hll, member("after.", i));
+  sput_fail_unless(within(brubeck_hll_estimate(hll, true), 1000, 0.05),
+                   "dense estimate is reset between intervals");
+}
+
+static struct brubeck_metric *concurrent_metric;
+
+static void *thread_record(void *ptr) {
+  int i;
+
+  for (i = 0; i < CONCURRENT_MEMBERS; ++i)
+    brubeck_metric_record(concurrent_metric, member("member.", i), 1.0, 0);
+
+  return NULL;
+}
+
+void test_hll__concurrent(void) {
+  struct brubeck_slab slab;
+  struct brubeck_metric metric;
+  value_t estimate;
+
+  brubeck_slab_init(&slab);
+  memset(&metric, 0x0, sizeof(metric));
+  metric.type = BRUBECK_MT_SET;
+  metric.as.set = brubeck_hll_new(&slab, 14);
+  pthread_spin_init(&metric.lock, PTHREAD_PROCESS_PRIVATE);
+
+  concurrent_metric = &metric;
+  spawn_threads(&thread_record, NULL);
+
+  pthread_spin_lock(&metric.lock);
+  estimate = brubeck_hll_estimate(metric.as.set, true);
+  pthread_spin_unlock(&metric.lock);
+
+  sput_fail_unless(within(estimate, CONCURRENT_MEMBERS, 0.03),
+                   "concurrent writers estimate within 3%");
+}
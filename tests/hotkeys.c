@@ -0,0 +1,70 @@
+#include "brubeck.h"
+#include "sput.h"
+
+static struct brubeck_metric *lookup(struct brubeck_server *server,
+                                     const char *key, int times) {
+  struct brubeck_metric *metric = NULL;
+
+  while (times--)
+    metric = brubeck_metric_find(server, key, strlen(key), BRUBECK_MT_METER);
+
+  return metric;
+}
+
+void test_hotkeys__sampling(void) {
+  static struct brubeck_server server;
+  static struct brubeck_backend backend;
+  struct brubeck_hotkeys *hotkeys;
+  struct brubeck_metric *hot;
+  value_t sharded = 0.0;
+  char key[32];
+  int i;
+
+  brubeck_slab_init(&server.slab);
+  server.metrics = brubeck_hashtable_new(64);
+  server.backends[0] = &backend;
+  backend.server = &server;
+  server.hotkeys = hotkeys = brubeck_hotkeys_new(8, 4, 0.25);
+
+  /* a hot meter buried in churn from two hundred colder keys */
+  for (i = 0; i < 200; ++i) {
+    snprintf(key, sizeof(key), "cold.%d", i);
+    lookup(&server, key, 10);
+    hot = lookup(&server, "hot", 40);
+  }
+
+  brubeck_hotkeys_rotate(&server);
+
+  sput_fail_unless(hotkeys->table_count == 1 && hotkeys->hot_count == 4,
+                   "memory is bounded by the top size");
+  sput_fail_unless(!strcmp(hotkeys->hot[0].key, "hot") &&
+                       hotkeys->hot[0].lookups > 6000 &&
+                       hotkeys->hot[0].lookups < 10000,
+                   "the hot key is found with a scaled up estimate");
+  sput_fail_unless(hotkeys->lookups > 8000 && hotkeys->lookups < 12000,
+                   "total lookups are estimated from the samples");
+  sput_fail_unless(hotkeys->hot[0].sharded && hot->as.meter.shards &&
+                       hotkeys->sharded == 1 && !hotkeys->hot[1].sharded,
+                   "only the hot meter is sharded");
+
+  for (i = 0; i < 3; ++i)
+    brubeck_metric_record(hot, 2.0, 1.0, 0);
+  for (i = 0; i < BRUBECK_METER_SHARDS; ++i)
+    sharded += hot->as.meter.shards[i].value;
+
+  sput_fail_unless(sharded == 6.0, "sharded meters record into their slots");
+
+  brubeck_hotkeys_rotate(&server);
+  sput_fail_unless(hotkeys->hot_count == 0 && hotkeys->lookups == 0,
+                   "tables are reset every interval");
+
+  /* a metric freed by eviction before the next rotation */
+  lookup(&server, "evicted", 40);
+  lookup(&server, "kept", 40);
+  hot = brubeck_hashtable_find(server.metrics, "evicted", 7);
+  brubeck_hotkeys_forget(hotkeys, &hot, 1);
+  brubeck_hotkeys_rotate(&server);
+  sput_fail_unless(hotkeys->hot_count == 1 &&
+                       !strcmp(hotkeys->hot[0].key, "kept"),
+                   "evicted metrics are forgotten");
+}
@@ -0,0 +1,93 @@
+#include "brubeck.h"
+#include "sput.h"
+
+static struct brubeck_metric *find(struct brubeck_server *server,
+                                   const char *key) {
+  return brubeck_hashtable_find(server->metrics, key, strlen(key));
+}
+
+static int parse_line(struct brubeck_influx_schema *schema, const char *line) {
+  char buf[512];
+  size_t len = strlen(line);
+
+  memcpy(buf, line, len);
+  return brubeck_influx_line_parse(schema, buf, buf + len);
+}
+
+void test_influx__line_protocol(void) {
+  static struct brubeck_server server;
+  static struct brubeck_backend backend;
+  struct brubeck_influx_field fields[] = {
+      {"requests", 8, BRUBECK_MT_METER}, {"latency", 7, BRUBECK_MT_HISTO}};
+  struct brubeck_influx_schema schema;
+  struct brubeck_metric *metric;
+  char packet[] = "http,host=a requests=2i,latency=12.5\n"
+                  "# a comment\n"
+                  "http,host=a requests=3i,latency=7.5 1500000000000000000\n"
+                  "http,host=b requests=1i\n"
+                  "broken\n";
+
+  memset(&schema, 0x0, sizeof(schema));
+  brubeck_slab_init(&server.slab);
+  server.metrics = brubeck_hashtable_new(64);
+  server.tags = brubeck_tags_create(64);
+  server.backends[0] = &backend;
+  schema.server = &server;
+  schema.default_type = BRUBECK_MT_GAUGE;
+  schema.fields = fields;
+  schema.field_count = 2;
+
+  sput_fail_unless(parse_line(&schema, "cpu,host=a,region=eu usage=92.5,"
+                                       "up=t,cores=8u,name=\"x, y\" "
+                                       "1500000000000000000") == 3,
+                   "numeric fields are recorded, strings skipped");
+
+  metric = find(&server, "cpu.usage,host=a,region=eu");
+  sput_fail_unless(metric && metric->type == BRUBECK_MT_GAUGE &&
+                       metric->as.gauge.value == 92.5,
+                   "float field as a gauge");
+  sput_fail_unless(metric && metric->tags && metric->tags->num_tags == 2 &&
+                       !strcmp(metric->key, "cpu.usage"),
+                   "tags are interned and stripped from the key");
+  sput_fail_unless(find(&server, "cpu.up,host=a,region=eu") &&
+                       find(&server, "cpu.up,host=a,region=eu")
+                               ->as.gauge.value == 1.0,
+                   "boolean field");
+  sput_fail_unless(find(&server, "cpu.cores,host=a,region=eu") &&
+                       find(&server, "cpu.cores,host=a,region=eu")
+                               ->as.gauge.value == 8.0,
+                   "unsigned integer field");
+  sput_fail_unless(metric->tags == find(&server, "cpu.up,host=a,region=eu")
+                                       ->tags,
+                   "fields of a line share their tag set");
+
+  sput_fail_unless(parse_line(&schema, "temp value=21.5") == 1 &&
+                       find(&server, "temp") &&
+                       find(&server, "temp")->as.gauge.value == 21.5,
+                   "`value` field is recorded under the measurement");
+
+  sput_fail_unless(parse_line(&schema, "") == 0, "empty line");
+  sput_fail_unless(parse_line(&schema, "cpu") < 0, "missing fields");
+  sput_fail_unless(parse_line(&schema, "cpu, usage=1") < 0, "empty tags");
+  sput_fail_unless(parse_line(&schema, "cpu usage=") < 0, "missing value");
+  sput_fail_unless(parse_line(&schema, "cpu usage=1x") < 0, "bad number");
+  sput_fail_unless(parse_line(&schema, "cpu usage=\"open") < 0,
+                   "unterminated string");
+  sput_fail_unless(parse_line(&schema, "cpu usage=1 12ab") < 0,
+                   "bad timestamp");
+
+  brubeck_influx_packet_parse(&schema, packet, packet + strlen(packet));
+
+  metric = find(&server, "http.requests,host=a");
+  sput_fail_unless(metric && metric->type == BRUBECK_MT_METER &&
+                       metric->as.meter.value == 5.0,
+                   "configured counter field");
+  metric = find(&server, "http.latency,host=a");
+  sput_fail_unless(metric && metric->type == BRUBECK_MT_HISTO &&
+                       metric->as.histogram.size == 2,
+                   "configured histogram field");
+  sput_fail_unless(find(&server, "http.requests,host=b") != NULL,
+                   "each tag set gets its own metric");
+  sput_fail_unless(schema.points == 5 && schema.invalid == 1,
+                   "packet points and invalid lines counted");
+}
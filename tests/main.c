@@ -3,6 +3,15 @@
 
 struct sput __sput;
 
+void test_admission__two_hits(void);
+void test_binary__dictionary(void);
+void test_binary__folded_keys(void);
+void test_cache__roundtrip(void);
+void test_cardinality__prefix_budgets(void);
+void test_denylist__prefixes(void);
+void test_eviction__clock(void);
+void test_eviction__large_chunks(void);
+void test_graphite__points(void);
 void test_histogram__sampling(void);
 void test_histogram__single_element(void);
 void test_histogram__large_range(void);
@@ -10,17 +19,58 @@ void test_histogram__multisamples(void);
 void test_histogram__with_sample_rate(void);
 void test_histogram__capacity(void);
 
+void test_hll__estimate(void);
+void test_hll__concurrent(void);
+void test_hotkeys__sampling(void);
+void test_influx__line_protocol(void);
+void test_metric__names(void);
 void test_mstore__save(void);
+void test_mstore__grow(void);
+void test_ratelimit__token_buckets(void);
 void test_atomic_spinlocks(void);
 void test_ftoa(void);
+void test_ftoa__roundtrip(void);
+void test_sampler__unix_rebind(void);
+void test_shm_ring__mpsc(void);
+void test_shm_ring__skip_stalled(void);
 void test_statsd_msg__parse_strings(void);
+void test_statsd_msg__upsampling(void);
+void test_statsd_msg__shed_keep(void);
+void test_statsd_msg__gro_segments(void);
+void test_statsd_tcp__reads(void);
 void test_tag_parsing(void);
 void test_tag_storage(void);
 void test_tag_offset(void);
+void test_talkers__space_saving(void);
+void test_upgrade__handoff(void);
+void test_upgrade__ack(void);
 
 int main(int argc, char *argv[]) {
   sput_start_testing();
 
+  sput_enter_suite("admission: two-hit filter for new keys");
+  sput_run_test(test_admission__two_hits);
+
+  sput_enter_suite("binary: key dictionary ingestion");
+  sput_run_test(test_binary__dictionary);
+  sput_run_test(test_binary__folded_keys);
+
+  sput_enter_suite("cache: metric store snapshots");
+  sput_run_test(test_cache__roundtrip);
+
+  sput_enter_suite("cardinality: per-prefix key budgets");
+  sput_run_test(test_cardinality__prefix_budgets);
+
+  sput_enter_suite("denylist: key prefix filtering");
+  sput_run_test(test_denylist__prefixes);
+
+  sput_enter_suite("eviction: memory budget with CLOCK eviction");
+  sput_run_test(test_eviction__clock);
+  sput_run_test(test_eviction__large_chunks);
+
+  sput_enter_suite("graphite: carbon plaintext and pickle ingestion");
+  sput_run_test(test_graphite__points);
+
   sput_enter_suite("histogram: time/data series aggregation");
   sput_run_test(test_histogram__sampling);
   sput_run_test(test_histogram__single_element);
@@ -29,23 +79,61 @@ int main(int argc, char *argv[]) {
   sput_run_test(test_histogram__with_sample_rate);
   sput_run_test(test_histogram__capacity);
 
+  sput_enter_suite("hll: set cardinality estimation");
+  sput_run_test(test_hll__estimate);
+  sput_run_test(test_hll__concurrent);
+
+  sput_enter_suite("hotkeys: sampled hot key tracking");
+  sput_run_test(test_hotkeys__sampling);
+
+  sput_enter_suite("influx: line protocol ingestion");
+  sput_run_test(test_influx__line_protocol);
+
+  sput_enter_suite("metric: output name encoding");
+  sput_run_test(test_metric__names);
+
   sput_enter_suite("mstore: concurrency test for metrics hash table");
   sput_run_test(test_mstore__save);
+  sput_run_test(test_mstore__grow);
+
+  sput_enter_suite("ratelimit: per-source and per-prefix token buckets");
+  sput_run_test(test_ratelimit__token_buckets);
 
   sput_enter_suite("atomic: atomic primitives");
   sput_run_test(test_atomic_spinlocks);
 
   sput_enter_suite("ftoa: double-to-string conversion");
   sput_run_test(test_ftoa);
+  sput_run_test(test_ftoa__roundtrip);
+
+  sput_enter_suite("shm: shared memory ingestion ring");
+  sput_run_test(test_shm_ring__mpsc);
+  sput_run_test(test_shm_ring__skip_stalled);
+
+  sput_enter_suite("sampler: listening sockets");
+  sput_run_test(test_sampler__unix_rebind);
 
   sput_enter_suite("statsd: packet parsing");
   sput_run_test(test_statsd_msg__parse_strings);
+  sput_run_test(test_statsd_msg__upsampling);
+  sput_run_test(test_statsd_msg__shed_keep);
+  sput_run_test(test_statsd_msg__gro_segments);
+
+  sput_enter_suite("statsd: TCP line reassembly and idle connections");
+  sput_run_test(test_statsd_tcp__reads);
 
   sput_enter_suite("tags: associative key value parsing");
   sput_run_test(test_tag_parsing);
   sput_run_test(test_tag_storage);
   sput_run_test(test_tag_offset);
 
+  sput_enter_suite("talkers: heaviest packet sources");
+  sput_run_test(test_talkers__space_saving);
+
+  sput_enter_suite("upgrade: socket handoff to a new binary");
+  sput_run_test(test_upgrade__handoff);
+  sput_run_test(test_upgrade__ack);
+
   sput_finish_testing();
   return sput_get_return_value();
 }
@@ -0,0 +1,76 @@
+#include "brubeck.h"
+#include "sput.h"
+
+static struct brubeck_metric *new_metric(struct brubeck_server *server,
+                                         const char *name) {
+  size_t name_len = strlen(name);
+  struct brubeck_metric *metric = brubeck_slab_alloc(
+      &server->slab, sizeof(struct brubeck_metric) + name_len + 1);
+
+  memset(metric, 0x0, sizeof(struct brubeck_metric));
+  memcpy(metric->key, name, name_len);
+  metric->key[name_len] = 0;
+  metric->key_len = name_len;
+
+  return metric;
+}
+
+static size_t bracket_encode(char *dst, const char *name, size_t len) {
+  if (memchr(name, ' ', len) != NULL)
+    return 0;
+
+  dst[0] = '[';
+  memcpy(dst + 1, name, len);
+  dst[len + 1] = ']';
+  return len + 2;
+}
+
+static bool name_eq(const struct brubeck_metric_names *names, size_t i,
+                    const char *expected) {
+  const char *blob = (const char *)&names->name[names->count];
+  return names->name[i].len == strlen(expected) &&
+         !memcmp(blob + names->name[i].offset, expected, names->name[i].len);
+}
+
+void test_metric__names(void) {
+  static const char *suffixes[] = {".count", ".percentile.999"};
+
+  struct brubeck_server server;
+  struct brubeck_backend backend;
+  const struct brubeck_metric_names *names;
+  struct brubeck_metric *metric;
+  char long_key[8192];
+
+  memset(&server, 0x0, sizeof(server));
+  memset(&backend, 0x0, sizeof(backend));
+  brubeck_slab_init(&server.slab);
+  backend.server = &server;
+
+  metric = new_metric(&server, "github.test");
+  names = brubeck_metric_names(metric, &backend, NULL, 0);
+  sput_fail_unless(names->count == 1, "single name without suffixes");
+  sput_fail_unless(name_eq(names, 0, "github.test"), "plain name");
+  sput_fail_unless(brubeck_metric_names(metric, &backend, NULL, 0) == names,
+                   "names are only built once");
+
+  backend.encode_name = &bracket_encode;
+
+  metric = new_metric(&server, "github.histo");
+  names = brubeck_metric_names(metric, &backend, suffixes, 2);
+  sput_fail_unless(names->count == 2, "one name per suffix");
+  sput_fail_unless(name_eq(names, 0, "[github.histo.count]"), "encoded name");
+  sput_fail_unless(name_eq(names, 1, "[github.histo.percentile.999]"),
+                   "encoded name");
+
+  metric = new_metric(&server, "github.has space");
+  names = brubeck_metric_names(metric, &backend, suffixes, 2);
+  sput_fail_unless(names->name[0].len == 0 && names->name[1].len == 0,
+                   "invalid names are not emitted");
+
+  memset(long_key, 'x', sizeof(long_key) - 1);
+  long_key[sizeof(long_key) - 1] = 0;
+  metric = new_metric(&server, long_key);
+  names = brubeck_metric_names(metric, &backend, suffixes, 2);
+  sput_fail_unless(names->name[1].len == sizeof(long_key) - 1 + 17,
+                   "names larger than a slab node");
+}
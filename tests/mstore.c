@@ -46,3 +46,49 @@ void test_mstore__save(void) {
 
   sput_fail_unless(i == nmetrics, "lookup all metrics from table");
 }
+
+#define KEY_COUNT 2000
+
+static char keys[KEY_COUNT][16];
+
+static struct brubeck_metric *value_of(int i) {
+  return (struct brubeck_metric *)&keys[i];
+}
+
+void test_mstore__grow(void) {
+  brubeck_hashtable_t *store = brubeck_hashtable_new(16);
+  struct brubeck_hashtable_stats stats;
+  bool found = true, grew = false;
+  int i, j;
+
+  for (i = 0; i < KEY_COUNT; ++i) {
+    snprintf(keys[i], sizeof(keys[i]), "key.%d", i);
+    brubeck_hashtable_insert(store, keys[i], strlen(keys[i]), value_of(i));
+
+    brubeck_hashtable_stats(store, &stats);
+    grew = grew || stats.growing;
+
+    for (j = 0; j <= i; j += 7) {
+      const char *key = keys[j];
+
+      if (brubeck_hashtable_find(store, key, strlen(key)) != value_of(j))
+        found = false;
+    }
+  }
+
+  sput_fail_unless(grew && found, "keys are found while the table grows");
+  sput_fail_unless(!brubeck_hashtable_insert(store, "key.5", 5, NULL),
+                   "existing keys are not inserted twice");
+
+  for (i = 0; i < KEY_COUNT; i += 2)
+    brubeck_hashtable_remove(store, keys[i], strlen(keys[i]));
+
+  brubeck_hashtable_stats(store, &stats);
+
+  sput_fail_unless(stats.size == KEY_COUNT / 2 &&
+                       !brubeck_hashtable_find(store, "key.0", 5) &&
+                       brubeck_hashtable_find(store, "key.1", 5) == value_of(1),
+                   "removed keys are gone from both tables");
+  sput_fail_unless(stats.capacity >= KEY_COUNT * 2 && stats.load_factor < 0.5,
+                   "the table keeps its load under one half");
+}
@@ -0,0 +1,72 @@
+#include "brubeck.h"
+#include "sput.h"
+
+#define SECOND 1000000000ULL
+
+static size_t apply(struct brubeck_ratelimit *ratelimit, uint32_t host,
+                    char *buf, const char *packet, uint64_t now) {
+  struct sockaddr_in source;
+  size_t len = strlen(packet);
+
+  memset(&source, 0x0, sizeof(source));
+  source.sin_family = AF_INET;
+  source.sin_addr.s_addr = htonl(host);
+
+  memcpy(buf, packet, len + 1);
+  len = brubeck_ratelimit_apply(ratelimit, host ? &source : NULL, buf, len,
+                                now);
+  buf[len] = '\0';
+  return len;
+}
+
+void test_ratelimit__token_buckets(void) {
+  struct brubeck_ratelimit_config config;
+  struct brubeck_ratelimit *ratelimit;
+  char buf[256];
+
+  memset(&config, 0x0, sizeof(config));
+  config.source_rate = 2.0;
+  config.source_burst = 3.0;
+  config.prefix_segments = 1;
+  config.max_entries = 16;
+  ratelimit = brubeck_ratelimit_new(&config);
+
+  apply(ratelimit, 1, buf, "a:1|c\nb:1|c\n\nc:1|c\nd:1|c\ne:1|c\n", SECOND);
+  sput_fail_unless(!strcmp(buf, "a:1|c\nb:1|c\n\nc:1|c"),
+                   "a source gets its burst, in order");
+  sput_fail_unless(ratelimit->source_dropped == 2, "the rest is dropped");
+
+  sput_fail_unless(apply(ratelimit, 2, buf, "x:1|c", SECOND) == 5,
+                   "sources have their own buckets");
+  sput_fail_unless(apply(ratelimit, 1, buf, "f:1|c", SECOND) == 0,
+                   "an empty bucket drops whole datagrams");
+  sput_fail_unless(apply(ratelimit, 1, buf, "f:1|c\ng:1|c\nh:1|c",
+                         SECOND + SECOND / 2) == 5 &&
+                       !strcmp(buf, "f:1|c"),
+                   "buckets refill at the configured rate");
+  sput_fail_unless(apply(ratelimit, 1, buf, "f:1|c\ng:1|c\nh:1|c\ni:1|c",
+                         100 * SECOND) == 17,
+                   "refills are capped at the burst");
+  sput_fail_unless(apply(ratelimit, 0, buf, "j:1|c\nk:1|c\nl:1|c\nm:1|c",
+                         100 * SECOND) == 23,
+                   "datagrams without a source are not limited by it");
+  sput_fail_unless(ratelimit->source_dropped == 6, "drops are counted");
+
+  memset(&config, 0x0, sizeof(config));
+  config.prefix_rate = 1.0;
+  config.prefix_burst = 2.0;
+  config.prefix_segments = 2;
+  config.max_entries = 16;
+  ratelimit = brubeck_ratelimit_new(&config);
+
+  apply(ratelimit, 1, buf,
+        "app.web.a:1|c\napp.db.a:1|c\napp.web.b:1|c\napp.web.c:1|c\n"
+        "app.db.b:2|ms\napp.web:1|c\napp.web.d:1|c",
+        SECOND);
+  sput_fail_unless(!strcmp(buf, "app.web.a:1|c\napp.db.a:1|c\napp.web.b:1|c\n"
+                                "app.db.b:2|ms"),
+                   "lines over their prefix limit are cut out");
+  sput_fail_unless(ratelimit->prefix_dropped == 3 &&
+                       ratelimit->source_dropped == 0,
+                   "prefix drops are counted");
+}
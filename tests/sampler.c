@@ -0,0 +1,54 @@
+#include "brubeck.h"
+#include "sput.h"
+
+/* send a datagram to the socket at `path` and read it back from `sock` */
+static bool roundtrip(int sock, const char *path) {
+  struct sockaddr_un un;
+  char buf[16];
+  int client = socket(AF_UNIX, SOCK_DGRAM, 0);
+  bool ok;
+
+  memset(&un, 0x0, sizeof(un));
+  un.sun_family = AF_UNIX;
+  strncpy(un.sun_path, path, sizeof(un.sun_path) - 1);
+
+  ok = sendto(client, "a.b:1|c", 7, 0, (struct sockaddr *)&un,
+              sizeof(un)) == 7 &&
+       recv(sock, buf, sizeof(buf), MSG_DONTWAIT) == 7 &&
+       !memcmp(buf, "a.b:1|c", 7);
+
+  close(client);
+  return ok;
+}
+
+void test_sampler__unix_rebind(void) {
+  struct brubeck_server *first = calloc(1, sizeof(struct brubeck_server));
+  struct brubeck_server *second = calloc(1, sizeof(struct brubeck_server));
+  struct brubeck_sampler sampler;
+  struct stat st;
+  char path[64];
+  int sock;
+
+  snprintf(path, sizeof(path), "/tmp/brubeck-sampler-test.%d", (int)getpid());
+
+  memset(&sampler, 0x0, sizeof(sampler));
+  sampler.server = first;
+  sampler.path = path;
+  sock = brubeck_sampler_socket_unix(&sampler, 0600, 0);
+
+  sput_fail_unless(roundtrip(sock, path), "datagram received");
+  sput_fail_unless(stat(path, &st) == 0 && (st.st_mode & 0777) == 0600,
+                   "socket file has the requested mode");
+
+  /* a previous run that exited without removing its socket file */
+  close(sock);
+  sampler.server = second;
+  sock = brubeck_sampler_socket_unix(&sampler, 0600, 0);
+
+  sput_fail_unless(roundtrip(sock, path), "rebound over the stale socket");
+
+  close(sock);
+  unlink(path);
+  free(first);
+  free(second);
+}
@@ -0,0 +1,129 @@
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "brubeck.h"
+#include "sput.h"
+#include "thread_helper.h"
+
+#define RECORDS_PER_THREAD 1000
+#define RING_SLOTS 16384
+
+static void *thread_push(void *ptr) {
+  struct brubeck_shm_ring *ring = ptr;
+  char record[64];
+  int i;
+
+  for (i = 0; i < RECORDS_PER_THREAD; ++i) {
+    int len = sprintf(record, "github.test.shm:%d|c", i);
+    if (brubeck_shm_push(ring, record, len) < 0)
+      break;
+  }
+
+  return NULL;
+}
+
+void test_shm_ring__mpsc(void) {
+  struct brubeck_shm_ring *ring;
+  struct brubeck_shm_consumer reader;
+  struct brubeck_shm_slot *slot;
+  char too_large[BRUBECK_SHM_RECORD_MAX + 1];
+  size_t consumed = 0, sum = 0, expected;
+  int i;
+
+  ring = mmap(NULL, brubeck_shm_size(RING_SLOTS), PROT_READ | PROT_WRITE,
+              MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  brubeck_shm_init(ring, RING_SLOTS);
+  sput_fail_unless(brubeck_shm_valid(ring, brubeck_shm_size(RING_SLOTS)),
+                   "initialized ring is valid");
+  brubeck_shm_consumer_init(&reader, ring, RING_SLOTS);
+
+  spawn_threads(&thread_push, ring);
+
+  while ((slot = brubeck_shm_peek(&reader)) != NULL) {
+    slot->data[slot->len] = '\0';
+    sum += atoi(strchr(slot->data, ':') + 1);
+    consumed++;
+    brubeck_shm_release(&reader, slot);
+  }
+
+  expected = (size_t)MAX_THREADS * RECORDS_PER_THREAD *
+             (RECORDS_PER_THREAD - 1) / 2;
+  sput_fail_unless(consumed == MAX_THREADS * RECORDS_PER_THREAD,
+                   "consumed every record");
+  sput_fail_unless(sum == expected, "records are intact");
+  sput_fail_unless(!brubeck_shm_pending(&reader), "ring is drained");
+
+  memset(too_large, 'x', sizeof(too_large));
+  sput_fail_unless(brubeck_shm_push(ring, too_large, sizeof(too_large)) < 0 &&
+                       errno == EMSGSIZE,
+                   "oversized records are refused");
+
+  for (i = 0; i < RING_SLOTS; ++i)
+    brubeck_shm_push(ring, "a:1|c", 5);
+  sput_fail_unless(brubeck_shm_push(ring, "a:1|c", 5) < 0 && errno == EAGAIN &&
+                       ring->dropped == 1,
+                   "full ring drops and counts");
+
+  munmap(ring, brubeck_shm_size(RING_SLOTS));
+}
+
+void test_shm_ring__skip_stalled(void) {
+  struct brubeck_shm_ring *ring;
+  struct brubeck_shm_consumer reader;
+  struct brubeck_shm_slot *slot;
+  pid_t dead;
+
+  ring = mmap(NULL, brubeck_shm_size(4), PROT_READ | PROT_WRITE,
+              MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  brubeck_shm_init(ring, 4);
+  brubeck_shm_consumer_init(&reader, ring, 4);
+
+  /* a producer that claimed slot 0 and is still writing it */
+  ring->tail = 1;
+  ring->slots[0].pid = getpid();
+  brubeck_shm_push(ring, "b:2|g", 5);
+
+  sput_fail_unless(brubeck_shm_peek(&reader) == NULL &&
+                       brubeck_shm_pending(&reader),
+                   "stalled slot blocks the consumer");
+  sput_fail_unless(!brubeck_shm_skip(&reader),
+                   "slot of a live producer is never recycled");
+
+  /* the producer died before publishing it */
+  if ((dead = fork()) == 0)
+    _exit(0);
+  waitpid(dead, NULL, 0);
+  ring->slots[0].pid = dead;
+  sput_fail_unless(brubeck_shm_skip(&reader),
+                   "slot of a dead producer is skipped");
+
+  slot = brubeck_shm_peek(&reader);
+  sput_fail_unless(slot != NULL && slot->len == 5 &&
+                       !memcmp(slot->data, "b:2|g", 5),
+                   "consumer resumes after the stalled slot");
+  brubeck_shm_release(&reader, slot);
+
+  /* a producer that died between its claim and storing its PID */
+  ring->tail = 3;
+  brubeck_shm_push(ring, "c:3|g", 5);
+  sput_fail_unless(brubeck_shm_peek(&reader) == NULL &&
+                       brubeck_shm_pending(&reader),
+                   "slot without a PID blocks the consumer");
+  sput_fail_unless(brubeck_shm_skip(&reader),
+                   "slot without a PID is skipped");
+
+  slot = brubeck_shm_peek(&reader);
+  sput_fail_unless(slot != NULL && slot->len == 5 &&
+                       !memcmp(slot->data, "c:3|g", 5),
+                   "consumer resumes after the slot without a PID");
+  brubeck_shm_release(&reader, slot);
+
+  /* a producer scribbling over the header cannot move the consumer */
+  ring->head = 1ULL << 40;
+  ring->capacity = 1U << 30;
+  sput_fail_unless(brubeck_shm_peek(&reader) == NULL &&
+                       reader.head == 4 && reader.mask == 3,
+                   "consumer state is private");
+
+  munmap(ring, brubeck_shm_size(4));
+}
@@ -18,6 +18,27 @@ static void must_parse(const char *msg_text, double value, double sample,
   sput_fail_unless(modifiers == msg.modifiers, "msg.modifiers == expected");
 }
 
+static void must_parse_tagged(const char *msg_text, uint16_t type,
+                              uint16_t value_count, const char *tags) {
+  struct brubeck_statsd_msg msg;
+  char buffer[128];
+  size_t len = strlen(msg_text);
+  memcpy(buffer, msg_text, len);
+
+  sput_fail_unless(
+      brubeck_statsd_msg_parse(&msg, buffer, buffer + len, 0.001) == 0,
+      msg_text);
+  sput_fail_unless(type == msg.type, "msg.type == expected");
+  sput_fail_unless(value_count == msg.value_count,
+                   "msg.value_count == expected");
+  if (tags)
+    sput_fail_unless(msg.tags && msg.tags_len == strlen(tags) &&
+                         memcmp(msg.tags, tags, msg.tags_len) == 0,
+                     "msg.tags == expected");
+  else
+    sput_fail_unless(msg.tags == NULL, "msg.tags == NULL");
+}
+
 static void must_not_parse(const char *msg_text) {
   struct brubeck_statsd_msg msg;
   char buffer[128];
@@ -51,9 +72,34 @@ void test_statsd_msg__parse_strings(void) {
   must_parse("this.are.some.floats:1234567.89|g", 1234567.89, 1.0, 0);
   must_parse("gauge.increment:+1|g", 1, 1.0, BRUBECK_MOD_RELATIVE_VALUE);
   must_parse("gauge.decrement:-1|g", -1, 1.0, BRUBECK_MOD_RELATIVE_VALUE);
+  must_parse("users.unique:765|s", brubeck_hll_member("765", 3), 1.0, 0);
+  must_parse("users.unique:-765|s", brubeck_hll_member("-765", 4), 1.0, 0);
+  must_parse("users.unique:jane.doe|s", brubeck_hll_member("jane.doe", 8), 1.0,
+             0);
+
+  must_parse("dog.distribution:12.5|d", 12.5, 1.0, 0);
+  must_parse("dog.tagged:1|c|#env:prod,az:a", 1, 1.0, 0);
+  must_parse("dog.tagged:1|c|@0.5|#env:prod", 1, 2.0, 0);
+  must_parse("dog.packed:1:2:3|ms", 0.001, 1.0, 0);
+
+  must_parse_tagged("dog.distribution:12.5|d", BRUBECK_MT_HISTO, 1, NULL);
+  must_parse_tagged("dog.tagged:1|c|#env:prod,az:a", BRUBECK_MT_METER, 1,
+                    "env:prod,az:a");
+  must_parse_tagged("dog.tagged:1|c|@0.5|#env:prod\n", BRUBECK_MT_METER, 1,
+                    "env:prod");
+  must_parse_tagged("dog.packed:1:2:3|ms|#a:b", BRUBECK_MT_TIMER, 3, "a:b");
+  must_parse_tagged("dog.packed:-1:+2|g", BRUBECK_MT_GAUGE, 2, NULL);
+  must_parse_tagged("dog.set:a:b|s", BRUBECK_MT_SET, 1, NULL);
+  must_parse_tagged("dog.set:1:2|s", BRUBECK_MT_SET, 1, NULL);
+  must_parse_tagged("dog.tagged:1|c|#", BRUBECK_MT_METER, 1, NULL);
 
   must_not_parse("this.are.some.floats:12.89.23|g");
+  must_not_parse("dog.packed:1:2x:3|ms");
+  must_not_parse("dog.tagged:1|c|#env:prod|@0.5");
+  must_not_parse("dog.tagged:1|c|#env:prod|c:container");
   must_not_parse("this.are.some.floats:12.89|a");
+  must_not_parse("this.are.some.floats:jane.doe|g");
+  must_not_parse("users.unique:|s");
   must_not_parse("this.are.some.floats:12.89|msdos");
   must_not_parse("this.are.some.floats:12.89g|g");
   must_not_parse("this.are.some.floats:12.89|");
@@ -74,3 +120,112 @@ void test_statsd_msg__parse_strings(void) {
   must_not_parse("this.are.some.floats:1.0|g|@0.0");
   must_not_parse("this.are.some.floats:1.0|g|@0");
 }
+
+static struct brubeck_metric *find(struct brubeck_server *server,
+                                   const char *key) {
+  return brubeck_hashtable_find(server->metrics, key, strlen(key));
+}
+
+void test_statsd_msg__upsampling(void) {
+  static struct brubeck_server server;
+  static struct brubeck_backend backend;
+  struct brubeck_statsd statsd;
+  struct brubeck_metric *metric;
+  char packet[] = "up.meter:1|c\nup.meter:2|c|@0.5\nup.counter:10|C\n"
+                  "up.histo:3|h\nup.timer:5|ms|@0.5\nup.counter:15|C";
+
+  memset(&statsd, 0x0, sizeof(statsd));
+  brubeck_slab_init(&server.slab);
+  server.metrics = brubeck_hashtable_new(64);
+  server.backends[0] = &backend;
+  brubeck_statsd_init(&statsd, BRUBECK_SAMPLER_STATSD, &brubeck_statsd_parse);
+  statsd.sampler.server = &server;
+
+  /* a datagram kept with a probability of 1/4 stands for four of them */
+  statsd.parse(&statsd, packet, packet + strlen(packet), 4.0);
+
+  metric = find(&server, "up.meter");
+  sput_fail_unless(metric && metric->as.meter.value == 4.0 + 16.0,
+                   "meters scaled on top of their sample rate");
+
+  metric = find(&server, "up.histo");
+  sput_fail_unless(metric && metric->as.histogram.count == 4 &&
+                       metric->as.histogram.size == 1,
+                   "histogram samples weighted");
+
+  metric = find(&server, "up.timer");
+  sput_fail_unless(metric && metric->as.histogram.count == 8,
+                   "timer samples weighted on top of their sample rate");
+
+  metric = find(&server, "up.counter");
+  sput_fail_unless(metric && metric->as.counter.value == 5.0 &&
+                       metric->as.counter.previous == 15.0,
+                   "absolute counters not scaled");
+}
+
+void test_statsd_msg__shed_keep(void) {
+  double keep = 1.0;
+  int i;
+
+  sput_fail_unless(brubeck_statsd_shed_keep(1.0, false, 0.3) == 1.0,
+                   "no shedding below the high watermark");
+  sput_fail_unless(brubeck_statsd_shed_keep(1.0, true, 0.0) == 0.5,
+                   "kernel drops halve the share kept");
+  sput_fail_unless(brubeck_statsd_shed_keep(0.5, false, 0.6) == 0.25,
+                   "a full queue halves the share kept");
+  sput_fail_unless(brubeck_statsd_shed_keep(0.5, false, 0.3) == 0.5,
+                   "held between the watermarks");
+  sput_fail_unless(brubeck_statsd_shed_keep(0.4, false, 0.05) == 0.5,
+                   "grows back once the queue has drained");
+
+  for (i = 0; i < 20; ++i)
+    keep = brubeck_statsd_shed_keep(keep, true, 1.0);
+  sput_fail_unless(keep == 1.0 / 1024, "never below the minimum");
+
+  for (i = 0; i < 40; ++i)
+    keep = brubeck_statsd_shed_keep(keep, false, 0.0);
+  sput_fail_unless(keep == 1.0, "never above keeping everything");
+}
+
+void test_statsd_msg__gro_segments(void) {
+  static struct brubeck_server server;
+  static struct brubeck_backend backend;
+  struct brubeck_statsd statsd;
+  struct brubeck_statsd_worker worker;
+  /* four coalesced datagrams of 23 bytes, none ending in a newline, and a
+   * shorter last one */
+  char buffer[] = "gro.k00:1|c\ngro.k01:2|c"
+                  "gro.k02:3|c\ngro.k03:4|c"
+                  "gro.k04:5|c\ngro.k05:6|c"
+                  "gro.k06:7|c\ngro.k07:8|c"
+                  "gro.k08:9|c";
+  char key[8];
+  bool recorded = true;
+  int i;
+
+  memset(&statsd, 0x0, sizeof(statsd));
+  memset(&worker, 0x0, sizeof(worker));
+  brubeck_slab_init(&server.slab);
+  server.metrics = brubeck_hashtable_new(64);
+  server.backends[0] = &backend;
+  brubeck_statsd_init(&statsd, BRUBECK_SAMPLER_STATSD, &brubeck_statsd_parse);
+  statsd.sampler.server = &server;
+  worker.statsd = &statsd;
+
+  sput_fail_unless(brubeck_statsd_parse_datagram(&worker, NULL, buffer,
+                                                 strlen(buffer), 23) == 5,
+                   "every datagram counted");
+
+  for (i = 0; i < 9; ++i) {
+    struct brubeck_metric *metric;
+
+    snprintf(key, sizeof(key), "gro.k%02d", i);
+    metric = find(&server, key);
+    recorded = recorded && metric && metric->as.meter.value == i + 1;
+  }
+
+  sput_fail_unless(recorded, "every line of every segment recorded");
+  sput_fail_unless(server.internal_stats.live.metrics == 9 &&
+                       server.internal_stats.live.errors == 0,
+                   "no line cut at a segment boundary");
+}
@@ -0,0 +1,112 @@
+#include "brubeck.h"
+#include "sput.h"
+
+static char lines[8][64];
+static size_t line_count;
+
+/* record every complete line, like statsd_tcp_parse would parse it */
+static char *record_lines(struct brubeck_statsd_tcp_loop *loop,
+                          struct brubeck_statsd_tcp_conn *conn, char *start,
+                          char *end) {
+  char *nl;
+
+  while ((nl = memchr(start, '\n', end - start)) != NULL) {
+    if (line_count < 8)
+      snprintf(lines[line_count++], sizeof(lines[0]), "%.*s",
+               (int)(nl - start), start);
+    start = nl + 1;
+  }
+
+  return start;
+}
+
+static struct brubeck_statsd_tcp_conn *
+add_conn(struct brubeck_statsd_tcp_loop *loop, int fd, time_t now) {
+  struct brubeck_statsd_tcp_conn *conn =
+      xmalloc(sizeof(struct brubeck_statsd_tcp_conn) + loop->tcp->buffer_size);
+
+  memset(conn, 0x0, sizeof(struct brubeck_statsd_tcp_conn));
+  conn->fd = fd;
+  conn->connected_at = conn->last_active = now;
+
+  conn->next = loop->conns;
+  if (loop->conns)
+    loop->conns->prev = conn;
+  loop->conns = conn;
+  loop->conn_count++;
+  return conn;
+}
+
+static void send_str(int fd, const char *str) {
+  ssize_t len = (ssize_t)strlen(str);
+  sput_fail_unless(write(fd, str, len) == len, "data written");
+}
+
+void test_statsd_tcp__reads(void) {
+  static struct brubeck_server server;
+  struct brubeck_statsd_tcp tcp;
+  struct brubeck_statsd_tcp_loop loop;
+  struct brubeck_statsd_tcp_conn *conn;
+  int pair[2], idle_pair[2];
+
+  memset(&tcp, 0x0, sizeof(tcp));
+  memset(&loop, 0x0, sizeof(loop));
+  tcp.sampler.server = &server;
+  tcp.sampler.type = BRUBECK_SAMPLER_STATSD_TCP;
+  tcp.parse = &record_lines;
+  tcp.buffer_size = 16;
+  tcp.idle_timeout = 300;
+  loop.tcp = &tcp;
+  pthread_mutex_init(&loop.lock, NULL);
+
+  socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pair);
+  conn = add_conn(&loop, pair[0], 1000);
+
+  /* a line split across two reads */
+  send_str(pair[1], "a.b:1|c\na.");
+  brubeck_statsd_tcp_read(&loop, conn, 1000);
+  sput_fail_unless(line_count == 1 && conn->partial == 2,
+                   "incomplete line kept for the next read");
+  send_str(pair[1], "c:2|c\n");
+  brubeck_statsd_tcp_read(&loop, conn, 1000);
+  sput_fail_unless(line_count == 2 && strcmp(lines[1], "a.c:2|c") == 0,
+                   "line reassembled across reads");
+  sput_fail_unless(conn->partial == 0, "nothing left over");
+
+  /* a line larger than the buffer is dropped up to its newline */
+  send_str(pair[1], "toolong.toolong.toolong:1|c\nd.e:3|c\n");
+  brubeck_statsd_tcp_read(&loop, conn, 1000);
+  sput_fail_unless(tcp.overflows == 1 && conn->discard,
+                   "over-long line counted and discarded");
+  brubeck_statsd_tcp_read(&loop, conn, 1000);
+  sput_fail_unless(!conn->discard && line_count == 2 && conn->partial == 2,
+                   "discarding stops at the newline");
+  brubeck_statsd_tcp_read(&loop, conn, 1000);
+  sput_fail_unless(line_count == 3 && strcmp(lines[2], "d.e:3|c") == 0,
+                   "next line after the over-long one parsed");
+  sput_fail_unless(tcp.overflows == 1, "one overflow only");
+
+  /* the idle sweep closes quiet connections and keeps the others */
+  socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, idle_pair);
+  add_conn(&loop, idle_pair[0], 1000);
+  send_str(pair[1], "f.g:4|c\n");
+  brubeck_statsd_tcp_read(&loop, conn, 1200);
+
+  brubeck_statsd_tcp_sweep(&loop, 1300);
+  sput_fail_unless(tcp.idle_closed == 1 && loop.conn_count == 1 &&
+                       loop.conns == conn && conn->prev == NULL,
+                   "idle connection closed");
+  sput_fail_unless(send(idle_pair[1], "x", 1, MSG_NOSIGNAL) < 0 &&
+                       errno == EPIPE,
+                   "idle socket shut");
+
+  brubeck_statsd_tcp_sweep(&loop, 1499);
+  sput_fail_unless(loop.conn_count == 1, "active connection kept");
+  brubeck_statsd_tcp_sweep(&loop, 1500);
+  sput_fail_unless(tcp.idle_closed == 2 && loop.conns == NULL &&
+                       loop.conn_count == 0,
+                   "closed once idle for the whole timeout");
+
+  close(pair[1]);
+  close(idle_pair[1]);
+}
@@ -73,6 +73,14 @@ void test_tag_parsing(void) {
   check_parse("foo=bar,",
               &(struct brubeck_tag_set){.tag_len = 8, .num_tags = 1},
               (struct brubeck_tag[]){{.key = "foo", .value = "bar"}});
+
+  /* DogStatsD */
+  check_parse("#env:prod,az:a",
+              &(struct brubeck_tag_set){.tag_len = 14, .num_tags = 2},
+              (struct brubeck_tag[]){{"env", "prod"}, {"az", "a"}});
+  check_parse("#url:http://x,beta,:x,y:",
+              &(struct brubeck_tag_set){.tag_len = 24, .num_tags = 1},
+              (struct brubeck_tag[]){{"url", "http://x"}});
 }
 
 const struct brubeck_tag_set *get_tag_set(struct brubeck_tags_t *tags,
@@ -103,6 +111,13 @@ void test_tag_storage(void) {
   t2 = get_tag_set(tags, "s,foo=bar,");
   sput_fail_unless(t2->index == 2, "index");
   check_tags_equal(t1, t2, "equivalent except index");
+
+  str = "dog.metric#env:prod,az:a";
+  t1 = get_tag_set(tags, str);
+  sput_fail_unless(t1->index == 3, "index");
+  sput_fail_unless(t1->tag_len == 14, "tag_len");
+  check_tags_equal(t1, parse("#env:prod,az:a"), str);
+  sput_fail_unless(t1 == get_tag_set(tags, str), "caching");
 }
 
 void check_tag_offset(const char *str, const uint16_t offset) {
@@ -0,0 +1,134 @@
+#include "brubeck.h"
+#include "sput.h"
+
+static void send_from(struct brubeck_talker_table *table, uint32_t host,
+                      int packets) {
+  struct sockaddr_in source;
+
+  memset(&source, 0x0, sizeof(source));
+  source.sin_family = AF_INET;
+  source.sin_addr.s_addr = htonl(0x0A000000 | host);
+
+  while (packets--)
+    brubeck_talkers_add(table, &source, 100);
+}
+
+static const struct brubeck_talker *
+find_talker(struct brubeck_talker_table *table, uint32_t host) {
+  size_t i;
+
+  for (i = 0; i < table->count; ++i) {
+    if (table->entries[i].addr == htonl(0x0A000000 | host))
+      return &table->entries[i];
+  }
+  return NULL;
+}
+
+static uint64_t lightest(struct brubeck_talker_table *table) {
+  uint64_t min = UINT64_MAX;
+  size_t i;
+
+  for (i = 0; i < table->count; ++i) {
+    if (table->entries[i].packets < min)
+      min = table->entries[i].packets;
+  }
+  return min;
+}
+
+/* the constant-time bookkeeping must pick the same counters as a scan */
+static void check_churn(struct brubeck_talker_table *table) {
+  uint64_t state = 42, total = 0;
+  bool evicts_lightest = true, found = true, unique = true;
+  int n;
+  size_t i, j;
+
+  for (n = 0; n < 20000; ++n) {
+    uint32_t host;
+    uint64_t min = lightest(table);
+    const struct brubeck_talker *talker;
+    bool known, full = table->count == table->size;
+
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    /* a few heavy sources and a long tail */
+    host = (state >> 60) < 8 ? (uint32_t)(state >> 61) + 1
+                             : (uint32_t)(state >> 40) % 5000 + 100;
+
+    known = find_talker(table, host) != NULL;
+    send_from(table, host, 1);
+    talker = find_talker(table, host);
+
+    found = found && talker != NULL;
+    if (talker && !known && full)
+      evicts_lightest = evicts_lightest && talker->error == min;
+  }
+
+  for (i = 0; i < table->count; ++i) {
+    total += table->entries[i].packets;
+    for (j = i + 1; j < table->count; ++j)
+      unique = unique && table->entries[i].addr != table->entries[j].addr;
+  }
+
+  sput_fail_unless(found, "every source is counted");
+  sput_fail_unless(evicts_lightest, "new sources take over a lightest counter");
+  sput_fail_unless(unique, "one counter per source");
+  sput_fail_unless(total == table->packets, "every packet is counted once");
+}
+
+void test_talkers__space_saving(void) {
+  static struct brubeck_server server;
+  struct brubeck_talker_table *a = brubeck_talkers_table_new(&server, 4);
+  struct brubeck_talker_table *b = brubeck_talkers_table_new(&server, 4);
+  struct brubeck_talkers *talkers = server.talkers;
+  uint32_t host;
+
+  /* a heavy hitter buried in churn from a thousand one-off sources */
+  for (host = 1; host <= 1000; ++host) {
+    send_from(a, 1000 + host, 1);
+    if (host % 10 == 0)
+      send_from(a, 1, 5);
+  }
+  send_from(b, 1, 50);
+  send_from(b, 2, 20);
+
+  sput_fail_unless(talkers->table_count == 2 && talkers->size == 4,
+                   "tables are registered with the server");
+  sput_fail_unless(a->count == 4 && a->packets == 1500,
+                   "memory is bounded by the table size");
+
+  brubeck_talkers_rotate(talkers);
+
+  sput_fail_unless(talkers->packets == 1570, "interval packets");
+  sput_fail_unless(talkers->top_count == 4 &&
+                       talkers->top[0].addr == htonl(0x0A000001),
+                   "the heavy hitter comes first");
+  sput_fail_unless(talkers->top[0].packets - talkers->top[0].error <= 550 &&
+                       talkers->top[0].packets >= 550,
+                   "its count is bracketed by the error bound");
+  sput_fail_unless(talkers->top[0].bytes <= talkers->top[0].packets * 100,
+                   "bytes are tracked");
+  sput_fail_unless(a->count == 0 && a->packets == 0 && b->count == 0,
+                   "tables are reset each interval");
+
+  send_from(a, 2, 3);
+  send_from(b, 2, 20);
+  send_from(b, 3, 5);
+  brubeck_talkers_rotate(talkers);
+
+  sput_fail_unless(talkers->top_count == 2 &&
+                       talkers->top[0].addr == htonl(0x0A000002) &&
+                       talkers->top[0].packets == 23 &&
+                       talkers->top[0].error == 0 &&
+                       talkers->top[0].bytes == 2300,
+                   "counts from all the workers are summed exactly");
+
+  brubeck_talkers_rotate(talkers);
+  sput_fail_unless(talkers->top_count == 0 && talkers->packets == 0,
+                   "an idle interval has no talkers");
+
+  check_churn(a);
+  brubeck_talkers_rotate(talkers);
+  sput_fail_unless(talkers->top_count == 4 &&
+                       talkers->top[0].packets >= talkers->top[1].packets,
+                   "sorted after churn");
+  check_churn(a);
+}
@@ -0,0 +1,150 @@
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "brubeck.h"
+#include "sput.h"
+
+static ino_t inode(int fd) {
+  struct stat st;
+  return (fstat(fd, &st) < 0) ? 0 : st.st_ino;
+}
+
+void test_upgrade__handoff(void) {
+  struct brubeck_server *old = calloc(1, sizeof(struct brubeck_server));
+  struct brubeck_server *new = calloc(1, sizeof(struct brubeck_server));
+  struct brubeck_sampler udp, unix_old, unix_new;
+  struct sockaddr_in other;
+  socklen_t len = sizeof(udp.addr);
+  int reuse[2], unix_sock, extra, pair[2], sock;
+  char path[64], ack = 0;
+
+  snprintf(path, sizeof(path), "/tmp/brubeck-upgrade-test.%d", (int)getpid());
+
+  memset(&udp, 0x0, sizeof(udp));
+  udp.server = old;
+  udp.addr.sin_family = AF_INET;
+  udp.addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  /* a SO_REUSEPORT group of two, on whatever port the first one got */
+  reuse[0] = brubeck_sampler_socket(&udp, 1);
+  getsockname(reuse[0], (struct sockaddr *)&udp.addr, &len);
+  reuse[1] = brubeck_sampler_socket(&udp, 1);
+
+  memset(&unix_old, 0x0, sizeof(unix_old));
+  unix_old.server = old;
+  unix_old.path = path;
+  unix_sock = brubeck_sampler_socket_unix(&unix_old, 0600, 0);
+
+  /* a listener the new process has no use for */
+  other = udp.addr;
+  other.sin_port = 0;
+  extra = socket(AF_INET, SOCK_DGRAM, 0);
+  bind(extra, (struct sockaddr *)&other, sizeof(other));
+  brubeck_upgrade_register(&old->upgrade, extra);
+
+  sput_fail_unless(old->upgrade.socket_count == 4, "all sockets registered");
+
+  socketpair(AF_UNIX, SOCK_STREAM, 0, pair);
+  sput_fail_unless(brubeck_upgrade_send(&old->upgrade, pair[0]) == 0,
+                   "sockets sent");
+  sput_fail_unless(brubeck_upgrade_recv(&new->upgrade, pair[1]) == 0,
+                   "sockets received");
+  sput_fail_unless(new->upgrade.inherited_count == 4, "all sockets passed");
+  new->upgrade.channel = pair[1];
+
+  /* the new samplers bind the same addresses and get the same sockets */
+  udp.server = new;
+  sock = brubeck_sampler_socket(&udp, 1);
+  sput_fail_unless(inode(sock) == inode(reuse[0]), "first of the group");
+  sock = brubeck_sampler_socket(&udp, 1);
+  sput_fail_unless(inode(sock) == inode(reuse[1]), "second of the group");
+
+  memset(&unix_new, 0x0, sizeof(unix_new));
+  unix_new.server = new;
+  unix_new.path = path;
+  sock = brubeck_sampler_socket_unix(&unix_new, 0600, 0);
+  sput_fail_unless(inode(sock) == inode(unix_sock), "unix socket taken over");
+  sput_fail_unless(access(path, F_OK) == 0, "socket file kept");
+
+  other.sin_port = udp.addr.sin_port;
+  sput_fail_unless(brubeck_upgrade_inherit(&new->upgrade, SOCK_STREAM,
+                                           (struct sockaddr *)&other) < 0,
+                   "no socket of another type");
+  sput_fail_unless(new->upgrade.socket_count == 3, "taken over and registered");
+
+  brubeck_upgrade_ack(&new->upgrade);
+  sput_fail_unless(new->upgrade.inherited[3] == -1, "unused socket closed");
+  sput_fail_unless(read(pair[0], &ack, 1) == 1 && ack == '1', "acked");
+
+  close(pair[0]);
+  unlink(path);
+}
+
+static pid_t idle_child(void) {
+  pid_t pid = fork();
+
+  if (pid == 0) {
+    pause();
+    _exit(0);
+  }
+  return pid;
+}
+
+static bool reaped(pid_t pid) {
+  return waitpid(pid, NULL, WNOHANG) < 0 && errno == ECHILD;
+}
+
+static void start_pending(struct brubeck_upgrade *upgrade, int pair[2]) {
+  /* forked first, so that the channel closes when this end is closed */
+  upgrade->child = idle_child();
+  socketpair(AF_UNIX, SOCK_STREAM, 0, pair);
+  upgrade->pending = pair[0];
+}
+
+void test_upgrade__ack(void) {
+  struct brubeck_upgrade *upgrade = calloc(1, sizeof(struct brubeck_upgrade));
+  int pair[2];
+  pid_t child;
+
+  /* the new process acks and takes over */
+  start_pending(upgrade, pair);
+  child = upgrade->child;
+  sput_fail_unless(write(pair[1], "1", 1) == 1, "ack sent");
+  sput_fail_unless(brubeck_upgrade_acked(upgrade), "acked");
+  sput_fail_unless(upgrade->handed_off && upgrade->pending == -1,
+                   "handed off");
+  sput_fail_unless(!reaped(child), "new process left running");
+  kill(child, SIGKILL);
+  waitpid(child, NULL, 0);
+  close(pair[1]);
+
+  brubeck_upgrade_drain(upgrade, 60);
+  sput_fail_unless(!brubeck_upgrade_drained(upgrade), "draining");
+  brubeck_upgrade_drain(upgrade, 0);
+  sput_fail_unless(brubeck_upgrade_drained(upgrade), "drained");
+
+  /* the new process goes away without acking */
+  upgrade->handed_off = false;
+  start_pending(upgrade, pair);
+  child = upgrade->child;
+  close(pair[1]);
+  sput_fail_unless(!brubeck_upgrade_acked(upgrade), "channel closed");
+  sput_fail_unless(!upgrade->handed_off && upgrade->pending == -1,
+                   "upgrade given up on");
+  sput_fail_unless(reaped(child), "new process killed and reaped");
+  sput_fail_unless(!brubeck_upgrade_drained(upgrade), "no drain");
+
+  /* the new process never acks */
+  start_pending(upgrade, pair);
+  child = upgrade->child;
+  upgrade->deadline = INT32_MAX;
+  brubeck_upgrade_expire(upgrade);
+  sput_fail_unless(upgrade->pending == pair[0], "still waiting");
+  upgrade->deadline = 0;
+  brubeck_upgrade_expire(upgrade);
+  sput_fail_unless(upgrade->pending == -1 && reaped(child),
+                   "timed out, killed and reaped");
+  close(pair[1]);
+
+  free(upgrade);
+}